@@ -16,13 +16,319 @@
  * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <firstinclude.h>
+#include <stdio.h>	// for printf(3), fprintf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3)
+#include <pthread.h>	// for pthread_t, pthread_create(3), pthread_join(3)
+#include <time.h>	// for clock_gettime(2), clock_nanosleep(2)
+#include <unistd.h>	// for sleep(3)
+#include <stdint.h>	// for uint32_t, uint64_t
+#include <atomic>	// for atomic
+#include <memory>	// for shared_ptr, make_shared
+#include <mutex>	// for mutex, lock_guard, unique_lock
+#include <vector>	// for vector
+#include <functional>	// for function
+#include <unordered_map>	// for unordered_map
+#include <err_utils.h>	// for CHECK_ZERO_ERRNO(), CHECK_NOT_M1(), CHECK_ASSERT()
+#include <timespec_utils.h>	// for timespec_add_nanos(), timespec_diff_nano()
+
+using namespace std;
+
 /*
+ * This example shows the copy-on-write (COW) snapshot pattern.
+ *
+ * Readers never lock. They take a snapshot of the current version of the data
+ * (an atomic load of a shared_ptr) and work on it for as long as they want.
+ * Writers clone the current version, modify the clone and publish it with an
+ * atomic store. Old versions are freed when the last reader drops them.
+ *
+ * Two classes are shown:
+ * CowPtr<T> - a single threaded copy-on-write pointer. Copies are cheap and
+ *	share the data, the data is cloned only when someone writes to a shared copy.
+ * AtomicSnapshot<T> - the multi threaded version. Readers call snapshot(),
+ *	writers call update() with a function that modifies the data.
+ *
+ * Writer coalescing:
+ * cloning a big structure for every small update is expensive. update() first
+ * puts the modification on a pending list and only then competes for the writer
+ * lock. Whoever gets the lock clones once, applies ALL pending modifications and
+ * publishes once. A writer that gets the lock and finds the pending list empty
+ * knows that another writer already published its modification and just returns.
+ * This way a burst of N concurrent updates produces far fewer than N publications
+ * and when update() returns the modification is always visible to readers.
+ *
+ * The benchmark:
+ * a routing table of 10K entries (destination->next hop) is read by 64 reader
+ * threads while a single writer changes one route at 1kHz. This is done once
+ * with an AtomicSnapshot and once with a regular map protected by a mutex.
+ * The number of lookups per second is printed for each.
+ *
+ * Notes:
+ * - std::atomic<std::shared_ptr<T>> is a C++20 feature. In libstdc++ it is
+ *	implemented with a tiny internal lock on the control block pointer and so is
+ *	not strictly lock free (is_lock_free() returns false) but it is held for a
+ *	few instructions only and never across a system call.
+ * - taking a snapshot increments the reference count of the shared_ptr. This
+ *	is a write to a cache line shared by all readers and with many readers on
+ *	many cores it costs more than the lookup itself. This is why the readers in
+ *	the benchmark keep their snapshot and call refresh() which only reads a
+ *	version counter and reloads the snapshot when a writer published a new one.
+ * - readers should take one snapshot per logical operation (one packet in the
+ *	routing case) and not per field access, otherwise they may see two different
+ *	versions of the table.
+ * - run with fewer readers than the default 64 on small machines to see the
+ *	difference between the methods without the scheduler noise.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++20
+ * EXTRA_LINK_FLAGS_AFTER=-lpthread
  */
 
-#include <firstinclude.h>
-#include <stdlib.h>
+template<typename T> class CowPtr {
+private:
+	shared_ptr<T> ptr;
+
+public:
+	explicit CowPtr(shared_ptr<T> iptr) : ptr(iptr) {
+	}
+	const T& operator*() const {
+		return *ptr;
+	}
+	const T* operator->() const {
+		return ptr.get();
+	}
+	// get a writable reference, cloning the data if it is shared
+	T& write() {
+		if(ptr.use_count()>1) {
+			ptr=make_shared<T>(*ptr);
+		}
+		return *ptr;
+	}
+	bool shares_with(const CowPtr<T>& other) const {
+		return ptr==other.ptr;
+	}
+};
+
+template<typename T> class AtomicSnapshot {
+private:
+	atomic<shared_ptr<const T>> current;
+	mutex writer_mutex;
+	mutex pending_mutex;
+	vector<function<void(T&)>> pending;
+	atomic<unsigned long> version;
+	atomic<unsigned long> updates;
+	atomic<unsigned long> publications;
+
+public:
+	explicit AtomicSnapshot(const T& initial) : current(make_shared<const T>(initial)), version(0), updates(0), publications(0) {
+	}
+	// lock free (for readers) access to the current version
+	shared_ptr<const T> snapshot() const {
+		return current.load(memory_order_acquire);
+	}
+	// refresh a snapshot cached by the reader, only if a new version was published
+	void refresh(shared_ptr<const T>& cached, unsigned long& cached_version) const {
+		unsigned long v=version.load(memory_order_acquire);
+		if(!cached || v!=cached_version) {
+			cached=current.load(memory_order_acquire);
+			cached_version=v;
+		}
+	}
+	// clone, modify and publish. Concurrent updates are coalesced.
+	void update(function<void(T&)> f) {
+		{
+			lock_guard<mutex> lock(pending_mutex);
+			pending.push_back(move(f));
+		}
+		updates.fetch_add(1, memory_order_relaxed);
+		lock_guard<mutex> lock(writer_mutex);
+		vector<function<void(T&)>> batch;
+		{
+			lock_guard<mutex> lock(pending_mutex);
+			batch.swap(pending);
+		}
+		// someone else already published our modification
+		if(batch.empty()) {
+			return;
+		}
+		shared_ptr<T> copy=make_shared<T>(*current.load(memory_order_relaxed));
+		for(auto& m : batch) {
+			m(*copy);
+		}
+		current.store(move(copy), memory_order_release);
+		version.fetch_add(1, memory_order_release);
+		publications.fetch_add(1, memory_order_relaxed);
+	}
+	unsigned long get_updates() const {
+		return updates.load();
+	}
+	unsigned long get_publications() const {
+		return publications.load();
+	}
+};
+
+typedef unordered_map<uint32_t, uint32_t> routing_table;
+
+// per reader data, aligned to avoid false sharing of the counters
+typedef struct _reader_data{
+	unsigned long lookups;
+	unsigned long found;
+	uint32_t seed;
+} __attribute__((aligned(64))) reader_data;
+
+static AtomicSnapshot<routing_table>* snap;
+static routing_table* locked_table;
+static mutex table_mutex;
+static atomic<bool> stop;
+static bool use_snapshot;
+static unsigned int entries;
+static unsigned int writer_hz;
+
+static inline uint32_t next_random(uint32_t* seed) {
+	// xorshift32
+	uint32_t x=*seed;
+	x^=x<<13;
+	x^=x>>17;
+	x^=x<<5;
+	*seed=x;
+	return x;
+}
+
+static void* reader(void* p) {
+	reader_data* rd=static_cast<reader_data*>(p);
+	shared_ptr<const routing_table> t;
+	unsigned long t_version=0;
+	while(!stop.load(memory_order_relaxed)) {
+		uint32_t key=next_random(&rd->seed)%entries;
+		if(use_snapshot) {
+			snap->refresh(t, t_version);
+			if(t->find(key)!=t->end()) {
+				rd->found++;
+			}
+		} else {
+			lock_guard<mutex> lock(table_mutex);
+			if(locked_table->find(key)!=locked_table->end()) {
+				rd->found++;
+			}
+		}
+		rd->lookups++;
+	}
+	t.reset();
+	return NULL;
+}
+
+static void* writer(void* p) {
+	unsigned long* writes=static_cast<unsigned long*>(p);
+	uint32_t seed=0x12345678;
+	struct timespec next;
+	CHECK_NOT_M1(clock_gettime(CLOCK_MONOTONIC, &next));
+	while(!stop.load(memory_order_relaxed)) {
+		timespec_add_nanos(&next, 1000000000LL/writer_hz);
+		CHECK_ZERO_ERRNO(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL));
+		uint32_t key=next_random(&seed)%entries;
+		uint32_t hop=next_random(&seed);
+		if(use_snapshot) {
+			snap->update([key, hop](routing_table& t) {
+				t[key]=hop;
+			});
+		} else {
+			lock_guard<mutex> lock(table_mutex);
+			(*locked_table)[key]=hop;
+		}
+		(*writes)++;
+	}
+	return NULL;
+}
+
+static void run(const char* name, unsigned int reader_num, unsigned int seconds) {
+	stop.store(false);
+	pthread_t* threads=new pthread_t[reader_num];
+	reader_data* data=new reader_data[reader_num];
+	struct timespec t_start, t_end;
+	CHECK_NOT_M1(clock_gettime(CLOCK_MONOTONIC, &t_start));
+	for(unsigned int i=0; i<reader_num; i++) {
+		data[i].lookups=0;
+		data[i].found=0;
+		data[i].seed=i+1;
+		CHECK_ZERO_ERRNO(pthread_create(threads+i, NULL, reader, data+i));
+	}
+	pthread_t writer_thread;
+	unsigned long writes=0;
+	CHECK_ZERO_ERRNO(pthread_create(&writer_thread, NULL, writer, &writes));
+	CHECK_ZERO(sleep(seconds));
+	stop.store(true);
+	for(unsigned int i=0; i<reader_num; i++) {
+		CHECK_ZERO_ERRNO(pthread_join(threads[i], NULL));
+	}
+	CHECK_ZERO_ERRNO(pthread_join(writer_thread, NULL));
+	CHECK_NOT_M1(clock_gettime(CLOCK_MONOTONIC, &t_end));
+	unsigned long lookups=0;
+	for(unsigned int i=0; i<reader_num; i++) {
+		lookups+=data[i].lookups;
+	}
+	double secs=timespec_diff_nano(&t_end, &t_start)/1e9;
+	printf("%s: readers=%u, lookups=%lu, lookups/sec=%.0lf, writes=%lu\n", name, reader_num, lookups, lookups/secs, writes);
+	delete[] threads;
+	delete[] data;
+}
+
+int main(int argc, char** argv) {
+	if(argc>5) {
+		fprintf(stderr, "%s: usage: %s [readers] [seconds] [entries] [writer_hz]\n", argv[0], argv[0]);
+		fprintf(stderr, "%s: example: %s 64 5 10000 1000\n", argv[0], argv[0]);
+		return EXIT_FAILURE;
+	}
+	unsigned int reader_num=argc>1 ? atoi(argv[1]) : 64;
+	unsigned int seconds=argc>2 ? atoi(argv[2]) : 5;
+	entries=argc>3 ? atoi(argv[3]) : 10000;
+	writer_hz=argc>4 ? atoi(argv[4]) : 1000;
+	CHECK_ASSERT(entries>0 && writer_hz>0);
+
+	// show the single threaded COW semantics first
+	CowPtr<routing_table> a(make_shared<routing_table>());
+	CowPtr<routing_table> b=a;
+	printf("CowPtr: after copy, shared=%d\n", a.shares_with(b));
+	b.write()[1]=1;
+	printf("CowPtr: after write, shared=%d, a.size()=%zu, b.size()=%zu\n", a.shares_with(b), a->size(), b->size());
+
+	routing_table initial;
+	for(uint32_t i=0; i<entries; i++) {
+		initial[i]=i;
+	}
+	snap=new AtomicSnapshot<routing_table>(initial);
+	locked_table=new routing_table(initial);
+
+	use_snapshot=true;
+	run("snapshot", reader_num, seconds);
+	printf("snapshot: updates=%lu, publications=%lu\n", snap->get_updates(), snap->get_publications());
+	use_snapshot=false;
+	run("mutex", reader_num, seconds);
 
-int main() {
-	// TBD
+	// show coalescing: many writers bursting at the same time
+	const unsigned int burst_writers=8;
+	const unsigned int burst_updates=1000;
+	AtomicSnapshot<routing_table> burst(initial);
+	vector<pthread_t> bthreads(burst_writers);
+	for(unsigned int i=0; i<burst_writers; i++) {
+		CHECK_ZERO_ERRNO(pthread_create(&bthreads[i], NULL, [](void* p) -> void* {
+			AtomicSnapshot<routing_table>* s=static_cast<AtomicSnapshot<routing_table>*>(p);
+			for(unsigned int j=0; j<burst_updates; j++) {
+				s->update([j](routing_table& t) {
+					t[j]++;
+				});
+			}
+			return NULL;
+		}, &burst));
+	}
+	for(unsigned int i=0; i<burst_writers; i++) {
+		CHECK_ZERO_ERRNO(pthread_join(bthreads[i], NULL));
+	}
+	// every update must have been applied exactly once
+	shared_ptr<const routing_table> final_table=burst.snapshot();
+	for(unsigned int j=0; j<burst_updates && j<entries; j++) {
+		CHECK_ASSERT(final_table->at(j)==j+burst_writers);
+	}
+	printf("burst: updates=%lu, publications=%lu\n", burst.get_updates(), burst.get_publications());
+	delete snap;
+	delete locked_table;
 	return EXIT_SUCCESS;
 }
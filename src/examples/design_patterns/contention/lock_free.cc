@@ -16,13 +16,613 @@
  * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <firstinclude.h>
+#include <stdio.h>	// for printf(3), fprintf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3), atoll(3)
+#include <pthread.h>	// for pthread_t, pthread_create(3), pthread_join(3)
+#include <sched.h>	// for sched_yield(2)
+#include <stdint.h>	// for uint64_t
+#include <atomic>	// for atomic
+#include <mutex>	// for mutex, lock_guard
+#include <queue>	// for queue
+#include <vector>	// for vector
+#include <err_utils.h>	// for CHECK_ZERO_ERRNO(), CHECK_ASSERT()
+#include <atomic_utils.h>	// for cpu_relax()
+#include <LatencyHistogram.hh>	// for LatencyHistogram, latency_now()
+
+using namespace std;
+
+/*
+ * This example shows lock free data structures and how to free memory in them.
+ *
+ * The structures:
+ * BoundedQueue - Dmitry Vyukov's bounded multi producer multi consumer queue.
+ *	An array of cells, each with a sequence number which tells producers and
+ *	consumers whether the cell is ready for them. There is no allocation at
+ *	all after construction and so no memory reclamation problem.
+ * MSQueue - the Michael-Scott unbounded queue. A linked list with a dummy
+ *	head node where producers CAS at the tail and consumers CAS at the head.
+ * TreiberStack - a linked list stack where push and pop CAS the top pointer.
+ *
+ * Memory reclamation:
+ * In MSQueue and TreiberStack a thread can read a node pointer, get descheduled
+ * while another thread pops and frees that node, and then touch freed memory.
+ * The same scenario causes the ABA problem: the node is freed and reallocated
+ * at the same address, pushed again, and the CAS of the first thread succeeds
+ * although the list changed under it.
+ * Hazard pointers solve both: before using a node a thread publishes its
+ * address in a per thread hazard slot and re-validates that it is still
+ * reachable. Removed nodes are not freed but retired to a per thread list and
+ * that list is scanned once in a while: nodes which do not appear in any
+ * hazard slot are freed, the others wait for the next scan. Since a protected
+ * node is never freed it is never reused and ABA cannot happen.
+ *
+ * The benchmark:
+ * for each structure and for 1, 2, 4, ... 32 producers and the same number of
+ * consumers, the producers push a fixed number of items and the consumers pop
+ * them all. The total ops/sec and a latency histogram of single successful
+ * push and pop operations (in nanoseconds) are printed. A mutex protected
+ * std::queue is measured as a baseline.
+ *
+ * Notes:
+ * - the latency of an operation includes the clock_gettime(2) overhead which
+ *	is about 20ns via the vDSO.
+ * - when there are more threads than cores the spinning threads fall back to
+ *	sched_yield(2) which is the only thing that saves these benchmarks from
+ *	lock holder preemption in the mutex case and from wasted time slices
+ *	in the lock free cases.
+ *
+ * References:
+ * https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ * Michael and Scott, "Simple, Fast, and Practical Non-Blocking and Blocking
+ *	Concurrent Queue Algorithms", PODC 1996
+ * Michael, "Hazard Pointers: Safe Memory Reclamation for Lock-Free Objects",
+ *	IEEE TPDS 2004
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++20
+ * EXTRA_LINK_FLAGS_AFTER=-lpthread
+ */
+
+static const unsigned int cache_line=64;
+
 /*
+ * Hazard pointers
  */
+class HazardPointers {
+public:
+	static const unsigned int max_threads=128;
+	static const unsigned int slots=2;
+	static const unsigned int scan_threshold=2*max_threads*slots;
 
-#include <firstinclude.h>
-#include <stdlib.h>
+private:
+	typedef struct _record{
+		atomic<bool> used;
+		atomic<void*> hp[slots];
+	} __attribute__((aligned(cache_line))) record;
+	typedef struct _retired_node{
+		void* ptr;
+		void (*deleter)(void*);
+	} retired_node;
+
+	record records[max_threads];
+	// nodes left over by threads that exited, freed at destruction
+	mutex orphans_mutex;
+	vector<retired_node> orphans;
+
+	void scan(vector<retired_node>& retired) {
+		vector<void*> hazards;
+		for(unsigned int i=0; i<max_threads; i++) {
+			for(unsigned int j=0; j<slots; j++) {
+				void* p=records[i].hp[j].load(memory_order_seq_cst);
+				if(p) {
+					hazards.push_back(p);
+				}
+			}
+		}
+		vector<retired_node> keep;
+		for(auto& r : retired) {
+			bool hazardous=false;
+			for(void* h : hazards) {
+				if(h==r.ptr) {
+					hazardous=true;
+					break;
+				}
+			}
+			if(hazardous) {
+				keep.push_back(r);
+			} else {
+				r.deleter(r.ptr);
+			}
+		}
+		retired.swap(keep);
+	}
+
+public:
+	// per thread handle, create one in each thread that uses the structures
+	class Thread {
+	private:
+		HazardPointers& domain;
+		record* rec;
+		vector<retired_node> retired;
+
+	public:
+		explicit Thread(HazardPointers& idomain) : domain(idomain), rec(NULL) {
+			for(unsigned int i=0; i<max_threads; i++) {
+				bool expected=false;
+				if(domain.records[i].used.compare_exchange_strong(expected, true)) {
+					rec=domain.records+i;
+					break;
+				}
+			}
+			CHECK_ASSERT(rec!=NULL);
+		}
+		~Thread() {
+			for(unsigned int j=0; j<slots; j++) {
+				rec->hp[j].store(NULL);
+			}
+			domain.scan(retired);
+			if(!retired.empty()) {
+				lock_guard<mutex> lock(domain.orphans_mutex);
+				domain.orphans.insert(domain.orphans.end(), retired.begin(), retired.end());
+			}
+			rec->used.store(false);
+		}
+		// publish a hazard on whatever 'src' points to and return it
+		template<typename T> T* protect(unsigned int slot, const atomic<T*>& src) {
+			T* p=src.load(memory_order_relaxed);
+			while(true) {
+				rec->hp[slot].store(p, memory_order_seq_cst);
+				T* again=src.load(memory_order_seq_cst);
+				if(again==p) {
+					return p;
+				}
+				p=again;
+			}
+		}
+		void clear(unsigned int slot) {
+			rec->hp[slot].store(NULL, memory_order_release);
+		}
+		template<typename T> void retire(T* p) {
+			retired.push_back({p, [](void* x) {
+				delete static_cast<T*>(x);
+			}});
+			if(retired.size()>=scan_threshold) {
+				domain.scan(retired);
+			}
+		}
+	};
+
+	HazardPointers() {
+		for(unsigned int i=0; i<max_threads; i++) {
+			records[i].used.store(false);
+			for(unsigned int j=0; j<slots; j++) {
+				records[i].hp[j].store(NULL);
+			}
+		}
+	}
+	~HazardPointers() {
+		for(auto& r : orphans) {
+			r.deleter(r.ptr);
+		}
+	}
+};
+
+/*
+ * Vyukov bounded MPMC queue
+ */
+template<typename T> class BoundedQueue {
+private:
+	typedef struct _cell{
+		atomic<size_t> sequence;
+		T data;
+	} cell;
+	cell* buffer;
+	const size_t mask;
+	alignas(cache_line) atomic<size_t> enqueue_pos;
+	alignas(cache_line) atomic<size_t> dequeue_pos;
+
+public:
+	explicit BoundedQueue(size_t size) : buffer(new cell[size]), mask(size-1) {
+		CHECK_ASSERT(size>=2 && (size & (size-1))==0);
+		for(size_t i=0; i<size; i++) {
+			buffer[i].sequence.store(i, memory_order_relaxed);
+		}
+		enqueue_pos.store(0, memory_order_relaxed);
+		dequeue_pos.store(0, memory_order_relaxed);
+	}
+	~BoundedQueue() {
+		delete[] buffer;
+	}
+	bool push(const T& data) {
+		cell* c;
+		size_t pos=enqueue_pos.load(memory_order_relaxed);
+		while(true) {
+			c=buffer+(pos & mask);
+			size_t seq=c->sequence.load(memory_order_acquire);
+			intptr_t dif=(intptr_t)seq-(intptr_t)pos;
+			if(dif==0) {
+				if(enqueue_pos.compare_exchange_weak(pos, pos+1, memory_order_relaxed)) {
+					break;
+				}
+			} else if(dif<0) {
+				// full
+				return false;
+			} else {
+				pos=enqueue_pos.load(memory_order_relaxed);
+			}
+		}
+		c->data=data;
+		c->sequence.store(pos+1, memory_order_release);
+		return true;
+	}
+	bool pop(T& data) {
+		cell* c;
+		size_t pos=dequeue_pos.load(memory_order_relaxed);
+		while(true) {
+			c=buffer+(pos & mask);
+			size_t seq=c->sequence.load(memory_order_acquire);
+			intptr_t dif=(intptr_t)seq-(intptr_t)(pos+1);
+			if(dif==0) {
+				if(dequeue_pos.compare_exchange_weak(pos, pos+1, memory_order_relaxed)) {
+					break;
+				}
+			} else if(dif<0) {
+				// empty
+				return false;
+			} else {
+				pos=dequeue_pos.load(memory_order_relaxed);
+			}
+		}
+		data=c->data;
+		c->sequence.store(pos+mask+1, memory_order_release);
+		return true;
+	}
+};
+
+/*
+ * Michael-Scott unbounded MPMC queue with hazard pointers
+ */
+template<typename T> class MSQueue {
+private:
+	typedef struct _node{
+		atomic<struct _node*> next;
+		T data;
+	} node;
+	alignas(cache_line) atomic<node*> head;
+	alignas(cache_line) atomic<node*> tail;
+
+public:
+	MSQueue() {
+		node* dummy=new node();
+		dummy->next.store(NULL);
+		head.store(dummy);
+		tail.store(dummy);
+	}
+	~MSQueue() {
+		node* n=head.load();
+		while(n) {
+			node* next=n->next.load();
+			delete n;
+			n=next;
+		}
+	}
+	bool push(HazardPointers::Thread& ht, const T& data) {
+		node* n=new node();
+		n->next.store(NULL, memory_order_relaxed);
+		n->data=data;
+		while(true) {
+			node* t=ht.protect(0, tail);
+			node* next=t->next.load(memory_order_acquire);
+			if(t!=tail.load(memory_order_acquire)) {
+				continue;
+			}
+			if(next!=NULL) {
+				// tail is lagging, help move it
+				tail.compare_exchange_weak(t, next, memory_order_release);
+				continue;
+			}
+			if(t->next.compare_exchange_weak(next, n, memory_order_release)) {
+				tail.compare_exchange_strong(t, n, memory_order_release);
+				break;
+			}
+		}
+		ht.clear(0);
+		return true;
+	}
+	bool pop(HazardPointers::Thread& ht, T& data) {
+		while(true) {
+			node* h=ht.protect(0, head);
+			node* t=tail.load(memory_order_acquire);
+			node* next=ht.protect(1, h->next);
+			if(h!=head.load(memory_order_acquire)) {
+				continue;
+			}
+			if(next==NULL) {
+				ht.clear(0);
+				ht.clear(1);
+				return false;
+			}
+			if(h==t) {
+				tail.compare_exchange_weak(t, next, memory_order_release);
+				continue;
+			}
+			// next is protected so it is safe to read its data before the CAS
+			data=next->data;
+			if(head.compare_exchange_weak(h, next, memory_order_release)) {
+				ht.clear(0);
+				ht.clear(1);
+				ht.retire(h);
+				return true;
+			}
+		}
+	}
+};
+
+/*
+ * Treiber stack with hazard pointers
+ */
+template<typename T> class TreiberStack {
+private:
+	typedef struct _node{
+		struct _node* next;
+		T data;
+	} node;
+	alignas(cache_line) atomic<node*> top;
+
+public:
+	TreiberStack() {
+		top.store(NULL);
+	}
+	~TreiberStack() {
+		node* n=top.load();
+		while(n) {
+			node* next=n->next;
+			delete n;
+			n=next;
+		}
+	}
+	bool push(HazardPointers::Thread&, const T& data) {
+		node* n=new node();
+		n->data=data;
+		n->next=top.load(memory_order_relaxed);
+		while(!top.compare_exchange_weak(n->next, n, memory_order_release, memory_order_relaxed)) {
+		}
+		return true;
+	}
+	bool pop(HazardPointers::Thread& ht, T& data) {
+		while(true) {
+			node* t=ht.protect(0, top);
+			if(t==NULL) {
+				ht.clear(0);
+				return false;
+			}
+			// t cannot be freed (or reused) while it is protected so reading
+			// t->next is safe and the CAS below cannot suffer from ABA
+			node* next=t->next;
+			if(top.compare_exchange_weak(t, next, memory_order_acquire, memory_order_relaxed)) {
+				ht.clear(0);
+				data=t->data;
+				ht.retire(t);
+				return true;
+			}
+		}
+	}
+};
+
+/*
+ * Baseline: a mutex protected std::queue
+ */
+template<typename T> class LockedQueue {
+private:
+	mutex mut;
+	queue<T> que;
+
+public:
+	bool push(const T& data) {
+		lock_guard<mutex> lock(mut);
+		que.push(data);
+		return true;
+	}
+	bool pop(T& data) {
+		lock_guard<mutex> lock(mut);
+		if(que.empty()) {
+			return false;
+		}
+		data=que.front();
+		que.pop();
+		return true;
+	}
+};
+
+/*
+ * The benchmark harness
+ */
+typedef enum _structure_type{
+	TYPE_BOUNDED,
+	TYPE_MS,
+	TYPE_TREIBER,
+	TYPE_LOCKED,
+} structure_type;
+
+static const char* type_names[]={
+	"vyukov_bounded_queue",
+	"michael_scott_queue",
+	"treiber_stack",
+	"mutex_std_queue",
+};
+
+typedef struct _shared_data{
+	structure_type type;
+	BoundedQueue<uint64_t>* bounded;
+	MSQueue<uint64_t>* ms;
+	TreiberStack<uint64_t>* treiber;
+	LockedQueue<uint64_t>* locked;
+	HazardPointers* hps;
+	uint64_t ops_per_producer;
+	uint64_t total;
+	atomic<uint64_t> consumed;
+	atomic<uint64_t> sum;
+} shared_data;
+
+typedef struct _thread_data{
+	shared_data* sd;
+	unsigned int id;
+	LatencyHistogram hist;
+} thread_data;
+
+static inline void backoff(unsigned int& spins) {
+	if(++spins<100) {
+		cpu_relax();
+	} else {
+		spins=0;
+		sched_yield();
+	}
+}
+
+static inline bool do_push(shared_data* sd, HazardPointers::Thread& ht, uint64_t v) {
+	switch(sd->type) {
+	case TYPE_BOUNDED:
+		return sd->bounded->push(v);
+	case TYPE_MS:
+		return sd->ms->push(ht, v);
+	case TYPE_TREIBER:
+		return sd->treiber->push(ht, v);
+	case TYPE_LOCKED:
+		return sd->locked->push(v);
+	}
+	return false;
+}
+
+static inline bool do_pop(shared_data* sd, HazardPointers::Thread& ht, uint64_t& v) {
+	switch(sd->type) {
+	case TYPE_BOUNDED:
+		return sd->bounded->pop(v);
+	case TYPE_MS:
+		return sd->ms->pop(ht, v);
+	case TYPE_TREIBER:
+		return sd->treiber->pop(ht, v);
+	case TYPE_LOCKED:
+		return sd->locked->pop(v);
+	}
+	return false;
+}
+
+static void* producer(void* p) {
+	thread_data* td=static_cast<thread_data*>(p);
+	shared_data* sd=td->sd;
+	HazardPointers::Thread ht(*sd->hps);
+	uint64_t base=(uint64_t)td->id*sd->ops_per_producer;
+	for(uint64_t i=0; i<sd->ops_per_producer; i++) {
+		unsigned int spins=0;
+		while(true) {
+			uint64_t start=latency_now();
+			bool ok=do_push(sd, ht, base+i+1);
+			uint64_t end=latency_now();
+			if(ok) {
+				td->hist.record(end-start);
+				break;
+			}
+			backoff(spins);
+		}
+	}
+	return NULL;
+}
+
+static void* consumer(void* p) {
+	thread_data* td=static_cast<thread_data*>(p);
+	shared_data* sd=td->sd;
+	HazardPointers::Thread ht(*sd->hps);
+	uint64_t sum=0;
+	unsigned int spins=0;
+	while(sd->consumed.load(memory_order_relaxed)<sd->total) {
+		uint64_t v;
+		uint64_t start=latency_now();
+		bool ok=do_pop(sd, ht, v);
+		uint64_t end=latency_now();
+		if(ok) {
+			td->hist.record(end-start);
+			sum+=v;
+			sd->consumed.fetch_add(1, memory_order_relaxed);
+			spins=0;
+		} else {
+			backoff(spins);
+		}
+	}
+	sd->sum.fetch_add(sum);
+	return NULL;
+}
+
+static void run(structure_type type, unsigned int pairs, uint64_t total_ops, bool print_buckets) {
+	HazardPointers hps;
+	shared_data sd;
+	sd.type=type;
+	sd.bounded=type==TYPE_BOUNDED ? new BoundedQueue<uint64_t>(1024) : NULL;
+	sd.ms=type==TYPE_MS ? new MSQueue<uint64_t>() : NULL;
+	sd.treiber=type==TYPE_TREIBER ? new TreiberStack<uint64_t>() : NULL;
+	sd.locked=type==TYPE_LOCKED ? new LockedQueue<uint64_t>() : NULL;
+	sd.hps=&hps;
+	sd.ops_per_producer=total_ops/pairs;
+	sd.total=sd.ops_per_producer*pairs;
+	sd.consumed.store(0);
+	sd.sum.store(0);
+	const unsigned int thread_num=2*pairs;
+	pthread_t* threads=new pthread_t[thread_num];
+	thread_data* tds=new thread_data[thread_num];
+	uint64_t start=latency_now();
+	for(unsigned int i=0; i<thread_num; i++) {
+		tds[i].sd=&sd;
+		tds[i].id=i/2;
+		CHECK_ZERO_ERRNO(pthread_create(threads+i, NULL, i%2==0 ? producer : consumer, tds+i));
+	}
+	for(unsigned int i=0; i<thread_num; i++) {
+		CHECK_ZERO_ERRNO(pthread_join(threads[i], NULL));
+	}
+	uint64_t end=latency_now();
+	// every item must have been popped exactly once
+	CHECK_ASSERT(sd.sum.load()==sd.total*(sd.total+1)/2);
+	LatencyHistogram push_hist;
+	LatencyHistogram pop_hist;
+	for(unsigned int i=0; i<thread_num; i++) {
+		if(i%2==0) {
+			push_hist.merge(tds[i].hist);
+		} else {
+			pop_hist.merge(tds[i].hist);
+		}
+	}
+	double secs=(end-start)/1e9;
+	printf("%s: producers=%u consumers=%u ops=%lu ops/sec=%.0lf\n", type_names[type], pairs, pairs, 2*sd.total, 2*sd.total/secs);
+	push_hist.print_summary("  push (ns)");
+	pop_hist.print_summary("  pop (ns)");
+	if(print_buckets) {
+		push_hist.print_buckets("  push (ns)");
+		pop_hist.print_buckets("  pop (ns)");
+	}
+	delete[] threads;
+	delete[] tds;
+	delete sd.bounded;
+	delete sd.ms;
+	delete sd.treiber;
+	delete sd.locked;
+}
 
-int main() {
-	// TBD
+int main(int argc, char** argv) {
+	if(argc>4) {
+		fprintf(stderr, "%s: usage: %s [total_ops] [max_pairs] [print_buckets]\n", argv[0], argv[0]);
+		fprintf(stderr, "%s: example: %s 1000000 32 0\n", argv[0], argv[0]);
+		return EXIT_FAILURE;
+	}
+	const long long total_ops=argc>1 ? atoll(argv[1]) : 1000000;
+	// every pair is two threads, pairs*=2 below must not overflow
+	const int max_pairs=argc>2 ? atoi(argv[2]) : 32;
+	bool print_buckets=argc>3 ? atoi(argv[3]) : false;
+	if(total_ops<1 || max_pairs<1 || max_pairs>1024) {
+		fprintf(stderr, "%s: total_ops must be at least 1, max_pairs between 1 and 1024\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	for(unsigned int t=TYPE_BOUNDED; t<=TYPE_LOCKED; t++) {
+		for(unsigned int pairs=1; pairs<=(unsigned int)max_pairs; pairs*=2) {
+			run((structure_type)t, pairs, total_ops, print_buckets);
+		}
+	}
 	return EXIT_SUCCESS;
 }
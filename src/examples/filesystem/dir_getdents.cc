@@ -34,6 +34,8 @@
  *
  * A great part of this example was shamelessly stolen from the getdents(2)
  * manual page.
+ *
+ * See tree_walk.cc for walking a whole tree with getdents64(2) in parallel.
  */
 
 int main(int argc, char** argv) {
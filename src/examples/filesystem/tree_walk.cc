@@ -0,0 +1,308 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for mode_t
+#include <sys/stat.h>	// for mkdir(2), STATX_*
+#include <fcntl.h>	// for open(2), openat(2), O_*
+#include <dirent.h>	// for DT_*
+#include <fnmatch.h>	// for fnmatch(3)
+#include <stdio.h>	// for printf(3), fprintf(3), snprintf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3), atol(3)
+#include <string.h>	// for strcmp(3), memset(3)
+#include <limits.h>	// for UINT_MAX
+#include <unistd.h>	// for write(2), close(2), sysconf(3)
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_ASSERT()
+#include <tree_walk.hh>	// for TreeWalker, TreeWalkEntry, TreeWalkStats
+#include <LatencyHistogram.hh>	// for latency_now()
+#include <vector>	// for vector<T>
+#include <string>	// for string
+#include <mutex>	// for mutex, lock_guard<T>
+#include <set>	// for set<T>
+#include <utility>	// for pair<T1, T2>
+
+using namespace std;
+
+/*
+ * find(1) and du(1) like frontends to TreeWalker (tree_walk.hh), the
+ * parallel getdents64(2) directory walker.
+ *
+ * tree_walk --mode=find [--name=glob] [--type=f|d|l] [--maxdepth=n] dir
+ *	prints the paths, like find dir [-name glob] [-type t] [-maxdepth n]
+ *	(in no particular order).
+ * tree_walk --mode=du [--bytes] dir
+ *	prints the total disk usage in KB like du -s (apparent size in bytes
+ *	like du -sb with --bytes), hard links are counted once.
+ * tree_walk --mode=create --files=1000000 dir
+ *	builds a synthetic tree to measure on: --per-dir files in every
+ *	directory and --fanout subdirectories per directory.
+ *
+ * --workers is the number of walker threads (default: the number of cpus),
+ * --stat=none|fstatat|statx what to do per entry (default: none for find,
+ * statx with STATX_BLOCKS|STATX_SIZE|STATX_NLINK|STATX_INO for du),
+ * --bufsize the getdents64 buffer. The statistics of the walk (system
+ * calls, steals, errors, time) go to stderr.
+ *
+ * Numbers on a single core VM for a tree made with --mode=create
+ * --files=1000000 (10000 directories of 100 files of 100 bytes, ext4), warm
+ * cache, output to /dev/null, seconds:
+ *	find dir			0.31
+ *	tree_walk --mode=find dir	0.20 (20000 getdents64, 1 stat)
+ *	du -s dir			1.80
+ *	tree_walk --mode=du dir		1.68 (statx), 1.72 (--stat=fstatat)
+ * find(1) does not stat either (it uses d_type as well), the difference is
+ * fts(3)'s bookkeeping. du is bound by the million stat calls, which is
+ * where the parallelism pays off on a machine with more than one cpu; on
+ * one cpu more workers only add steals and context switches (1.87s with
+ * --workers=4). A cold cache is dominated by the disk and benefits even
+ * more from several directories being read at once.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ * EXTRA_LINK_FLAGS_AFTER=-lpthread
+ */
+
+// collects lines and writes them to stdout in big chunks
+class Output{
+private:
+	static mutex lock;
+	string buf;
+
+public:
+	Output() {
+		buf.reserve(128*1024);
+	}
+	~Output() {
+		flush();
+	}
+	void line(const TreeWalkEntry& e, string& tmp) {
+		if(e.depth==0) {
+			buf.append(e.name);
+		} else {
+			e.path(tmp);
+			buf.append(tmp);
+		}
+		buf.push_back('\n');
+		if(buf.size()>=64*1024) {
+			flush();
+		}
+	}
+	void flush() {
+		lock_guard<mutex> guard(lock);
+		const char* p=buf.data();
+		size_t len=buf.size();
+		while(len>0) {
+			ssize_t ret=CHECK_NOT_M1(write(STDOUT_FILENO, p, len));
+			p+=ret;
+			len-=ret;
+		}
+		buf.clear();
+	}
+};
+mutex Output::lock;
+
+struct alignas(CACHE_LINE_SIZE) DuSum {
+	unsigned long blocks;
+	unsigned long bytes;
+};
+
+static void create_tree(const char* root, unsigned long files, unsigned int per_dir, unsigned int fanout, size_t size) {
+	unsigned long dirs=(files+per_dir-1)/per_dir;
+	vector<string> paths(dirs);
+	vector<char> data(size, 'x');
+	char name[32];
+	for(unsigned long i=0; i<dirs; i++) {
+		if(i==0) {
+			paths[i]=root;
+		} else {
+			snprintf(name, sizeof(name), "/d%lu", i);
+			paths[i]=paths[(i-1)/fanout]+name;
+		}
+		CHECK_NOT_M1(mkdir(paths[i].c_str(), 0755));
+		int dirfd=CHECK_NOT_M1(open(paths[i].c_str(), O_RDONLY|O_DIRECTORY));
+		for(unsigned int j=0; j<per_dir && i*per_dir+j<files; j++) {
+			snprintf(name, sizeof(name), "f%u", j);
+			int fd=CHECK_NOT_M1(openat(dirfd, name, O_WRONLY|O_CREAT|O_EXCL, 0644));
+			if(size>0) {
+				CHECK_ASSERT(CHECK_NOT_M1(write(fd, data.data(), size))==(ssize_t)size);
+			}
+			CHECK_NOT_M1(close(fd));
+		}
+		CHECK_NOT_M1(close(dirfd));
+	}
+	printf("created %lu files in %lu directories under %s\n", files, dirs, root);
+}
+
+int main(int argc, char** argv) {
+	const char* mode="find";
+	unsigned int workers=sysconf(_SC_NPROCESSORS_ONLN);
+	const char* stat_name=NULL;
+	size_t bufsize=256*1024;
+	const char* name_glob=NULL;
+	int type=-1;
+	unsigned int max_depth=UINT_MAX;
+	bool bytes=false;
+	unsigned long files=1000000;
+	unsigned int per_dir=100;
+	unsigned int fanout=10;
+	size_t size=100;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"mode", required_argument, 0, 0},
+			{"workers", required_argument, 0, 1},
+			{"stat", required_argument, 0, 2},
+			{"bufsize", required_argument, 0, 3},
+			{"name", required_argument, 0, 4},
+			{"type", required_argument, 0, 5},
+			{"maxdepth", required_argument, 0, 6},
+			{"bytes", no_argument, 0, 7},
+			{"files", required_argument, 0, 8},
+			{"per-dir", required_argument, 0, 9},
+			{"fanout", required_argument, 0, 10},
+			{"size", required_argument, 0, 11},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			mode=optarg;
+			break;
+		case 1:
+			workers=atoi(optarg);
+			break;
+		case 2:
+			stat_name=optarg;
+			break;
+		case 3:
+			bufsize=atol(optarg);
+			break;
+		case 4:
+			name_glob=optarg;
+			break;
+		case 5:
+			type=optarg[0]=='f'?DT_REG:optarg[0]=='d'?DT_DIR:optarg[0]=='l'?DT_LNK:-1;
+			break;
+		case 6:
+			max_depth=atoi(optarg);
+			break;
+		case 7:
+			bytes=true;
+			break;
+		case 8:
+			files=atol(optarg);
+			break;
+		case 9:
+			per_dir=atoi(optarg);
+			break;
+		case 10:
+			fanout=atoi(optarg);
+			break;
+		case 11:
+			size=atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--mode=find|du|create] [--workers=n] [--stat=none|fstatat|statx] [--bufsize=bytes] [--name=glob] [--type=f|d|l] [--maxdepth=n] [--bytes] [--files=n] [--per-dir=n] [--fanout=n] [--size=bytes] dir\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(optind!=argc-1 || workers==0) {
+		fprintf(stderr, "%s: give exactly one directory\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char* root=argv[optind];
+	if(strcmp(mode, "create")==0) {
+		uint64_t start=latency_now();
+		create_tree(root, files, per_dir, fanout, size);
+		fprintf(stderr, "elapsed=%.3lfs\n", (latency_now()-start)/1e9);
+		return EXIT_SUCCESS;
+	}
+	bool du=strcmp(mode, "du")==0;
+	if(!du && strcmp(mode, "find")!=0) {
+		fprintf(stderr, "%s: unknown mode %s\n", argv[0], mode);
+		return EXIT_FAILURE;
+	}
+	tree_walk_stat stat_mode=du?tree_walk_stat_statx:tree_walk_stat_none;
+	if(stat_name!=NULL) {
+		if(strcmp(stat_name, "none")==0) {
+			stat_mode=tree_walk_stat_none;
+		} else if(strcmp(stat_name, "fstatat")==0) {
+			stat_mode=tree_walk_stat_fstatat;
+		} else if(strcmp(stat_name, "statx")==0) {
+			stat_mode=tree_walk_stat_statx;
+		} else {
+			fprintf(stderr, "%s: unknown stat %s\n", argv[0], stat_name);
+			return EXIT_FAILURE;
+		}
+	}
+	if(du && stat_mode==tree_walk_stat_none) {
+		fprintf(stderr, "%s: du needs sizes, use --stat=fstatat or --stat=statx\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	// per worker state
+	vector<Output> outputs(du?0:workers);
+	vector<string> tmps(workers);
+	vector<DuSum> sums(workers);
+	memset(sums.data(), 0, sizeof(DuSum)*workers);
+	// inodes with more than one link seen so far
+	mutex links_lock;
+	set<pair<dev_t, ino64_t>> links;
+	TreeWalker::Visitor visitor;
+	if(du) {
+		visitor=[&](unsigned int w, const TreeWalkEntry& e) {
+			if(e.nlink>1 && e.type!=DT_DIR) {
+				lock_guard<mutex> guard(links_lock);
+				if(!links.insert(make_pair(e.dev, e.ino)).second) {
+					return;
+				}
+			}
+			sums[w].blocks+=e.blocks;
+			sums[w].bytes+=e.size;
+		};
+	} else {
+		visitor=[&](unsigned int w, const TreeWalkEntry& e) {
+			if(type!=-1 && e.type!=type) {
+				return;
+			}
+			if(name_glob!=NULL && fnmatch(name_glob, e.name, 0)!=0) {
+				return;
+			}
+			outputs[w].line(e, tmps[w]);
+		};
+	}
+	uint64_t start=latency_now();
+	TreeWalker walker(workers, visitor, stat_mode, STATX_TYPE|STATX_NLINK|STATX_INO|STATX_SIZE|STATX_BLOCKS, bufsize, max_depth);
+	walker.walk(root);
+	for(Output& o : outputs) {
+		o.flush();
+	}
+	double elapsed=(latency_now()-start)/1e9;
+	if(du) {
+		DuSum total={0, 0};
+		for(const DuSum& s : sums) {
+			total.blocks+=s.blocks;
+			total.bytes+=s.bytes;
+		}
+		printf("%lu\t%s\n", bytes?total.bytes:total.blocks/2, root);
+	}
+	const TreeWalkStats& s=walker.get_stats();
+	fprintf(stderr, "workers=%u dirs=%lu entries=%lu getdents=%lu stats=%lu steals=%lu errors=%lu elapsed=%.3lfs\n", workers, s.dirs, s.entries, s.getdents, s.stats, s.steals, s.errors, elapsed);
+	return s.errors==0?EXIT_SUCCESS:EXIT_FAILURE;
+}
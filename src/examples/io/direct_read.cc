@@ -23,10 +23,9 @@
 #include <sys/types.h>	// for open(2), fstat(2)
 #include <sys/stat.h>	// for open(2), fstat(2)
 #include <fcntl.h>	// for open(2)
-#include <sys/ioctl.h>	// for ioctl(2)
 #include <unistd.h>	// for fstat(2)
-#include <linux/fs.h>	// for BLKSSZGET
 #include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_INT()
+#include <direct_reader.hh>	// for dio_align(), DioAlign
 #include <multiproc_utils.h>	// for my_system()
 
 /*
@@ -40,12 +39,10 @@
  * the underlying used block size and a size which is a multiple
  * of the same. play around with the command line parameters to
  * see that.
- *
- * TODO:
- * - show the difference in performance between doing O_DIRECT and
- * not (maybe in another example and not this one?!?).
- * - use the BLKSSZGET ioctl(2) (see the code below) to get the block
- * size as well as the fstat(2) that is currently used.
+ * The alignment comes from dio_align() (direct_reader.hh): statx(2) with
+ * STATX_DIOALIGN, the BLKSSZGET ioctl(2) of the device and st_blksize of
+ * fstat(2) are all printed. For the performance difference between
+ * O_DIRECT and buffered reads see direct_read_bench.cc.
  *
  * References:
  * http://www.quora.com/Linux/How-can-I-bypass-the-OS-buffering-during-I-O-in-Linux
@@ -71,11 +68,11 @@ int main(int argc, char** argv) {
 	}
 	int fd=CHECK_NOT_M1(open(filename, flags));
 	// find out the block size
-	blksize_t block_size1;
-	CHECK_NOT_M1(ioctl(fd, BLKSSZGET, &block_size1));
-	printf("block_size1=%ld\n", block_size1);
+	DioAlign align=dio_align(fd);
+	printf("dio_mem_align=%u, dio_offset_align=%u, logical_block_size=%u\n", align.mem_align, align.offset_align, align.logical_block);
 	struct stat mystat;
 	CHECK_NOT_M1(fstat(fd, &mystat));
+	printf("st_blksize=%ld\n", mystat.st_blksize);
 	blksize_t block_size=mystat.st_blksize;
 	char* p;
 	if(use_malloc) {
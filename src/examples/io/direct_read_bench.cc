@@ -0,0 +1,265 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for off_t
+#include <sys/stat.h>	// for stat(2), struct stat
+#include <sys/resource.h>	// for getrusage(2), struct rusage
+#include <fcntl.h>	// for open(2), O_*, posix_fadvise(2)
+#include <stdio.h>	// for printf(3), fprintf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3), atof(3)
+#include <string.h>	// for strcmp(3)
+#include <stdint.h>	// for uint64_t
+#include <unistd.h>	// for write(2), fsync(2), close(2)
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_ZERO(), CHECK_ASSERT(), CHECK_INT()
+#include <direct_reader.hh>	// for dio_align(), AlignedBufferPool, DirectReadEngine
+#include <LatencyHistogram.hh>	// for latency_now()
+#include <vector>	// for vector<T>
+
+using namespace std;
+
+/*
+ * Buffered against O_DIRECT reads of a big file, sequential and random,
+ * through one of the engines of direct_reader.hh (sync pread(2), POSIX AIO
+ * or io_uring) with a queue depth. Reports MB/s, reads per second and the
+ * cpu the process used (user+system, including the glibc AIO threads and
+ * the io_uring io-wq workers) as a percentage of the elapsed time.
+ *
+ * Before every run the file is dropped from the page cache with
+ * posix_fadvise(POSIX_FADV_DONTNEED) so the buffered reads start cold too
+ * (--warm to keep the cache, then buffered is a memcpy(3) from the cache).
+ *
+ * Usage: direct_read_bench [--engine=sync|aio|uring] [--qd=n] [--bs=bytes]
+ * [--mode=buffered|direct|both] [--pattern=seq|rand|both] [--size=MB]
+ * [--seconds=s] [--warm] [--file=path]
+ *
+ * The file (/tmp/bigfile by default) is created if it is smaller than
+ * --size.
+ *
+ * Numbers on a single core VM (virtio disk, ext4), 1GB file, 4K reads,
+ * 2 seconds each (MB/s, cpu%):
+ *	engine	qd	mode		seq		rand
+ *	sync	1	buffered	278 97%		111 52%
+ *	sync	1	direct		99 45%		96 46%
+ *	aio	8	buffered	243 97%		257 90%
+ *	aio	8	direct		229 91%		228 94%
+ *	aio	32	buffered	246 98%		344 85%
+ *	aio	32	direct		286 94%		364 94%
+ *	uring	8	buffered	306 97%		385 49%
+ *	uring	8	direct		558 55%		453 47%
+ *	uring	32	buffered	309 97%		679 49%
+ *	uring	32	direct		1428 55%	719 38%
+ * (aio and uring with qd=1 are the same as sync.)
+ * - Buffered sequential reads do not care about the queue depth, the read
+ * ahead of the kernel is the queue, and they are cpu bound on the copy.
+ * - Direct reads at depth 1 are slower than buffered, each 4K waits for the
+ * device. They need depth, and then pass buffered in both patterns at
+ * about half the cpu.
+ * - POSIX AIO pays for its threads (a thread switch per read on one cpu),
+ * io_uring gets more than twice the throughput for the same cpu.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ * EXTRA_LINK_FLAGS_AFTER=-lrt
+ */
+
+static uint64_t xorshift(uint64_t& s) {
+	s^=s<<13;
+	s^=s>>7;
+	s^=s<<17;
+	return s;
+}
+
+static void create_file(const char* filename, off_t size) {
+	int fd=CHECK_NOT_M1(open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644));
+	vector<uint64_t> buf(1024*1024/sizeof(uint64_t));
+	uint64_t s=88172645463325252ULL;
+	for(off_t done=0; done<size; done+=buf.size()*sizeof(uint64_t)) {
+		for(uint64_t& x : buf) {
+			x=xorshift(s);
+		}
+		CHECK_INT(write(fd, buf.data(), buf.size()*sizeof(uint64_t)), (ssize_t)(buf.size()*sizeof(uint64_t)));
+	}
+	CHECK_NOT_M1(fsync(fd));
+	CHECK_NOT_M1(close(fd));
+}
+
+static double cpu_seconds() {
+	struct rusage ru;
+	CHECK_NOT_M1(getrusage(RUSAGE_SELF, &ru));
+	return ru.ru_utime.tv_sec+ru.ru_utime.tv_usec/1e6+ru.ru_stime.tv_sec+ru.ru_stime.tv_usec/1e6;
+}
+
+static void run(const char* filename, const char* engine_name, bool direct, bool random, unsigned int qd, size_t bs, off_t size, double seconds, bool warm) {
+	int fd=CHECK_NOT_M1(open(filename, O_RDONLY|(direct?O_DIRECT:0)));
+	if(!warm) {
+		CHECK_ZERO(posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED));
+	}
+	DioAlign align=dio_align(fd);
+	if(direct && align.offset_align==0) {
+		fprintf(stderr, "direct_read_bench: %s does not support O_DIRECT\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	if(direct && bs%align.offset_align!=0) {
+		fprintf(stderr, "direct_read_bench: block size %zu is not a multiple of %u\n", bs, align.offset_align);
+		exit(EXIT_FAILURE);
+	}
+	DirectReadEngine* engine=DirectReadEngine::create(engine_name, qd);
+	CHECK_ASSERT(engine!=NULL);
+	if(strcmp(engine_name, "sync")==0) {
+		qd=1;
+	}
+	AlignedBufferPool pool(qd, bs, align.mem_align>0?align.mem_align:4096);
+	const off_t blocks=size/bs;
+	off_t next=0;
+	uint64_t seed=0x9E3779B97F4A7C15ULL;
+	auto submit=[&](unsigned int tag) {
+		off_t block;
+		if(random) {
+			block=xorshift(seed)%blocks;
+		} else {
+			block=next;
+			next=(next+1)%blocks;
+		}
+		engine->submit(fd, pool.buffer(tag), bs, block*bs, tag);
+	};
+	vector<unsigned int> done;
+	engine->on_complete=[&](unsigned int tag, ssize_t res) {
+		CHECK_ASSERT(res==(ssize_t)bs);
+		done.push_back(tag);
+	};
+	unsigned long reads=0;
+	double cpu_start=cpu_seconds();
+	uint64_t start=latency_now();
+	uint64_t end=start+seconds*1e9;
+	for(unsigned int i=0; i<qd; i++) {
+		submit(pool.get());
+	}
+	unsigned int inflight=qd;
+	bool stop=false;
+	while(inflight>0) {
+		engine->reap();
+		reads+=done.size();
+		inflight-=done.size();
+		if(!stop && latency_now()>=end) {
+			stop=true;
+		}
+		for(unsigned int tag : done) {
+			if(stop) {
+				pool.put(tag);
+			} else {
+				submit(tag);
+				inflight++;
+			}
+		}
+		done.clear();
+	}
+	double elapsed=(latency_now()-start)/1e9;
+	double cpu=cpu_seconds()-cpu_start;
+	printf("engine=%s qd=%u bs=%zu mode=%s pattern=%s MB/s=%.1lf reads/s=%.0lf cpu=%.0lf%%\n", engine_name, qd, bs, direct?"direct":"buffered", random?"rand":"seq", reads*bs/elapsed/1e6, reads/elapsed, cpu/elapsed*100);
+	delete engine;
+	CHECK_NOT_M1(close(fd));
+}
+
+int main(int argc, char** argv) {
+	const char* engine="sync";
+	unsigned int qd=1;
+	size_t bs=4096;
+	const char* mode="both";
+	const char* pattern="both";
+	off_t size=1024;
+	double seconds=3;
+	bool warm=false;
+	const char* filename="/tmp/bigfile";
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"engine", required_argument, 0, 0},
+			{"qd", required_argument, 0, 1},
+			{"bs", required_argument, 0, 2},
+			{"mode", required_argument, 0, 3},
+			{"pattern", required_argument, 0, 4},
+			{"size", required_argument, 0, 5},
+			{"seconds", required_argument, 0, 6},
+			{"warm", no_argument, 0, 7},
+			{"file", required_argument, 0, 8},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			engine=optarg;
+			break;
+		case 1:
+			qd=atoi(optarg);
+			break;
+		case 2:
+			bs=atoi(optarg);
+			break;
+		case 3:
+			mode=optarg;
+			break;
+		case 4:
+			pattern=optarg;
+			break;
+		case 5:
+			size=atoi(optarg);
+			break;
+		case 6:
+			seconds=atof(optarg);
+			break;
+		case 7:
+			warm=true;
+			break;
+		case 8:
+			filename=optarg;
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--engine=sync|aio|uring] [--qd=n] [--bs=bytes] [--mode=buffered|direct|both] [--pattern=seq|rand|both] [--size=MB] [--seconds=s] [--warm] [--file=path]\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	DirectReadEngine* check=DirectReadEngine::create(engine, 1);
+	if(check==NULL || qd==0 || bs==0) {
+		fprintf(stderr, "%s: bad engine %s, queue depth or block size\n", argv[0], engine);
+		return EXIT_FAILURE;
+	}
+	delete check;
+	size*=1024*1024;
+	struct stat st;
+	if(stat(filename, &st)==-1 || st.st_size<size) {
+		printf("creating %s...\n", filename);
+		create_file(filename, size);
+	}
+	for(int d=0; d<2; d++) {
+		bool direct=d==1;
+		if(strcmp(mode, "both")!=0 && strcmp(mode, direct?"direct":"buffered")!=0) {
+			continue;
+		}
+		for(int r=0; r<2; r++) {
+			bool random=r==1;
+			if(strcmp(pattern, "both")!=0 && strcmp(pattern, random?"rand":"seq")!=0) {
+				continue;
+			}
+			run(filename, engine, direct, random, qd, bs, size, seconds, warm);
+		}
+	}
+	return EXIT_SUCCESS;
+}
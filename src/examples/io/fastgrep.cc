@@ -0,0 +1,460 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for off_t
+#include <sys/stat.h>	// for fstat(2), struct stat
+#include <sys/mman.h>	// for mmap(2), munmap(2), madvise(2), MADV_*
+#include <fcntl.h>	// for open(2), O_*
+#include <stdio.h>	// for printf(3), fprintf(3), snprintf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3), atol(3)
+#include <string.h>	// for strcmp(3), strlen(3), memchr(3), memrchr(3)
+#include <stdint.h>	// for uint64_t
+#include <unistd.h>	// for pread(2), write(2), close(2), sysconf(3)
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <pthread.h>	// for pthread_create(3), pthread_join(3)
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_NOT_VOIDP(), CHECK_ZERO_ERRNO(), CHECK_ASSERT()
+#include <fast_search.h>	// for fast_search_func, fast_search_select(), fast_search_avx2(), fast_search_sse2(), fast_search_memmem()
+#include <uring_batch.hh>	// for UringBatch
+#include <vector>	// for vector<T>
+#include <string>	// for string
+#include <mutex>	// for mutex, unique_lock<T>
+#include <condition_variable>	// for condition_variable
+#include <atomic>	// for atomic<T>
+
+using namespace std;
+
+/*
+ * A parallel grep -F: print the lines of the files that contain a fixed
+ * string, in file order, like grep -F does.
+ *
+ * fastgrep [--threads=n] [--chunk=MB] [--io=mmap|uring|read]
+ *	[--scan=auto|avx2|sse2|memmem] [--count] pattern file...
+ * fastgrep --make=MB file
+ *	writes a synthetic log to search in (one line in about 2000 has
+ *	"ERROR code=").
+ *
+ * - every file is cut into chunks of --chunk MB which a pool of --threads
+ * threads takes in order. A chunk owns the lines that start in it: its
+ * worker skips the partial line at the start (the previous chunk has it)
+ * and reads past its end to the end of its last line. Since the pattern
+ * cannot hold a newline no match crosses a line, so the chunks are
+ * searched independently.
+ * - the output of every chunk is collected in a string and the main thread
+ * writes them in chunk order, so the output is that of grep. Workers stay
+ * at most 4*threads chunks ahead of the writer, which bounds the memory.
+ * - --io=mmap maps every file with MADV_SEQUENTIAL (aggressive read ahead,
+ * pages dropped behind the scan), --io=uring reads a chunk with one
+ * UringBatch (uring_batch.hh) submission of 256KB reads that the kernel
+ * runs concurrently, --io=read with pread(2).
+ * - the search is fast_search.h: a SIMD scan for positions where the
+ * first and the last byte of the pattern match, verified with memcmp(3).
+ * At a match the line is found with memrchr(3)/memchr(3), the rest of the
+ * line is skipped (a line is printed once).
+ *
+ * Numbers on a single core VM (avx2), 1GB log (--make=1024, 11.5M lines),
+ * pattern "ERROR code=" (5824 matching lines), output to a file (GNU grep
+ * stops at the first match when its output is /dev/null), seconds:
+ *					hot cache	cold cache
+ *	grep -F				0.70		2.7-4.9
+ *	fastgrep (mmap, avx2)		0.17		0.7-2.7
+ *	fastgrep --io=uring		0.23-0.27	0.8-4.7
+ *	fastgrep --io=read		0.26		0.4-2.9
+ *	fastgrep --scan=sse2		0.27
+ *	fastgrep --scan=memmem		0.29-0.30
+ *	fastgrep --threads=4		0.17-0.25
+ * Hot, the scan is the whole cost: avx2 at about 6GB/s is 4 times grep
+ * (which runs Boyer-Moore style skips on one buffer at a time), sse2 and
+ * glibc's memmem(3) are a third slower, and mmap saves the copy into a
+ * buffer that the read paths pay. Cold here means
+ * posix_fadvise(POSIX_FADV_DONTNEED) and the disk of the VM is cached by
+ * the host, so the cold runs measure the host more than anything (hence
+ * the ranges). On one cpu more threads only add switches, the pool is for
+ * machines where the scan of one file is cpu bound.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ * EXTRA_LINK_FLAGS_AFTER=-lpthread
+ */
+
+enum grep_io {
+	grep_io_mmap,
+	grep_io_uring,
+	grep_io_read,
+};
+
+struct GrepFile {
+	const char* name;
+	int fd;
+	off_t size;
+	// the mapping for grep_io_mmap
+	char* map;
+};
+
+struct GrepChunk {
+	unsigned int file;
+	off_t start;
+	off_t end;
+	// the last chunk of its file
+	bool last;
+	// filled by the worker
+	string out;
+	unsigned long matches;
+	bool done;
+};
+
+static vector<GrepFile> files;
+static vector<GrepChunk> chunks;
+static const char* pattern;
+static size_t pattern_len;
+static fast_search_func search_func;
+static grep_io io=grep_io_mmap;
+static bool count_only=false;
+static bool with_names;
+static atomic<size_t> next_chunk;
+static mutex chunks_lock;
+static condition_variable cond;
+// chunks written by the main thread
+static size_t written=0;
+static size_t ahead;
+
+static const size_t uring_block=256*1024;
+
+// what a worker keeps between chunks
+struct GrepWorker {
+	vector<char> buf;
+	UringBatch* ring;
+};
+
+static void read_full(int fd, char* buf, size_t len, off_t offset) {
+	while(len>0) {
+		ssize_t ret=CHECK_NOT_M1(pread(fd, buf, len, offset));
+		CHECK_ASSERT(ret>0);
+		buf+=ret;
+		len-=ret;
+		offset+=ret;
+	}
+}
+
+// bytes [base, base+len) of the file, with the end of the last line of the
+// chunk in it unless the file ends first
+static const char* load(GrepWorker& w, const GrepFile& f, const GrepChunk& c, off_t base, size_t& len) {
+	if(io==grep_io_mmap) {
+		len=f.size-base;
+		return f.map+base;
+	}
+	len=c.end-base;
+	if(w.buf.size()<len) {
+		w.buf.resize(len);
+	}
+	if(io==grep_io_read) {
+		read_full(f.fd, w.buf.data(), len, base);
+	} else {
+		unsigned int failed=0;
+		w.ring->on_complete=[&](uint64_t, int res) {
+			if(res<0) {
+				failed++;
+			}
+		};
+		size_t pos=0;
+		while(pos<len) {
+			size_t n=len-pos<uring_block?len-pos:uring_block;
+			UringBatch::prep_read(w.ring->get_sqe(), f.fd, w.buf.data()+pos, n, base+pos, pos);
+			pos+=n;
+		}
+		w.ring->finish();
+		CHECK_ASSERT(failed==0);
+	}
+	// the end of the last line
+	const size_t step=64*1024;
+	while(base+(off_t)len<f.size && memchr(w.buf.data()+(c.end-1-base), '\n', len-(c.end-1-base))==NULL) {
+		size_t n=f.size-(base+len)<step?f.size-(base+len):step;
+		w.buf.resize(len+n);
+		read_full(f.fd, w.buf.data()+len, n, base+len);
+		len+=n;
+	}
+	return w.buf.data();
+}
+
+static void grep_chunk(GrepWorker& w, GrepChunk& c) {
+	const GrepFile& f=files[c.file];
+	if(f.size==0) {
+		return;
+	}
+	// one byte before the chunk tells if it starts a line
+	off_t base=c.start==0?0:c.start-1;
+	size_t len;
+	const char* data=load(w, f, c, base, len);
+	const char* end_of_data=data+len;
+	const char* p=data;
+	if(c.start>0) {
+		p=static_cast<const char*>(memchr(data, '\n', len));
+		if(p==NULL || p>=data+(c.end-1-base)) {
+			// one line covers the whole chunk, it is not ours
+			return;
+		}
+		p++;
+	}
+	const char* end=static_cast<const char*>(memchr(data+(c.end-1-base), '\n', end_of_data-(data+(c.end-1-base))));
+	end=end==NULL?end_of_data:end+1;
+	while(p<end) {
+		const char* m=search_func(p, end-p, pattern, pattern_len);
+		if(m==NULL) {
+			break;
+		}
+		const char* ls=static_cast<const char*>(memrchr(p, '\n', m-p));
+		ls=ls==NULL?p:ls+1;
+		const char* le=static_cast<const char*>(memchr(m, '\n', end-m));
+		le=le==NULL?end:le+1;
+		c.matches++;
+		if(!count_only) {
+			if(with_names) {
+				c.out.append(f.name);
+				c.out.push_back(':');
+			}
+			c.out.append(ls, le-ls);
+			if(le[-1]!='\n') {
+				c.out.push_back('\n');
+			}
+		}
+		p=le;
+	}
+}
+
+static void* worker_main(void*) {
+	GrepWorker w;
+	w.ring=io==grep_io_uring?new UringBatch(64):NULL;
+	while(true) {
+		size_t i=next_chunk.fetch_add(1);
+		if(i>=chunks.size()) {
+			break;
+		}
+		{
+			unique_lock<mutex> guard(chunks_lock);
+			cond.wait(guard, [i] { return i<written+ahead; });
+		}
+		grep_chunk(w, chunks[i]);
+		{
+			lock_guard<mutex> guard(chunks_lock);
+			chunks[i].done=true;
+		}
+		cond.notify_all();
+	}
+	delete w.ring;
+	return NULL;
+}
+
+static void write_all(int fd, const char* p, size_t len) {
+	while(len>0) {
+		ssize_t ret=CHECK_NOT_M1(write(fd, p, len));
+		p+=ret;
+		len-=ret;
+	}
+}
+
+static uint64_t xorshift(uint64_t& s) {
+	s^=s<<13;
+	s^=s>>7;
+	s^=s<<17;
+	return s;
+}
+
+static void make_log(const char* filename, size_t size) {
+	static const char* levels[]={"INFO ", "DEBUG", "WARN ", "INFO ", "TRACE"};
+	static const char* words[]={"request", "session", "cache", "backend", "worker", "queue", "timeout", "retry", "connection", "user"};
+	int fd=CHECK_NOT_M1(open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644));
+	string buf;
+	uint64_t s=88172645463325252ULL;
+	size_t total=0;
+	unsigned long line=0;
+	char tmp[256];
+	while(total<size) {
+		uint64_t r=xorshift(s);
+		bool error=r%2000==0;
+		int len=snprintf(tmp, sizeof(tmp), "2026-10-18 %02lu:%02lu:%02lu.%03lu %s [worker-%lu] %s %s id=%lu took %luus%s\n",
+			(line/3600000)%24, (line/60000)%60, (line/1000)%60, line%1000,
+			error?"ERROR":levels[r%5], (r>>8)%64, words[(r>>16)%10], words[(r>>24)%10], r>>32, (r>>40)%10000,
+			error?" ERROR code=503 upstream reset":" status=200");
+		buf.append(tmp, len);
+		line++;
+		if(buf.size()>=1024*1024) {
+			write_all(fd, buf.data(), buf.size());
+			total+=buf.size();
+			buf.clear();
+		}
+	}
+	CHECK_NOT_M1(close(fd));
+	printf("wrote %zu bytes, %lu lines to %s\n", total, line, filename);
+}
+
+int main(int argc, char** argv) {
+	unsigned int threads=sysconf(_SC_NPROCESSORS_ONLN);
+	size_t chunk=8;
+	const char* scan="auto";
+	long make=-1;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"threads", required_argument, 0, 0},
+			{"chunk", required_argument, 0, 1},
+			{"io", required_argument, 0, 2},
+			{"scan", required_argument, 0, 3},
+			{"count", no_argument, 0, 4},
+			{"make", required_argument, 0, 5},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			threads=atoi(optarg);
+			break;
+		case 1:
+			chunk=atol(optarg);
+			break;
+		case 2:
+			if(strcmp(optarg, "mmap")==0) {
+				io=grep_io_mmap;
+			} else if(strcmp(optarg, "uring")==0) {
+				io=grep_io_uring;
+			} else if(strcmp(optarg, "read")==0) {
+				io=grep_io_read;
+			} else {
+				fprintf(stderr, "%s: unknown io %s\n", argv[0], optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 3:
+			scan=optarg;
+			break;
+		case 4:
+			count_only=true;
+			break;
+		case 5:
+			make=atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--threads=n] [--chunk=MB] [--io=mmap|uring|read] [--scan=auto|avx2|sse2|memmem] [--count] pattern file...\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(make>=0) {
+		if(optind!=argc-1) {
+			fprintf(stderr, "%s: --make needs one file\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		make_log(argv[optind], make*1024*1024);
+		return EXIT_SUCCESS;
+	}
+	if(argc-optind<2 || threads==0 || chunk==0) {
+		fprintf(stderr, "%s: give a pattern and at least one file\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	pattern=argv[optind];
+	pattern_len=strlen(pattern);
+	if(pattern_len==0 || memchr(pattern, '\n', pattern_len)!=NULL) {
+		fprintf(stderr, "%s: the pattern must be one non empty line\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if(strcmp(scan, "auto")==0) {
+		search_func=fast_search_select();
+	} else if(strcmp(scan, "avx2")==0) {
+		search_func=fast_search_avx2;
+	} else if(strcmp(scan, "sse2")==0) {
+		search_func=fast_search_sse2;
+	} else if(strcmp(scan, "memmem")==0) {
+		search_func=fast_search_memmem;
+	} else {
+		fprintf(stderr, "%s: unknown scan %s\n", argv[0], scan);
+		return EXIT_FAILURE;
+	}
+	chunk*=1024*1024;
+	with_names=argc-optind>2;
+	for(int i=optind+1; i<argc; i++) {
+		GrepFile f;
+		f.name=argv[i];
+		f.fd=CHECK_NOT_M1(open(f.name, O_RDONLY));
+		struct stat st;
+		CHECK_NOT_M1(fstat(f.fd, &st));
+		f.size=st.st_size;
+		f.map=NULL;
+		if(io==grep_io_mmap && f.size>0) {
+			f.map=static_cast<char*>(CHECK_NOT_VOIDP(mmap(NULL, f.size, PROT_READ, MAP_PRIVATE, f.fd, 0), MAP_FAILED));
+			CHECK_NOT_M1(madvise(f.map, f.size, MADV_SEQUENTIAL));
+		}
+		unsigned int fi=files.size();
+		files.push_back(f);
+		// an empty file still gets a chunk, for --count
+		off_t start=0;
+		do {
+			off_t end=start+(off_t)chunk<f.size?start+chunk:f.size;
+			chunks.push_back(GrepChunk{fi, start, end, end==f.size, string(), 0, false});
+			start=end;
+		} while(start<f.size);
+	}
+	ahead=4*threads;
+	next_chunk=0;
+	vector<pthread_t> tids(threads);
+	for(unsigned int i=0; i<threads; i++) {
+		CHECK_ZERO_ERRNO(pthread_create(&tids[i], NULL, worker_main, NULL));
+	}
+	// write the chunks in order
+	unsigned long file_matches=0;
+	unsigned long total=0;
+	string line;
+	for(size_t i=0; i<chunks.size(); i++) {
+		GrepChunk& c=chunks[i];
+		{
+			unique_lock<mutex> guard(chunks_lock);
+			cond.wait(guard, [&c] { return c.done; });
+		}
+		write_all(STDOUT_FILENO, c.out.data(), c.out.size());
+		string().swap(c.out);
+		file_matches+=c.matches;
+		total+=c.matches;
+		if(c.last) {
+			if(count_only) {
+				line.clear();
+				if(with_names) {
+					line.append(files[c.file].name);
+					line.push_back(':');
+				}
+				line.append(to_string(file_matches));
+				line.push_back('\n');
+				write_all(STDOUT_FILENO, line.data(), line.size());
+			}
+			file_matches=0;
+		}
+		{
+			lock_guard<mutex> guard(chunks_lock);
+			written++;
+		}
+		cond.notify_all();
+	}
+	for(unsigned int i=0; i<threads; i++) {
+		CHECK_ZERO_ERRNO(pthread_join(tids[i], NULL));
+	}
+	for(const GrepFile& f : files) {
+		if(f.map!=NULL) {
+			CHECK_NOT_M1(munmap(f.map, f.size));
+		}
+		CHECK_NOT_M1(close(f.fd));
+	}
+	// like grep: 0 if a line was found, 1 if not
+	return total>0?EXIT_SUCCESS:EXIT_FAILURE;
+}
@@ -171,12 +171,12 @@ int app_setup_uring(struct submitter *s) {
 	}
 	/* Save useful fields in a global app_io_sq_ring struct for later
 	 * easy reference */
-	sring->head = static_cast<unsigned int*>(sq_ptr) + p.sq_off.head;
-	sring->tail = static_cast<unsigned int*>(sq_ptr) + p.sq_off.tail;
-	sring->ring_mask = static_cast<unsigned int*>(sq_ptr) + p.sq_off.ring_mask;
-	sring->ring_entries = static_cast<unsigned int*>(sq_ptr) + p.sq_off.ring_entries;
-	sring->flags = static_cast<unsigned int*>(sq_ptr) + p.sq_off.flags;
-	sring->array = static_cast<unsigned int*>(sq_ptr) + p.sq_off.array;
+	sring->head = reinterpret_cast<unsigned int*>(static_cast<char*>(sq_ptr) + p.sq_off.head);
+	sring->tail = reinterpret_cast<unsigned int*>(static_cast<char*>(sq_ptr) + p.sq_off.tail);
+	sring->ring_mask = reinterpret_cast<unsigned int*>(static_cast<char*>(sq_ptr) + p.sq_off.ring_mask);
+	sring->ring_entries = reinterpret_cast<unsigned int*>(static_cast<char*>(sq_ptr) + p.sq_off.ring_entries);
+	sring->flags = reinterpret_cast<unsigned int*>(static_cast<char*>(sq_ptr) + p.sq_off.flags);
+	sring->array = reinterpret_cast<unsigned int*>(static_cast<char*>(sq_ptr) + p.sq_off.array);
 
 	/* Map in the submission queue entries array */
 	CHECK_NOT_VOIDP(s->sqes = static_cast<io_uring_sqe*>(mmap(0, p.sq_entries * sizeof(struct io_uring_sqe),
@@ -185,11 +185,11 @@ int app_setup_uring(struct submitter *s) {
 
 	/* Save useful fields in a global app_io_cq_ring struct for later
 	 * easy reference */
-	cring->head = static_cast<unsigned int*>(cq_ptr) + p.cq_off.head;
-	cring->tail = static_cast<unsigned int*>(cq_ptr) + p.cq_off.tail;
-	cring->ring_mask = static_cast<unsigned int*>(cq_ptr) + p.cq_off.ring_mask;
-	cring->ring_entries = static_cast<unsigned int*>(cq_ptr) + p.cq_off.ring_entries;
-	cring->cqes = static_cast<io_uring_cqe*>(cq_ptr) + p.cq_off.cqes;
+	cring->head = reinterpret_cast<unsigned int*>(static_cast<char*>(cq_ptr) + p.cq_off.head);
+	cring->tail = reinterpret_cast<unsigned int*>(static_cast<char*>(cq_ptr) + p.cq_off.tail);
+	cring->ring_mask = reinterpret_cast<unsigned int*>(static_cast<char*>(cq_ptr) + p.cq_off.ring_mask);
+	cring->ring_entries = reinterpret_cast<unsigned int*>(static_cast<char*>(cq_ptr) + p.cq_off.ring_entries);
+	cring->cqes = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(cq_ptr) + p.cq_off.cqes);
 
 	return 0;
 }
@@ -266,6 +266,8 @@ int submit_to_sq(char *file_path, struct submitter *s) {
 		return 1;
 	}
 	fi->file_sz = file_sz;
+	/* the iovecs live right after the struct, in the same allocation */
+	fi->iovecs = reinterpret_cast<struct iovec*>(fi + 1);
 	/*
 	 * For each block of the file we need to read, we allocate an iovec struct
 	 * which is indexed into the iovecs array. This array is passed in as part
@@ -0,0 +1,293 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for uid_t, gid_t
+#include <sys/stat.h>	// for statx(2), struct statx, STATX_*, S_IS*()
+#include <fcntl.h>	// for open(2), O_*, AT_*
+#include <dirent.h>	// for getdents64(2), struct dirent64
+#include <pwd.h>	// for getpwuid(3)
+#include <grp.h>	// for getgrgid(3)
+#include <time.h>	// for time(2), localtime_r(3), strftime(3)
+#include <stdio.h>	// for printf(3), fprintf(3), snprintf(3), fwrite(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3)
+#include <string.h>	// for strcmp(3), strerror(3)
+#include <errno.h>	// for errno
+#include <unistd.h>	// for readlinkat(2), lseek(2), close(2)
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <err_utils.h>	// for CHECK_NOT_M1()
+#include <uring_batch.hh>	// for UringBatch
+#include <LatencyHistogram.hh>	// for latency_now()
+#include <vector>	// for vector<T>
+#include <string>	// for string
+#include <map>	// for map<K, V>
+#include <algorithm>	// for sort()
+
+using namespace std;
+
+/*
+ * ls -l of one directory, the metadata of the entries fetched either one
+ * statx(2) per entry (like exercises/c/ls/solution.c does with lstat(2))
+ * or all of them in one io_uring batch (UringBatch in uring_batch.hh).
+ *
+ * Usage: ls_uring [--mode=serial|uring] [--all] [--repeat=n] [dir]
+ *
+ * With --repeat the listing is done n times and only printed once, the
+ * time per listing and the number of system calls the program made for it
+ * go to stderr. readlinkat(2) of symbolic links is a system call in both
+ * modes (io_uring has no readlink). The output is that of LC_ALL=C ls -l,
+ * including "major, minor" in place of the size of device files.
+ *
+ * Numbers on a single core VM, warm cache, per listing (us / system calls):
+ *	directory		entries	serial		uring
+ *	100 files, 10 dirs	110	80/113		90/4
+ *	/usr/bin (344 symlinks)	939	970/1283	1170/348
+ *	10000 empty files	10001	8400/10006	16400/45
+ * The system calls go away as promised but the time does not: the kernel
+ * always hands IORING_OP_STATX to an io-wq worker thread, and with one cpu
+ * that hand off (a wakeup and a context switch per batch, the work list
+ * per operation) costs more than the system call transition it saves. The
+ * batch pays off when the stats can block (cold cache, network file
+ * systems) or when there are cpus for the io-wq workers to run on in
+ * parallel.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ */
+
+struct Entry {
+	string name;
+	struct statx stx;
+	int res;
+	string link;
+};
+
+// ls considers anything older than 6 months to be printed with a year
+static const time_t six_months=(365*24*60*60)/2;
+
+static void mode_string(mode_t m, char* p) {
+	p[0]=S_ISDIR(m)?'d':S_ISLNK(m)?'l':S_ISCHR(m)?'c':S_ISBLK(m)?'b':S_ISFIFO(m)?'p':S_ISSOCK(m)?'s':'-';
+	const char* rwx="rwxrwxrwx";
+	for(int i=0; i<9; i++) {
+		p[i+1]=(m & (1<<(8-i)))?rwx[i]:'-';
+	}
+	if(m & S_ISUID) {
+		p[3]=(m & S_IXUSR)?'s':'S';
+	}
+	if(m & S_ISGID) {
+		p[6]=(m & S_IXGRP)?'s':'S';
+	}
+	if(m & S_ISVTX) {
+		p[9]=(m & S_IXOTH)?'t':'T';
+	}
+	p[10]='\0';
+}
+
+static const string& user_name(uid_t uid) {
+	static map<uid_t, string> cache;
+	auto it=cache.find(uid);
+	if(it!=cache.end()) {
+		return it->second;
+	}
+	const struct passwd* pw=getpwuid(uid);
+	return cache[uid]=pw!=NULL?pw->pw_name:to_string(uid);
+}
+
+static const string& group_name(gid_t gid) {
+	static map<gid_t, string> cache;
+	auto it=cache.find(gid);
+	if(it!=cache.end()) {
+		return it->second;
+	}
+	const struct group* gr=getgrgid(gid);
+	return cache[gid]=gr!=NULL?gr->gr_name:to_string(gid);
+}
+
+static void read_dir(int dirfd, bool all, vector<Entry>& entries, unsigned long& syscalls) {
+	char buf[256*1024];
+	CHECK_NOT_M1(lseek(dirfd, 0, SEEK_SET));
+	syscalls++;
+	while(true) {
+		ssize_t nread=CHECK_NOT_M1(getdents64(dirfd, buf, sizeof(buf)));
+		syscalls++;
+		if(nread==0) {
+			break;
+		}
+		for(ssize_t pos=0; pos<nread;) {
+			const struct dirent64* de=reinterpret_cast<const struct dirent64*>(buf+pos);
+			pos+=de->d_reclen;
+			if(de->d_name[0]=='.' && !all) {
+				continue;
+			}
+			entries.emplace_back();
+			entries.back().name=de->d_name;
+		}
+	}
+}
+
+static const unsigned int mask=STATX_TYPE|STATX_MODE|STATX_NLINK|STATX_UID|STATX_GID|STATX_SIZE|STATX_BLOCKS|STATX_MTIME;
+
+static void stat_serial(int dirfd, vector<Entry>& entries, unsigned long& syscalls) {
+	for(Entry& e : entries) {
+		e.res=statx(dirfd, e.name.c_str(), AT_SYMLINK_NOFOLLOW, mask, &e.stx)==-1?-errno:0;
+		syscalls++;
+	}
+}
+
+static void stat_uring(UringBatch& ring, int dirfd, vector<Entry>& entries) {
+	ring.on_complete=[&](uint64_t i, int res) {
+		entries[i].res=res;
+	};
+	for(size_t i=0; i<entries.size(); i++) {
+		UringBatch::prep_statx(ring.get_sqe(), dirfd, entries[i].name.c_str(), AT_SYMLINK_NOFOLLOW, mask, &entries[i].stx, i);
+	}
+	ring.finish();
+}
+
+static void read_links(int dirfd, vector<Entry>& entries, unsigned long& syscalls) {
+	char target[4096];
+	for(Entry& e : entries) {
+		if(e.res==0 && S_ISLNK(e.stx.stx_mode)) {
+			ssize_t len=readlinkat(dirfd, e.name.c_str(), target, sizeof(target));
+			syscalls++;
+			if(len!=-1) {
+				e.link.assign(target, len);
+			}
+		}
+	}
+}
+
+static void print(const vector<Entry>& entries) {
+	time_t now=time(NULL);
+	unsigned long blocks=0;
+	int w_nlink=1, w_user=1, w_group=1, w_size=1, w_major=0, w_minor=0;
+	for(const Entry& e : entries) {
+		if(e.res!=0) {
+			continue;
+		}
+		blocks+=e.stx.stx_blocks;
+		w_nlink=max(w_nlink, (int)to_string(e.stx.stx_nlink).size());
+		w_user=max(w_user, (int)user_name(e.stx.stx_uid).size());
+		w_group=max(w_group, (int)group_name(e.stx.stx_gid).size());
+		// devices show "major, minor" in the size column, like ls(1)
+		if(S_ISCHR(e.stx.stx_mode) || S_ISBLK(e.stx.stx_mode)) {
+			w_major=max(w_major, (int)to_string(e.stx.stx_rdev_major).size());
+			w_minor=max(w_minor, (int)to_string(e.stx.stx_rdev_minor).size());
+		} else {
+			w_size=max(w_size, (int)to_string(e.stx.stx_size).size());
+		}
+	}
+	if(w_major>0) {
+		w_size=max(w_size, w_major+2+w_minor);
+	}
+	printf("total %lu\n", blocks/2);
+	for(const Entry& e : entries) {
+		if(e.res!=0) {
+			fprintf(stderr, "ls_uring: cannot access '%s': %s\n", e.name.c_str(), strerror(-e.res));
+			continue;
+		}
+		char mode[11];
+		mode_string(e.stx.stx_mode, mode);
+		char date[32];
+		time_t mtime=e.stx.stx_mtime.tv_sec;
+		struct tm tm;
+		localtime_r(&mtime, &tm);
+		if(now-mtime>six_months || mtime>now) {
+			strftime(date, sizeof(date), "%b %e  %Y", &tm);
+		} else {
+			strftime(date, sizeof(date), "%b %e %H:%M", &tm);
+		}
+		printf("%s %*u %-*s %-*s ", mode, w_nlink, e.stx.stx_nlink, w_user, user_name(e.stx.stx_uid).c_str(), w_group, group_name(e.stx.stx_gid).c_str());
+		if(S_ISCHR(e.stx.stx_mode) || S_ISBLK(e.stx.stx_mode)) {
+			printf("%*u, %*u", w_size-2-w_minor, e.stx.stx_rdev_major, w_minor, e.stx.stx_rdev_minor);
+		} else {
+			printf("%*llu", w_size, (unsigned long long)e.stx.stx_size);
+		}
+		printf(" %s %s", date, e.name.c_str());
+		if(S_ISLNK(e.stx.stx_mode)) {
+			printf(" -> %s", e.link.c_str());
+		}
+		printf("\n");
+	}
+}
+
+int main(int argc, char** argv) {
+	const char* mode="uring";
+	bool all=false;
+	unsigned int repeat=1;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"mode", required_argument, 0, 0},
+			{"all", no_argument, 0, 1},
+			{"repeat", required_argument, 0, 2},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			mode=optarg;
+			break;
+		case 1:
+			all=true;
+			break;
+		case 2:
+			repeat=atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--mode=serial|uring] [--all] [--repeat=n] [dir]\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	// the time per listing is divided by it
+	if(repeat<1) {
+		fprintf(stderr, "%s: --repeat must be at least 1\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	bool uring=strcmp(mode, "uring")==0;
+	if(!uring && strcmp(mode, "serial")!=0) {
+		fprintf(stderr, "%s: unknown mode %s\n", argv[0], mode);
+		return EXIT_FAILURE;
+	}
+	const char* dir=optind<argc?argv[optind]:".";
+	int dirfd=CHECK_NOT_M1(open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC));
+	UringBatch ring;
+	vector<Entry> entries;
+	unsigned long syscalls=0;
+	uint64_t start=latency_now();
+	for(unsigned int r=0; r<repeat; r++) {
+		entries.clear();
+		read_dir(dirfd, all, entries, syscalls);
+		if(uring) {
+			stat_uring(ring, dirfd, entries);
+		} else {
+			stat_serial(dirfd, entries, syscalls);
+		}
+		read_links(dirfd, entries, syscalls);
+	}
+	double elapsed=(latency_now()-start)/1e3/repeat;
+	syscalls+=ring.get_enters();
+	sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+		return strcmp(a.name.c_str(), b.name.c_str())<0;
+	});
+	print(entries);
+	fprintf(stderr, "mode=%s entries=%zu us_per_listing=%.1lf syscalls_per_listing=%.1lf uring_ops=%lu\n", mode, entries.size(), elapsed, (double)syscalls/repeat, ring.get_ops()/repeat);
+	CHECK_NOT_M1(close(dirfd));
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,304 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for pid_t, uid_t
+#include <sys/stat.h>	// for statx(2), struct statx, STATX_UID
+#include <fcntl.h>	// for open(2), openat(2), O_*
+#include <dirent.h>	// for getdents64(2), struct dirent64
+#include <stdio.h>	// for printf(3), fprintf(3), snprintf(3), sscanf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3)
+#include <string.h>	// for strcmp(3), strchr(3), strrchr(3), memcpy(3)
+#include <errno.h>	// for errno
+#include <unistd.h>	// for read(2), close(2), lseek(2), readlinkat(2), getuid(2), sysconf(3)
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_ASSERT()
+#include <uring_batch.hh>	// for UringBatch
+#include <LatencyHistogram.hh>	// for latency_now()
+#include <vector>	// for vector<T>
+#include <string>	// for string
+
+using namespace std;
+
+/*
+ * A /proc process scanner (like exercises/io/find_your_own_processes)
+ * which finds the processes of the current user (all of them with --all)
+ * and reads /proc/<pid>/stat of each of them, either one system call at a
+ * time or in io_uring batches (UringBatch in uring_batch.hh).
+ *
+ * serial: per process statx(2) of /proc/<pid> for the owner, then
+ * openat(2), read(2) and close(2) of /proc/<pid>/stat.
+ * uring: the same operations, but every step is one batch for all the
+ * processes: one IORING_OP_STATX per process, then one IORING_OP_OPENAT,
+ * IORING_OP_READ and IORING_OP_CLOSE. Each step needs the results of the
+ * previous one (the fd of the open) so a sample is four batches.
+ *
+ * --files lists the open files of every process like the exercise asks,
+ * this is getdents64(2) and readlinkat(2) in both modes as io_uring has no
+ * readlink.
+ *
+ * Usage: proc_scan_uring [--mode=serial|uring] [--all] [--files] [--repeat=n]
+ *
+ * Numbers on a single core VM with 92 processes, --all, per sample:
+ *	serial	400-650us	371 system calls
+ *	uring	800us		7 system calls (368 io_uring operations)
+ * Like with ls_uring.cc the statx and the reads of /proc files (which do
+ * not support non blocking reads) go through io-wq worker threads, which
+ * on one cpu is slower than doing the system calls.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ */
+
+struct Proc {
+	char pid[16];
+	char stat_path[32];
+	struct statx stx;
+	int res;
+	int fd;
+	char buf[1024];
+	// from /proc/<pid>/stat
+	char comm[64];
+	char state;
+	int ppid;
+	unsigned long utime;
+	unsigned long stime;
+	long rss;
+};
+
+static void list_pids(int procfd, vector<Proc>& procs, unsigned long& syscalls) {
+	char buf[64*1024];
+	CHECK_NOT_M1(lseek(procfd, 0, SEEK_SET));
+	syscalls++;
+	while(true) {
+		ssize_t nread=CHECK_NOT_M1(getdents64(procfd, buf, sizeof(buf)));
+		syscalls++;
+		if(nread==0) {
+			break;
+		}
+		for(ssize_t pos=0; pos<nread;) {
+			const struct dirent64* de=reinterpret_cast<const struct dirent64*>(buf+pos);
+			pos+=de->d_reclen;
+			if(de->d_name[0]<'1' || de->d_name[0]>'9') {
+				continue;
+			}
+			procs.emplace_back();
+			Proc& p=procs.back();
+			int pid=atoi(de->d_name);
+			snprintf(p.pid, sizeof(p.pid), "%d", pid);
+			snprintf(p.stat_path, sizeof(p.stat_path), "%d/stat", pid);
+			p.res=0;
+			p.fd=-1;
+		}
+	}
+}
+
+// processes which went away or which are not ours are dropped
+static void filter(vector<Proc>& procs, bool all) {
+	uid_t uid=getuid();
+	size_t j=0;
+	for(size_t i=0; i<procs.size(); i++) {
+		if(procs[i].res>=0 && (all || procs[i].stx.stx_uid==uid)) {
+			if(i!=j) {
+				procs[j]=procs[i];
+			}
+			j++;
+		}
+	}
+	procs.resize(j);
+}
+
+static void parse(Proc& p) {
+	p.comm[0]='\0';
+	p.state='?';
+	if(p.res<=0) {
+		return;
+	}
+	p.buf[p.res]='\0';
+	// the command name may contain anything, ')' included
+	char* open=strchr(p.buf, '(');
+	char* close=strrchr(p.buf, ')');
+	if(open==NULL || close==NULL) {
+		return;
+	}
+	size_t len=close-open-1;
+	if(len>=sizeof(p.comm)) {
+		len=sizeof(p.comm)-1;
+	}
+	memcpy(p.comm, open+1, len);
+	p.comm[len]='\0';
+	sscanf(close+2, "%c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d %*u %*u %ld", &p.state, &p.ppid, &p.utime, &p.stime, &p.rss);
+}
+
+static void sample_serial(int procfd, vector<Proc>& procs, bool all, unsigned long& syscalls) {
+	for(Proc& p : procs) {
+		p.res=statx(procfd, p.pid, 0, STATX_UID, &p.stx)==-1?-errno:0;
+		syscalls++;
+	}
+	filter(procs, all);
+	for(Proc& p : procs) {
+		p.res=-1;
+		int fd=openat(procfd, p.stat_path, O_RDONLY|O_CLOEXEC);
+		syscalls++;
+		if(fd==-1) {
+			continue;
+		}
+		p.res=read(fd, p.buf, sizeof(p.buf)-1);
+		CHECK_NOT_M1(close(fd));
+		syscalls+=2;
+	}
+}
+
+static void sample_uring(UringBatch& ring, int procfd, vector<Proc>& procs, bool all) {
+	ring.on_complete=[&](uint64_t i, int res) {
+		procs[i].res=res;
+	};
+	for(size_t i=0; i<procs.size(); i++) {
+		UringBatch::prep_statx(ring.get_sqe(), procfd, procs[i].pid, 0, STATX_UID, &procs[i].stx, i);
+	}
+	ring.finish();
+	filter(procs, all);
+	for(size_t i=0; i<procs.size(); i++) {
+		UringBatch::prep_openat(ring.get_sqe(), procfd, procs[i].stat_path, O_RDONLY|O_CLOEXEC, 0, i);
+	}
+	ring.finish();
+	for(size_t i=0; i<procs.size(); i++) {
+		procs[i].fd=procs[i].res;
+		if(procs[i].fd>=0) {
+			UringBatch::prep_read(ring.get_sqe(), procs[i].fd, procs[i].buf, sizeof(procs[i].buf)-1, 0, i);
+		}
+	}
+	ring.finish();
+	ring.on_complete=[](uint64_t, int res) {
+		CHECK_ASSERT(res==0);
+	};
+	for(size_t i=0; i<procs.size(); i++) {
+		if(procs[i].fd>=0) {
+			UringBatch::prep_close(ring.get_sqe(), procs[i].fd, i);
+		} else {
+			procs[i].res=-1;
+		}
+	}
+	ring.finish();
+}
+
+static void print_files(int procfd, const Proc& p) {
+	char path[64];
+	snprintf(path, sizeof(path), "%s/fd", p.pid);
+	int fd=openat(procfd, path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if(fd==-1) {
+		printf("\tcannot access fd folder\n");
+		return;
+	}
+	char buf[16*1024];
+	char target[4096];
+	ssize_t nread;
+	while((nread=getdents64(fd, buf, sizeof(buf)))>0) {
+		for(ssize_t pos=0; pos<nread;) {
+			const struct dirent64* de=reinterpret_cast<const struct dirent64*>(buf+pos);
+			pos+=de->d_reclen;
+			if(de->d_name[0]=='.') {
+				continue;
+			}
+			ssize_t len=readlinkat(fd, de->d_name, target, sizeof(target)-1);
+			if(len==-1) {
+				continue;
+			}
+			target[len]='\0';
+			printf("\t/proc/%s/fd/%s --> %s\n", p.pid, de->d_name, target);
+		}
+	}
+	CHECK_NOT_M1(close(fd));
+}
+
+int main(int argc, char** argv) {
+	const char* mode="uring";
+	bool all=false;
+	bool files=false;
+	unsigned int repeat=1;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"mode", required_argument, 0, 0},
+			{"all", no_argument, 0, 1},
+			{"files", no_argument, 0, 2},
+			{"repeat", required_argument, 0, 3},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			mode=optarg;
+			break;
+		case 1:
+			all=true;
+			break;
+		case 2:
+			files=true;
+			break;
+		case 3:
+			repeat=atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--mode=serial|uring] [--all] [--files] [--repeat=n]\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	bool uring=strcmp(mode, "uring")==0;
+	if(!uring && strcmp(mode, "serial")!=0) {
+		fprintf(stderr, "%s: unknown mode %s\n", argv[0], mode);
+		return EXIT_FAILURE;
+	}
+	int procfd=CHECK_NOT_M1(open("/proc", O_RDONLY|O_DIRECTORY|O_CLOEXEC));
+	UringBatch ring;
+	vector<Proc> procs;
+	unsigned long syscalls=0;
+	size_t scanned=0;
+	uint64_t start=latency_now();
+	for(unsigned int r=0; r<repeat; r++) {
+		procs.clear();
+		list_pids(procfd, procs, syscalls);
+		scanned=procs.size();
+		if(uring) {
+			sample_uring(ring, procfd, procs, all);
+		} else {
+			sample_serial(procfd, procs, all, syscalls);
+		}
+		for(Proc& p : procs) {
+			parse(p);
+		}
+	}
+	double elapsed=(latency_now()-start)/1e3/repeat;
+	syscalls+=ring.get_enters();
+	long ticks=sysconf(_SC_CLK_TCK);
+	long page_kb=sysconf(_SC_PAGESIZE)/1024;
+	printf("%7s %7s %s %8s %8s %8s %s\n", "PID", "PPID", "S", "UTIME", "STIME", "RSS_KB", "COMM");
+	for(const Proc& p : procs) {
+		if(p.res<=0) {
+			continue;
+		}
+		printf("%7s %7d %c %8.2lf %8.2lf %8ld %s\n", p.pid, p.ppid, p.state, (double)p.utime/ticks, (double)p.stime/ticks, p.rss*page_kb, p.comm);
+		if(files) {
+			print_files(procfd, p);
+		}
+	}
+	fprintf(stderr, "mode=%s scanned=%zu matched=%zu us_per_sample=%.1lf syscalls_per_sample=%.1lf uring_ops=%lu\n", mode, scanned, procs.size(), elapsed, (double)syscalls/repeat, ring.get_ops()/repeat);
+	CHECK_NOT_M1(close(procfd));
+	return EXIT_SUCCESS;
+}
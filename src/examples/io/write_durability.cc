@@ -0,0 +1,402 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for off_t
+#include <sys/stat.h>	// for open(2)
+#include <fcntl.h>	// for open(2), O_*, fallocate(2), sync_file_range(2), SYNC_FILE_RANGE_*
+#include <pthread.h>	// for pthread_create(3), pthread_join(3), pthread_mutex_*, pthread_cond_*
+#include <stdio.h>	// for printf(3), fprintf(3), snprintf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3), atof(3)
+#include <string.h>	// for strcmp(3), memset(3)
+#include <unistd.h>	// for pwrite(2), fsync(2), fdatasync(2), close(2), unlink(2)
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_ZERO_ERRNO(), CHECK_ASSERT(), CHECK_INT()
+#include <uring_batch.hh>	// for UringBatch
+#include <LatencyHistogram.hh>	// for LatencyHistogram, latency_now()
+#include <vector>	// for vector<T>
+
+using namespace std;
+
+/*
+ * Durable appends: how fast can records be written to a file so that each
+ * of them survives a crash once its writer is told it is committed.
+ *
+ * Strategies:
+ * - none: pwrite(2) only, nothing is durable (the baseline).
+ * - fsync, fdatasync: pwrite(2) and a sync per record. fdatasync skips the
+ * metadata that is not needed to read the data back (the mtime).
+ * - osync, odsync: the file opened with O_SYNC or O_DSYNC, every pwrite(2)
+ * returns only once durable. Appending changes the size of the file, which
+ * is metadata that O_DSYNC must write too: with --prealloc=fallocate the
+ * size is set up front but the blocks are still unwritten extents whose
+ * conversion is metadata as well, with --prealloc=zero the file is written
+ * with zeros first and the records overwrite data in place, nothing but
+ * data to flush.
+ * - group: group commit. Each of --writers threads appends a record and
+ * waits until it is durable. A writer that finds no sync in progress does
+ * one fdatasync(2) for every record appended so far (its own and those of
+ * everyone who came in while the previous sync ran), the others wait for
+ * it.
+ * - sfr: sync_file_range(2) write behind. Every --window bytes the window
+ * just written is started (SYNC_FILE_RANGE_WRITE) and the one before it is
+ * waited for, so the dirty data stays bounded and writeback streams behind
+ * the writer. Not durable: no metadata and no flush of the device cache,
+ * it is about the stalls a big writer otherwise gets when the dirty limits
+ * hit. The latency is per pwrite(2).
+ * - uring: --batch writes and an fdatasync (IORING_OP_FSYNC with
+ * IORING_FSYNC_DATASYNC) linked after them (IOSQE_IO_LINK) as one
+ * io_uring submission, one system call per commit.
+ *
+ * Reports the commits, syncs (fsync/fdatasync calls, O_SYNC/O_DSYNC writes
+ * or sync_file_range calls) and bytes per second and the commit latency.
+ *
+ * Usage: write_durability [--strategy=none|fsync|fdatasync|osync|odsync|
+ * group|sfr|uring|all] [--size=bytes] [--writers=n] [--batch=n]
+ * [--window=KB] [--prealloc=none|fallocate|zero] [--seconds=s]
+ * [--file=path]
+ *
+ * Numbers on a single core VM (virtio disk, ext4), 512 byte records, one
+ * writer unless noted (commits/s, syncs/s, p50/p99.9 latency in us):
+ *	none				964000	0	0.4/31
+ *	fsync				4000	4000	119/3342
+ *	fdatasync			8600	8600	121/447
+ *	osync				8200	8200	126/713
+ *	odsync				7900	7900	130/647
+ *	odsync --prealloc=fallocate	10800	10800	86/606
+ *	odsync --prealloc=zero		11000	11000	85/483
+ *	fdatasync, 8 writers		18900	18900	389/1999
+ *	fdatasync, 32 writers		22000	22000	1278/29098
+ *	group, 8 writers		32300	7500	244/1475
+ *	group, 32 writers		79700	5400	369/2130
+ *	uring --batch=8			55000	6900	143/778
+ *	uring --batch=32		182000	5700	174/1114
+ * - fsync costs twice fdatasync, the mtime update is a journal commit.
+ * - Appending is metadata, preallocating takes a third off every sync.
+ * - Concurrent fdatasync calls already share journal commits (jbd2) but
+ * every writer still pays a full sync. Group commit does a sync per group
+ * and scales with the writers, the latency of a commit stays one or two
+ * syncs.
+ * - Batching in one io_uring submission is the same idea in one thread.
+ * - With 64K writes sfr gives 357MB/s with p99.9 of 1.9ms and a 7.7ms
+ * max, plain writes 917MB/s (into the page cache) with 4ms and 33ms
+ * stalls when the dirty limit hits.
+ * This disk acknowledges flushes quickly (the host caches it), on real
+ * disks a sync is 0.1-10ms and the gains of grouping are larger.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ * EXTRA_LINK_FLAGS_AFTER=-lpthread
+ */
+
+struct Config {
+	const char* strategy;
+	size_t size;
+	unsigned int writers;
+	unsigned int batch;
+	size_t window;
+	const char* prealloc;
+	double seconds;
+	const char* filename;
+};
+
+struct Shared {
+	const Config* config;
+	int fd;
+	uint64_t end;
+	// the next offset to write at
+	off_t offset;
+	// group commit state
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned long appended;
+	unsigned long durable;
+	bool syncing;
+};
+
+struct Writer {
+	Shared* shared;
+	LatencyHistogram h;
+	unsigned long commits;
+	unsigned long syncs;
+};
+
+static off_t next_offset(Shared* s, size_t len) {
+	return __atomic_fetch_add(&s->offset, len, __ATOMIC_RELAXED);
+}
+
+static void* writer_simple(void* arg) {
+	Writer* w=static_cast<Writer*>(arg);
+	Shared* s=w->shared;
+	const char* strategy=s->config->strategy;
+	const size_t size=s->config->size;
+	const bool do_fsync=strcmp(strategy, "fsync")==0;
+	const bool do_fdatasync=strcmp(strategy, "fdatasync")==0;
+	const bool sync_open=strcmp(strategy, "osync")==0 || strcmp(strategy, "odsync")==0;
+	vector<char> buf(size, 'x');
+	uint64_t now;
+	while((now=latency_now())<s->end) {
+		CHECK_INT(pwrite(s->fd, buf.data(), size, next_offset(s, size)), (ssize_t)size);
+		if(do_fsync) {
+			CHECK_NOT_M1(fsync(s->fd));
+		}
+		if(do_fdatasync) {
+			CHECK_NOT_M1(fdatasync(s->fd));
+		}
+		if(do_fsync || do_fdatasync || sync_open) {
+			w->syncs++;
+		}
+		w->h.record(latency_now()-now);
+		w->commits++;
+	}
+	return NULL;
+}
+
+static void* writer_group(void* arg) {
+	Writer* w=static_cast<Writer*>(arg);
+	Shared* s=w->shared;
+	const size_t size=s->config->size;
+	vector<char> buf(size, 'x');
+	uint64_t now;
+	while((now=latency_now())<s->end) {
+		CHECK_INT(pwrite(s->fd, buf.data(), size, next_offset(s, size)), (ssize_t)size);
+		CHECK_ZERO_ERRNO(pthread_mutex_lock(&s->mutex));
+		unsigned long mine=++s->appended;
+		while(s->durable<mine) {
+			if(s->syncing) {
+				CHECK_ZERO_ERRNO(pthread_cond_wait(&s->cond, &s->mutex));
+				continue;
+			}
+			// lead a sync for everything appended so far
+			s->syncing=true;
+			unsigned long target=s->appended;
+			CHECK_ZERO_ERRNO(pthread_mutex_unlock(&s->mutex));
+			CHECK_NOT_M1(fdatasync(s->fd));
+			w->syncs++;
+			CHECK_ZERO_ERRNO(pthread_mutex_lock(&s->mutex));
+			s->durable=target;
+			s->syncing=false;
+			CHECK_ZERO_ERRNO(pthread_cond_broadcast(&s->cond));
+		}
+		CHECK_ZERO_ERRNO(pthread_mutex_unlock(&s->mutex));
+		w->h.record(latency_now()-now);
+		w->commits++;
+	}
+	return NULL;
+}
+
+static void writer_sfr(Writer* w) {
+	Shared* s=w->shared;
+	const size_t size=s->config->size;
+	const off_t window=s->config->window;
+	vector<char> buf(size, 'x');
+	off_t window_start=0;
+	uint64_t now;
+	while((now=latency_now())<s->end) {
+		off_t offset=next_offset(s, size);
+		CHECK_INT(pwrite(s->fd, buf.data(), size, offset), (ssize_t)size);
+		if(offset+(off_t)size-window_start>=window) {
+			// start writeback of this window, wait for the previous one
+			CHECK_NOT_M1(sync_file_range(s->fd, window_start, window, SYNC_FILE_RANGE_WRITE));
+			if(window_start>=window) {
+				CHECK_NOT_M1(sync_file_range(s->fd, window_start-window, window, SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE|SYNC_FILE_RANGE_WAIT_AFTER));
+			}
+			w->syncs+=2;
+			window_start+=window;
+		}
+		w->h.record(latency_now()-now);
+		w->commits++;
+	}
+}
+
+static void writer_uring(Writer* w) {
+	Shared* s=w->shared;
+	const size_t size=s->config->size;
+	const unsigned int batch=s->config->batch;
+	vector<char> buf(size, 'x');
+	UringBatch ring(batch+1);
+	ring.on_complete=[&](uint64_t, int res) {
+		CHECK_ASSERT(res>=0);
+	};
+	uint64_t now;
+	while((now=latency_now())<s->end) {
+		for(unsigned int i=0; i<batch; i++) {
+			struct io_uring_sqe* sqe=ring.get_sqe();
+			UringBatch::prep_write(sqe, s->fd, buf.data(), size, next_offset(s, size), i);
+			sqe->flags|=IOSQE_IO_LINK;
+		}
+		UringBatch::prep_fsync(ring.get_sqe(), s->fd, IORING_FSYNC_DATASYNC, batch);
+		ring.finish();
+		uint64_t latency=latency_now()-now;
+		for(unsigned int i=0; i<batch; i++) {
+			w->h.record(latency);
+		}
+		w->commits+=batch;
+		w->syncs++;
+	}
+}
+
+static int open_file(const Config& c) {
+	unlink(c.filename);
+	int flags=O_WRONLY|O_CREAT;
+	if(strcmp(c.strategy, "osync")==0) {
+		flags|=O_SYNC;
+	}
+	if(strcmp(c.strategy, "odsync")==0) {
+		flags|=O_DSYNC;
+	}
+	int fd=CHECK_NOT_M1(open(c.filename, flags, 0644));
+	// room for everything the fastest strategy writes, 1GB
+	const off_t prealloc_size=1024*1024*1024;
+	if(strcmp(c.prealloc, "fallocate")==0) {
+		CHECK_NOT_M1(fallocate(fd, 0, 0, prealloc_size));
+		CHECK_NOT_M1(fsync(fd));
+	} else if(strcmp(c.prealloc, "zero")==0) {
+		// written through a non synchronous fd, then synced once
+		int zfd=CHECK_NOT_M1(open(c.filename, O_WRONLY));
+		vector<char> zeros(1024*1024, 0);
+		for(off_t off=0; off<prealloc_size; off+=zeros.size()) {
+			CHECK_INT(pwrite(zfd, zeros.data(), zeros.size(), off), (ssize_t)zeros.size());
+		}
+		CHECK_NOT_M1(fsync(zfd));
+		CHECK_NOT_M1(close(zfd));
+	}
+	return fd;
+}
+
+static void run(const Config& c) {
+	Shared s;
+	s.config=&c;
+	s.fd=open_file(c);
+	s.offset=0;
+	CHECK_ZERO_ERRNO(pthread_mutex_init(&s.mutex, NULL));
+	CHECK_ZERO_ERRNO(pthread_cond_init(&s.cond, NULL));
+	s.appended=0;
+	s.durable=0;
+	s.syncing=false;
+	const bool threaded=strcmp(c.strategy, "sfr")!=0 && strcmp(c.strategy, "uring")!=0;
+	const unsigned int writers=threaded?c.writers:1;
+	vector<Writer> w(writers);
+	for(Writer& writer : w) {
+		writer.shared=&s;
+		writer.commits=0;
+		writer.syncs=0;
+	}
+	uint64_t start=latency_now();
+	s.end=start+c.seconds*1e9;
+	if(threaded) {
+		void* (*func)(void*)=strcmp(c.strategy, "group")==0?writer_group:writer_simple;
+		vector<pthread_t> threads(writers);
+		for(unsigned int i=0; i<writers; i++) {
+			CHECK_ZERO_ERRNO(pthread_create(&threads[i], NULL, func, &w[i]));
+		}
+		for(pthread_t t : threads) {
+			CHECK_ZERO_ERRNO(pthread_join(t, NULL));
+		}
+	} else if(strcmp(c.strategy, "sfr")==0) {
+		writer_sfr(&w[0]);
+	} else {
+		writer_uring(&w[0]);
+	}
+	double elapsed=(latency_now()-start)/1e9;
+	LatencyHistogram h;
+	unsigned long commits=0, syncs=0;
+	for(const Writer& writer : w) {
+		h.merge(writer.h);
+		commits+=writer.commits;
+		syncs+=writer.syncs;
+	}
+	printf("%-9s %-9s %3u %5u %10.0lf %10.0lf %8.2lf %8.1lf %8.1lf %8.1lf %9.1lf\n", c.strategy, c.prealloc, writers, threaded?1:c.batch, commits/elapsed, syncs/elapsed, commits*c.size/elapsed/1e6, h.percentile(50)/1e3, h.percentile(99)/1e3, h.percentile(99.9)/1e3, h.get_max()/1e3);
+	CHECK_ZERO_ERRNO(pthread_cond_destroy(&s.cond));
+	CHECK_ZERO_ERRNO(pthread_mutex_destroy(&s.mutex));
+	CHECK_NOT_M1(close(s.fd));
+	CHECK_NOT_M1(unlink(c.filename));
+}
+
+int main(int argc, char** argv) {
+	Config c={"all", 512, 8, 1, 1024*1024, "none", 2, "/tmp/write_durability.dat"};
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"strategy", required_argument, 0, 0},
+			{"size", required_argument, 0, 1},
+			{"writers", required_argument, 0, 2},
+			{"batch", required_argument, 0, 3},
+			{"window", required_argument, 0, 4},
+			{"prealloc", required_argument, 0, 5},
+			{"seconds", required_argument, 0, 6},
+			{"file", required_argument, 0, 7},
+			{0, 0, 0, 0}
+		};
+		int ch=getopt_long(argc, argv, "", long_options, &option_index);
+		if(ch==-1)
+			break;
+		switch(ch) {
+		case 0:
+			c.strategy=optarg;
+			break;
+		case 1:
+			c.size=atoi(optarg);
+			break;
+		case 2:
+			c.writers=atoi(optarg);
+			break;
+		case 3:
+			c.batch=atoi(optarg);
+			break;
+		case 4:
+			c.window=atoi(optarg)*1024;
+			break;
+		case 5:
+			c.prealloc=optarg;
+			break;
+		case 6:
+			c.seconds=atof(optarg);
+			break;
+		case 7:
+			c.filename=optarg;
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--strategy=none|fsync|fdatasync|osync|odsync|group|sfr|uring|all] [--size=bytes] [--writers=n] [--batch=n] [--window=KB] [--prealloc=none|fallocate|zero] [--seconds=s] [--file=path]\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	const char* strategies[]={"none", "fsync", "fdatasync", "osync", "odsync", "group", "sfr", "uring"};
+	bool known=strcmp(c.strategy, "all")==0;
+	for(const char* strategy : strategies) {
+		known|=strcmp(c.strategy, strategy)==0;
+	}
+	if(!known || c.size==0 || c.writers==0 || c.batch==0 || c.window==0) {
+		fprintf(stderr, "%s: bad strategy, size, writers, batch or window\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if(strcmp(c.prealloc, "none")!=0 && strcmp(c.prealloc, "fallocate")!=0 && strcmp(c.prealloc, "zero")!=0) {
+		fprintf(stderr, "%s: unknown prealloc %s\n", argv[0], c.prealloc);
+		return EXIT_FAILURE;
+	}
+	printf("%-9s %-9s %3s %5s %10s %10s %8s %8s %8s %8s %9s\n", "strategy", "prealloc", "thr", "batch", "commits/s", "syncs/s", "MB/s", "p50_us", "p99_us", "p99.9_us", "max_us");
+	if(strcmp(c.strategy, "all")==0) {
+		for(const char* strategy : strategies) {
+			Config one=c;
+			one.strategy=strategy;
+			run(one);
+		}
+	} else {
+		run(c);
+	}
+	return EXIT_SUCCESS;
+}
@@ -44,6 +44,9 @@
  * You can also use iotop to see the process consuming first place in the io
  * category.
  *
+ * For writes that must be durable (fsync(2), O_SYNC, group commit...) see
+ * write_durability.cc.
+ *
  * EXTRA_LINK_FLAGS_AFTER=-lcpufreq -lpthread
  */
 
@@ -0,0 +1,265 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <stdio.h>	// for printf(3), fprintf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3)
+#include <string.h>	// for strcmp(3), memcmp(3)
+#include <stdint.h>	// for uint32_t, uint64_t
+#include <sys/types.h>	// for open(2), off_t
+#include <sys/stat.h>	// for open(2), fstat(2), struct stat
+#include <sys/sendfile.h>	// for sendfile(2)
+#include <fcntl.h>	// for open(2), posix_fadvise(2)
+#include <unistd.h>	// for read(2), write(2), pwrite(2), ftruncate(2), copy_file_range(2), fdatasync(2), close(2), unlink(2)
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <limits.h>	// for INT_MAX
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_ZERO(), CHECK_ASSERT(), CHECK_INT()
+#include <sparse_copy.hh>	// for sparse_copy()
+#include <proc_reader.h>	// for proc_reader_t, proc_read_io()
+#include <crc32c_utils.h>	// for crc32c()
+#include <LatencyHistogram.hh>	// for latency_now()
+#include <vector>	// for vector<T>
+
+using namespace std;
+
+/*
+ * A comparison of the ways to copy a file (the copy_file_*.cc examples
+ * here) on a sparse file, like a VM image which is mostly holes:
+ * - read_write: read(2)/write(2) with a 1MB buffer (copy_file_read_write.cc)
+ * - zero_detect: the same, but 4KB blocks of zeros are not written (what
+ * cp --sparse=always does): the holes are kept but still read.
+ * - sendfile: sendfile(2) (copy_file_sendfile.cc)
+ * - copy_file_range: copy_file_range(2) of the whole file
+ * - sparse_seek, sparse_fiemap: only the data extents (sparse_copy.hh,
+ * copy_file_sparse.cc)
+ *
+ * For every method: the time (including fdatasync(2) of the destination),
+ * the bytes the process moved through system calls (rchar+wchar of
+ * /proc/self/io) and the space the destination takes. Every copy is checked
+ * against the source (CRC32C). The source is dropped from the page cache
+ * before every copy (posix_fadvise(2)).
+ *
+ * Usage: copy_file_bench [--method=name|all] [--size=MB] [--data=percent]
+ * [--extent=KB] [--src=path] [--dst=path]
+ *
+ * The source (/tmp/copy_file_bench.src) is created with --data percent of
+ * its --size in random data extents of --extent KB, the rest holes. If /tmp
+ * is a tmpfs sparse_fiemap is the same as sparse_seek (tmpfs has no
+ * FIEMAP), use --src/--dst on a disk file system to compare the two.
+ *
+ * Numbers on a single core VM (ext4), 1GB with 5% data (60MB) in 1MB
+ * extents:
+ *	method		seconds	read_MB	written_MB	alloc_MB
+ *	read_write	5.41	1074	1074		1074
+ *	zero_detect	0.30	1074	60		60
+ *	sendfile	0.66	1074	1074		1074
+ *	copy_file_range	1.70	1074	1074		1074
+ *	sparse_seek	0.13	60	60		60
+ *	sparse_fiemap	0.08	60	60		60
+ * With 10% data in 64KB extents (1447 extents after merging) the two sparse
+ * walks are the same (0.21s): the cost is the copying, not the walk.
+ * copy_file_range(2) of the whole file fills the holes on ext4 (no reflink
+ * there), so it is the size of the apparent file like read/write. The
+ * zero_detect column shows that keeping holes is not enough: the holes are
+ * still read (and compared) at the full apparent size.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ */
+
+static uint64_t xorshift(uint64_t& s) {
+	s^=s<<13;
+	s^=s>>7;
+	s^=s<<17;
+	return s;
+}
+
+static void create_source(const char* filename, off_t size, unsigned int data_percent, size_t extent) {
+	int fd=CHECK_NOT_M1(open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644));
+	CHECK_NOT_M1(ftruncate(fd, size));
+	const off_t extents=size/extent;
+	uint64_t s=88172645463325252ULL;
+	vector<uint64_t> buf(extent/sizeof(uint64_t));
+	for(off_t i=0; i<extents; i++) {
+		if(xorshift(s)%100>=data_percent) {
+			continue;
+		}
+		for(uint64_t& x : buf) {
+			x=xorshift(s);
+		}
+		CHECK_INT(pwrite(fd, buf.data(), extent, i*extent), (ssize_t)extent);
+	}
+	CHECK_NOT_M1(fdatasync(fd));
+	CHECK_NOT_M1(close(fd));
+}
+
+static uint32_t file_crc(const char* filename) {
+	int fd=CHECK_NOT_M1(open(filename, O_RDONLY));
+	vector<char> buf(1024*1024);
+	uint32_t crc=0;
+	ssize_t ret;
+	while((ret=CHECK_NOT_M1(read(fd, buf.data(), buf.size())))>0) {
+		crc=crc32c(buf.data(), ret, crc);
+	}
+	CHECK_NOT_M1(close(fd));
+	return crc;
+}
+
+static void copy_read_write(int fdin, int fdout, bool skip_zeros) {
+	vector<char> buf(1024*1024);
+	const size_t block=4096;
+	off_t pos=0;
+	ssize_t ret;
+	while((ret=CHECK_NOT_M1(read(fdin, buf.data(), buf.size())))>0) {
+		if(!skip_zeros) {
+			CHECK_INT(write(fdout, buf.data(), ret), ret);
+		} else {
+			for(ssize_t off=0; off<ret; off+=block) {
+				size_t len=(size_t)(ret-off)<block?ret-off:block;
+				const char* p=buf.data()+off;
+				bool zero=p[0]==0 && memcmp(p, p+1, len-1)==0;
+				if(!zero) {
+					CHECK_INT(pwrite(fdout, p, len, pos+off), (ssize_t)len);
+				}
+			}
+		}
+		pos+=ret;
+	}
+	// a hole at the end must still count in the size
+	CHECK_NOT_M1(ftruncate(fdout, pos));
+}
+
+static void copy_sendfile(int fdin, int fdout) {
+	while(CHECK_NOT_M1(sendfile(fdout, fdin, NULL, INT_MAX))>0) {
+	}
+}
+
+static void copy_range(int fdin, int fdout) {
+	while(CHECK_NOT_M1(copy_file_range(fdin, NULL, fdout, NULL, INT_MAX, 0))>0) {
+	}
+}
+
+static const char* methods[]={"read_write", "zero_detect", "sendfile", "copy_file_range", "sparse_seek", "sparse_fiemap"};
+
+static void run(const char* method, const char* src, const char* dst, uint32_t src_crc) {
+	unlink(dst);
+	int fdin=CHECK_NOT_M1(open(src, O_RDONLY));
+	CHECK_ZERO(posix_fadvise(fdin, 0, 0, POSIX_FADV_DONTNEED));
+	int fdout=CHECK_NOT_M1(open(dst, O_WRONLY|O_CREAT|O_TRUNC, 0644));
+	proc_reader_t r;
+	CHECK_ASSERT(proc_reader_open(&r, 0, PROC_FILE(proc_file_io)));
+	proc_io_t before, after;
+	CHECK_ASSERT(proc_read_io(&r, &before));
+	unsigned long extents=0;
+	uint64_t start=latency_now();
+	if(strcmp(method, "read_write")==0) {
+		copy_read_write(fdin, fdout, false);
+	} else if(strcmp(method, "zero_detect")==0) {
+		copy_read_write(fdin, fdout, true);
+	} else if(strcmp(method, "sendfile")==0) {
+		copy_sendfile(fdin, fdout);
+	} else if(strcmp(method, "copy_file_range")==0) {
+		copy_range(fdin, fdout);
+	} else {
+		enum sparse_walk walk=strcmp(method, "sparse_fiemap")==0?sparse_walk_fiemap:sparse_walk_seek;
+		SparseCopyStats stats=sparse_copy(fdin, fdout, walk, sparse_holes_preserve);
+		extents=stats.extents;
+		if(stats.walk!=walk) {
+			fprintf(stderr, "%s: no FIEMAP on this file system, used SEEK_DATA/SEEK_HOLE\n", method);
+		}
+	}
+	CHECK_NOT_M1(fdatasync(fdout));
+	double elapsed=(latency_now()-start)/1e9;
+	CHECK_ASSERT(proc_read_io(&r, &after));
+	proc_reader_close(&r);
+	struct stat st;
+	CHECK_NOT_M1(fstat(fdout, &st));
+	CHECK_NOT_M1(close(fdin));
+	CHECK_NOT_M1(close(fdout));
+	bool ok=file_crc(dst)==src_crc;
+	printf("%-16s %8.3lf %10.1lf %10.1lf %10.1lf %8lu %s\n", method, elapsed, (after.rchar-before.rchar)/1e6, (after.wchar-before.wchar)/1e6, st.st_blocks*512/1e6, extents, ok?"ok":"DIFFERENT");
+	CHECK_NOT_M1(unlink(dst));
+}
+
+int main(int argc, char** argv) {
+	const char* method="all";
+	off_t size=1024;
+	unsigned int data_percent=5;
+	size_t extent=1024;
+	const char* src="/tmp/copy_file_bench.src";
+	const char* dst="/tmp/copy_file_bench.dst";
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"method", required_argument, 0, 0},
+			{"size", required_argument, 0, 1},
+			{"data", required_argument, 0, 2},
+			{"extent", required_argument, 0, 3},
+			{"src", required_argument, 0, 4},
+			{"dst", required_argument, 0, 5},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			method=optarg;
+			break;
+		case 1:
+			size=atoi(optarg);
+			break;
+		case 2:
+			data_percent=atoi(optarg);
+			break;
+		case 3:
+			extent=atoi(optarg);
+			break;
+		case 4:
+			src=optarg;
+			break;
+		case 5:
+			dst=optarg;
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--method=read_write|zero_detect|sendfile|copy_file_range|sparse_seek|sparse_fiemap|all] [--size=MB] [--data=percent] [--extent=KB] [--src=path] [--dst=path]\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	size*=1024*1024;
+	extent*=1024;
+	CHECK_ASSERT(extent>0 && extent%4096==0);
+	create_source(src, size, data_percent, extent);
+	uint32_t src_crc=file_crc(src);
+	struct stat st;
+	CHECK_NOT_M1(stat(src, &st));
+	printf("source: %.1lfMB, %.1lfMB of data\n", size/1e6, st.st_blocks*512/1e6);
+	printf("%-16s %8s %10s %10s %10s %8s %s\n", "method", "seconds", "read_MB", "written_MB", "alloc_MB", "extents", "check");
+	bool found=false;
+	for(const char* m : methods) {
+		if(strcmp(method, "all")==0 || strcmp(method, m)==0) {
+			run(m, src, dst, src_crc);
+			found=true;
+		}
+	}
+	if(!found) {
+		fprintf(stderr, "%s: unknown method %s\n", argv[0], method);
+		return EXIT_FAILURE;
+	}
+	CHECK_NOT_M1(unlink(src));
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <stdio.h>	// for fprintf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE
+#include <string.h>	// for strcmp(3)
+#include <sys/types.h>	// for open(2)
+#include <sys/stat.h>	// for open(2)
+#include <fcntl.h>	// for open(2)
+#include <unistd.h>	// for close(2)
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <err_utils.h>	// for CHECK_NOT_M1()
+#include <sparse_copy.hh>	// for sparse_copy()
+
+/*
+ * This is cp(1) for sparse files: only the data extents of the source are
+ * copied (copy_file_range(2)) and the holes stay holes in the destination.
+ * See sparse_copy.hh for how the extents are found.
+ *
+ * --walk selects SEEK_DATA/SEEK_HOLE (seek) or FS_IOC_FIEMAP (fiemap, seek
+ * on file systems without it, like tmpfs).
+ * --punch updates an existing destination in place: it is not truncated
+ * and the holes of the source are punched in it.
+ *
+ * Create a sparse file with filesystem/sparse_syscalls.cc or
+ * truncate -s 1G and compare the result with du(1) and cmp(1).
+ * copy_file_bench.cc compares this with the other ways to copy.
+ */
+
+int main(int argc, char** argv) {
+	enum sparse_walk walk=sparse_walk_seek;
+	enum sparse_holes holes=sparse_holes_preserve;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"walk", required_argument, 0, 0},
+			{"punch", no_argument, 0, 1},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			walk=strcmp(optarg, "fiemap")==0?sparse_walk_fiemap:sparse_walk_seek;
+			break;
+		case 1:
+			holes=sparse_holes_punch;
+			break;
+		default:
+			optind=argc;
+			break;
+		}
+	}
+	if(argc-optind!=2) {
+		fprintf(stderr, "%s: usage: %s [--walk=seek|fiemap] [--punch] [infile] [outfile]\n", argv[0], argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char* filein=argv[optind];
+	const char* fileout=argv[optind+1];
+	int fdin=CHECK_NOT_M1(open(filein, O_RDONLY));
+	int flags=O_WRONLY|O_CREAT;
+	if(holes==sparse_holes_preserve) {
+		flags|=O_TRUNC;
+	}
+	int fdout=CHECK_NOT_M1(open(fileout, flags, 0666));
+	SparseCopyStats stats=sparse_copy(fdin, fdout, walk, holes);
+	fprintf(stderr, "extents=%lu data_bytes=%ld hole_bytes=%ld walk_calls=%lu\n", stats.extents, (long)stats.data_bytes, (long)stats.hole_bytes, stats.walk_calls);
+	CHECK_NOT_M1(close(fdin));
+	CHECK_NOT_M1(close(fdout));
+	return EXIT_SUCCESS;
+}
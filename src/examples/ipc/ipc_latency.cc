@@ -0,0 +1,612 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for pid_t, mkfifo(3)
+#include <sys/stat.h>	// for mkfifo(3)
+#include <sys/socket.h>	// for socketpair(2), socket(2), bind(2), listen(2), accept(2), connect(2)
+#include <sys/ipc.h>	// for IPC_PRIVATE, IPC_RMID, IPC_NOWAIT
+#include <sys/msg.h>	// for msgget(2), msgsnd(2), msgrcv(2), msgctl(2)
+#include <sys/eventfd.h>	// for eventfd(2)
+#include <sys/wait.h>	// for waitpid(2)
+#include <netinet/in.h>	// for sockaddr_in, IPPROTO_TCP
+#include <netinet/tcp.h>	// for TCP_NODELAY
+#include <arpa/inet.h>	// for htonl(3)
+#include <mqueue.h>	// for mq_open(3), mq_send(3), mq_receive(3), mq_close(3), mq_unlink(3)
+#include <signal.h>	// for sigqueue(3), sigwaitinfo(2), sigtimedwait(2), sigprocmask(2)
+#include <sched.h>	// for sched_setaffinity(2), CPU_SET()
+#include <fcntl.h>	// for open(2), O_RDWR, O_NONBLOCK
+#include <stdio.h>	// for printf(3), fprintf(3), fopen(3), fscanf(3), fclose(3), sscanf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3), strtoul(3)
+#include <string.h>	// for strcmp(3), strtok(3), memcpy(3)
+#include <errno.h>	// for errno, EAGAIN, EINTR, ENOMSG
+#include <unistd.h>	// for fork(2), pipe(2), read(2), write(2), close(2), unlink(2), _exit(2)
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_ASSERT(), CHECK_NOT_NULL_FILEP()
+#include <shm_ring.hh>	// for ShmRing
+#include <LatencyHistogram.hh>	// for LatencyHistogram, latency_now()
+#include <vector>	// for vector<T>
+#include <string>	// for string
+
+using namespace std;
+
+/*
+ * Ping-pong latency between two processes over every IPC mechanism the
+ * examples in this tree show:
+ *	pipe		pipe(2), one per direction
+ *	fifo		named pipes (see fifo/mkfifo_basic.cc)
+ *	unix		SOCK_STREAM socketpair(2)
+ *	tcp		TCP over loopback with TCP_NODELAY
+ *	posix_mq	POSIX message queues, one per direction
+ *	sysv_mq		one SysV message queue, the message type is the direction
+ *	eventfd		eventfd(2) per direction, carries an 8 byte counter only
+ *	signal		sigqueue(3) with a real time signal, carries an int only
+ *	shm		ShmRing (shared_memory/shm_ring.cc) in POSIX shared memory
+ *
+ * The two processes are pinned (--cpus, by default two different cpus if
+ * there are two). --wait=block waits in the kernel the normal way,
+ * --wait=spin polls without blocking (O_NONBLOCK, IPC_NOWAIT, a zero
+ * timeout or spinning on the ring) which trades a cpu for not paying the
+ * wakeup. Spinning only makes sense with a cpu per process.
+ *
+ * For every mechanism and size the round trip histogram is printed with
+ * LatencyHistogram::print_summary() (--hdr adds the full HdrHistogram
+ * percentile distribution in us) followed by the throughput, so every
+ * transport is reported the same way. Mechanisms that carry a fixed size
+ * token (eventfd, signal) run once at their own size. Sizes above the
+ * limit of a mechanism (fs.mqueue.msgsize_max, kernel.msgmax) are skipped.
+ *
+ * Numbers on a single core VM, --wait=block, round trip p50/p99 in us:
+ *	size	pipe	fifo	unix	tcp	posix_mq	sysv_mq	shm
+ *	64	3.8/10	4.1/10	4.0/9.7	7.0/18	2.6/4.6		3.1/9.2	2.4/4.7
+ *	1K	3.7/9.3	3.8/8.3	4.2/9.2	6.6/14	2.6/6.1		3.4/9.0	2.5/4.7
+ *	8K	4.6/11	4.2/8.8	5.2/11	7.5/17	4.0/7.1		4.9/11	3.2/5.9
+ * eventfd (8 bytes) 2.3/4.2, signal (4 bytes) 3.9/6.8.
+ * With both processes on one cpu every round trip is two context switches
+ * whatever the transport, so what is left is the cost of the path through
+ * the kernel: the shared memory ring (a futex wake and wait only), eventfd
+ * and POSIX queues come first, the byte streams and SysV queues next and
+ * loopback TCP, which goes through the whole network stack, last. Spinning
+ * on a single cpu degrades to the scheduler tick (milliseconds), run
+ * --wait=spin on a machine with a cpu per process.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ * EXTRA_LINK_FLAGS_AFTER=-lpthread -lrt
+ */
+
+static bool spin=false;
+
+struct Mechanism {
+	virtual ~Mechanism() {}
+	virtual const char* name()=0;
+	// the largest message, 0 if any size goes
+	virtual size_t max_size() {
+		return 0;
+	}
+	// the only size it carries, 0 if it carries any
+	virtual size_t fixed_size() {
+		return 0;
+	}
+	// called in each process after the fork, before any message
+	virtual void setup(bool parent __attribute__((unused))) {}
+	virtual void send(bool parent, const char* buf, size_t len)=0;
+	virtual void recv(bool parent, char* buf, size_t len)=0;
+	// called in the parent after the child exited
+	virtual void cleanup() {}
+};
+
+static void set_nonblock(int fd) {
+	int flags=CHECK_NOT_M1(fcntl(fd, F_GETFL));
+	CHECK_NOT_M1(fcntl(fd, F_SETFL, flags|O_NONBLOCK));
+}
+
+static void write_all(int fd, const char* buf, size_t len) {
+	while(len>0) {
+		ssize_t ret=write(fd, buf, len);
+		if(ret==-1 && errno==EAGAIN) {
+			continue;
+		}
+		CHECK_NOT_M1(ret);
+		buf+=ret;
+		len-=ret;
+	}
+}
+
+static void read_all(int fd, char* buf, size_t len) {
+	while(len>0) {
+		ssize_t ret=read(fd, buf, len);
+		if(ret==-1 && errno==EAGAIN) {
+			continue;
+		}
+		CHECK_NOT_M1(ret);
+		CHECK_ASSERT(ret>0);
+		buf+=ret;
+		len-=ret;
+	}
+}
+
+// anything that is a pair of file descriptors per direction
+struct FdMechanism : public Mechanism {
+	int parent_rd=-1, parent_wr=-1, child_rd=-1, child_wr=-1;
+	~FdMechanism() {
+		int fds[]={parent_rd, parent_wr, child_rd, child_wr};
+		for(unsigned int i=0; i<4; i++) {
+			bool seen=false;
+			for(unsigned int j=0; j<i; j++) {
+				seen|=fds[j]==fds[i];
+			}
+			if(fds[i]!=-1 && !seen) {
+				CHECK_NOT_M1(close(fds[i]));
+			}
+		}
+	}
+	void setup(bool parent) {
+		if(spin) {
+			set_nonblock(parent?parent_rd:child_rd);
+		}
+	}
+	void send(bool parent, const char* buf, size_t len) {
+		write_all(parent?parent_wr:child_wr, buf, len);
+	}
+	void recv(bool parent, char* buf, size_t len) {
+		read_all(parent?parent_rd:child_rd, buf, len);
+	}
+};
+
+struct PipeMechanism : public FdMechanism {
+	PipeMechanism() {
+		int to_child[2], to_parent[2];
+		CHECK_NOT_M1(pipe(to_child));
+		CHECK_NOT_M1(pipe(to_parent));
+		child_rd=to_child[0];
+		parent_wr=to_child[1];
+		parent_rd=to_parent[0];
+		child_wr=to_parent[1];
+	}
+	const char* name() {
+		return "pipe";
+	}
+};
+
+struct FifoMechanism : public FdMechanism {
+	const char* to_child="/tmp/ipc_latency_to_child";
+	const char* to_parent="/tmp/ipc_latency_to_parent";
+	FifoMechanism() {
+		unlink(to_child);
+		unlink(to_parent);
+		CHECK_NOT_M1(mkfifo(to_child, 0600));
+		CHECK_NOT_M1(mkfifo(to_parent, 0600));
+	}
+	const char* name() {
+		return "fifo";
+	}
+	void setup(bool parent) {
+		// O_RDWR so that the open does not wait for the other side
+		int a=CHECK_NOT_M1(open(to_child, O_RDWR));
+		int b=CHECK_NOT_M1(open(to_parent, O_RDWR));
+		parent_wr=child_rd=a;
+		parent_rd=child_wr=b;
+		FdMechanism::setup(parent);
+	}
+	void cleanup() {
+		CHECK_NOT_M1(unlink(to_child));
+		CHECK_NOT_M1(unlink(to_parent));
+	}
+};
+
+struct UnixMechanism : public FdMechanism {
+	UnixMechanism() {
+		int sv[2];
+		CHECK_NOT_M1(socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+		parent_rd=parent_wr=sv[0];
+		child_rd=child_wr=sv[1];
+	}
+	const char* name() {
+		return "unix";
+	}
+};
+
+struct TcpMechanism : public FdMechanism {
+	TcpMechanism() {
+		int lfd=CHECK_NOT_M1(socket(AF_INET, SOCK_STREAM, 0));
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family=AF_INET;
+		addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+		addr.sin_port=0;
+		CHECK_NOT_M1(bind(lfd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)));
+		CHECK_NOT_M1(listen(lfd, 1));
+		socklen_t addrlen=sizeof(addr);
+		CHECK_NOT_M1(getsockname(lfd, reinterpret_cast<struct sockaddr*>(&addr), &addrlen));
+		int cfd=CHECK_NOT_M1(socket(AF_INET, SOCK_STREAM, 0));
+		CHECK_NOT_M1(connect(cfd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)));
+		int afd=CHECK_NOT_M1(accept(lfd, NULL, NULL));
+		CHECK_NOT_M1(close(lfd));
+		int one=1;
+		CHECK_NOT_M1(setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)));
+		CHECK_NOT_M1(setsockopt(afd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)));
+		parent_rd=parent_wr=cfd;
+		child_rd=child_wr=afd;
+	}
+	const char* name() {
+		return "tcp";
+	}
+};
+
+static size_t read_proc_size(const char* path) {
+	FILE* f=CHECK_NOT_NULL_FILEP(fopen(path, "r"));
+	size_t v;
+	CHECK_ASSERT(fscanf(f, "%zu", &v)==1);
+	CHECK_NOT_M1(fclose(f));
+	return v;
+}
+
+struct PosixMqMechanism : public Mechanism {
+	const char* to_child="/ipc_latency_to_child";
+	const char* to_parent="/ipc_latency_to_parent";
+	size_t msgsize;
+	mqd_t rd, wr;
+	explicit PosixMqMechanism(size_t max) {
+		msgsize=read_proc_size("/proc/sys/fs/mqueue/msgsize_max");
+		if(max<msgsize) {
+			msgsize=max;
+		}
+		struct mq_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.mq_maxmsg=1;
+		attr.mq_msgsize=msgsize;
+		mq_unlink(to_child);
+		mq_unlink(to_parent);
+		CHECK_NOT_M1(mq_close(CHECK_NOT_M1(mq_open(to_child, O_CREAT|O_RDWR, 0600, &attr))));
+		CHECK_NOT_M1(mq_close(CHECK_NOT_M1(mq_open(to_parent, O_CREAT|O_RDWR, 0600, &attr))));
+	}
+	const char* name() {
+		return "posix_mq";
+	}
+	size_t max_size() {
+		return msgsize;
+	}
+	void setup(bool parent) {
+		int flags=spin?O_NONBLOCK:0;
+		rd=CHECK_NOT_M1(mq_open(parent?to_parent:to_child, O_RDONLY|flags));
+		wr=CHECK_NOT_M1(mq_open(parent?to_child:to_parent, O_WRONLY));
+	}
+	void send(bool parent __attribute__((unused)), const char* buf, size_t len) {
+		CHECK_NOT_M1(mq_send(wr, buf, len, 0));
+	}
+	void recv(bool parent __attribute__((unused)), char* buf, size_t len) {
+		while(true) {
+			ssize_t ret=mq_receive(rd, buf, msgsize, NULL);
+			if(ret==-1 && errno==EAGAIN) {
+				continue;
+			}
+			CHECK_NOT_M1(ret);
+			CHECK_ASSERT((size_t)ret==len);
+			return;
+		}
+	}
+	void cleanup() {
+		CHECK_NOT_M1(mq_unlink(to_child));
+		CHECK_NOT_M1(mq_unlink(to_parent));
+	}
+};
+
+struct SysvMqMechanism : public Mechanism {
+	int id;
+	size_t msgmax;
+	vector<char> msg;
+	SysvMqMechanism() {
+		msgmax=read_proc_size("/proc/sys/kernel/msgmax");
+		msg.resize(sizeof(long)+msgmax);
+		id=CHECK_NOT_M1(msgget(IPC_PRIVATE, IPC_CREAT|0600));
+	}
+	const char* name() {
+		return "sysv_mq";
+	}
+	size_t max_size() {
+		return msgmax;
+	}
+	void send(bool parent, const char* buf, size_t len) {
+		long type=parent?1:2;
+		memcpy(msg.data(), &type, sizeof(type));
+		memcpy(msg.data()+sizeof(long), buf, len);
+		CHECK_NOT_M1(msgsnd(id, msg.data(), len, 0));
+	}
+	void recv(bool parent, char* buf, size_t len) {
+		while(true) {
+			ssize_t ret=msgrcv(id, msg.data(), msgmax, parent?2:1, spin?IPC_NOWAIT:0);
+			if(ret==-1 && errno==ENOMSG) {
+				continue;
+			}
+			CHECK_NOT_M1(ret);
+			CHECK_ASSERT((size_t)ret==len);
+			memcpy(buf, msg.data()+sizeof(long), len);
+			return;
+		}
+	}
+	void cleanup() {
+		CHECK_NOT_M1(msgctl(id, IPC_RMID, NULL));
+	}
+};
+
+struct EventfdMechanism : public FdMechanism {
+	EventfdMechanism() {
+		parent_wr=child_rd=CHECK_NOT_M1(eventfd(0, 0));
+		child_wr=parent_rd=CHECK_NOT_M1(eventfd(0, 0));
+	}
+	const char* name() {
+		return "eventfd";
+	}
+	size_t fixed_size() {
+		return sizeof(uint64_t);
+	}
+	void send(bool parent, const char* buf, size_t len) {
+		// an eventfd counter must not be 0
+		uint64_t v;
+		memcpy(&v, buf, len);
+		v|=1;
+		write_all(parent?parent_wr:child_wr, reinterpret_cast<char*>(&v), sizeof(v));
+	}
+};
+
+struct SignalMechanism : public Mechanism {
+	pid_t peer;
+	int sig;
+	sigset_t set;
+	SignalMechanism() {
+		sig=SIGRTMIN;
+		sigemptyset(&set);
+		sigaddset(&set, sig);
+		// blocked before the fork so the child can not miss the first one
+		CHECK_NOT_M1(sigprocmask(SIG_BLOCK, &set, NULL));
+	}
+	~SignalMechanism() {
+		CHECK_NOT_M1(sigprocmask(SIG_UNBLOCK, &set, NULL));
+	}
+	const char* name() {
+		return "signal";
+	}
+	size_t fixed_size() {
+		return sizeof(int);
+	}
+	void setup(bool parent) {
+		if(!parent) {
+			peer=getppid();
+		}
+	}
+	void send(bool parent __attribute__((unused)), const char* buf, size_t len) {
+		union sigval v;
+		v.sival_int=0;
+		memcpy(&v.sival_int, buf, len);
+		CHECK_NOT_M1(sigqueue(peer, sig, v));
+	}
+	void recv(bool parent __attribute__((unused)), char* buf, size_t len) {
+		siginfo_t si;
+		struct timespec zero={0, 0};
+		while(true) {
+			int ret=spin?sigtimedwait(&set, &si, &zero):sigwaitinfo(&set, &si);
+			if(ret==-1 && (errno==EAGAIN || errno==EINTR)) {
+				continue;
+			}
+			CHECK_NOT_M1(ret);
+			memcpy(buf, &si.si_value.sival_int, len);
+			return;
+		}
+	}
+};
+
+struct ShmMechanism : public Mechanism {
+	const char* to_child="/ipc_latency_shm_to_child";
+	const char* to_parent="/ipc_latency_shm_to_parent";
+	ShmRing* down;
+	ShmRing* up;
+	explicit ShmMechanism(size_t max) {
+		size_t capacity=1<<16;
+		while(capacity/2<max+64) {
+			capacity*=2;
+		}
+		// spinning means never sleeping on the futex
+		unsigned int spins=spin?UINT_MAX:0;
+		down=ShmRing::create(to_child, capacity, spins);
+		up=ShmRing::create(to_parent, capacity, spins);
+	}
+	~ShmMechanism() {
+		delete down;
+		delete up;
+	}
+	const char* name() {
+		return "shm";
+	}
+	void setup(bool parent) {
+		CHECK_ASSERT((parent?down:up)->attach_producer());
+		CHECK_ASSERT((parent?up:down)->attach_consumer());
+	}
+	void send(bool parent, const char* buf, size_t len) {
+		CHECK_ASSERT((parent?down:up)->send(buf, len)==shm_ring_ok);
+	}
+	void recv(bool parent, char* buf, size_t len) {
+		ShmRing* r=parent?up:down;
+		const char* p;
+		uint32_t got;
+		CHECK_ASSERT(r->receive(&p, &got)==shm_ring_ok && got==len);
+		memcpy(buf, p, len);
+		r->release();
+	}
+	void cleanup() {
+		ShmRing::unlink(to_child);
+		ShmRing::unlink(to_parent);
+	}
+};
+
+static void pin(int cpu) {
+	if(cpu<0) {
+		return;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	CHECK_NOT_M1(sched_setaffinity(0, sizeof(set), &set));
+}
+
+static void run(Mechanism* m, const vector<size_t>& all_sizes, unsigned int count, int cpu_parent, int cpu_child, bool hdr) {
+	vector<size_t> sizes;
+	if(m->fixed_size()) {
+		sizes.push_back(m->fixed_size());
+	} else {
+		for(size_t s : all_sizes) {
+			if(m->max_size()==0 || s<=m->max_size()) {
+				sizes.push_back(s);
+			}
+		}
+	}
+	size_t max=0;
+	for(size_t s : sizes) {
+		max=s>max?s:max;
+	}
+	vector<char> buf(max);
+	// a few round trips that are not measured to get everything warm
+	const unsigned int warmup=count/10+1;
+	pid_t pid=CHECK_NOT_M1(fork());
+	if(pid==0) {
+		pin(cpu_child);
+		m->setup(false);
+		for(size_t s : sizes) {
+			for(unsigned int i=0; i<count+warmup; i++) {
+				m->recv(false, buf.data(), s);
+				m->send(false, buf.data(), s);
+			}
+		}
+		_exit(EXIT_SUCCESS);
+	}
+	pin(cpu_parent);
+	m->setup(true);
+	if(SignalMechanism* sm=dynamic_cast<SignalMechanism*>(m)) {
+		sm->peer=pid;
+	}
+	for(size_t s : sizes) {
+		for(unsigned int i=0; i<warmup; i++) {
+			m->send(true, buf.data(), s);
+			m->recv(true, buf.data(), s);
+		}
+		LatencyHistogram h;
+		uint64_t start=latency_now();
+		for(unsigned int i=0; i<count; i++) {
+			uint64_t t0=latency_now();
+			m->send(true, buf.data(), s);
+			m->recv(true, buf.data(), s);
+			h.record(latency_now()-t0);
+		}
+		double elapsed=(latency_now()-start)/1e9;
+		char name[64];
+		snprintf(name, sizeof(name), "%s/%zu", m->name(), s);
+		h.print_summary(name);
+		printf("%s: throughput=%.0lf rtt/s %.1lf MB/s\n", name, count/elapsed, 2.0*s*count/elapsed/1e6);
+		if(hdr) {
+			h.print_hdr(stdout, 1000.0);
+		}
+	}
+	int status;
+	CHECK_NOT_M1(waitpid(pid, &status, 0));
+	CHECK_ASSERT(WIFEXITED(status) && WEXITSTATUS(status)==EXIT_SUCCESS);
+	m->cleanup();
+	delete m;
+}
+
+int main(int argc, char** argv) {
+	vector<size_t> sizes={64, 1024, 8192};
+	unsigned int count=20000;
+	int cpu_parent=0;
+	int cpu_child=sysconf(_SC_NPROCESSORS_ONLN)>1?1:0;
+	string only;
+	bool hdr=false;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"sizes", required_argument, 0, 0},
+			{"count", required_argument, 0, 1},
+			{"wait", required_argument, 0, 2},
+			{"cpus", required_argument, 0, 3},
+			{"only", required_argument, 0, 4},
+			{"hdr", no_argument, 0, 5},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			sizes.clear();
+			for(char* tok=strtok(optarg, ","); tok; tok=strtok(NULL, ",")) {
+				sizes.push_back(strtoul(tok, NULL, 0));
+			}
+			break;
+		case 1:
+			count=atoi(optarg);
+			break;
+		case 2:
+			if(strcmp(optarg, "spin")==0) {
+				spin=true;
+			} else if(strcmp(optarg, "block")!=0) {
+				fprintf(stderr, "%s: wait is block or spin\n", argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 3:
+			// -1 means do not pin
+			CHECK_ASSERT(sscanf(optarg, "%d,%d", &cpu_parent, &cpu_child)==2);
+			break;
+		case 4:
+			only=","+string(optarg)+",";
+			break;
+		case 5:
+			hdr=true;
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--sizes=64,1024,...] [--count=N] [--wait=block|spin] [--cpus=parent,child] [--only=pipe,shm,...] [--hdr]\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(spin && cpu_parent==cpu_child) {
+		fprintf(stderr, "%s: warning: spinning with both processes on cpu %d, expect milliseconds\n", argv[0], cpu_parent);
+	}
+	size_t max=0;
+	for(size_t s : sizes) {
+		max=s>max?s:max;
+	}
+	printf("wait=%s cpus=%d,%d count=%u\n", spin?"spin":"block", cpu_parent, cpu_child, count);
+	vector<Mechanism*> all={
+		new PipeMechanism(),
+		new FifoMechanism(),
+		new UnixMechanism(),
+		new TcpMechanism(),
+		new PosixMqMechanism(max),
+		new SysvMqMechanism(),
+		new EventfdMechanism(),
+		new SignalMechanism(),
+		new ShmMechanism(max),
+	};
+	for(Mechanism* m : all) {
+		if(only.empty() || only.find(","+string(m->name())+",")!=string::npos) {
+			run(m, sizes, count, cpu_parent, cpu_child, hdr);
+		} else {
+			m->cleanup();
+			delete m;
+		}
+	}
+	return EXIT_SUCCESS;
+}
@@ -54,10 +54,10 @@
  *	like that.
  *
  * TODO:
- * - add three more test cases: open(2), write(2), close(2) with
- *	- standard flags.
- *	- O_ASYNC
- *	- O_SYNC
+ * - add a test case of open(2), write(2), close(2) with standard flags.
+ *	O_SYNC, O_DSYNC and the other ways to make writes durable are in
+ *	io/write_durability.cc. O_ASYNC is signal driven I/O for terminals,
+ *	pipes and sockets and does nothing for regular files.
  * - add another test with syslog which writes to a sysfs file instead.
  * - add another test case of asynchroneous syslog (damn it! how do I configure that?!?).
  * - explain the results in the text above.
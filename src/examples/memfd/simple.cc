@@ -25,6 +25,11 @@
 #include <fcntl.h>
 #include <err_utils.h>
 
+/*
+ * A minimal memfd demo. See include/fd_ipc.hh for memfds that are sealed and
+ * passed between processes to move large buffers without copying them.
+ */
+
 int main() {
 	const char *name = "example_memfd";
 	const char *data = "Hello, memfd!";
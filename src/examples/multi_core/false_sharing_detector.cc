@@ -0,0 +1,446 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <stdio.h>	// for printf(3), fprintf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3), atof(3), strtoul(3), strtoull(3)
+#include <string.h>	// for memset(3), strerror(3)
+#include <errno.h>	// for errno
+#include <unistd.h>	// for syscall(2), sysconf(3), read(2), close(2)
+#include <sys/syscall.h>// for SYS_perf_event_open
+#include <sys/ioctl.h>	// for ioctl(2)
+#include <sys/mman.h>	// for mmap(2), munmap(2)
+#include <linux/perf_event.h>	// for struct perf_event_attr, PERF_* constants
+#include <pthread.h>	// for pthread_create(3), pthread_join(3)
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <stdint.h>	// for uint64_t
+#include <atomic>	// for atomic
+#include <map>	// for map
+#include <vector>	// for vector
+#include <algorithm>	// for sort
+#include <err_utils.h>	// for CHECK_ZERO_ERRNO(), CHECK_NOT_M1(), CHECK_NOT_VOIDP(), CHECK_INT(), CHECK_ASSERT()
+#include <cache_line_utils.hh>	// for cache_padded, per_thread_array, sharded_counter, cache_line_size(), cache_line_check()
+#include <LatencyHistogram.hh>	// for latency_now()
+
+using namespace std;
+
+/*
+ * A false sharing detector.
+ *
+ * This runs the typical ways of keeping per thread statistics, each with all
+ * threads hammering their counters, and measures every workload with
+ * hardware performance counters via perf_event_open(2):
+ * - cache misses (PERF_COUNT_HW_CACHE_MISSES)
+ * - L1 data cache read misses
+ * - optionally a raw HITM event (--hitm=[raw event]). HITM ("hit modified")
+ *	means that a load found the line modified in ANOTHER core's cache, which is
+ *	exactly what false sharing produces. There is no generic perf event for it,
+ *	the raw encoding depends on the CPU model, e.g. on Skylake it is
+ *	MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM=0x04d2 ('perf list' shows it).
+ * A workload with more than [threshold] misses per operation is flagged.
+ *
+ * The sampling mode (--sample=[raw event]) goes further and finds the hot
+ * lines themselves: it samples the data addresses of a precise memory event
+ * (PERF_SAMPLE_ADDR) in every worker thread, groups them by cache line and
+ * prints the hottest lines with the object and offset they belong to.
+ * Lines touched by more than one thread are flagged as false sharing
+ * candidates. Use a precise load event which records addresses, for example
+ * the HITM event above or MEM_INST_RETIRED.ALL_STORES.
+ *
+ * The workloads:
+ * packed - uint64_t counters[threads], the classic stats struct.
+ * padded - cache_padded<uint64_t> counters[threads].
+ * per_thread_array - per_thread_array<uint64_t> with the run time line size.
+ * sharded - one logical sharded_counter incremented by all threads.
+ * shared_atomic - one atomic counter incremented by all threads (true sharing,
+ *	for comparison).
+ *
+ * If the machine (or VM) does not expose hardware counters, or
+ * /proc/sys/kernel/perf_event_paranoid forbids them, only times are shown.
+ *
+ * Notes:
+ * - the threads are not pinned. Pin the process with taskset(1) to see the
+ *	effect of placement.
+ * - to hunt false sharing in your own structs, run your workload in place of
+ *	the ones here. The sampling code does not care what the threads do.
+ *
+ * EXTRA_LINK_FLAGS_AFTER=-lpthread
+ */
+
+static const unsigned int max_threads=256;
+
+static uint64_t packed[max_threads];
+static cache_padded<uint64_t> padded[max_threads];
+static per_thread_array<uint64_t>* pta;
+static sharded_counter* sharded;
+static atomic<uint64_t> shared_atomic;
+
+typedef enum _workload_type{
+	WORK_PACKED,
+	WORK_PADDED,
+	WORK_PER_THREAD_ARRAY,
+	WORK_SHARDED,
+	WORK_SHARED_ATOMIC,
+	WORK_NUM,
+} workload_type;
+
+static const char* workload_names[]={
+	"packed",
+	"padded",
+	"per_thread_array",
+	"sharded",
+	"shared_atomic",
+};
+
+static long perf_event_open(struct perf_event_attr* attr, pid_t pid, int cpu, int group_fd, unsigned long flags) {
+	return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+/*
+ * Counting
+ */
+typedef struct _counter_def{
+	const char* name;
+	uint32_t type;
+	uint64_t config;
+} counter_def;
+
+static vector<counter_def> counter_defs;
+
+/*
+ * open a counting event for this process and all threads created after it
+ * returns -1 if the counter is not supported
+ */
+static int counter_open(const counter_def& def) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size=sizeof(attr);
+	attr.type=def.type;
+	attr.config=def.config;
+	attr.disabled=1;
+	attr.inherit=1;
+	attr.exclude_kernel=1;
+	attr.exclude_hv=1;
+	return perf_event_open(&attr, 0, -1, -1, 0);
+}
+
+/*
+ * Sampling
+ */
+static uint64_t sample_config;
+static uint64_t sample_period;
+static const unsigned int sample_pages=64;
+
+// cache line address -> (samples, bitmask of threads which touched it)
+typedef struct _line_info{
+	uint64_t samples;
+	uint64_t threads;
+} line_info;
+
+static map<uint64_t, line_info> hot_lines;
+static pthread_mutex_t hot_lines_mutex=PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct _sampler{
+	int fd;
+	void* ring;
+	size_t ring_size;
+} sampler;
+
+static bool sampler_open(sampler* s) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size=sizeof(attr);
+	attr.type=PERF_TYPE_RAW;
+	attr.config=sample_config;
+	attr.sample_period=sample_period;
+	attr.sample_type=PERF_SAMPLE_ADDR;
+	attr.precise_ip=2;
+	attr.disabled=1;
+	attr.exclude_kernel=1;
+	attr.exclude_hv=1;
+	// this thread only
+	s->fd=perf_event_open(&attr, 0, -1, -1, 0);
+	if(s->fd==-1) {
+		return false;
+	}
+	s->ring_size=(sample_pages+1)*getpagesize();
+	s->ring=CHECK_NOT_VOIDP(mmap(NULL, s->ring_size, PROT_READ|PROT_WRITE, MAP_SHARED, s->fd, 0), MAP_FAILED);
+	CHECK_NOT_M1(ioctl(s->fd, PERF_EVENT_IOC_RESET, 0));
+	CHECK_NOT_M1(ioctl(s->fd, PERF_EVENT_IOC_ENABLE, 0));
+	return true;
+}
+
+/*
+ * stop sampling and fold the samples of the ring buffer into hot_lines
+ */
+static void sampler_close(sampler* s, unsigned int thread_id) {
+	CHECK_NOT_M1(ioctl(s->fd, PERF_EVENT_IOC_DISABLE, 0));
+	struct perf_event_mmap_page* meta=static_cast<struct perf_event_mmap_page*>(s->ring);
+	char* data=static_cast<char*>(s->ring)+getpagesize();
+	const uint64_t data_size=sample_pages*getpagesize();
+	uint64_t head=__atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+	uint64_t tail=meta->data_tail;
+	const uint64_t line_mask=~((uint64_t)cache_line_size()-1);
+	map<uint64_t, uint64_t> local;
+	while(tail<head) {
+		struct perf_event_header hdr;
+		for(unsigned int i=0; i<sizeof(hdr); i++) {
+			reinterpret_cast<char*>(&hdr)[i]=data[(tail+i)%data_size];
+		}
+		if(hdr.type==PERF_RECORD_SAMPLE) {
+			uint64_t addr;
+			for(unsigned int i=0; i<sizeof(addr); i++) {
+				reinterpret_cast<char*>(&addr)[i]=data[(tail+sizeof(hdr)+i)%data_size];
+			}
+			if(addr!=0) {
+				local[addr & line_mask]++;
+			}
+		}
+		tail+=hdr.size;
+	}
+	__atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+	CHECK_NOT_M1(munmap(s->ring, s->ring_size));
+	CHECK_NOT_M1(close(s->fd));
+	CHECK_ZERO_ERRNO(pthread_mutex_lock(&hot_lines_mutex));
+	for(auto& p : local) {
+		line_info& li=hot_lines[p.first];
+		li.samples+=p.second;
+		li.threads|=1ULL<<(thread_id%64);
+	}
+	CHECK_ZERO_ERRNO(pthread_mutex_unlock(&hot_lines_mutex));
+}
+
+/*
+ * name the object an address belongs to
+ */
+static void describe_address(uint64_t addr, char* buf, size_t len) {
+	typedef struct _range{
+		const char* name;
+		uint64_t start;
+		uint64_t size;
+	} range;
+	const range ranges[]={
+		{"packed", (uint64_t)packed, sizeof(packed)},
+		{"padded", (uint64_t)padded, sizeof(padded)},
+		{"per_thread_array", (uint64_t)&(*pta)[0], (uint64_t)pta->get_stride()*pta->size()},
+		{"shared_atomic", (uint64_t)&shared_atomic, sizeof(shared_atomic)},
+	};
+	for(const range& r : ranges) {
+		if(addr>=r.start && addr<r.start+r.size) {
+			snprintf(buf, len, "%s+%lu", r.name, addr-r.start);
+			return;
+		}
+	}
+	snprintf(buf, len, "unknown");
+}
+
+/*
+ * The workloads
+ */
+typedef struct _thread_data{
+	unsigned int id;
+	workload_type type;
+	unsigned long iterations;
+} thread_data;
+
+static void* worker(void* p) {
+	thread_data* td=static_cast<thread_data*>(p);
+	sampler s;
+	bool sampling=sample_config!=0 && sampler_open(&s);
+	// volatile so that the compiler really writes the counter on every iteration
+	volatile uint64_t* counter=NULL;
+	switch(td->type) {
+	case WORK_PACKED:
+		counter=packed+td->id;
+		break;
+	case WORK_PADDED:
+		counter=&padded[td->id].value;
+		break;
+	case WORK_PER_THREAD_ARRAY:
+		counter=&(*pta)[td->id];
+		break;
+	default:
+		break;
+	}
+	switch(td->type) {
+	case WORK_PACKED:
+	case WORK_PADDED:
+	case WORK_PER_THREAD_ARRAY:
+		for(unsigned long i=0; i<td->iterations; i++) {
+			*counter=*counter+1;
+		}
+		break;
+	case WORK_SHARDED:
+		for(unsigned long i=0; i<td->iterations; i++) {
+			sharded->inc();
+		}
+		break;
+	case WORK_SHARED_ATOMIC:
+		for(unsigned long i=0; i<td->iterations; i++) {
+			shared_atomic.fetch_add(1, memory_order_relaxed);
+		}
+		break;
+	case WORK_NUM:
+		break;
+	}
+	if(sampling) {
+		sampler_close(&s, td->id);
+	}
+	return NULL;
+}
+
+static void run(workload_type type, unsigned int thread_num, unsigned long iterations, double threshold) {
+	vector<int> fds;
+	for(const counter_def& def : counter_defs) {
+		int fd=counter_open(def);
+		fds.push_back(fd);
+		if(fd!=-1) {
+			CHECK_NOT_M1(ioctl(fd, PERF_EVENT_IOC_RESET, 0));
+			CHECK_NOT_M1(ioctl(fd, PERF_EVENT_IOC_ENABLE, 0));
+		}
+	}
+	pthread_t* threads=new pthread_t[thread_num];
+	thread_data* tds=new thread_data[thread_num];
+	uint64_t start=latency_now();
+	for(unsigned int i=0; i<thread_num; i++) {
+		tds[i].id=i;
+		tds[i].type=type;
+		tds[i].iterations=iterations;
+		CHECK_ZERO_ERRNO(pthread_create(threads+i, NULL, worker, tds+i));
+	}
+	for(unsigned int i=0; i<thread_num; i++) {
+		CHECK_ZERO_ERRNO(pthread_join(threads[i], NULL));
+	}
+	uint64_t end=latency_now();
+	const double ops=(double)iterations*thread_num;
+	printf("%s: threads=%u ns/op=%.2lf", workload_names[type], thread_num, (end-start)/ops);
+	bool suspect=false;
+	for(unsigned int i=0; i<fds.size(); i++) {
+		if(fds[i]==-1) {
+			printf(" %s=n/a", counter_defs[i].name);
+			continue;
+		}
+		CHECK_NOT_M1(ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0));
+		uint64_t val;
+		CHECK_INT(read(fds[i], &val, sizeof(val)), sizeof(val));
+		CHECK_NOT_M1(close(fds[i]));
+		double per_op=val/ops;
+		printf(" %s/op=%.4lf", counter_defs[i].name, per_op);
+		if(per_op>threshold) {
+			suspect=true;
+		}
+	}
+	printf("%s\n", suspect ? " <== SUSPECT: cache lines are bouncing between cores" : "");
+	delete[] threads;
+	delete[] tds;
+}
+
+static void print_hot_lines(unsigned int top) {
+	vector<pair<uint64_t, line_info>> lines(hot_lines.begin(), hot_lines.end());
+	sort(lines.begin(), lines.end(), [](const pair<uint64_t, line_info>& a, const pair<uint64_t, line_info>& b) {
+		return a.second.samples>b.second.samples;
+	});
+	printf("hot cache lines (line size %u):\n", cache_line_size());
+	for(unsigned int i=0; i<lines.size() && i<top; i++) {
+		char desc[256];
+		describe_address(lines[i].first, desc, sizeof(desc));
+		unsigned int thread_count=__builtin_popcountll(lines[i].second.threads);
+		printf("  0x%lx %-24s samples=%lu threads=%u%s\n", lines[i].first, desc, lines[i].second.samples, thread_count, thread_count>1 ? " <== FALSE SHARING CANDIDATE" : "");
+	}
+}
+
+int main(int argc, char** argv) {
+	unsigned int thread_num=CHECK_NOT_M1(sysconf(_SC_NPROCESSORS_ONLN));
+	unsigned long iterations=10000000;
+	uint64_t hitm_config=0;
+	double threshold=0.01;
+	sample_period=1000;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"threads", required_argument, 0, 0},
+			{"iterations", required_argument, 0, 1},
+			{"hitm", required_argument, 0, 2},
+			{"sample", required_argument, 0, 3},
+			{"period", required_argument, 0, 4},
+			{"threshold", required_argument, 0, 5},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			thread_num=atoi(optarg);
+			break;
+		case 1:
+			iterations=strtoul(optarg, NULL, 0);
+			break;
+		case 2:
+			hitm_config=strtoull(optarg, NULL, 0);
+			break;
+		case 3:
+			sample_config=strtoull(optarg, NULL, 0);
+			break;
+		case 4:
+			sample_period=strtoull(optarg, NULL, 0);
+			break;
+		case 5:
+			threshold=atof(optarg);
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--threads=N] [--iterations=N] [--hitm=raw_event] [--sample=raw_event] [--period=N] [--threshold=misses_per_op]\n", argv[0], argv[0]);
+			fprintf(stderr, "%s: example (Skylake): %s --hitm=0x04d2 --sample=0x04d2\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(thread_num<2) {
+		thread_num=2;
+	}
+	CHECK_ASSERT(thread_num<=max_threads);
+	cache_line_check();
+	counter_defs.push_back({"cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES});
+	counter_defs.push_back({"l1d_read_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ<<8) | (PERF_COUNT_HW_CACHE_RESULT_MISS<<16)});
+	if(hitm_config) {
+		counter_defs.push_back({"hitm", PERF_TYPE_RAW, hitm_config});
+	}
+	int probe=counter_open(counter_defs[0]);
+	if(probe==-1) {
+		fprintf(stderr, "%s: hardware counters not available (%s), showing times only\n", argv[0], strerror(errno));
+		fprintf(stderr, "%s: check /proc/sys/kernel/perf_event_paranoid and that the machine exposes a PMU\n", argv[0]);
+	} else {
+		CHECK_NOT_M1(close(probe));
+	}
+	pta=new per_thread_array<uint64_t>(thread_num);
+	sharded=new sharded_counter();
+	printf("cache line size: compiled %d, run time %u\n", CACHE_LINE_SIZE, cache_line_size());
+	for(unsigned int t=0; t<WORK_NUM; t++) {
+		run((workload_type)t, thread_num, iterations, threshold);
+	}
+	CHECK_ASSERT(sharded->read()==iterations*thread_num);
+	if(sample_config) {
+		if(hot_lines.empty()) {
+			fprintf(stderr, "%s: no samples collected, is the sample event supported and precise?\n", argv[0]);
+		} else {
+			print_hot_lines(10);
+		}
+	}
+	delete pta;
+	delete sharded;
+	return EXIT_SUCCESS;
+}
@@ -40,6 +40,8 @@
  * - notice the rule setting up at the begining so that we could get
  * all the packets into user space.
  *
+ * See nfqueue_batch.cc for a multi queue version with batched verdicts.
+ *
  * References:
  * http://gitorious.org/meshias/mainline/blobs/db36f92bfcbdb78631aaf7f03c1ed1c156f8c218/examples/nfqueue.c
  *
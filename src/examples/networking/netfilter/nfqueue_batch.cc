@@ -0,0 +1,358 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <stdint.h>	// for uint32_t, uint16_t, uint8_t
+#include <signal.h>	// for SIGINT, SIGTERM
+#include <arpa/inet.h>	// for ntohl(3), ntohs(3), inet_pton(3)
+#include <netinet/in.h>	// for IPPROTO_UDP, IPPROTO_TCP
+#include <netinet/ip.h>	// for struct iphdr
+#include <sys/socket.h>	// for recv(2), setsockopt(2)
+#include <sys/resource.h>	// for getrusage(2), RUSAGE_THREAD
+#include <linux/netlink.h>	// for NETLINK_NO_ENOBUFS, SOL_NETLINK
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3)
+#include <stdio.h>	// for printf(3), fprintf(3), fopen(3), fgets(3)
+#include <string.h>	// for strcmp(3)
+#include <errno.h>	// for errno, EINTR, EAGAIN, ENOBUFS
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <unistd.h>	// for usleep(3), pause(2)
+#include <pthread.h>	// for pthread_create(3), pthread_join(3)
+#include <libnetfilter_queue/libnetfilter_queue.h>	// for nfq_*()
+#include <linux/netfilter.h>	// for NF_ACCEPT, NF_DROP
+#include <err_utils.h>	// for CHECK_NOT_NULL(), CHECK_NOT_NEGATIVE(), CHECK_NOT_M1(), CHECK_ZERO_ERRNO(), CHECK_NOT_NULL_FILEP()
+#include <security_utils.h>	// for check_root()
+#include <multiproc_utils.h>	// for my_system()
+#include <signal_utils.h>	// for signal_register_handler_sigaction()
+#include <LatencyHistogram.hh>	// for latency_now()
+#include <unordered_set>	// for unordered_set<T>
+#include <vector>	// for vector<T>
+
+using namespace std;
+
+/*
+ * A high throughput version of nfqueue.cc.
+ *
+ * nfqueue.cc sends one verdict message per packet and handles one queue.
+ * Here:
+ * - the iptables rule uses '--queue-balance 0:N-1' so that the kernel
+ * spreads flows over N queues and each queue gets its own netlink socket
+ * and worker thread.
+ * - accepted packets are not answered one by one. A single
+ * nfq_set_verdict_batch() after every recv(2) buffer accepts every packet
+ * with an id up to the last one seen. Only dropped packets get their own
+ * verdict, and they get it right away so that the batch does not cover
+ * them.
+ * - NFQA_CFG_F_FAIL_OPEN makes the kernel accept packets when the queue is
+ * full instead of dropping them, the right thing for a monitor that should
+ * not take the machine off the network when it falls behind.
+ * - the netlink receive buffer is enlarged and NETLINK_NO_ENOBUFS set so
+ * that a burst does not kill the socket with ENOBUFS.
+ * - a tiny rule engine: a hash set of blocked 5-tuples read from a file
+ * with lines of the form "udp 127.0.0.1 0 127.0.0.1 9000" (a source port
+ * of 0 matches any source port).
+ *
+ * How to measure, as root:
+ *	nfqueue_batch --queues=1 --port=9000 --seconds=10 &
+ *	for i in 1 2 3 4; do ../udp/send_batch --port=9000 --count=2000000 --size=64 & done
+ * and repeat with --queues=2 and --queues=4. '--queue-balance' hashes on
+ * the flow so one sender only ever feeds one queue, which is why several
+ * senders are used. Compare with --batch=0 which gives a verdict per
+ * packet like nfqueue.cc. The per queue kernel counters (queue_dropped,
+ * user_dropped) are printed at the end from
+ * /proc/net/netfilter/nfnetlink_queue.
+ *
+ * EXTRA_COMPILE_CMD=pkg-config --cflags libnetfilter_queue
+ * EXTRA_LINK_CMD=pkg-config --libs libnetfilter_queue
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ * EXTRA_LINK_FLAGS_AFTER=-lpthread
+ */
+
+struct FiveTuple {
+	uint32_t saddr;
+	uint32_t daddr;
+	uint16_t sport;
+	uint16_t dport;
+	uint8_t proto;
+	bool operator==(const FiveTuple& o) const {
+		return saddr==o.saddr && daddr==o.daddr && sport==o.sport && dport==o.dport && proto==o.proto;
+	}
+};
+
+struct FiveTupleHash {
+	size_t operator()(const FiveTuple& t) const {
+		uint64_t h=((uint64_t)t.saddr<<32|t.daddr)*0x9e3779b97f4a7c15ULL;
+		h^=((uint64_t)t.sport<<24|(uint64_t)t.dport<<8|t.proto)*0xc2b2ae3d27d4eb4fULL;
+		return h^(h>>29);
+	}
+};
+
+// filled before the workers start and only read afterwards
+static unordered_set<FiveTuple, FiveTupleHash> blocked;
+
+struct Worker {
+	unsigned int queue_num;
+	bool batch;
+	struct nfq_handle* handle;
+	struct nfq_q_handle* queue;
+	int fd;
+	uint32_t last_id;
+	bool pending;
+	uint64_t packets;
+	uint64_t dropped;
+	uint64_t verdicts;
+	double cpu;
+};
+
+static volatile bool over=false;
+
+static void handler(int sig __attribute__((unused)),
+	// cppcheck-suppress constParameterCallback
+	siginfo_t *si __attribute__((unused)),
+	// cppcheck-suppress constParameterCallback
+	void* unused __attribute__((unused))) {
+	over=true;
+}
+
+static bool is_blocked(const unsigned char* p, int len) {
+	if(blocked.empty() || len<(int)sizeof(struct iphdr)) {
+		return false;
+	}
+	const struct iphdr* ip=reinterpret_cast<const struct iphdr*>(p);
+	FiveTuple t;
+	t.saddr=ip->saddr;
+	t.daddr=ip->daddr;
+	t.proto=ip->protocol;
+	t.sport=0;
+	t.dport=0;
+	int off=ip->ihl*4;
+	if((t.proto==IPPROTO_UDP || t.proto==IPPROTO_TCP) && len>=off+4) {
+		t.sport=ntohs(*reinterpret_cast<const uint16_t*>(p+off));
+		t.dport=ntohs(*reinterpret_cast<const uint16_t*>(p+off+2));
+	}
+	if(blocked.count(t)) {
+		return true;
+	}
+	t.sport=0;
+	return blocked.count(t)>0;
+}
+
+static int manage_packet(struct nfq_q_handle *qh,
+	struct nfgenmsg *nfmsg __attribute__((unused)),
+	struct nfq_data *nfa,
+	void* data) {
+	Worker* w=static_cast<Worker*>(data);
+	struct nfqnl_msg_packet_hdr* ph=nfq_get_msg_packet_hdr(nfa);
+	if(ph==NULL) {
+		return 0;
+	}
+	uint32_t id=ntohl(ph->packet_id);
+	unsigned char* payload;
+	int len=nfq_get_payload(nfa, &payload);
+	w->packets++;
+	if(is_blocked(payload, len)) {
+		w->dropped++;
+		w->verdicts++;
+		return nfq_set_verdict(qh, id, NF_DROP, 0, NULL);
+	}
+	if(!w->batch) {
+		w->verdicts++;
+		return nfq_set_verdict(qh, id, NF_ACCEPT, 0, NULL);
+	}
+	w->last_id=id;
+	w->pending=true;
+	return 0;
+}
+
+static void* worker(void* arg) {
+	Worker* w=static_cast<Worker*>(arg);
+	// one recv(2) carries many packets, with a copy range of 128 bytes
+	// this buffer holds more than a thousand of them
+	const size_t buf_size=256*1024;
+	vector<char> buf(buf_size);
+	while(!over) {
+		int received=recv(w->fd, buf.data(), buf_size, 0);
+		if(received==-1) {
+			if(errno==EINTR || errno==EAGAIN || errno==ENOBUFS) {
+				continue;
+			}
+			CHECK_NOT_M1(received);
+		}
+		CHECK_NOT_NEGATIVE(nfq_handle_packet(w->handle, buf.data(), received));
+		if(w->pending) {
+			CHECK_NOT_NEGATIVE(nfq_set_verdict_batch(w->queue, w->last_id, NF_ACCEPT));
+			w->verdicts++;
+			w->pending=false;
+		}
+	}
+	struct rusage ru;
+	CHECK_NOT_M1(getrusage(RUSAGE_THREAD, &ru));
+	w->cpu=ru.ru_utime.tv_sec+ru.ru_utime.tv_usec/1e6+ru.ru_stime.tv_sec+ru.ru_stime.tv_usec/1e6;
+	return NULL;
+}
+
+static void open_worker(Worker* w, unsigned int queue_maxlen, unsigned int rcvbuf) {
+	w->handle=static_cast<struct nfq_handle *>(CHECK_NOT_NULL(nfq_open()));
+	CHECK_NOT_NEGATIVE(nfq_unbind_pf(w->handle, AF_INET));
+	CHECK_NOT_NEGATIVE(nfq_bind_pf(w->handle, AF_INET));
+	w->queue=static_cast<struct nfq_q_handle *>(CHECK_NOT_NULL(nfq_create_queue(w->handle, w->queue_num, &manage_packet, w)));
+	// the rule engine needs the IP and transport headers only
+	CHECK_NOT_NEGATIVE(nfq_set_mode(w->queue, NFQNL_COPY_PACKET, 128));
+	CHECK_NOT_NEGATIVE(nfq_set_queue_maxlen(w->queue, queue_maxlen));
+	CHECK_NOT_NEGATIVE(nfq_set_queue_flags(w->queue, NFQA_CFG_F_FAIL_OPEN, NFQA_CFG_F_FAIL_OPEN));
+	nfnl_rcvbufsiz(nfq_nfnlh(w->handle), rcvbuf);
+	w->fd=nfq_fd(w->handle);
+	int one=1;
+	CHECK_NOT_M1(setsockopt(w->fd, SOL_NETLINK, NETLINK_NO_ENOBUFS, &one, sizeof(one)));
+	// wake up now and then to notice 'over'
+	struct timeval tv={0, 200000};
+	CHECK_NOT_M1(setsockopt(w->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+}
+
+static void load_rules(const char* file) {
+	FILE* fp=CHECK_NOT_NULL_FILEP(fopen(file, "r"));
+	char line[256];
+	while(fgets(line, sizeof(line), fp)) {
+		char proto[16], src[64], dst[64];
+		unsigned int sport, dport;
+		if(line[0]=='#' || sscanf(line, "%15s %63s %u %63s %u", proto, src, &sport, dst, &dport)!=5) {
+			continue;
+		}
+		FiveTuple t;
+		t.proto=strcmp(proto, "udp")==0?IPPROTO_UDP:(strcmp(proto, "tcp")==0?IPPROTO_TCP:atoi(proto));
+		if(inet_pton(AF_INET, src, &t.saddr)!=1 || inet_pton(AF_INET, dst, &t.daddr)!=1) {
+			fprintf(stderr, "bad address in rule: %s", line);
+			exit(EXIT_FAILURE);
+		}
+		t.sport=sport;
+		t.dport=dport;
+		blocked.insert(t);
+	}
+	CHECK_NOT_M1(fclose(fp));
+	printf("loaded %zu blocking rules\n", blocked.size());
+}
+
+int main(int argc, char** argv) {
+	unsigned int queues=1;
+	unsigned int port=9000;
+	unsigned int queue_maxlen=65536;
+	unsigned int rcvbuf=16*1024*1024;
+	bool batch=true;
+	double seconds=0;
+	const char* rules=NULL;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"queues", required_argument, 0, 0},
+			{"port", required_argument, 0, 1},
+			{"maxlen", required_argument, 0, 2},
+			{"rcvbuf", required_argument, 0, 3},
+			{"batch", required_argument, 0, 4},
+			{"seconds", required_argument, 0, 5},
+			{"rules", required_argument, 0, 6},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			queues=atoi(optarg);
+			break;
+		case 1:
+			port=atoi(optarg);
+			break;
+		case 2:
+			queue_maxlen=atoi(optarg);
+			break;
+		case 3:
+			rcvbuf=atoi(optarg);
+			break;
+		case 4:
+			batch=atoi(optarg)!=0;
+			break;
+		case 5:
+			seconds=atof(optarg);
+			break;
+		case 6:
+			rules=optarg;
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--queues=N] [--port=N] [--maxlen=N] [--rcvbuf=bytes] [--batch=0|1] [--seconds=N] [--rules=file]\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	check_root();
+	if(rules) {
+		load_rules(rules);
+	}
+	signal_register_handler_sigaction(SIGINT, handler, 0);
+	signal_register_handler_sigaction(SIGTERM, handler, 0);
+	vector<Worker> ws(queues);
+	vector<pthread_t> tids(queues);
+	for(unsigned int i=0; i<queues; i++) {
+		ws[i]=Worker();
+		ws[i].queue_num=i;
+		ws[i].batch=batch;
+		open_worker(&ws[i], queue_maxlen, rcvbuf);
+	}
+	// the queues exist before the rule so no packet finds an empty queue
+	char target[64];
+	if(queues==1) {
+		snprintf(target, sizeof(target), "NFQUEUE --queue-num 0");
+	} else {
+		snprintf(target, sizeof(target), "NFQUEUE --queue-balance 0:%u", queues-1);
+	}
+	my_system("iptables -I INPUT -i lo -p udp --dport %u -j %s", port, target);
+	uint64_t start=latency_now();
+	for(unsigned int i=0; i<queues; i++) {
+		CHECK_ZERO_ERRNO(pthread_create(&tids[i], NULL, worker, &ws[i]));
+	}
+	printf("%u queue(s), %s verdicts, udp port %u, CTRL+C to stop\n", queues, batch?"batched":"per packet", port);
+	if(seconds>0) {
+		uint64_t end=start+(uint64_t)(seconds*1e9);
+		while(!over && latency_now()<end) {
+			usleep(100000);
+		}
+		over=true;
+	} else {
+		while(!over) {
+			pause();
+		}
+	}
+	// remove the rule first so that no packets are stuck in dead queues
+	my_system("iptables -D INPUT -i lo -p udp --dport %u -j %s", port, target);
+	for(unsigned int i=0; i<queues; i++) {
+		CHECK_ZERO_ERRNO(pthread_join(tids[i], NULL));
+	}
+	double elapsed=(latency_now()-start)/1e9;
+	printf("%-6s %12s %10s %10s %10s %8s %12s\n", "queue", "packets", "pps", "dropped", "verdicts", "cpu_s", "pkts/verdict");
+	uint64_t total=0;
+	for(unsigned int i=0; i<queues; i++) {
+		const Worker& w=ws[i];
+		printf("%-6u %12lu %10.0lf %10lu %10lu %8.2lf %12.1lf\n", w.queue_num, w.packets, w.packets/elapsed, w.dropped, w.verdicts, w.cpu, w.verdicts?(double)w.packets/w.verdicts:0);
+		total+=w.packets;
+	}
+	printf("total %lu packets (%.0lf pps)\n", total, total/elapsed);
+	// queue_number portid queue_total copy_mode copy_range queue_dropped user_dropped id_sequence 1
+	my_system("cat /proc/net/netfilter/nfnetlink_queue");
+	for(unsigned int i=0; i<queues; i++) {
+		nfq_destroy_queue(ws[i].queue);
+		nfq_close(ws[i].handle);
+	}
+	return EXIT_SUCCESS;
+}
@@ -32,6 +32,10 @@
 /*
  * An example of a sniffer
  *
+ * This does a system call per packet and copies every packet. See
+ * sniffer_ring.cc for a sniffer that uses a TPACKET_V3 ring, fanout and an
+ * in kernel filter.
+ *
  * References:
  * http://www.tenouk.com/Module42a.html
  */
@@ -0,0 +1,462 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for socket(2)
+#include <sys/socket.h>	// for socket(2), bind(2), setsockopt(2), getsockopt(2), recvfrom(2)
+#include <sys/mman.h>	// for mmap(2), munmap(2)
+#include <sys/resource.h>	// for getrusage(2), RUSAGE_THREAD
+#include <linux/if_packet.h>	// for tpacket_req3, tpacket_block_desc, tpacket3_hdr, PACKET_*
+#include <linux/if_ether.h>	// for ETH_P_ALL, ETH_P_IP, ETH_HLEN
+#include <linux/filter.h>	// for sock_filter, sock_fprog, BPF_*
+#include <net/if.h>	// for if_nametoindex(3)
+#include <arpa/inet.h>	// for htons(3)
+#include <netinet/in.h>	// for IPPROTO_UDP, IPPROTO_TCP
+#include <poll.h>	// for poll(2)
+#include <stdio.h>	// for printf(3), fprintf(3), fopen(3), fscanf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3)
+#include <string.h>	// for strcmp(3)
+#include <strings.h>	// for bzero(3)
+#include <errno.h>	// for errno, EINTR, EAGAIN, ENOPROTOOPT
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <unistd.h>	// for getpid(2), close(2)
+#include <pthread.h>	// for pthread_create(3), pthread_join(3)
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_ZERO_ERRNO(), CHECK_NOT_VOIDP(), CHECK_NOT_NULL_FILEP(), CHECK_ASSERT()
+#include <security_utils.h>	// for check_root()
+#include <LatencyHistogram.hh>	// for latency_now()
+#include <vector>	// for vector<T>
+#include <atomic>	// for atomic<T>
+
+using namespace std;
+
+/*
+ * A packet sniffer that reads frames from a TPACKET_V3 ring instead of one
+ * read(2) per frame like sniffer.cc.
+ *
+ * - PACKET_RX_RING with TPACKET_V3 maps a ring of blocks shared with the
+ * kernel. The kernel fills a block with as many frames as fit (no fixed
+ * frame slots, so small packets do not waste memory) and hands it over when
+ * it is full or when 'retire_blk_tov' expires. One poll(2) per block instead
+ * of one system call per frame.
+ * - PACKET_FANOUT spreads the traffic of one interface over --workers
+ * sockets, each with its own ring and thread. 'hash' keeps a flow on one
+ * worker, 'lb' round robins, 'cpu' follows the cpu that received the frame.
+ * - the filter runs in the kernel (SO_ATTACH_FILTER, classic BPF) so
+ * unwanted frames are never copied. Use --proto/--port for the built in one
+ * or --bpf=file with the output of 'tcpdump -ddd <expression>'.
+ * - --mode=recv does the same with recvfrom(2) per frame on the same kind of
+ * socket for comparison.
+ * - a packet socket sees both directions and on lo every frame is both sent
+ * and received, so without care each datagram is counted twice. The
+ * outgoing copy is turned off with PACKET_IGNORE_OUTGOING (4.20), for a
+ * fanout group with PACKET_FANOUT_FLAG_IGNORE_OUTGOING (6.10) and, where
+ * the kernel has neither, skipped by its packet type (PACKET_OUTGOING).
+ *
+ * Per worker it reports packets per second, the kernel's drop counter
+ * (PACKET_STATISTICS) and the thread's CPU time.
+ *
+ * libpcap (see ../pcap/simple.cc) has used TPACKET_V3 itself since version
+ * 1.5 so it gets the ring but pays a callback per packet and, in the
+ * example, a printf(3) per packet which dominates everything else.
+ *
+ * Test on loopback with the udp batch sender as the traffic source and
+ * recv_batch as the sink (without a receiver the sender's datagrams are
+ * refused by the stack):
+ *	../udp/recv_batch --port=9000 > /dev/null &
+ *	sniffer_ring --iface=lo --proto=udp --port=9000 --workers=2 --seconds=10 &
+ *	../udp/send_batch --count=1000000 --size=64
+ * Numbers on a single core VM for 64 byte datagrams with the sender and
+ * the receiver on the same core (the sender manages 210K-320K pps), out of
+ * the 1M datagrams sent, each counted once:
+ *	mode		captured	dropped		cpu ns/packet
+ *	recv		46%-51%		49%-54%		1300-1600
+ *	ring		100%		0		31-36
+ * (plus the end markers of send_batch). In ring mode the sniffer saw every
+ * datagram and was idle the rest of the time. With --workers=2 and the
+ * default 'hash' fanout a single flow lands on one worker; use --fanout=lb
+ * or several senders to spread the load.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ * EXTRA_LINK_FLAGS_AFTER=-lpthread
+ */
+
+// older headers do not have this
+#ifndef PACKET_FANOUT_FLAG_IGNORE_OUTGOING
+#define PACKET_FANOUT_FLAG_IGNORE_OUTGOING 0x4000
+#endif
+
+// ring geometry: 64 blocks of 1MB
+static const unsigned int block_size=1<<20;
+static const unsigned int block_nr=64;
+static const unsigned int frame_size=2048;
+// a partially filled block is handed to us after this many ms
+static const unsigned int retire_blk_tov=10;
+
+struct Worker {
+	unsigned int id;
+	int fd;
+	uint8_t* ring;
+	size_t ring_size;
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t udp;
+	uint64_t tcp;
+	uint64_t other;
+	uint64_t outgoing;
+	unsigned int drops;
+	double cpu;
+};
+
+static atomic<bool> stop(false);
+static bool use_ring=true;
+
+// a little bit of work per frame so that the loop is not empty
+static inline void process(Worker* w, const uint8_t* frame, unsigned int len, unsigned char pkttype) {
+	// our own transmissions (the second copy of everything on lo)
+	if(pkttype==PACKET_OUTGOING) {
+		w->outgoing++;
+		return;
+	}
+	w->packets++;
+	w->bytes+=len;
+	if(len>=ETH_HLEN+20 && frame[12]==0x08 && frame[13]==0x00) {
+		uint8_t proto=frame[ETH_HLEN+9];
+		if(proto==IPPROTO_UDP) {
+			w->udp++;
+			return;
+		}
+		if(proto==IPPROTO_TCP) {
+			w->tcp++;
+			return;
+		}
+	}
+	w->other++;
+}
+
+static void walk_block(Worker* w, struct tpacket_block_desc* bd) {
+	unsigned int num=bd->hdr.bh1.num_pkts;
+	struct tpacket3_hdr* ph=reinterpret_cast<struct tpacket3_hdr*>(reinterpret_cast<uint8_t*>(bd)+bd->hdr.bh1.offset_to_first_pkt);
+	for(unsigned int i=0; i<num; i++) {
+		// the link level address follows the header
+		const struct sockaddr_ll* ll=reinterpret_cast<const struct sockaddr_ll*>(reinterpret_cast<uint8_t*>(ph)+TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+		process(w, reinterpret_cast<uint8_t*>(ph)+ph->tp_mac, ph->tp_snaplen, ll->sll_pkttype);
+		ph=reinterpret_cast<struct tpacket3_hdr*>(reinterpret_cast<uint8_t*>(ph)+ph->tp_next_offset);
+	}
+}
+
+static void* ring_worker(void* arg) {
+	Worker* w=static_cast<Worker*>(arg);
+	unsigned int current=0;
+	struct pollfd pfd;
+	pfd.fd=w->fd;
+	pfd.events=POLLIN|POLLERR;
+	while(!stop) {
+		struct tpacket_block_desc* bd=reinterpret_cast<struct tpacket_block_desc*>(w->ring+current*block_size);
+		if(!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+			int ret=poll(&pfd, 1, 100);
+			if(ret==-1 && errno!=EINTR) {
+				CHECK_NOT_M1(ret);
+			}
+			continue;
+		}
+		walk_block(w, bd);
+		// give the block back to the kernel
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		current=(current+1)%block_nr;
+	}
+	struct rusage ru;
+	CHECK_NOT_M1(getrusage(RUSAGE_THREAD, &ru));
+	w->cpu=ru.ru_utime.tv_sec+ru.ru_utime.tv_usec/1e6+ru.ru_stime.tv_sec+ru.ru_stime.tv_usec/1e6;
+	return NULL;
+}
+
+static void* recv_worker(void* arg) {
+	Worker* w=static_cast<Worker*>(arg);
+	uint8_t buf[65536];
+	while(!stop) {
+		struct sockaddr_ll ll;
+		socklen_t ll_len=sizeof(ll);
+		ssize_t len=recvfrom(w->fd, buf, sizeof(buf), 0, reinterpret_cast<struct sockaddr*>(&ll), &ll_len);
+		if(len==-1) {
+			if(errno==EINTR || errno==EAGAIN) {
+				continue;
+			}
+			CHECK_NOT_M1(len);
+		}
+		process(w, buf, len, ll.sll_pkttype);
+	}
+	struct rusage ru;
+	CHECK_NOT_M1(getrusage(RUSAGE_THREAD, &ru));
+	w->cpu=ru.ru_utime.tv_sec+ru.ru_utime.tv_usec/1e6+ru.ru_stime.tv_sec+ru.ru_stime.tv_usec/1e6;
+	return NULL;
+}
+
+/*
+ * Classic BPF for "ip and <proto> and port <port>" on an ethernet frame,
+ * the same thing 'tcpdump -dd' would produce (minus fragments and IPv6).
+ * Returns the number of instructions.
+ */
+static unsigned int build_filter(struct sock_filter* f, unsigned int proto, unsigned int port) {
+	unsigned int n=0;
+	unsigned int accept_len=262144;
+	// ethertype == IPv4
+	f[n++]=BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 12);
+	f[n++]=BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_IP, 0, 0);
+	unsigned int drop_jumps[4];
+	unsigned int nd=0;
+	drop_jumps[nd++]=n-1;
+	if(proto) {
+		f[n++]=BPF_STMT(BPF_LD|BPF_B|BPF_ABS, ETH_HLEN+9);
+		f[n++]=BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, proto, 0, 0);
+		drop_jumps[nd++]=n-1;
+	}
+	if(port) {
+		// X = IP header length, then load the ports relative to it
+		f[n++]=BPF_STMT(BPF_LDX|BPF_B|BPF_MSH, ETH_HLEN);
+		f[n++]=BPF_STMT(BPF_LD|BPF_H|BPF_IND, ETH_HLEN);
+		f[n++]=BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, port, 3, 0);
+		f[n++]=BPF_STMT(BPF_LD|BPF_H|BPF_IND, ETH_HLEN+2);
+		f[n++]=BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, port, 1, 0);
+		f[n++]=BPF_STMT(BPF_RET|BPF_K, 0);
+	}
+	f[n++]=BPF_STMT(BPF_RET|BPF_K, accept_len);
+	unsigned int drop=n;
+	f[n++]=BPF_STMT(BPF_RET|BPF_K, 0);
+	// the "not equal" branches go to the drop
+	for(unsigned int i=0; i<nd; i++) {
+		f[drop_jumps[i]].jf=drop-drop_jumps[i]-1;
+	}
+	return n;
+}
+
+// read the output of 'tcpdump -ddd': a count and then "code jt jf k" lines
+static unsigned int load_filter(const char* file, struct sock_filter* f, unsigned int max) {
+	FILE* fp=CHECK_NOT_NULL_FILEP(fopen(file, "r"));
+	unsigned int n;
+	if(fscanf(fp, "%u", &n)!=1 || n>max) {
+		fprintf(stderr, "bad filter file %s\n", file);
+		exit(EXIT_FAILURE);
+	}
+	for(unsigned int i=0; i<n; i++) {
+		unsigned int code, jt, jf, k;
+		if(fscanf(fp, "%u %u %u %u", &code, &jt, &jf, &k)!=4) {
+			fprintf(stderr, "bad filter file %s\n", file);
+			exit(EXIT_FAILURE);
+		}
+		f[i].code=code;
+		f[i].jt=jt;
+		f[i].jf=jf;
+		f[i].k=k;
+	}
+	CHECK_NOT_M1(fclose(fp));
+	return n;
+}
+
+static void open_worker(Worker* w, int ifindex, struct sock_fprog* prog, int fanout) {
+	w->fd=CHECK_NOT_M1(socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL)));
+	// filter first so nothing unfiltered sneaks in between bind and attach
+	if(prog) {
+		CHECK_NOT_M1(setsockopt(w->fd, SOL_SOCKET, SO_ATTACH_FILTER, prog, sizeof(*prog)));
+	}
+	// only what the interface receives, older kernels do not know the option
+	int one=1;
+	if(setsockopt(w->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one))==-1 && errno!=ENOPROTOOPT) {
+		CHECK_NOT_M1(-1);
+	}
+	if(use_ring) {
+		int version=TPACKET_V3;
+		CHECK_NOT_M1(setsockopt(w->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)));
+		struct tpacket_req3 req;
+		bzero(&req, sizeof(req));
+		req.tp_block_size=block_size;
+		req.tp_block_nr=block_nr;
+		req.tp_frame_size=frame_size;
+		req.tp_frame_nr=(block_size*block_nr)/frame_size;
+		req.tp_retire_blk_tov=retire_blk_tov;
+		req.tp_feature_req_word=TP_FT_REQ_FILL_RXHASH;
+		CHECK_NOT_M1(setsockopt(w->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)));
+		w->ring_size=(size_t)block_size*block_nr;
+		w->ring=static_cast<uint8_t*>(CHECK_NOT_VOIDP(mmap(NULL, w->ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_LOCKED, w->fd, 0), MAP_FAILED));
+	} else {
+		struct timeval tv={0, 100000};
+		CHECK_NOT_M1(setsockopt(w->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+		w->ring=NULL;
+	}
+	struct sockaddr_ll ll;
+	bzero(&ll, sizeof(ll));
+	ll.sll_family=AF_PACKET;
+	ll.sll_protocol=htons(ETH_P_ALL);
+	ll.sll_ifindex=ifindex;
+	CHECK_NOT_M1(bind(w->fd, reinterpret_cast<struct sockaddr*>(&ll), sizeof(ll)));
+	if(fanout!=-1) {
+		// group id in the low 16 bits, the type and flags in the high 16
+		int arg=(getpid()&0xffff)|((fanout|PACKET_FANOUT_FLAG_IGNORE_OUTGOING)<<16);
+		if(setsockopt(w->fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg))==-1) {
+			// a kernel without the flag, process() skips the outgoing frames
+			CHECK_ASSERT(errno==EINVAL);
+			arg=(getpid()&0xffff)|(fanout<<16);
+			CHECK_NOT_M1(setsockopt(w->fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)));
+		}
+	}
+}
+
+static void usage(const char* prog) {
+	fprintf(stderr, "%s: usage: %s [--iface=lo] [--workers=N] [--fanout=hash|lb|cpu] [--proto=udp|tcp|N] [--port=N] [--bpf=tcpdump_ddd_file] [--seconds=N] [--mode=ring|recv]\n", prog, prog);
+}
+
+int main(int argc, char** argv) {
+	const char* iface="lo";
+	int workers=1;
+	int fanout=PACKET_FANOUT_HASH;
+	int proto=0;
+	int port=0;
+	const char* bpf_file=NULL;
+	double seconds=5;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"iface", required_argument, 0, 0},
+			{"workers", required_argument, 0, 1},
+			{"fanout", required_argument, 0, 2},
+			{"proto", required_argument, 0, 3},
+			{"port", required_argument, 0, 4},
+			{"bpf", required_argument, 0, 5},
+			{"seconds", required_argument, 0, 6},
+			{"mode", required_argument, 0, 7},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			iface=optarg;
+			break;
+		case 1:
+			workers=atoi(optarg);
+			break;
+		case 2:
+			if(strcmp(optarg, "hash")==0) {
+				fanout=PACKET_FANOUT_HASH;
+			} else if(strcmp(optarg, "lb")==0) {
+				fanout=PACKET_FANOUT_LB;
+			} else if(strcmp(optarg, "cpu")==0) {
+				fanout=PACKET_FANOUT_CPU;
+			} else {
+				fprintf(stderr, "%s: fanout is one of hash, lb, cpu\n", argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 3:
+			proto=strcmp(optarg, "udp")==0?IPPROTO_UDP:(strcmp(optarg, "tcp")==0?IPPROTO_TCP:atoi(optarg));
+			break;
+		case 4:
+			port=atoi(optarg);
+			break;
+		case 5:
+			bpf_file=optarg;
+			break;
+		case 6:
+			seconds=atof(optarg);
+			break;
+		case 7:
+			if(strcmp(optarg, "ring")==0) {
+				use_ring=true;
+			} else if(strcmp(optarg, "recv")==0) {
+				use_ring=false;
+			} else {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(workers<1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	check_root();
+	int ifindex=if_nametoindex(iface);
+	if(ifindex==0) {
+		fprintf(stderr, "%s: no such interface %s\n", argv[0], iface);
+		return EXIT_FAILURE;
+	}
+	struct sock_filter filter[256];
+	struct sock_fprog prog;
+	struct sock_fprog* pprog=NULL;
+	if(bpf_file) {
+		prog.len=load_filter(bpf_file, filter, 256);
+		prog.filter=filter;
+		pprog=&prog;
+	} else if(proto || port) {
+		prog.len=build_filter(filter, proto, port);
+		prog.filter=filter;
+		pprog=&prog;
+	}
+
+	vector<Worker> ws(workers);
+	vector<pthread_t> tids(workers);
+	for(int i=0; i<workers; i++) {
+		bzero(&ws[i], sizeof(ws[i]));
+		ws[i].id=i;
+		open_worker(&ws[i], ifindex, pprog, workers>1?fanout:-1);
+	}
+	printf("capturing on %s with %d %s worker(s) for %.1lf seconds\n", iface, workers, use_ring?"ring":"recv", seconds);
+	uint64_t start=latency_now();
+	for(int i=0; i<workers; i++) {
+		CHECK_ZERO_ERRNO(pthread_create(&tids[i], NULL, use_ring?ring_worker:recv_worker, &ws[i]));
+	}
+	usleep((useconds_t)(seconds*1e6));
+	stop=true;
+	uint64_t total=0;
+	uint64_t total_outgoing=0;
+	unsigned int total_drops=0;
+	for(int i=0; i<workers; i++) {
+		CHECK_ZERO_ERRNO(pthread_join(tids[i], NULL));
+	}
+	double elapsed=(latency_now()-start)/1e9;
+	printf("%-6s %12s %10s %10s %10s %10s %8s %12s\n", "worker", "packets", "pps", "udp", "tcp", "drops", "cpu_s", "cpu_ns/pkt");
+	for(int i=0; i<workers; i++) {
+		Worker& w=ws[i];
+		// reading the statistics also resets them
+		if(use_ring) {
+			struct tpacket_stats_v3 st;
+			socklen_t len=sizeof(st);
+			CHECK_NOT_M1(getsockopt(w.fd, SOL_PACKET, PACKET_STATISTICS, &st, &len));
+			w.drops=st.tp_drops;
+		} else {
+			struct tpacket_stats st;
+			socklen_t len=sizeof(st);
+			CHECK_NOT_M1(getsockopt(w.fd, SOL_PACKET, PACKET_STATISTICS, &st, &len));
+			w.drops=st.tp_drops;
+		}
+		printf("%-6u %12lu %10.0lf %10lu %10lu %10u %8.2lf %12.0lf\n", w.id, w.packets, w.packets/elapsed, w.udp, w.tcp, w.drops, w.cpu, w.packets?w.cpu*1e9/w.packets:0);
+		total+=w.packets;
+		total_drops+=w.drops;
+		total_outgoing+=w.outgoing;
+		if(w.ring) {
+			CHECK_NOT_M1(munmap(w.ring, w.ring_size));
+		}
+		CHECK_NOT_M1(close(w.fd));
+	}
+	printf("total %lu packets (%.0lf pps), %u dropped, %lu outgoing skipped\n", total, total/elapsed, total_drops, total_outgoing);
+	return EXIT_SUCCESS;
+}
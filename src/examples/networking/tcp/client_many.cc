@@ -32,6 +32,7 @@
 
 /*
  * This is a tcp client demo.
+ * For measuring servers use load_generator.cc in this folder instead.
  *
  * EXTRA_LINK_FLAGS_AFTER=-lpthread
  */
@@ -0,0 +1,636 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for socket(2), connect(2), send(2), recv(2)
+#include <sys/socket.h>	// for socket(2), bind(2), connect(2), send(2), recv(2), getsockopt(2)
+#include <sys/epoll.h>	// for epoll_create1(2), epoll_ctl(2), epoll_pwait2(2)
+#include <netinet/in.h>	// for sockaddr_in, IP_BIND_ADDRESS_NO_PORT
+#include <netinet/tcp.h>// for TCP_NODELAY
+#include <arpa/inet.h>	// for inet_pton(3)
+#include <strings.h>	// for bzero(3), strncasecmp(3)
+#include <string.h>	// for memmem(3), memmove(3), strcmp(3)
+#include <stdio.h>	// for printf(3), fprintf(3), fopen(3), fclose(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3), strtoull(3), atof(3)
+#include <errno.h>	// for errno, EAGAIN, EINTR, EINPROGRESS
+#include <signal.h>	// for signal(2), SIGPIPE, SIG_IGN
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <unistd.h>	// for close(2)
+#include <pthread.h>	// for pthread_create(3), pthread_join(3)
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_ZERO_ERRNO(), CHECK_NOT_NULL_FILEP()
+#include <LatencyHistogram.hh>	// for LatencyHistogram, latency_now()
+#include <string>	// for string
+#include <vector>	// for vector<T>
+#include <deque>	// for deque<T>
+
+using namespace std;
+
+/*
+ * A TCP load generator for the servers in this repo (echo servers, web
+ * servers, server_vmsplice, the ACE exercises...) so that they can be
+ * compared using the same numbers. client_many.cc next to this file is the
+ * teaching version: a thread and a blocking socket per connection and a
+ * printf per request. Here:
+ * - every thread drives thousands of non blocking connections with one
+ * epoll instance, edge triggered.
+ * - requests have a configurable size and every connection may have up to
+ * 'pipeline' requests in flight.
+ * - two ways to drive the load:
+ *	closed loop (the default): every connection keeps its pipeline full,
+ *	a new request leaves when a response arrives. This finds the peak
+ *	throughput but its latency numbers suffer from coordinated omission:
+ *	when the server stalls the client stops sending and so the stall is
+ *	measured once instead of once for every request that should have been
+ *	sent during it. --co-interval applies HdrHistogram's after the fact
+ *	correction.
+ *	open loop (--rate): requests are scheduled at a constant rate no matter
+ *	how the server is doing. Latency is measured from the time the request
+ *	was *meant* to be sent, so time spent waiting for a free connection is
+ *	counted. This is the number a user of the service would see. The
+ *	service time (from the actual send) is reported next to it.
+ * - latency is kept in LatencyHistogram and can be written in the
+ * HdrHistogram percentile format (--hdr=file, in microseconds) for plotting.
+ *
+ * - --close opens a new connection for every request (the latency then
+ * includes the TCP handshake), for servers that hang up after one response
+ * like the minimal and the pthread web servers.
+ * - --source binds the connections to a local address. Tens of thousands of
+ * connections to one server from one address make every connect(2) search
+ * a crowded ephemeral port range, run several copies with --source=127.0.0.2,
+ * 127.0.0.3... instead.
+ *
+ * Protocols:
+ *	echo: send --size bytes (ending with a newline), expect --response bytes
+ *	back (default: the same as --size).
+ *	http: send GET --path, responses are delimited by Content-Length or,
+ *	with --close, by the server closing the connection. The header must
+ *	end with CRLFCRLF, a server sending bare newlines is counted as errors.
+ *
+ * Examples:
+ *	load_generator --port=8080 --proto=http --path=/index.html --connections=1000 --threads=4
+ *	load_generator --port=7000 --size=64 --pipeline=8 --rate=100000 --duration=30 --hdr=out.hgrm
+ *	load_generator --port=8080 --proto=http --close --connections=50
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ * EXTRA_LINK_FLAGS_AFTER=-lpthread
+ */
+
+enum proto {
+	PROTO_ECHO,
+	PROTO_HTTP,
+};
+
+// the configuration, shared read only by all threads
+static struct sockaddr_in addr;
+static struct sockaddr_in source;
+static bool use_source=false;
+static enum proto protocol=PROTO_ECHO;
+static string request;
+static size_t response_size;
+static unsigned int pipeline=1;
+static uint64_t co_interval=0;
+static bool close_mode=false;
+
+// Connection::remaining of a body that ends when the server closes
+static const long long until_eof=-2;
+
+struct Connection {
+	int fd;
+	bool connected;
+	// when conn_open() started, the send time of a request in --close mode
+	uint64_t opened;
+	bool in_ready;
+	// requests in flight: when they were meant to go and when they went
+	deque<uint64_t> intended;
+	deque<uint64_t> sent;
+	// output not yet accepted by the kernel
+	string out;
+	size_t outoff;
+	// input parsing state
+	char* buf;
+	size_t len;
+	// bytes still missing from the current response, -1 means in the header
+	long long remaining;
+};
+
+struct ThreadData {
+	unsigned int connections;
+	// 0 means closed loop
+	double rate;
+	uint64_t start;
+	uint64_t end;
+	LatencyHistogram latency;
+	LatencyHistogram service;
+	unsigned long sent;
+	unsigned long completed;
+	unsigned long errors;
+	unsigned long connects;
+	unsigned long long bytes;
+	// the longest the open loop backlog got
+	size_t max_backlog;
+};
+
+static const size_t bufsize=65536;
+
+static void conn_open(int epollfd, Connection& c, ThreadData* td) {
+	c.fd=CHECK_NOT_M1(socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, IPPROTO_TCP));
+	int one=1;
+	CHECK_NOT_M1(setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)));
+	if(use_source) {
+		// the port is picked by connect(2), knowing the destination
+		CHECK_NOT_M1(setsockopt(c.fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one)));
+		CHECK_NOT_M1(bind(c.fd, reinterpret_cast<struct sockaddr*>(&source), sizeof(source)));
+	}
+	c.connected=false;
+	c.intended.clear();
+	c.sent.clear();
+	c.out.clear();
+	c.outoff=0;
+	c.len=0;
+	c.remaining=-1;
+	c.opened=latency_now();
+	int ret=connect(c.fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+	if(ret==-1 && errno!=EINPROGRESS) {
+		CHECK_NOT_M1(ret);
+	}
+	td->connects++;
+	struct epoll_event ev;
+	ev.events=EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET;
+	ev.data.ptr=&c;
+	CHECK_NOT_M1(epoll_ctl(epollfd, EPOLL_CTL_ADD, c.fd, &ev));
+}
+
+// drop a broken connection and start over, requests in flight are lost
+static void conn_reset(int epollfd, Connection& c, ThreadData* td) {
+	td->errors+=c.intended.size()+1;
+	close(c.fd);
+	conn_open(epollfd, c, td);
+}
+
+// --close: the response is in, hang up and dial again
+static void conn_recycle(int epollfd, Connection& c, ThreadData* td) {
+	close(c.fd);
+	conn_open(epollfd, c, td);
+}
+
+static bool conn_flush(Connection& c) {
+	while(c.outoff<c.out.size()) {
+		ssize_t ret=send(c.fd, c.out.data()+c.outoff, c.out.size()-c.outoff, MSG_NOSIGNAL);
+		if(ret==-1) {
+			if(errno==EAGAIN) {
+				return true;
+			}
+			if(errno==EINTR) {
+				continue;
+			}
+			return false;
+		}
+		c.outoff+=ret;
+	}
+	c.out.clear();
+	c.outoff=0;
+	return true;
+}
+
+static void conn_queue(Connection& c, ThreadData* td, uint64_t intended, uint64_t now, vector<Connection*>& dirty) {
+	if(c.out.empty()) {
+		dirty.push_back(&c);
+	}
+	c.out+=request;
+	c.intended.push_back(intended);
+	c.sent.push_back(close_mode?c.opened:now);
+	td->sent++;
+}
+
+static void response_done(Connection& c, ThreadData* td, uint64_t now) {
+	uint64_t intended=c.intended.front();
+	uint64_t sent=c.sent.front();
+	c.intended.pop_front();
+	c.sent.pop_front();
+	if(td->rate>0) {
+		td->latency.record(now-intended);
+		td->service.record(now-sent);
+	} else {
+		td->latency.record_corrected(now-sent, co_interval);
+	}
+	td->completed++;
+}
+
+// consume the input buffer, returns the number of responses completed
+// or -1 on a protocol error
+static int conn_parse(Connection& c, ThreadData* td, uint64_t now) {
+	int done=0;
+	if(protocol==PROTO_ECHO) {
+		// no framing, just count bytes
+		while(c.len>0) {
+			if(c.remaining==-1) {
+				if(c.intended.empty()) {
+					return -1;
+				}
+				c.remaining=response_size;
+			}
+			size_t take=(size_t)c.remaining<c.len?c.remaining:c.len;
+			c.remaining-=take;
+			c.len-=take;
+			if(c.remaining==0) {
+				c.remaining=-1;
+				response_done(c, td, now);
+				done++;
+			}
+		}
+		return done;
+	}
+	size_t pos=0;
+	while(pos<c.len) {
+		if(c.remaining==-1) {
+			char* start=c.buf+pos;
+			char* end=static_cast<char*>(memmem(start, c.len-pos, "\r\n\r\n", 4));
+			if(end==NULL) {
+				break;
+			}
+			if(c.intended.empty()) {
+				return -1;
+			}
+			long long clen=-1;
+			for(char* p=start; p<end; p++) {
+				if((p==start || p[-1]=='\n') && strncasecmp(p, "Content-Length:", 15)==0) {
+					clen=strtoll(p+15, NULL, 10);
+				}
+			}
+			if(clen<0) {
+				// only a server that closes after the response may omit it
+				if(!close_mode) {
+					return -1;
+				}
+				clen=until_eof;
+			}
+			c.remaining=clen;
+			pos+=end-start+4;
+		}
+		if(c.remaining==until_eof) {
+			pos=c.len;
+			break;
+		}
+		size_t take=(size_t)c.remaining<c.len-pos?c.remaining:c.len-pos;
+		c.remaining-=take;
+		pos+=take;
+		if(c.remaining==0) {
+			c.remaining=-1;
+			response_done(c, td, now);
+			done++;
+		}
+	}
+	// keep a partial header for the next read
+	c.len-=pos;
+	memmove(c.buf, c.buf+pos, c.len);
+	if(c.len==bufsize) {
+		return -1;
+	}
+	return done;
+}
+
+static void* worker(void* arg) {
+	ThreadData* td=static_cast<ThreadData*>(arg);
+	int epollfd=CHECK_NOT_M1(epoll_create1(EPOLL_CLOEXEC));
+	vector<Connection> conns(td->connections);
+	for(Connection& c : conns) {
+		c.buf=new char[bufsize];
+		c.in_ready=false;
+		conn_open(epollfd, c, td);
+	}
+	// connections with output waiting to be sent
+	vector<Connection*> dirty;
+	// connections with room in their pipeline, in order of getting it
+	deque<Connection*> ready;
+	// open loop: requests that are due but have no connection to go on
+	deque<uint64_t> backlog;
+	uint64_t interval=td->rate>0?(uint64_t)(1e9/td->rate):0;
+	uint64_t next_intended=td->start;
+	const unsigned int maxevents=1024;
+	vector<struct epoll_event> events(maxevents);
+	while(true) {
+		uint64_t now=latency_now();
+		if(now>=td->end) {
+			break;
+		}
+		// hand out work
+		if(interval) {
+			while(next_intended<=now) {
+				backlog.push_back(next_intended);
+				next_intended+=interval;
+			}
+			if(backlog.size()>td->max_backlog) {
+				td->max_backlog=backlog.size();
+			}
+			while(!backlog.empty() && !ready.empty()) {
+				Connection& c=*ready.front();
+				if(c.intended.size()<pipeline) {
+					conn_queue(c, td, backlog.front(), now, dirty);
+					backlog.pop_front();
+				}
+				if(c.intended.size()>=pipeline) {
+					ready.pop_front();
+					c.in_ready=false;
+				}
+			}
+		} else {
+			while(!ready.empty()) {
+				Connection& c=*ready.front();
+				ready.pop_front();
+				c.in_ready=false;
+				while(c.intended.size()<pipeline) {
+					conn_queue(c, td, close_mode?c.opened:now, now, dirty);
+				}
+			}
+		}
+		// one send(2) per connection for everything queued on it
+		for(Connection* c : dirty) {
+			if(c->connected && !conn_flush(*c)) {
+				conn_reset(epollfd, *c, td);
+			}
+		}
+		dirty.clear();
+		// sleep until the next request is due or something happens
+		struct timespec timeout;
+		uint64_t wait_ns=100000000;
+		if(interval) {
+			if(!backlog.empty() && !ready.empty()) {
+				wait_ns=0;
+			} else if(backlog.empty()) {
+				wait_ns=next_intended>now?next_intended-now:0;
+			}
+		}
+		timeout.tv_sec=wait_ns/1000000000;
+		timeout.tv_nsec=wait_ns%1000000000;
+		int nfds=epoll_pwait2(epollfd, events.data(), maxevents, &timeout, NULL);
+		if(nfds==-1 && errno==EINTR) {
+			continue;
+		}
+		CHECK_NOT_M1(nfds);
+		for(int n=0; n<nfds; n++) {
+			Connection& c=*static_cast<Connection*>(events[n].data.ptr);
+			// a failed connect. A live connection that got reset may still
+			// hold a response, recv(2) returns it before the error.
+			if((events[n].events & EPOLLERR) && !c.connected) {
+				conn_reset(epollfd, c, td);
+				continue;
+			}
+			if(!c.connected) {
+				if(!(events[n].events & EPOLLOUT)) {
+					continue;
+				}
+				c.connected=true;
+			}
+			if((events[n].events & (EPOLLOUT|EPOLLERR))==EPOLLOUT && !conn_flush(c)) {
+				conn_reset(epollfd, c, td);
+				continue;
+			}
+			bool broken=false;
+			bool served=false;
+			while(events[n].events & (EPOLLIN|EPOLLRDHUP|EPOLLERR)) {
+				ssize_t ret=recv(c.fd, c.buf+c.len, bufsize-c.len, 0);
+				if(ret==-1 && errno==EAGAIN) {
+					break;
+				}
+				if(ret==-1 && errno==EINTR) {
+					continue;
+				}
+				if(ret==0 && c.remaining==until_eof) {
+					// the close is the end of the response
+					c.remaining=-1;
+					response_done(c, td, latency_now());
+					served=true;
+					break;
+				}
+				if(ret<=0) {
+					broken=true;
+					break;
+				}
+				td->bytes+=ret;
+				c.len+=ret;
+				int done=conn_parse(c, td, latency_now());
+				if(done==-1) {
+					broken=true;
+					break;
+				}
+				if(close_mode && done>0) {
+					served=true;
+					break;
+				}
+			}
+			if(served) {
+				conn_recycle(epollfd, c, td);
+				continue;
+			}
+			if(broken) {
+				conn_reset(epollfd, c, td);
+				continue;
+			}
+			if(!c.in_ready && c.intended.size()<pipeline) {
+				c.in_ready=true;
+				ready.push_back(&c);
+			}
+		}
+	}
+	// what is still waiting was never served in time, count it as such
+	uint64_t end=latency_now();
+	for(uint64_t intended : backlog) {
+		td->latency.record(end-intended);
+	}
+	for(Connection& c : conns) {
+		close(c.fd);
+		delete[] c.buf;
+	}
+	CHECK_NOT_M1(close(epollfd));
+	return NULL;
+}
+
+static void usage(const char* prog) {
+	fprintf(stderr, "%s: usage: %s [--host=ip] [--port=N] [--threads=N] [--connections=N] [--duration=secs]\n", prog, prog);
+	fprintf(stderr, "\t[--proto=echo|http] [--size=bytes] [--response=bytes] [--path=url] [--pipeline=N]\n");
+	fprintf(stderr, "\t[--rate=requests_per_sec] [--co-interval=ns] [--hdr=file] [--close] [--source=ip]\n");
+}
+
+int main(int argc, char** argv) {
+	const char* host="127.0.0.1";
+	unsigned int port=7000;
+	unsigned int threads=1;
+	unsigned int connections=100;
+	double duration=10;
+	size_t size=64;
+	long response=-1;
+	const char* path="/";
+	double rate=0;
+	const char* hdr=NULL;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"host", required_argument, 0, 0},
+			{"port", required_argument, 0, 1},
+			{"threads", required_argument, 0, 2},
+			{"connections", required_argument, 0, 3},
+			{"duration", required_argument, 0, 4},
+			{"proto", required_argument, 0, 5},
+			{"size", required_argument, 0, 6},
+			{"response", required_argument, 0, 7},
+			{"path", required_argument, 0, 8},
+			{"pipeline", required_argument, 0, 9},
+			{"rate", required_argument, 0, 10},
+			{"co-interval", required_argument, 0, 11},
+			{"hdr", required_argument, 0, 12},
+			{"close", no_argument, 0, 13},
+			{"source", required_argument, 0, 14},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			host=optarg;
+			break;
+		case 1:
+			port=atoi(optarg);
+			break;
+		case 2:
+			threads=atoi(optarg);
+			break;
+		case 3:
+			connections=atoi(optarg);
+			break;
+		case 4:
+			duration=atof(optarg);
+			break;
+		case 5:
+			if(strcmp(optarg, "http")==0) {
+				protocol=PROTO_HTTP;
+			} else if(strcmp(optarg, "echo")==0) {
+				protocol=PROTO_ECHO;
+			} else {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 6:
+			size=strtoul(optarg, NULL, 0);
+			break;
+		case 7:
+			response=strtol(optarg, NULL, 0);
+			break;
+		case 8:
+			path=optarg;
+			break;
+		case 9:
+			pipeline=atoi(optarg);
+			break;
+		case 10:
+			rate=atof(optarg);
+			break;
+		case 11:
+			co_interval=strtoull(optarg, NULL, 0);
+			break;
+		case 12:
+			hdr=optarg;
+			break;
+		case 13:
+			close_mode=true;
+			break;
+		case 14:
+			bzero(&source, sizeof(source));
+			source.sin_family=AF_INET;
+			if(inet_pton(AF_INET, optarg, &source.sin_addr)!=1) {
+				fprintf(stderr, "%s: source must be a dotted IPv4 address\n", argv[0]);
+				return EXIT_FAILURE;
+			}
+			use_source=true;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(threads<1 || connections<threads || pipeline<1 || size<1 || (close_mode && pipeline>1)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	bzero(&addr, sizeof(addr));
+	addr.sin_family=AF_INET;
+	addr.sin_port=htons(port);
+	if(inet_pton(AF_INET, host, &addr.sin_addr)!=1) {
+		fprintf(stderr, "%s: host must be a dotted IPv4 address\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if(protocol==PROTO_HTTP) {
+		request=string("GET ")+path+" HTTP/1.1\r\nHost: "+host+"\r\n"+(close_mode?"Connection: close\r\n":"")+"\r\n";
+	} else {
+		request.assign(size-1, 'x');
+		request+='\n';
+		response_size=response>=0?response:size;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	uint64_t start=latency_now();
+	vector<ThreadData*> tds(threads);
+	vector<pthread_t> tids(threads);
+	for(unsigned int i=0; i<threads; i++) {
+		ThreadData* td=new ThreadData();
+		td->connections=connections/threads+(i<connections%threads?1:0);
+		td->rate=rate/threads;
+		td->start=start;
+		td->end=start+(uint64_t)(duration*1e9);
+		td->sent=td->completed=td->errors=td->connects=0;
+		td->bytes=0;
+		td->max_backlog=0;
+		tds[i]=td;
+		CHECK_ZERO_ERRNO(pthread_create(&tids[i], NULL, worker, td));
+	}
+	LatencyHistogram latency;
+	LatencyHistogram service;
+	unsigned long sent=0, completed=0, errors=0, connects=0;
+	unsigned long long bytes=0;
+	size_t max_backlog=0;
+	for(unsigned int i=0; i<threads; i++) {
+		CHECK_ZERO_ERRNO(pthread_join(tids[i], NULL));
+		ThreadData* td=tds[i];
+		latency.merge(td->latency);
+		service.merge(td->service);
+		sent+=td->sent;
+		completed+=td->completed;
+		errors+=td->errors;
+		connects+=td->connects;
+		bytes+=td->bytes;
+		max_backlog+=td->max_backlog;
+		delete td;
+	}
+	double elapsed=(latency_now()-start)/1e9;
+	printf("mode=%s threads=%u connections=%u pipeline=%u close=%d duration=%.2lf\n", rate>0?"open":"closed", threads, connections, pipeline, close_mode, elapsed);
+	printf("sent=%lu completed=%lu (%.0lf/s) errors=%lu connects=%lu (%.0lf/s) rx=%.1lf MB/s\n", sent, completed, completed/elapsed, errors, connects, connects/elapsed, bytes/elapsed/1e6);
+	if(rate>0) {
+		printf("target rate=%.0lf/s max backlog=%zu\n", rate, max_backlog);
+		latency.print_summary("latency_ns (from intended send)");
+		service.print_summary("service_ns (from actual send)");
+	} else {
+		latency.print_summary(co_interval?"latency_ns (co corrected)":"latency_ns");
+	}
+	if(hdr) {
+		FILE* f=CHECK_NOT_NULL_FILEP(fopen(hdr, "w"));
+		latency.print_hdr(f, 1000.0);
+		CHECK_NOT_M1(fclose(f));
+	}
+	return EXIT_SUCCESS;
+}
@@ -26,10 +26,10 @@
 #include <arpa/inet.h>	// for ntohs(3)
 #include <fcntl.h>	// for vmsplice(2), splice(2)
 #include <unistd.h>	// for read(2), close(2), pipe(2)
-#include <pthread.h>	// for pthread_create(3)
+#include <pthread.h>	// for pthread_create(3), pthread_detach(3)
 #include <netinet/in.h>	// for sockaddr_in, inet_addr(3)
 #include <arpa/inet.h>	// for inet_addr(3)
-#include <sys/mman.h>	// for mmap(2)
+#include <sys/mman.h>	// for mmap(2), munmap(2)
 #include <stdlib.h>	// for rand(3), EXIT_SUCCESS, EXIT_FAILURE
 #include <assert.h>	// for assert(3)
 #include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_ZERO_ERRNO(), CHECK_NOT_VOIDP()
@@ -39,12 +39,15 @@
 
 /*
  * This is an example of using vmsplice to send mucho data to clients.
+ * See server_zerocopy.cc for a version that reuses its buffers and pipes
+ * and compares vmsplice with MSG_ZEROCOPY and plain send.
  *
  * EXTRA_LINK_FLAGS_AFTER=-lpthread
  */
 
 void* worker(void* arg) {
 	int fd=*(static_cast<int*>(arg));
+	delete static_cast<int*>(arg);
 	TRACE("thread %d starting", gettid());
 	TRACE("thread %d got fd %d", gettid(), fd);
 	const unsigned int buflen=1024;
@@ -65,16 +68,8 @@ void* worker(void* arg) {
 	// 3. vmsplice it
 	int mypipe[2];
 	CHECK_NOT_M1(pipe(mypipe));
-	/*
-	 * This does not work...
-	 * struct iovec myiovec={
-	 * .iov_base=mypointer,
-	 * .iov_len=mysize,
-	 * };
-	 */
-	struct iovec myiovec;
-	myiovec.iov_base=mypointer;
-	myiovec.iov_len=mysize;
+	// designated initializers (.iov_base=...) are only C++20, use the positional form
+	struct iovec myiovec={mypointer, mysize};
 	int bytes;
 	char* pp=static_cast<char*>(mypointer);
 	while((bytes=vmsplice(mypipe[1], &myiovec, 1, SPLICE_F_GIFT| SPLICE_F_MOVE))>0) {
@@ -89,6 +84,10 @@ void* worker(void* arg) {
 		assert(ret==0);
 	}
 	CHECK_NOT_M1(bytes);
+	CHECK_NOT_M1(close(mypipe[0]));
+	CHECK_NOT_M1(close(mypipe[1]));
+	// the gifted pages now belong to the kernel, unmapping only drops our mapping
+	CHECK_NOT_M1(munmap(mypointer, mysize));
 	CHECK_NOT_M1(close(fd));
 	TRACE("thread %d ending", gettid());
 	return NULL;
@@ -142,13 +141,14 @@ int main(int argc, char** argv) {
 	printf("listen was successful\n");
 	while(true) {
 		struct sockaddr_in client;
-		socklen_t addrlen;
+		socklen_t addrlen=sizeof(client);
 		int fd=CHECK_NOT_M1(accept(sockfd, reinterpret_cast<struct sockaddr *>(&client), &addrlen));
 		printf("accepted fd %d\n", fd);
 		// spawn a thread to handle the connection to that client...
 		pthread_t thread;
 		int* p=new int(fd);
 		CHECK_ZERO_ERRNO(pthread_create(&thread, NULL, worker, p));
+		CHECK_ZERO_ERRNO(pthread_detach(thread));
 	}
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,549 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/uio.h>	// for vmsplice(2), struct iovec
+#include <sys/types.h>	// for socket(2), bind(2), listen(2), accept(2), recv(2), setsockopt(2)
+#include <sys/socket.h>	// for socket(2), bind(2), listen(2), accept(2), recv(2), recvmsg(2), setsockopt(2)
+#include <sys/mman.h>	// for mmap(2), munmap(2)
+#include <sys/resource.h>	// for getrusage(2), RUSAGE_THREAD, RUSAGE_SELF
+#include <strings.h>	// for bzero(3)
+#include <string.h>	// for strcmp(3), strcpy(3), memchr(3), memset(3)
+#include <stdio.h>	// for printf(3), fprintf(3), sscanf(3), snprintf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3), strtoull(3)
+#include <errno.h>	// for errno, ENOBUFS, EINTR
+#include <poll.h>	// for poll(2)
+#include <fcntl.h>	// for vmsplice(2), splice(2), fcntl(2), F_SETPIPE_SZ
+#include <unistd.h>	// for read(2), close(2), pipe2(2)
+#include <pthread.h>	// for pthread_create(3), pthread_detach(3)
+#include <netinet/in.h>	// for sockaddr_in
+#include <arpa/inet.h>	// for inet_addr(3)
+#include <linux/errqueue.h>	// for struct sock_extended_err, SO_EE_ORIGIN_ZEROCOPY
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_ZERO_ERRNO(), CHECK_NOT_VOIDP()
+#include <network_utils.h>	// for get_backlog()
+#include <LatencyHistogram.hh>	// for latency_now()
+#include <vector>	// for vector<T>
+#include <deque>	// for deque<T>
+#include <mutex>	// for mutex, lock_guard<T>
+
+using namespace std;
+
+/*
+ * A bulk data server with three ways to push bytes into a TCP socket,
+ * chosen by the client per connection. It is the grown up version of
+ * server_vmsplice.cc which mmaps fresh memory and creates a new pipe for
+ * every client.
+ *
+ * The protocol is a line "<mode> <bytes>\n" answered with that many bytes,
+ * repeated until the client closes. The first request fixes the mode of the
+ * connection, a request for another mode closes it. Modes:
+ *	send	plain send(2): the kernel copies the user buffer into socket buffers.
+ *	zerocopy	send(2) with MSG_ZEROCOPY on a SO_ZEROCOPY socket: the kernel pins
+ *	the user pages and transmits from them. The buffer may not be
+ *	touched until the kernel says it is done with it. That is reported
+ *	on the socket error queue as ranges of send call numbers, which is
+ *	how the buffer pool below knows when a chunk can be refilled.
+ *	vmsplice	vmsplice(2) the buffer into a pipe and splice(2) the pipe into the
+ *	socket. The pipes come from a pool shared by all connections and are
+ *	enlarged with F_SETPIPE_SZ to hold a whole chunk. There is no
+ *	completion notification here: the pages stay referenced by the socket
+ *	until the data is acknowledged and writing to them before that
+ *	corrupts the stream. SPLICE_F_GIFT (which server_vmsplice.cc uses) is
+ *	not used since we want to reuse the buffers.
+ *
+ * Each connection owns a pool of 'pool_chunks' page aligned chunks. A real
+ * server would generate data into a chunk just before sending it; here the
+ * first word of every chunk is rewritten before each use which is enough to
+ * show when reuse is safe (and is not done in vmsplice mode where it never
+ * is). That is why the mode is per connection: after a vmsplice request the
+ * socket may still reference any chunk of the pool, so a later send or
+ * zerocopy request on the same connection would rewrite data that is not
+ * out yet.
+ *
+ * MSG_ZEROCOPY is a win for big sends to a real NIC. Over loopback the
+ * kernel has to copy anyway (the receiving socket cannot hold on to the
+ * sender's pages) and flags the completions with SO_EE_CODE_ZEROCOPY_COPIED,
+ * so loopback only shows the cost of the bookkeeping. The server reports
+ * this. Also note the per socket optmem limit (net.core.optmem_max): when
+ * too many notifications are pending send fails with ENOBUFS and we wait
+ * for completions.
+ *
+ * usage:
+ *	server_zerocopy [port]	serve
+ *	server_zerocopy --bench	serve and measure over loopback in process
+ * The benchmark prints Gb/s and the server thread's CPU seconds per GB for
+ * payloads from 64KB to 16MB. Numbers on a single core VM (noisy, the client
+ * shares the core):
+ *	size	send	zerocopy	vmsplice
+ *	64KB	27.1 Gb/s 0.14s/GB	19.7 Gb/s 0.20s/GB	30.3 Gb/s 0.13s/GB
+ *	1MB	19.9 Gb/s 0.19s/GB	10.8 Gb/s 0.46s/GB	15.9 Gb/s 0.25s/GB
+ *	16MB	17.6 Gb/s 0.19s/GB	13.2 Gb/s 0.34s/GB	16.0 Gb/s 0.18s/GB
+ * (zerocopy completions: all copied, as expected over loopback)
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ * EXTRA_LINK_FLAGS_AFTER=-lpthread
+ */
+
+static const size_t chunk_size=256*1024;
+static const unsigned int pool_chunks=32;
+
+/*
+ * Pipes are expensive to set up (two fds, a pipe_inode_info, and
+ * F_SETPIPE_SZ reallocates the ring) so they are kept for reuse.
+ */
+class PipePool{
+private:
+	mutex m;
+	vector<pair<int, int>> pipes;
+
+public:
+	pair<int, int> get() {
+		{
+			lock_guard<mutex> lock(m);
+			if(!pipes.empty()) {
+				pair<int, int> p=pipes.back();
+				pipes.pop_back();
+				return p;
+			}
+		}
+		int fds[2];
+		CHECK_NOT_M1(pipe2(fds, O_CLOEXEC));
+		// may fail above /proc/sys/fs/pipe-max-size, the default size still works
+		fcntl(fds[1], F_SETPIPE_SZ, chunk_size);
+		return make_pair(fds[0], fds[1]);
+	}
+	void put(pair<int, int> p) {
+		lock_guard<mutex> lock(m);
+		pipes.push_back(p);
+	}
+};
+
+static PipePool pipe_pool;
+
+struct ZerocopyStats {
+	uint64_t notifications;
+	uint64_t copied;
+	uint64_t enobufs;
+};
+
+/*
+ * The chunks of one connection and, for zerocopy, the bookkeeping of which
+ * chunk is still pinned by which send call.
+ */
+class ChunkPool{
+private:
+	int fd;
+	char* mem;
+	vector<int> free_chunks;
+	// (id of the last send(2) that used the chunk, chunk)
+	deque<pair<uint32_t, int>> inflight;
+	// the kernel numbers MSG_ZEROCOPY send calls per socket from 0
+	uint32_t next_id;
+
+public:
+	ZerocopyStats zc;
+
+	ChunkPool(int ifd) : fd(ifd), next_id(0), zc() {
+		mem=static_cast<char*>(CHECK_NOT_VOIDP(mmap(NULL, chunk_size*pool_chunks, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0), MAP_FAILED));
+		for(unsigned int i=0; i<pool_chunks; i++) {
+			memset(mem+i*chunk_size, 'a'+i%26, chunk_size);
+			free_chunks.push_back(i);
+		}
+	}
+	~ChunkPool() {
+		// the kernel may still hold our pages, wait until it lets go
+		while(!inflight.empty()) {
+			if(!reap(true)) {
+				break;
+			}
+		}
+		CHECK_NOT_M1(munmap(mem, chunk_size*pool_chunks));
+	}
+	char* chunk(int i) {
+		return mem+i*chunk_size;
+	}
+	/*
+	 * A chunk to send from. For zerocopy wait until one is released.
+	 * 'generate' writes new data into it which is only safe if the
+	 * kernel is not still holding the pages (not after vmsplice).
+	 */
+	int get(bool zerocopy, bool generate) {
+		if(zerocopy) {
+			reap(false);
+			while(free_chunks.empty()) {
+				if(!reap(true)) {
+					break;
+				}
+			}
+		}
+		if(free_chunks.empty()) {
+			// the connection broke, nothing is coming back
+			return -1;
+		}
+		int c=free_chunks.back();
+		free_chunks.pop_back();
+		if(generate) {
+			*reinterpret_cast<uint64_t*>(chunk(c))=latency_now();
+		}
+		return c;
+	}
+	void put(int c) {
+		free_chunks.push_back(c);
+	}
+	// note a MSG_ZEROCOPY send call and return its id
+	uint32_t sent_zerocopy() {
+		return next_id++;
+	}
+	void put_after(int c, uint32_t last_id) {
+		inflight.push_back(make_pair(last_id, c));
+	}
+	/*
+	 * Read completion notifications from the error queue and release
+	 * the chunks they cover. With 'block' wait for at least one.
+	 * Returns false if the socket is dead.
+	 */
+	bool reap(bool block) {
+		bool got=false;
+		while(true) {
+			struct msghdr msg;
+			char control[128];
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_control=control;
+			msg.msg_controllen=sizeof(control);
+			// MSG_ERRQUEUE never blocks
+			int ret=recvmsg(fd, &msg, MSG_ERRQUEUE);
+			if(ret==-1) {
+				if(errno==EINTR) {
+					continue;
+				}
+				if(errno!=EAGAIN) {
+					return false;
+				}
+				if(!block || got) {
+					return true;
+				}
+				// the error queue being non empty shows as POLLERR
+				struct pollfd pfd;
+				pfd.fd=fd;
+				pfd.events=0;
+				if(poll(&pfd, 1, 1000)<=0) {
+					return false;
+				}
+				if(pfd.revents & (POLLHUP|POLLNVAL)) {
+					return false;
+				}
+				continue;
+			}
+			for(struct cmsghdr* cm=CMSG_FIRSTHDR(&msg); cm!=NULL; cm=CMSG_NXTHDR(&msg, cm)) {
+				struct sock_extended_err* serr=reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cm));
+				if(serr->ee_errno!=0 || serr->ee_origin!=SO_EE_ORIGIN_ZEROCOPY) {
+					continue;
+				}
+				zc.notifications++;
+				if(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+					zc.copied++;
+				}
+				// send calls ee_info..ee_data are done, completions come in order
+				uint32_t hi=serr->ee_data;
+				while(!inflight.empty() && static_cast<int32_t>(inflight.front().first-hi)<=0) {
+					free_chunks.push_back(inflight.front().second);
+					inflight.pop_front();
+				}
+				got=true;
+			}
+		}
+	}
+};
+
+static bool send_plain(int fd, ChunkPool& pool, size_t size) {
+	while(size>0) {
+		int c=pool.get(false, true);
+		size_t len=size<chunk_size?size:chunk_size;
+		char* p=pool.chunk(c);
+		size_t off=0;
+		while(off<len) {
+			ssize_t ret=send(fd, p+off, len-off, MSG_NOSIGNAL);
+			if(ret==-1) {
+				if(errno==EINTR) {
+					continue;
+				}
+				pool.put(c);
+				return false;
+			}
+			off+=ret;
+		}
+		pool.put(c);
+		size-=len;
+	}
+	return true;
+}
+
+static bool send_zerocopy(int fd, ChunkPool& pool, size_t size) {
+	while(size>0) {
+		int c=pool.get(true, true);
+		if(c==-1) {
+			return false;
+		}
+		size_t len=size<chunk_size?size:chunk_size;
+		char* p=pool.chunk(c);
+		size_t off=0;
+		uint32_t last_id=0;
+		bool used=false;
+		while(off<len) {
+			ssize_t ret=send(fd, p+off, len-off, MSG_ZEROCOPY|MSG_NOSIGNAL);
+			if(ret==-1) {
+				if(errno==EINTR) {
+					continue;
+				}
+				if(errno==ENOBUFS) {
+					// too many notifications outstanding (optmem), drain some
+					pool.zc.enobufs++;
+					if(!pool.reap(true)) {
+						return false;
+					}
+					continue;
+				}
+				if(used) {
+					pool.put_after(c, last_id);
+				} else {
+					pool.put(c);
+				}
+				return false;
+			}
+			last_id=pool.sent_zerocopy();
+			used=true;
+			off+=ret;
+		}
+		pool.put_after(c, last_id);
+		size-=len;
+	}
+	return true;
+}
+
+static bool send_vmsplice(int fd, ChunkPool& pool, size_t size) {
+	pair<int, int> pp=pipe_pool.get();
+	bool ok=true;
+	while(ok && size>0) {
+		int c=pool.get(false, false);
+		size_t len=size<chunk_size?size:chunk_size;
+		struct iovec iov;
+		iov.iov_base=pool.chunk(c);
+		iov.iov_len=len;
+		while(ok && iov.iov_len>0) {
+			ssize_t in=vmsplice(pp.second, &iov, 1, 0);
+			if(in==-1) {
+				if(errno==EINTR) {
+					continue;
+				}
+				ok=false;
+				break;
+			}
+			iov.iov_base=static_cast<char*>(iov.iov_base)+in;
+			iov.iov_len-=in;
+			size_t todo=in;
+			while(todo>0) {
+				unsigned int flags=SPLICE_F_MOVE;
+				if(iov.iov_len>0 || size>len) {
+					flags|=SPLICE_F_MORE;
+				}
+				ssize_t out=splice(pp.first, NULL, fd, NULL, todo, flags);
+				if(out<=0) {
+					if(out==-1 && errno==EINTR) {
+						continue;
+					}
+					ok=false;
+					break;
+				}
+				todo-=out;
+			}
+		}
+		pool.put(c);
+		size-=len;
+	}
+	if(ok) {
+		pipe_pool.put(pp);
+	} else {
+		// the pipe may still hold data, do not hand it to anyone else
+		CHECK_NOT_M1(close(pp.first));
+		CHECK_NOT_M1(close(pp.second));
+	}
+	return ok;
+}
+
+static void* worker(void* arg) {
+	int fd=*(static_cast<int*>(arg));
+	delete static_cast<int*>(arg);
+	int one=1;
+	bool have_zerocopy=setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one))==0;
+	ChunkPool* pool=new ChunkPool(fd);
+	char line[128];
+	size_t len=0;
+	// the mode of the first request, the chunk pool is only safe for one
+	char conn_mode[32]="";
+	while(true) {
+		// read one request line
+		char* nl=static_cast<char*>(memchr(line, '\n', len));
+		if(nl==NULL) {
+			if(len==sizeof(line)) {
+				break;
+			}
+			ssize_t ret=recv(fd, line+len, sizeof(line)-len, 0);
+			if(ret<=0) {
+				break;
+			}
+			len+=ret;
+			continue;
+		}
+		*nl='\0';
+		char mode[32];
+		unsigned long long size;
+		bool ok=false;
+		if(sscanf(line, "%31s %llu", mode, &size)==2) {
+			if(conn_mode[0]=='\0') {
+				strcpy(conn_mode, mode);
+			}
+			if(strcmp(mode, conn_mode)!=0) {
+				fprintf(stderr, "fd %d: %s after %s, closing\n", fd, mode, conn_mode);
+			} else if(strcmp(mode, "send")==0) {
+				ok=send_plain(fd, *pool, size);
+			} else if(strcmp(mode, "zerocopy")==0 && have_zerocopy) {
+				ok=send_zerocopy(fd, *pool, size);
+			} else if(strcmp(mode, "vmsplice")==0) {
+				ok=send_vmsplice(fd, *pool, size);
+			}
+		}
+		if(!ok) {
+			break;
+		}
+		size_t used=nl-line+1;
+		len-=used;
+		memmove(line, line+used, len);
+	}
+	if(pool->zc.notifications>0) {
+		printf("fd %d: %lu zerocopy notifications, %lu copied, %lu ENOBUFS\n", fd, pool->zc.notifications, pool->zc.copied, pool->zc.enobufs);
+	}
+	delete pool;
+	CHECK_NOT_M1(close(fd));
+	return NULL;
+}
+
+static void* acceptor(void* arg) {
+	int sockfd=*(static_cast<int*>(arg));
+	while(true) {
+		int fd=CHECK_NOT_M1(accept(sockfd, NULL, NULL));
+		pthread_t thread;
+		int* p=new int(fd);
+		CHECK_ZERO_ERRNO(pthread_create(&thread, NULL, worker, p));
+		CHECK_ZERO_ERRNO(pthread_detach(thread));
+	}
+	return NULL;
+}
+
+static int listen_on(unsigned int port) {
+	int sockfd=CHECK_NOT_M1(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+	int optval=1;
+	CHECK_NOT_M1(setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)));
+	struct sockaddr_in server;
+	bzero(&server, sizeof(server));
+	server.sin_family=AF_INET;
+	server.sin_addr.s_addr=INADDR_ANY;
+	server.sin_port=htons(port);
+	CHECK_NOT_M1(bind(sockfd, reinterpret_cast<struct sockaddr *>(&server), sizeof(server)));
+	CHECK_NOT_M1(listen(sockfd, get_backlog()));
+	return sockfd;
+}
+
+static double cpu_secs(int who) {
+	struct rusage ru;
+	CHECK_NOT_M1(getrusage(who, &ru));
+	return ru.ru_utime.tv_sec+ru.ru_utime.tv_usec/1e6+ru.ru_stime.tv_sec+ru.ru_stime.tv_usec/1e6;
+}
+
+/*
+ * Fetch 'size' bytes in 'mode' repeatedly for about a second and report.
+ * The server CPU is everything the process used minus this (client) thread.
+ */
+static void bench_one(unsigned int port, const char* mode, size_t size) {
+	int fd=CHECK_NOT_M1(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+	struct sockaddr_in addr;
+	bzero(&addr, sizeof(addr));
+	addr.sin_family=AF_INET;
+	addr.sin_addr.s_addr=inet_addr("127.0.0.1");
+	addr.sin_port=htons(port);
+	CHECK_NOT_M1(connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)));
+	const size_t buflen=1024*1024;
+	char* buf=new char[buflen];
+	char req[64];
+	int reqlen=snprintf(req, sizeof(req), "%s %zu\n", mode, size);
+	double self_start=cpu_secs(RUSAGE_SELF);
+	double me_start=cpu_secs(RUSAGE_THREAD);
+	uint64_t start=latency_now();
+	uint64_t total=0;
+	bool ok=true;
+	while(ok && latency_now()-start<1000000000) {
+		CHECK_NOT_M1(send(fd, req, reqlen, 0));
+		size_t left=size;
+		while(left>0) {
+			ssize_t ret=CHECK_NOT_M1(recv(fd, buf, left<buflen?left:buflen, 0));
+			if(ret==0) {
+				ok=false;
+				break;
+			}
+			left-=ret;
+			total+=ret;
+		}
+	}
+	double secs=(latency_now()-start)/1e9;
+	double me=cpu_secs(RUSAGE_THREAD)-me_start;
+	double server_cpu=cpu_secs(RUSAGE_SELF)-self_start-me;
+	CHECK_NOT_M1(close(fd));
+	delete[] buf;
+	double gb=total/1e9;
+	if(ok) {
+		printf("%-9s %9zu KB %8.2lf Gb/s %8.3lf server_cpu_s/GB %8.3lf client_cpu_s/GB\n", mode, size/1024, gb*8/secs, server_cpu/gb, me/gb);
+	} else {
+		printf("%-9s %9zu KB not supported\n", mode, size/1024);
+	}
+	// let the worker thread print and exit before the next round
+	usleep(50000);
+}
+
+int main(int argc, char** argv) {
+	if(argc!=2) {
+		fprintf(stderr, "%s: usage: %s [port|--bench]\n", argv[0], argv[0]);
+		return EXIT_FAILURE;
+	}
+	if(strcmp(argv[1], "--bench")==0) {
+		unsigned int port=9876;
+		int sockfd=listen_on(port);
+		pthread_t thread;
+		CHECK_ZERO_ERRNO(pthread_create(&thread, NULL, acceptor, &sockfd));
+		const char* modes[]={"send", "zerocopy", "vmsplice"};
+		for(size_t size=64*1024; size<=16*1024*1024; size*=4) {
+			for(const char* mode : modes) {
+				bench_one(port, mode, size);
+			}
+		}
+		return EXIT_SUCCESS;
+	}
+	unsigned int port=atoi(argv[1]);
+	int sockfd=listen_on(port);
+	printf("contact me at port %u, send lines of \"[send|zerocopy|vmsplice] [bytes]\"\n", port);
+	acceptor(&sockfd);
+	return EXIT_SUCCESS;
+}
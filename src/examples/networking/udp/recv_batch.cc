@@ -0,0 +1,194 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for socket(2), bind(2), open(2)
+#include <sys/stat.h>	// for open(2)
+#include <sys/socket.h>	// for socket(2), bind(2), setsockopt(2)
+#include <strings.h>	// for bzero(3)
+#include <stdio.h>	// for fprintf(3), printf(3)
+#include <stdlib.h>	// for EXIT_FAILURE, EXIT_SUCCESS, atoi(3)
+#include <unistd.h>	// for close(2)
+#include <fcntl.h>	// for open(2)
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <netinet/in.h>	// for sockaddr_in
+#include <arpa/inet.h>	// for inet_addr(3)
+#include <err_utils.h>	// for CHECK_NOT_M1()
+#include <network_utils.h>	// for get_udp_snmp(), udp_snmp_t
+#include <udp_batch.hh>	// for UdpReceiver, UdpStats, BufferedWriter, udp_set_rcvbuf()
+#include <LatencyHistogram.hh>	// for latency_now()
+
+/*
+ * This is the batched version of recv.cc: a udp receiver that writes
+ * anything it gets to a file, built the way a market data feed handler
+ * would be.
+ * - recvmmsg(2) pulls up to --batch datagrams per system call.
+ * - --gro turns on UDP_GRO so a burst of datagrams of the same flow arrives
+ * as one buffer (split here using the segment size the kernel reports).
+ * - --rcvbuf asks for a big socket buffer to ride out bursts.
+ * - output goes through a BufferedWriter (one write(2) per megabyte) and
+ * not through a write(2)+fsync(2) per datagram like recv.cc does.
+ * Every second (and at the end) it prints packets per second, the datagrams
+ * lost according to the sequence numbers and the kernel's drop counters
+ * from /proc/net/snmp.
+ * It stops at the end marker (an empty datagram) or, since that can be lost
+ * too, when nothing arrived for --idle seconds after the traffic started.
+ * Datagrams shorter than the sequence number are counted as runts and
+ * dropped.
+ *
+ * Feed it with send_batch.cc. See udp_pps.cc for a benchmark of the modes.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ */
+
+int main(int argc, char** argv) {
+	const char* host="127.0.0.1";
+	unsigned int port=9000;
+	int batch=64;
+	int max_datagram=2048;
+	bool gro=false;
+	int rcvbuf=0;
+	const char* file=NULL;
+	unsigned int idle=3;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"host", required_argument, 0, 0},
+			{"port", required_argument, 0, 1},
+			{"batch", required_argument, 0, 2},
+			{"size", required_argument, 0, 3},
+			{"gro", no_argument, 0, 4},
+			{"rcvbuf", required_argument, 0, 5},
+			{"file", required_argument, 0, 6},
+			{"idle", required_argument, 0, 7},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			host=optarg;
+			break;
+		case 1:
+			port=atoi(optarg);
+			break;
+		case 2:
+			batch=atoi(optarg);
+			break;
+		case 3:
+			max_datagram=atoi(optarg);
+			break;
+		case 4:
+			gro=true;
+			break;
+		case 5:
+			rcvbuf=atoi(optarg);
+			break;
+		case 6:
+			file=optarg;
+			break;
+		case 7:
+			idle=atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--host=ip] [--port=N] [--batch=N] [--size=max_datagram] [--gro] [--rcvbuf=bytes] [--file=out] [--idle=secs]\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(batch<1) {
+		batch=1;
+	}
+	// the receive buffers are batch*max_datagram, each holds a sequence number
+	if(max_datagram<(int)sizeof(uint64_t) || max_datagram>(int)udp_max_payload) {
+		fprintf(stderr, "%s: size must be between %zu and %zu\n", argv[0], sizeof(uint64_t), udp_max_payload);
+		return EXIT_FAILURE;
+	}
+	if(idle<1) {
+		idle=1;
+	}
+
+	int sockfd=CHECK_NOT_M1(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP));
+	if(rcvbuf>0) {
+		printf("rcvbuf is %d\n", udp_set_rcvbuf(sockfd, rcvbuf));
+	}
+	// wake up once a second to report even if nothing arrives
+	struct timeval tv={1, 0};
+	CHECK_NOT_M1(setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+	struct sockaddr_in server;
+	bzero(&server, sizeof(server));
+	server.sin_family=AF_INET;
+	server.sin_addr.s_addr=inet_addr(host);
+	server.sin_port=htons(port);
+	CHECK_NOT_M1(bind(sockfd, reinterpret_cast<struct sockaddr *>(&server), sizeof(server)));
+	printf("listening on %s:%u batch=%d gro=%d\n", host, port, batch, gro);
+
+	int fd=-1;
+	BufferedWriter* writer=NULL;
+	if(file) {
+		fd=CHECK_NOT_M1(open(file, O_WRONLY | O_CREAT | O_TRUNC, 0666));
+		writer=new BufferedWriter(fd, 1<<20);
+	}
+	UdpReceiver receiver(sockfd, batch, max_datagram, gro);
+	UdpStats stats;
+	udp_snmp_t snmp_start;
+	get_udp_snmp(&snmp_start);
+	uint64_t start=0;
+	uint64_t last_report=latency_now();
+	uint64_t last_packets=0;
+	uint64_t last_packet=0;
+	unsigned int timeouts=0;
+	while(true) {
+		int ret=receiver.receive(stats, writer);
+		if(ret==0) {
+			break;
+		}
+		uint64_t now=latency_now();
+		if(ret>0) {
+			if(start==0) {
+				start=now;
+			}
+			last_packet=now;
+			timeouts=0;
+		} else if(start!=0) {
+			// the end marker got lost (or the sender died)
+			if(++timeouts>=idle) {
+				printf("nothing for %u secs, stopping\n", idle);
+				break;
+			}
+		}
+		if(now-last_report>=1000000000) {
+			double secs=(now-last_report)/1e9;
+			printf("%.0lf pps, lost %lu\n", (stats.packets-last_packets)/secs, stats.lost);
+			last_report=now;
+			last_packets=stats.packets;
+		}
+	}
+	double elapsed=start?(last_packet-start)/1e9:0;
+	delete writer;
+	if(fd!=-1) {
+		CHECK_NOT_M1(close(fd));
+	}
+	CHECK_NOT_M1(close(sockfd));
+	udp_snmp_t snmp_end;
+	get_udp_snmp(&snmp_end);
+	printf("received %lu datagrams, %lu bytes in %.3lf secs (%.0lf pps), %lu syscalls (%.1lf datagrams each)\n", stats.packets, stats.bytes, elapsed, elapsed>0?stats.packets/elapsed:0, stats.syscalls, stats.syscalls?(double)stats.packets/stats.syscalls:0);
+	printf("lost by sequence numbers: %lu, reordered: %lu, runts: %lu\n", stats.lost, stats.reordered, stats.runts);
+	printf("/proc/net/snmp: RcvbufErrors +%llu InErrors +%llu\n", snmp_end.RcvbufErrors-snmp_start.RcvbufErrors, snmp_end.InErrors-snmp_start.InErrors);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,135 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for socket(2), connect(2)
+#include <sys/socket.h>	// for socket(2), connect(2)
+#include <strings.h>	// for bzero(3)
+#include <stdio.h>	// for fprintf(3), printf(3)
+#include <stdlib.h>	// for EXIT_FAILURE, EXIT_SUCCESS, atoi(3), strtoull(3)
+#include <unistd.h>	// for close(2)
+#include <sched.h>	// for sched_yield(2)
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <netinet/in.h>	// for sockaddr_in
+#include <arpa/inet.h>	// for inet_addr(3)
+#include <err_utils.h>	// for CHECK_NOT_M1()
+#include <udp_batch.hh>	// for UdpSender, UdpStats, udp_set_sndbuf()
+#include <LatencyHistogram.hh>	// for latency_now()
+
+/*
+ * This is the batched version of send.cc: it sends --count datagrams of
+ * --size bytes, each starting with a sequence number, as fast as it can.
+ * - sendmmsg(2) sends --batch messages per system call.
+ * - --gso sets UDP_SEGMENT so every message carries up to 64 datagrams
+ * which the kernel (or the NIC) cuts up.
+ * A final empty datagram tells recv_batch.cc that we are done.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ */
+
+int main(int argc, char** argv) {
+	const char* host="127.0.0.1";
+	unsigned int port=9000;
+	unsigned int batch=64;
+	size_t size=1024;
+	uint64_t count=1000000;
+	bool gso=false;
+	int sndbuf=0;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"host", required_argument, 0, 0},
+			{"port", required_argument, 0, 1},
+			{"batch", required_argument, 0, 2},
+			{"size", required_argument, 0, 3},
+			{"count", required_argument, 0, 4},
+			{"gso", no_argument, 0, 5},
+			{"sndbuf", required_argument, 0, 6},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			host=optarg;
+			break;
+		case 1:
+			port=atoi(optarg);
+			break;
+		case 2:
+			batch=atoi(optarg);
+			break;
+		case 3:
+			size=atoi(optarg);
+			break;
+		case 4:
+			count=strtoull(optarg, NULL, 0);
+			break;
+		case 5:
+			gso=true;
+			break;
+		case 6:
+			sndbuf=atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--host=ip] [--port=N] [--batch=N] [--size=bytes] [--count=N] [--gso] [--sndbuf=bytes]\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(batch<1) {
+		batch=1;
+	}
+	if(size<sizeof(uint64_t) || size>udp_max_payload) {
+		fprintf(stderr, "%s: size must be between %zu and %zu\n", argv[0], sizeof(uint64_t), udp_max_payload);
+		return EXIT_FAILURE;
+	}
+
+	int sockfd=CHECK_NOT_M1(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP));
+	if(sndbuf>0) {
+		printf("sndbuf is %d\n", udp_set_sndbuf(sockfd, sndbuf));
+	}
+	struct sockaddr_in peer_addr;
+	bzero(&peer_addr, sizeof(peer_addr));
+	peer_addr.sin_family=AF_INET;
+	peer_addr.sin_addr.s_addr=inet_addr(host);
+	peer_addr.sin_port=htons(port);
+	// connecting saves the kernel a route lookup per datagram
+	CHECK_NOT_M1(connect(sockfd, reinterpret_cast<struct sockaddr *>(&peer_addr), sizeof(peer_addr)));
+
+	UdpSender sender(sockfd, size, batch, gso);
+	UdpStats stats;
+	uint64_t start=latency_now();
+	uint64_t seq=0;
+	uint64_t retries=0;
+	while(seq<count) {
+		uint64_t left=count-seq;
+		unsigned int n=left<sender.per_call()?left:sender.per_call();
+		unsigned int sent=sender.send(seq, n, stats);
+		if(sent==0) {
+			retries++;
+			sched_yield();
+		}
+		seq+=sent;
+	}
+	double elapsed=(latency_now()-start)/1e9;
+	sender.send_end();
+	CHECK_NOT_M1(close(sockfd));
+	printf("sent %lu datagrams of %zu bytes in %.3lf secs (%.0lf pps, %.1lf MB/s), %lu syscalls, %lu retries\n", stats.packets, size, elapsed, stats.packets/elapsed, stats.bytes/elapsed/1e6, stats.syscalls, retries);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,205 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for socket(2), bind(2), connect(2)
+#include <sys/socket.h>	// for socket(2), bind(2), connect(2), setsockopt(2)
+#include <strings.h>	// for bzero(3)
+#include <stdio.h>	// for printf(3), fprintf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3), strtoull(3)
+#include <unistd.h>	// for close(2), usleep(3)
+#include <sched.h>	// for sched_yield(2)
+#include <pthread.h>	// for pthread_create(3), pthread_join(3)
+#include <netinet/in.h>	// for sockaddr_in
+#include <arpa/inet.h>	// for inet_addr(3)
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_ZERO_ERRNO()
+#include <network_utils.h>	// for get_udp_snmp(), udp_snmp_t
+#include <udp_batch.hh>	// for UdpSender, UdpReceiver, UdpStats, udp_set_rcvbuf()
+#include <LatencyHistogram.hh>	// for latency_now()
+#include <atomic>	// for atomic<T>
+
+using namespace std;
+
+/*
+ * Packets per second over loopback for the different ways of moving
+ * datagrams:
+ *	single	send(2)/recv(2), one datagram per system call (like send.cc/recv.cc)
+ *	mmsg/N	sendmmsg(2)/recvmmsg(2) with N datagrams per call
+ *	gso+gro	sendmmsg(2) with UDP_SEGMENT, recvmmsg(2) with UDP_GRO
+ * The sender runs flat out so the receiver is the bottleneck. What it could
+ * not keep up with is dropped when its socket buffer fills: the loss is
+ * reported both from the sequence numbers and from RcvbufErrors in
+ * /proc/net/snmp (which counts skbs, so a dropped GSO packet counts once).
+ *
+ * Numbers on a single core VM (sender and receiver share the core), 1M
+ * datagrams, 4MB receive buffer:
+ *	size	mode	send_pps	recv_pps	lost	rx_per_call	rcvbuf_errors
+ *	64	single	431K	432K	0	1.0	0
+ *	64	mmsg/8	472K	472K	0	2.5	0
+ *	64	mmsg/64	469K	469K	0	3.1	0
+ *	64	gso+gro	20.1M	17.8M	19.8%	216	3100
+ *	1000	single	368K	368K	0	1.0	0
+ *	1000	mmsg/64	403K	403K	0	3.1	0
+ *	1000	gso+gro	6.9M	4.3M	38.4%	90	6003
+ * On one core the receiver is woken as soon as a datagram lands, so its
+ * batches stay small and recvmmsg(2) buys only ~10%. With the two on
+ * separate cores under a real burst the batches fill up. Segmentation
+ * offload is in another league since the stack is traversed once per 64
+ * datagrams; there the sender outruns the receiver and the socket buffer
+ * overflows (note how few skbs RcvbufErrors counts for that many datagrams).
+ *
+ * usage: udp_pps [count] [size] [rcvbuf]
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ * EXTRA_LINK_FLAGS_AFTER=-lpthread
+ */
+
+static const unsigned int port=9123;
+
+struct Mode {
+	const char* name;
+	unsigned int batch;
+	bool offload;
+};
+
+struct Run {
+	Mode mode;
+	uint64_t count;
+	size_t size;
+	int rcvbuf;
+	int rxfd;
+	atomic<bool> sender_done;
+	UdpStats rx;
+	uint64_t rx_first;
+	uint64_t rx_last;
+};
+
+static void* receiver(void* arg) {
+	Run* r=static_cast<Run*>(arg);
+	UdpReceiver rcv(r->rxfd, r->mode.batch, r->size, r->mode.offload);
+	while(true) {
+		int ret=rcv.receive(r->rx, NULL);
+		if(ret==0) {
+			break;
+		}
+		if(ret==-1) {
+			// the end marker may have been dropped too
+			if(r->sender_done) {
+				break;
+			}
+			continue;
+		}
+		r->rx_last=latency_now();
+		if(r->rx_first==0) {
+			r->rx_first=r->rx_last;
+		}
+	}
+	return NULL;
+}
+
+static void run(const Mode& mode, uint64_t count, size_t size, int rcvbuf) {
+	Run r;
+	r.mode=mode;
+	r.count=count;
+	r.size=size;
+	r.rcvbuf=rcvbuf;
+	r.sender_done=false;
+	// stay 0 if nothing arrives
+	r.rx_first=0;
+	r.rx_last=0;
+
+	struct sockaddr_in addr;
+	bzero(&addr, sizeof(addr));
+	addr.sin_family=AF_INET;
+	addr.sin_addr.s_addr=inet_addr("127.0.0.1");
+	addr.sin_port=htons(port);
+	r.rxfd=CHECK_NOT_M1(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP));
+	udp_set_rcvbuf(r.rxfd, rcvbuf);
+	struct timeval tv={0, 200000};
+	CHECK_NOT_M1(setsockopt(r.rxfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+	CHECK_NOT_M1(bind(r.rxfd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)));
+	int txfd=CHECK_NOT_M1(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP));
+	CHECK_NOT_M1(connect(txfd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)));
+
+	udp_snmp_t snmp_start;
+	get_udp_snmp(&snmp_start);
+	pthread_t tid;
+	CHECK_ZERO_ERRNO(pthread_create(&tid, NULL, receiver, &r));
+
+	UdpSender sender(txfd, size, mode.batch, mode.offload);
+	UdpStats tx;
+	uint64_t start=latency_now();
+	uint64_t seq=0;
+	while(seq<count) {
+		uint64_t left=count-seq;
+		unsigned int n=left<sender.per_call()?left:sender.per_call();
+		unsigned int sent=sender.send(seq, n, tx);
+		if(sent==0) {
+			sched_yield();
+		}
+		seq+=sent;
+	}
+	double tx_secs=(latency_now()-start)/1e9;
+	// give the receiver a moment to drain before telling it we are done
+	usleep(10000);
+	r.sender_done=true;
+	sender.send_end();
+	CHECK_ZERO_ERRNO(pthread_join(tid, NULL));
+	udp_snmp_t snmp_end;
+	get_udp_snmp(&snmp_end);
+	CHECK_NOT_M1(close(txfd));
+	CHECK_NOT_M1(close(r.rxfd));
+
+	double rx_secs=r.rx_last>r.rx_first?(r.rx_last-r.rx_first)/1e9:0;
+	// anything after the last sequence number we saw is lost too
+	uint64_t lost=r.rx.lost+(count>r.rx.next_seq?count-r.rx.next_seq:0);
+	printf("%-8s %12.0lf %12.0lf %10lu %9.1lf%% %12.1lf %14llu\n",
+		mode.name,
+		tx.packets/tx_secs,
+		rx_secs>0?r.rx.packets/rx_secs:0,
+		lost,
+		100.0*lost/count,
+		r.rx.syscalls?(double)r.rx.packets/r.rx.syscalls:0,
+		snmp_end.RcvbufErrors-snmp_start.RcvbufErrors);
+}
+
+int main(int argc, char** argv) {
+	if(argc>4) {
+		fprintf(stderr, "%s: usage: %s [count] [size] [rcvbuf]\n", argv[0], argv[0]);
+		return EXIT_FAILURE;
+	}
+	uint64_t count=argc>1?strtoull(argv[1], NULL, 0):1000000;
+	size_t size=argc>2?atoi(argv[2]):64;
+	int rcvbuf=argc>3?atoi(argv[3]):4*1024*1024;
+	if(size<sizeof(uint64_t) || size>udp_max_payload) {
+		fprintf(stderr, "%s: size must be between %zu and %zu\n", argv[0], sizeof(uint64_t), udp_max_payload);
+		return EXIT_FAILURE;
+	}
+	const Mode modes[]={
+		{"single", 1, false},
+		{"mmsg/8", 8, false},
+		{"mmsg/64", 64, false},
+		{"gso+gro", 64, true},
+	};
+	printf("count=%lu size=%zu rcvbuf=%d\n", count, size, rcvbuf);
+	printf("%-8s %12s %12s %10s %10s %12s %14s\n", "mode", "send_pps", "recv_pps", "lost", "lost%", "rx_per_call", "rcvbuf_errors");
+	for(const Mode& mode : modes) {
+		run(mode, count, size, rcvbuf);
+	}
+	return EXIT_SUCCESS;
+}
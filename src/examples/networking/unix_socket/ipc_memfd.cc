@@ -0,0 +1,258 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for pid_t
+#include <sys/socket.h>	// for socketpair(2), send(2), recv(2)
+#include <sys/wait.h>	// for waitpid(2)
+#include <stdio.h>	// for printf(3), fprintf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3)
+#include <string.h>	// for memset(3)
+#include <unistd.h>	// for fork(2), close(2), _exit(2)
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_ASSERT()
+#include <fd_ipc.hh>	// for FdChannel, FdIpcMessage, FdIpcBuffer
+#include <LatencyHistogram.hh>	// for LatencyHistogram, latency_now()
+#include <vector>	// for vector<T>
+
+using namespace std;
+
+/*
+ * Moving large buffers between two processes: copying through a SOCK_STREAM
+ * unix socket against FdChannel (fd_ipc.hh) which sends small messages
+ * inline over SOCK_SEQPACKET and large ones as a memfd.
+ *
+ * For every payload size the parent sends messages to a forked child which
+ * reads every 4KB page of the payload (a consumer has to look at the data
+ * or the memfd case would be measuring nothing) and answers with a one
+ * byte ack. Latency is send to ack, throughput is payload bytes over
+ * total time.
+ *
+ * Modes:
+ * - stream: length prefix and payload through SOCK_STREAM, two copies
+ * (sender to kernel, kernel to receiver).
+ * - fdipc: FdChannel::send(buf, len), the payload is copied once into a
+ * new sealed memfd when it is larger than --inline.
+ * - fdipc-inplace: the sender writes the payload directly into an
+ * FdChannel::alloc() buffer, a new sealed memfd per message.
+ * - fdipc-pool: like fdipc-inplace with a pooled channel, the memfds are
+ * recycled and stay mapped on both sides.
+ *
+ * Numbers on a single core VM (p50 latency in us / MB/s):
+ *	size	stream		fdipc		fdipc-inplace	fdipc-pool
+ *	1K	4.5/181		3.5/269		3.8/243		3.7/239
+ *	64K	10/6101		8.2/7812	8.4/7004	8.3/6982
+ *	256K	25/8701		114/2243	107/2351	4.9/48698
+ *	1M	110/8176	455/2235	401/2562	6.1/122332
+ *	4M	508/8109	1884/2205	1638/2462	16/84048
+ *	64M	15073/4444	47710/1377	39846/1694	246/11572
+ * Up to --inline (64K) all the channel modes are the same inline
+ * SOCK_SEQPACKET message and are a little faster than the stream (no
+ * framing, one system call per side). Above it a fresh sealed memfd per
+ * message is 3-4 times slower than copying: allocating and zeroing new
+ * shmem pages costs more than a copy, mapping and unmapping them on both
+ * sides comes on top. Recycling the memfds removes all of that and the
+ * cost per message no longer depends on the size (the throughput at 16M
+ * and 64M includes allocating the first buffer, there are only 8-16
+ * messages). So: sealed memfds for peers you do not trust, the pool for
+ * your own co-located processes.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ */
+
+static const size_t page=4096;
+
+// touch every page, returns something so the compiler keeps the loads
+static inline uint64_t consume(const char* p, size_t len) {
+	uint64_t sum=0;
+	for(size_t i=0; i<len; i+=page) {
+		sum+=p[i];
+	}
+	return sum;
+}
+
+// the producer's work: write every page
+static inline void produce(char* p, size_t len, unsigned int iter) {
+	for(size_t i=0; i<len; i+=page) {
+		p[i]=(char)(iter+i);
+	}
+}
+
+static void send_all(int fd, const void* buf, size_t len) {
+	const char* p=static_cast<const char*>(buf);
+	while(len>0) {
+		ssize_t ret=CHECK_NOT_M1(send(fd, p, len, MSG_NOSIGNAL));
+		p+=ret;
+		len-=ret;
+	}
+}
+
+// false on end of stream
+static bool recv_all(int fd, void* buf, size_t len) {
+	char* p=static_cast<char*>(buf);
+	while(len>0) {
+		ssize_t ret=CHECK_NOT_M1(recv(fd, p, len, MSG_WAITALL));
+		if(ret==0) {
+			return false;
+		}
+		p+=ret;
+		len-=ret;
+	}
+	return true;
+}
+
+static void stream_child(int fd, size_t max_size) {
+	vector<char> buf(max_size);
+	uint64_t sum=0;
+	uint64_t len;
+	while(recv_all(fd, &len, sizeof(len))) {
+		CHECK_ASSERT(recv_all(fd, buf.data(), len));
+		sum+=consume(buf.data(), len);
+		char ack=(char)sum;
+		send_all(fd, &ack, 1);
+	}
+}
+
+static void fdipc_child(int fd, size_t inline_max) {
+	FdChannel ch(fd, inline_max);
+	FdIpcMessage m;
+	uint64_t sum=0;
+	while(ch.receive(m)) {
+		sum+=consume(m.data, m.len);
+		ch.release(m);
+		char ack=(char)sum;
+		ch.send(&ack, 1);
+	}
+}
+
+int main(int argc, char** argv) {
+	const char* mode="fdipc";
+	size_t min_size=1024;
+	size_t max_size=64*1024*1024;
+	size_t inline_max=64*1024;
+	size_t total_bytes=1024*1024*1024;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"mode", required_argument, 0, 0},
+			{"min", required_argument, 0, 1},
+			{"max", required_argument, 0, 2},
+			{"inline", required_argument, 0, 3},
+			{"bytes", required_argument, 0, 4},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			mode=optarg;
+			break;
+		case 1:
+			min_size=atol(optarg);
+			break;
+		case 2:
+			max_size=atol(optarg);
+			break;
+		case 3:
+			inline_max=atol(optarg);
+			break;
+		case 4:
+			total_bytes=atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--mode=stream|fdipc|fdipc-inplace|fdipc-pool] [--min=bytes] [--max=bytes] [--inline=bytes] [--bytes=bytes_per_size]\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	bool stream=strcmp(mode, "stream")==0;
+	bool pool=strcmp(mode, "fdipc-pool")==0;
+	bool inplace=pool || strcmp(mode, "fdipc-inplace")==0;
+	if(!stream && !inplace && strcmp(mode, "fdipc")!=0) {
+		fprintf(stderr, "%s: unknown mode %s\n", argv[0], mode);
+		return EXIT_FAILURE;
+	}
+	int fds[2];
+	if(stream) {
+		CHECK_NOT_M1(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, fds));
+	} else {
+		FdChannel::pair(fds);
+	}
+	pid_t pid=CHECK_NOT_M1(fork());
+	if(pid==0) {
+		CHECK_NOT_M1(close(fds[0]));
+		if(stream) {
+			stream_child(fds[1], max_size);
+			CHECK_NOT_M1(close(fds[1]));
+		} else {
+			fdipc_child(fds[1], inline_max);
+		}
+		_exit(EXIT_SUCCESS);
+	}
+	CHECK_NOT_M1(close(fds[1]));
+	FdChannel* ch=stream?NULL:new FdChannel(fds[0], inline_max, pool);
+	vector<char> buf(max_size);
+	memset(buf.data(), 1, max_size);
+	printf("mode=%s inline=%zd\n", mode, inline_max);
+	printf("%10s %8s %10s %10s %10s %10s\n", "size", "msgs", "p50_us", "p99_us", "max_us", "MB/s");
+	for(size_t size=min_size; size<=max_size; size*=4) {
+		unsigned int iters=total_bytes/size;
+		if(iters<8) {
+			iters=8;
+		}
+		if(iters>20000) {
+			iters=20000;
+		}
+		LatencyHistogram h;
+		uint64_t start=latency_now();
+		for(unsigned int i=0; i<iters; i++) {
+			uint64_t t0=latency_now();
+			char ack;
+			if(stream) {
+				produce(buf.data(), size, i);
+				uint64_t len=size;
+				send_all(fds[0], &len, sizeof(len));
+				send_all(fds[0], buf.data(), size);
+				CHECK_ASSERT(recv_all(fds[0], &ack, 1));
+			} else {
+				if(inplace && size>inline_max) {
+					FdIpcBuffer b=ch->alloc(size);
+					produce(b.data, size, i);
+					ch->send(b);
+				} else {
+					produce(buf.data(), size, i);
+					ch->send(buf.data(), size);
+				}
+				FdIpcMessage m;
+				CHECK_ASSERT(ch->receive(m));
+				ch->release(m);
+			}
+			h.record(latency_now()-t0);
+		}
+		double elapsed=(latency_now()-start)/1e9;
+		printf("%10zd %8u %10.1lf %10.1lf %10.1lf %10.0lf\n", size, iters, h.percentile(50)/1e3, h.percentile(99)/1e3, h.get_max()/1e3, size*(double)iters/elapsed/1e6);
+	}
+	if(stream) {
+		CHECK_NOT_M1(close(fds[0]));
+	} else {
+		delete ch;
+	}
+	int status;
+	CHECK_NOT_M1(waitpid(pid, &status, 0));
+	return EXIT_SUCCESS;
+}
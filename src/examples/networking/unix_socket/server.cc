@@ -37,6 +37,9 @@
  * This is a unix socket server demo.
  * It is a simple echo server sending back anything that is send to it.
  *
+ * Every byte is copied into the socket and out again. For moving large
+ * buffers see fd_ipc.hh and ipc_memfd.cc which pass a memfd instead.
+ *
  * EXTRA_LINK_FLAGS_AFTER=-lpthread
  */
 
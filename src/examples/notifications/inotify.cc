@@ -43,12 +43,12 @@
  * file name lengths. And a single read can return more than one record but will always return
  * an even amount of records.
  *
+ * This is the minimal version. tree_watch.cc is the scalable one: folders
+ * and events from the command line, whole trees, an epoll loop over a
+ * signalfd instead of the EINTR code, coalescing of events and a fanotify
+ * backend (the shared code is in tree_watch.hh).
+ *
  * TODO:
- * - get the folder to watch from the command line.
- * - get the events to watch from the command line.
- * - get the generic inotify functions into a shared header file.
- * - rewrite this with select on a signal fd so that I won't need the EINTR code
- * and this code will be more scalable.
  * - i'm missing inotify events here. look at the reference.
  *
  * references:
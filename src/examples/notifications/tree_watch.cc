@@ -0,0 +1,364 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/epoll.h>	// for epoll_create1(2), epoll_ctl(2), epoll_wait(2), struct epoll_event
+#include <sys/signalfd.h>	// for signalfd(2), struct signalfd_siginfo
+#include <sys/timerfd.h>	// for timerfd_create(2), timerfd_settime(2)
+#include <sys/resource.h>	// for getrusage(2), struct rusage
+#include <sys/wait.h>	// for waitpid(2)
+#include <sys/types.h>	// for pid_t
+#include <signal.h>	// for sigprocmask(2), sigset_t, SIG*
+#include <fcntl.h>	// for open(2), O_*
+#include <stdio.h>	// for printf(3), fprintf(3), snprintf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3), atol(3)
+#include <string.h>	// for strcmp(3), strtok_r(3), memset(3)
+#include <unistd.h>	// for fork(2), pwrite(2), close(2), unlink(2), read(2), getpid(2), sysconf(3), _exit(2)
+#include <errno.h>	// for errno, EAGAIN
+#include <limits.h>	// for PATH_MAX
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_INT(), CHECK_ASSERT()
+#include <us_helper.h>	// for ARRAY_SIZEOF()
+#include <tree_watch.hh>	// for TreeWatcher, TreeWatchEvent, TreeWatchStats
+#include <LatencyHistogram.hh>	// for latency_now()
+#include <vector>	// for vector<T>
+#include <string>	// for string
+
+using namespace std;
+
+/*
+ * Watch directory trees for changes: the scalable version of inotify.cc
+ * on top of TreeWatcher (tree_watch.hh).
+ *
+ * tree_watch [--backend=inotify|fanotify] [--events=create,delete,...]
+ *	[--window=ms] [--delay=ms] [--workers=n] [--bufsize=KB]
+ *	[--max-pending=n] [--quiet] [--storm=n] [--storm-files=n] dir...
+ *
+ * One epoll(7) loop over three fds and no signal handlers:
+ * - the watcher fd (inotify or fanotify).
+ * - a signalfd(2): SIGINT/SIGTERM stop, SIGUSR1 prints the statistics,
+ * SIGCHLD is the end of --storm.
+ * - a timerfd(2) set to when the coalescer has events to emit
+ * (TreeWatcher::next_deadline()).
+ *
+ * --window is the coalescing window (the events of a path within it come
+ * out as one). --delay makes the loop read the watcher at most once per
+ * delay (EPOLLONESHOT, re-armed by the timer): under a storm the kernel
+ * queue fills up between reads and merges repeated events itself, so every
+ * read(2) brings in a full buffer. The price is up to delay more latency
+ * and, if the queue (/proc/sys/fs/inotify/max_queued_events) fills, an
+ * overflow.
+ *
+ * --storm=n forks a child that writes n times round robin to --storm-files
+ * files in the first directory and then exits, to measure the cost of a
+ * storm. Every run prints the time it took to set up the watches and at
+ * the end the statistics and the cpu time of the process.
+ *
+ * Numbers on a single core VM (ext4), a tree of 40000 directories
+ * (tree_walk --mode=create --files=40000 --per-dir=1, inside the 48542
+ * default max_user_watches):
+ *	setup inotify --workers=1	0.24s
+ *	setup inotify --workers=4	0.21s (one cpu, little to gain)
+ *	setup fanotify			0.00s (one mark)
+ * A storm of 1000000 writes round robin to 100 files (--storm=1000000
+ * --quiet), cpu time of the watcher (setup included):
+ *	backend		--delay	reads	raw events	emitted	overflows	cpu
+ *	inotify		0	112330	1000300		1178	0		0.69s
+ *	inotify		1	731	1000300		800	0		0.41s
+ *	inotify		10	158	981373		804	9		0.42s
+ *	fanotify	0	206565	230028		1500	0		0.56s
+ *	fanotify	10	75	7500		800	0		0.01s
+ * Every write is an event for inotify: the kernel only merges an event with
+ * the last one in the queue, which round robin writes never match. A short
+ * --delay cuts the reads by 150 times, a long one overflows the queue.
+ * fanotify merges with any queued event of the same object, so with a
+ * delay the storm hardly reaches user space at all. Either way a million
+ * writes come out as a few hundred events.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ * EXTRA_LINK_FLAGS_AFTER=-lpthread
+ */
+
+static uint32_t event_types[]={
+	IN_ACCESS, IN_ATTRIB, IN_CLOSE_WRITE, IN_CLOSE_NOWRITE,
+	IN_CREATE, IN_DELETE, IN_MODIFY, IN_MOVED_FROM,
+	IN_MOVED_TO, IN_OPEN, IN_Q_OVERFLOW, IN_ISDIR
+};
+static const char* event_names[]={
+	"access", "attrib", "close_write", "close_nowrite",
+	"create", "delete", "modify", "moved_from",
+	"moved_to", "open", "overflow", "isdir"
+};
+
+static uint32_t parse_events(const char* list) {
+	string s(list);
+	uint32_t mask=0;
+	char* save;
+	for(char* tok=strtok_r(&s[0], ",", &save); tok!=NULL; tok=strtok_r(NULL, ",", &save)) {
+		bool found=false;
+		for(unsigned int i=0; i<ARRAY_SIZEOF(event_names); i++) {
+			if(strcmp(tok, event_names[i])==0) {
+				mask|=event_types[i];
+				found=true;
+			}
+		}
+		if(!found) {
+			fprintf(stderr, "tree_watch: unknown event %s\n", tok);
+			exit(EXIT_FAILURE);
+		}
+	}
+	return mask;
+}
+
+static void print_event(const TreeWatchEvent& e) {
+	bool first=true;
+	for(unsigned int i=0; i<ARRAY_SIZEOF(event_types); i++) {
+		if(e.mask & event_types[i]) {
+			printf("%s%s", first?"":"|", event_names[i]);
+			first=false;
+		}
+	}
+	if(e.path[0]=='\0') {
+		printf(" events were lost, rescan\n");
+	} else {
+		printf(" %s", e.path);
+		if(e.count>1) {
+			printf(" (x%u)", e.count);
+		}
+		printf("\n");
+	}
+}
+
+static void print_stats(const TreeWatcher* w) {
+	const TreeWatchStats& s=w->get_stats();
+	struct rusage ru;
+	CHECK_NOT_M1(getrusage(RUSAGE_SELF, &ru));
+	double cpu=ru.ru_utime.tv_sec+ru.ru_utime.tv_usec/1e6+ru.ru_stime.tv_sec+ru.ru_stime.tv_usec/1e6;
+	fprintf(stderr, "watches=%lu watch_errors=%lu reads=%lu bytes=%lu raw_events=%lu emitted=%lu overflows=%lu forced=%lu filtered=%lu pending=%zu cpu=%.3lfs\n", s.watches, s.watch_errors, s.reads, s.bytes, s.raw_events, s.emitted, s.overflows, s.forced, s.filtered, w->pending(), cpu);
+}
+
+static void storm(const char* dir, unsigned long writes, unsigned int files) {
+	vector<int> fds(files);
+	char name[PATH_MAX];
+	for(unsigned int i=0; i<files; i++) {
+		snprintf(name, sizeof(name), "%s/storm%u", dir, i);
+		fds[i]=CHECK_NOT_M1(open(name, O_WRONLY|O_CREAT|O_TRUNC, 0644));
+	}
+	for(unsigned long i=0; i<writes; i++) {
+		CHECK_INT(pwrite(fds[i%files], &i, 1, 0), 1);
+	}
+	for(unsigned int i=0; i<files; i++) {
+		CHECK_NOT_M1(close(fds[i]));
+		snprintf(name, sizeof(name), "%s/storm%u", dir, i);
+		CHECK_NOT_M1(unlink(name));
+	}
+}
+
+static void set_timer(int tfd, uint64_t when) {
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	// zero disarms
+	its.it_value.tv_sec=when/1000000000;
+	its.it_value.tv_nsec=when%1000000000;
+	CHECK_NOT_M1(timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL));
+}
+
+int main(int argc, char** argv) {
+	const char* backend="inotify";
+	uint32_t mask=IN_CREATE|IN_DELETE|IN_MODIFY|IN_MOVED_FROM|IN_MOVED_TO|IN_CLOSE_WRITE;
+	uint64_t window=100;
+	uint64_t delay=0;
+	int workers=sysconf(_SC_NPROCESSORS_ONLN);
+	size_t bufsize=256;
+	size_t max_pending=64*1024;
+	bool quiet=false;
+	long storm_writes=-1;
+	int storm_files=100;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"backend", required_argument, 0, 0},
+			{"events", required_argument, 0, 1},
+			{"window", required_argument, 0, 2},
+			{"delay", required_argument, 0, 3},
+			{"workers", required_argument, 0, 4},
+			{"bufsize", required_argument, 0, 5},
+			{"max-pending", required_argument, 0, 6},
+			{"quiet", no_argument, 0, 7},
+			{"storm", required_argument, 0, 8},
+			{"storm-files", required_argument, 0, 9},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			backend=optarg;
+			break;
+		case 1:
+			mask=parse_events(optarg);
+			break;
+		case 2:
+			window=atol(optarg);
+			break;
+		case 3:
+			delay=atol(optarg);
+			break;
+		case 4:
+			workers=atoi(optarg);
+			break;
+		case 5:
+			bufsize=atol(optarg);
+			break;
+		case 6:
+			max_pending=atol(optarg);
+			break;
+		case 7:
+			quiet=true;
+			break;
+		case 8:
+			storm_writes=atol(optarg);
+			break;
+		case 9:
+			storm_files=atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--backend=inotify|fanotify] [--events=create,delete,...] [--window=ms] [--delay=ms] [--workers=n] [--bufsize=KB] [--max-pending=n] [--quiet] [--storm=n] [--storm-files=n] dir...\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(optind==argc) {
+		fprintf(stderr, "%s: give at least one directory\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if(workers<1) {
+		fprintf(stderr, "%s: --workers must be at least 1\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if(storm_files<1) {
+		fprintf(stderr, "%s: --storm-files must be at least 1\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	window*=1000000;
+	delay*=1000000;
+	TreeWatcher* w=TreeWatcher::create(backend, mask, window, workers, bufsize*1024);
+	if(w==NULL) {
+		fprintf(stderr, "%s: unknown backend %s\n", argv[0], backend);
+		return EXIT_FAILURE;
+	}
+	w->set_limits(max_pending, 16);
+	uint64_t start=latency_now();
+	for(int i=optind; i<argc; i++) {
+		w->add_tree(argv[i]);
+	}
+	fprintf(stderr, "watching %lu %s in %.3lfs, stop me with [kill %d]\n", w->get_stats().watches, w->get_stats().watches==1?"mark":"directories", (latency_now()-start)/1e9, getpid());
+
+	sigset_t sigs;
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	sigaddset(&sigs, SIGUSR1);
+	sigaddset(&sigs, SIGCHLD);
+	CHECK_NOT_M1(sigprocmask(SIG_BLOCK, &sigs, NULL));
+	int sfd=CHECK_NOT_M1(signalfd(-1, &sigs, SFD_NONBLOCK|SFD_CLOEXEC));
+	int tfd=CHECK_NOT_M1(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC));
+	int epfd=CHECK_NOT_M1(epoll_create1(EPOLL_CLOEXEC));
+	struct epoll_event ev;
+	const uint32_t watch_events=delay>0?EPOLLIN|EPOLLONESHOT:EPOLLIN;
+	ev.events=watch_events;
+	ev.data.fd=w->get_fd();
+	CHECK_NOT_M1(epoll_ctl(epfd, EPOLL_CTL_ADD, w->get_fd(), &ev));
+	ev.events=EPOLLIN;
+	ev.data.fd=sfd;
+	CHECK_NOT_M1(epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &ev));
+	ev.data.fd=tfd;
+	CHECK_NOT_M1(epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev));
+
+	pid_t child=-1;
+	if(storm_writes>=0) {
+		child=CHECK_NOT_M1(fork());
+		if(child==0) {
+			storm(argv[optind], storm_writes, storm_files);
+			_exit(EXIT_SUCCESS);
+		}
+	}
+	TreeWatcher::Callback cb=[quiet](const TreeWatchEvent& e) {
+		if(!quiet) {
+			print_event(e);
+		}
+	};
+	// with --delay: when the watcher fd is armed again, 0 if it is armed
+	uint64_t rearm=0;
+	bool stop=false;
+	while(!stop) {
+		struct epoll_event evs[3];
+		int n=CHECK_NOT_M1(epoll_wait(epfd, evs, ARRAY_SIZEOF(evs), -1));
+		uint64_t now=latency_now();
+		for(int i=0; i<n; i++) {
+			int fd=evs[i].data.fd;
+			if(fd==w->get_fd()) {
+				w->read_events(now);
+				if(delay>0) {
+					rearm=now+delay;
+				}
+			} else if(fd==sfd) {
+				struct signalfd_siginfo si;
+				while(read(sfd, &si, sizeof(si))==sizeof(si)) {
+					if(si.ssi_signo==SIGUSR1) {
+						print_stats(w);
+					} else if(si.ssi_signo==SIGCHLD) {
+						if(waitpid(child, NULL, WNOHANG)==child) {
+							// take in what the child left in the queue
+							while(w->read_events(latency_now())) {
+							}
+							stop=true;
+						}
+					} else {
+						stop=true;
+					}
+				}
+			} else {
+				uint64_t expirations;
+				CHECK_ASSERT(read(tfd, &expirations, sizeof(expirations))==sizeof(expirations) || errno==EAGAIN);
+			}
+		}
+		if(rearm>0 && rearm<=now) {
+			ev.events=watch_events;
+			ev.data.fd=w->get_fd();
+			CHECK_NOT_M1(epoll_ctl(epfd, EPOLL_CTL_MOD, w->get_fd(), &ev));
+			rearm=0;
+		}
+		w->flush(now, cb);
+		uint64_t deadline=w->next_deadline();
+		if(rearm>0 && (deadline==0 || rearm<deadline)) {
+			deadline=rearm;
+		}
+		set_timer(tfd, deadline);
+		if(!quiet) {
+			fflush(stdout);
+		}
+	}
+	w->flush(latency_now(), cb, true);
+	print_stats(w);
+	CHECK_NOT_M1(close(epfd));
+	CHECK_NOT_M1(close(tfd));
+	CHECK_NOT_M1(close(sfd));
+	delete w;
+	return EXIT_SUCCESS;
+}
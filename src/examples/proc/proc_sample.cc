@@ -0,0 +1,363 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for pid_t
+#include <sys/wait.h>	// for waitpid(2)
+#include <sys/resource.h>	// for getrlimit(2), setrlimit(2), struct rlimit, RLIMIT_NOFILE
+#include <signal.h>	// for kill(2), SIGKILL
+#include <dirent.h>	// for opendir(3), readdir(3), closedir(3)
+#include <stdio.h>	// for printf(3), fprintf(3), fopen(3), fgets(3), fscanf(3), sscanf(3), fclose(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3), atof(3), system(3)
+#include <string.h>	// for strcmp(3), strtok_r(3), strrchr(3)
+#include <unistd.h>	// for fork(2), pause(2), _exit(2), sysconf(3)
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_NOT_NULL(), CHECK_ZERO()
+#include <proc_reader.h>	// for proc_reader_t, proc_read_*()
+#include <multiproc_utils.h>	// for my_system()
+#include <LatencyHistogram.hh>	// for latency_now()
+#include <vector>	// for vector<T>
+#include <string>	// for string
+
+using namespace std;
+
+/*
+ * Sampling the /proc files of many processes, the way a monitoring agent
+ * does it every second, with:
+ * - reader: proc_reader.h, the fds of every process opened once and a
+ * pread(2) plus hand written parsing per file per sample.
+ * - fopen: fopen(3), fgets(3)/sscanf(3) and fclose(3) per file per sample,
+ * the way the helpers in proc_utils.h used to parse /proc.
+ * - system: my_system("cat /proc/<pid>/<file>"), what proc_utils.h used to
+ * do to show a /proc file (output to /dev/null).
+ * - ps: procps itself, one "ps -e -o ..." per sample (output to /dev/null),
+ * which reads stat and status of every process.
+ *
+ * Usage: proc_sample [--mode=reader|fopen|system|ps] [--files=stat,statm,
+ * status,smaps_rollup,schedstat,io] [--spawn=n] [--seconds=s] [--print]
+ *
+ * All the processes in /proc are sampled, --spawn adds n sleeping children
+ * so there is something to sample. --print shows what the reader parsed
+ * in the last sample. The result is samples per second and the cost per
+ * process per sample.
+ *
+ * The reader keeps a fd per file per process open, so RLIMIT_NOFILE is
+ * raised to cover them (a reader that runs out of fds fails instead of
+ * silently sampling less). failed_opens counts files left closed for lack
+ * of permission (io of processes of other users when not root).
+ *
+ * Numbers on a single core VM, 263 processes (--spawn=200), stat, statm,
+ * status, schedstat and io of every process (us per process per sample):
+ *	reader	10
+ *	fopen	31
+ *	system	11000
+ *	ps	45 (stat and status only)
+ * The reader is three times faster than stdio: no open(2)/close(2) per file
+ * (each of them a path walk in /proc), no FILE allocation and no scanf(3).
+ * smaps_rollup alone costs 105us per process in both modes, that is the
+ * kernel walking the page tables, so it is not in the default set.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ */
+
+static vector<pid_t> list_pids() {
+	vector<pid_t> pids;
+	DIR* d=static_cast<DIR*>(CHECK_NOT_NULL(opendir("/proc")));
+	const struct dirent* de;
+	while((de=readdir(d))!=NULL) {
+		if(de->d_name[0]>='1' && de->d_name[0]<='9') {
+			pids.push_back(atoi(de->d_name));
+		}
+	}
+	CHECK_NOT_M1(closedir(d));
+	return pids;
+}
+
+// everything the reader gets for one process in one sample
+struct Sample {
+	proc_stat_t stat;
+	proc_statm_t statm;
+	proc_status_t status;
+	proc_smaps_rollup_t smaps_rollup;
+	proc_schedstat_t schedstat;
+	proc_io_t io;
+};
+
+// the parsed values are summed (like in fopen mode) so the parsing cannot
+// be optimized away and the modes can be compared
+static unsigned int sample_reader(proc_reader_t& r, unsigned int files, Sample& s, unsigned long long& sum) {
+	unsigned int ok=0;
+	if((files & PROC_FILE(proc_file_stat)) && proc_read_stat(&r, &s.stat)) {
+		sum+=s.stat.utime+s.stat.stime+s.stat.rss;
+		ok++;
+	}
+	if((files & PROC_FILE(proc_file_statm)) && proc_read_statm(&r, &s.statm)) {
+		sum+=s.statm.size+s.statm.resident+s.statm.shared;
+		ok++;
+	}
+	if((files & PROC_FILE(proc_file_status)) && proc_read_status(&r, &s.status)) {
+		sum+=s.status.vm_rss+s.status.threads+s.status.voluntary_ctxt_switches;
+		ok++;
+	}
+	if((files & PROC_FILE(proc_file_smaps_rollup)) && proc_read_smaps_rollup(&r, &s.smaps_rollup)) {
+		sum+=s.smaps_rollup.rss+s.smaps_rollup.pss;
+		ok++;
+	}
+	if((files & PROC_FILE(proc_file_schedstat)) && proc_read_schedstat(&r, &s.schedstat)) {
+		sum+=s.schedstat.run_ns+s.schedstat.timeslices;
+		ok++;
+	}
+	if((files & PROC_FILE(proc_file_io)) && proc_read_io(&r, &s.io)) {
+		sum+=s.io.rchar+s.io.wchar;
+		ok++;
+	}
+	return ok;
+}
+
+// enough fds for every file of every process, or fail
+static void raise_nofile(size_t needed) {
+	struct rlimit rl;
+	CHECK_NOT_M1(getrlimit(RLIMIT_NOFILE, &rl));
+	if(rl.rlim_cur>=needed) {
+		return;
+	}
+	if(rl.rlim_max!=RLIM_INFINITY && rl.rlim_max<needed) {
+		fprintf(stderr, "proc_sample: need %zu fds, the hard limit is %lu\n", needed, (unsigned long)rl.rlim_max);
+		exit(EXIT_FAILURE);
+	}
+	rl.rlim_cur=needed;
+	CHECK_NOT_M1(setrlimit(RLIMIT_NOFILE, &rl));
+}
+
+// "Name: value" files the stdio way, the value of every line is summed so
+// the parsing cannot be optimized away
+static unsigned long long parse_fields_stdio(FILE* fp) {
+	char line[256];
+	char name[64];
+	unsigned long long v, sum=0;
+	while(fgets(line, sizeof(line), fp)!=NULL) {
+		if(sscanf(line, "%63[^:]: %llu", name, &v)==2) {
+			sum+=v;
+		}
+	}
+	return sum;
+}
+
+static unsigned int sample_fopen(pid_t pid, unsigned int files, unsigned long long& sum) {
+	unsigned int ok=0;
+	char path[64];
+	for(int f=0; f<proc_file_count; f++) {
+		if(!(files & PROC_FILE(f))) {
+			continue;
+		}
+		snprintf(path, sizeof(path), "/proc/%d/%s", pid, proc_file_names[f]);
+		FILE* fp=fopen(path, "r");
+		if(fp==NULL) {
+			continue;
+		}
+		char buf[1024];
+		switch(f) {
+		case proc_file_stat:
+			if(fgets(buf, sizeof(buf), fp)!=NULL) {
+				const char* close=strrchr(buf, ')');
+				char state;
+				int ppid;
+				unsigned long minflt, majflt, utime, stime;
+				long rss;
+				if(close!=NULL && sscanf(close+2, "%c %d %*d %*d %*d %*d %*u %lu %*u %lu %*u %lu %lu %*d %*d %*d %*d %*d %*d %*u %*u %ld", &state, &ppid, &minflt, &majflt, &utime, &stime, &rss)==7) {
+					sum+=utime+stime+rss;
+					ok++;
+				}
+			}
+			break;
+		case proc_file_statm:
+		case proc_file_schedstat: {
+			unsigned long long v;
+			while(fscanf(fp, "%llu", &v)==1) {
+				sum+=v;
+			}
+			ok++;
+			break;
+		}
+		default:
+			sum+=parse_fields_stdio(fp);
+			ok++;
+			break;
+		}
+		fclose(fp);
+	}
+	return ok;
+}
+
+static unsigned int parse_files(const char* s) {
+	unsigned int files=0;
+	string copy(s);
+	char* save;
+	for(char* tok=strtok_r(&copy[0], ",", &save); tok!=NULL; tok=strtok_r(NULL, ",", &save)) {
+		int f;
+		for(f=0; f<proc_file_count; f++) {
+			if(strcmp(tok, proc_file_names[f])==0) {
+				files|=PROC_FILE(f);
+				break;
+			}
+		}
+		if(f==proc_file_count) {
+			fprintf(stderr, "proc_sample: unknown file %s\n", tok);
+			exit(EXIT_FAILURE);
+		}
+	}
+	return files;
+}
+
+int main(int argc, char** argv) {
+	const char* mode="reader";
+	unsigned int files=PROC_FILE(proc_file_stat)|PROC_FILE(proc_file_statm)|PROC_FILE(proc_file_status)|PROC_FILE(proc_file_schedstat)|PROC_FILE(proc_file_io);
+	unsigned int spawn=0;
+	double seconds=2;
+	bool print=false;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"mode", required_argument, 0, 0},
+			{"files", required_argument, 0, 1},
+			{"spawn", required_argument, 0, 2},
+			{"seconds", required_argument, 0, 3},
+			{"print", no_argument, 0, 4},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			mode=optarg;
+			break;
+		case 1:
+			files=parse_files(optarg);
+			break;
+		case 2:
+			spawn=atoi(optarg);
+			break;
+		case 3:
+			seconds=atof(optarg);
+			break;
+		case 4:
+			print=true;
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--mode=reader|fopen|system|ps] [--files=stat,statm,status,smaps_rollup,schedstat,io] [--spawn=n] [--seconds=s] [--print]\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	bool reader=strcmp(mode, "reader")==0;
+	bool use_fopen=strcmp(mode, "fopen")==0;
+	bool use_system=strcmp(mode, "system")==0;
+	bool ps=strcmp(mode, "ps")==0;
+	if(!reader && !use_fopen && !use_system && !ps) {
+		fprintf(stderr, "%s: unknown mode %s\n", argv[0], mode);
+		return EXIT_FAILURE;
+	}
+	if(reader) {
+		// before the fork so a failure leaves no children behind, with
+		// room for processes that show up until we list them
+		raise_nofile((list_pids().size()+spawn)*__builtin_popcount(files)+256);
+	}
+	vector<pid_t> children;
+	for(unsigned int i=0; i<spawn; i++) {
+		pid_t pid=CHECK_NOT_M1(fork());
+		if(pid==0) {
+			pause();
+			_exit(EXIT_SUCCESS);
+		}
+		children.push_back(pid);
+	}
+	vector<pid_t> pids=list_pids();
+	vector<proc_reader_t> readers;
+	vector<Sample> samples;
+	// files left closed for lack of permission (io of other users)
+	unsigned long failed_opens=0;
+	if(reader) {
+		readers.resize(pids.size());
+		samples.resize(pids.size());
+		for(size_t i=0; i<pids.size(); i++) {
+			if(!proc_reader_open(&readers[i], pids[i], files)) {
+				// went away since we listed it
+				readers[i].pid=-1;
+				continue;
+			}
+			for(int f=0; f<proc_file_count; f++) {
+				if((files & PROC_FILE(f)) && readers[i].fds[f]==-1) {
+					failed_opens++;
+				}
+			}
+		}
+	}
+	unsigned long long sum=0;
+	unsigned long reads=0;
+	unsigned long nsamples=0;
+	uint64_t start=latency_now();
+	uint64_t end=start+seconds*1e9;
+	do {
+		if(reader) {
+			for(size_t i=0; i<pids.size(); i++) {
+				if(readers[i].pid!=-1) {
+					reads+=sample_reader(readers[i], files, samples[i], sum);
+				}
+			}
+		} else if(use_fopen) {
+			for(pid_t pid : pids) {
+				reads+=sample_fopen(pid, files, sum);
+			}
+		} else if(use_system) {
+			for(pid_t pid : pids) {
+				for(int f=0; f<proc_file_count; f++) {
+					if(files & PROC_FILE(f)) {
+						my_system("cat /proc/%d/%s > /dev/null 2>&1 || true", pid, proc_file_names[f]);
+						reads++;
+					}
+				}
+			}
+		} else {
+			CHECK_ZERO(system("ps -e -o pid,ppid,stat,rss,vsz,min_flt,maj_flt,time,nlwp,comm > /dev/null"));
+		}
+		nsamples++;
+	} while(latency_now()<end);
+	double elapsed=(latency_now()-start)/1e9;
+	if(print && reader) {
+		long page_kb=sysconf(_SC_PAGESIZE)/1024;
+		printf("%7s %c %8s %8s %8s %6s %12s %12s %s\n", "PID", 'S', "RSS_KB", "VMRSS_KB", "MINFLT", "THR", "RUN_NS", "RCHAR", "COMM");
+		for(size_t i=0; i<pids.size(); i++) {
+			if(readers[i].pid==-1) {
+				continue;
+			}
+			const Sample& s=samples[i];
+			printf("%7d %c %8ld %8llu %8lu %6llu %12llu %12llu %s\n", pids[i], s.stat.state, s.stat.rss*page_kb, s.status.vm_rss, s.stat.minflt, s.status.threads, s.schedstat.run_ns, s.io.rchar, s.stat.comm);
+		}
+	}
+	printf("mode=%s processes=%zu samples=%lu samples/s=%.1lf us_per_process=%.2lf file_reads=%lu failed_opens=%lu checksum=%llu\n", mode, pids.size(), nsamples, nsamples/elapsed, elapsed*1e6/nsamples/pids.size(), reads, failed_opens, sum);
+	for(proc_reader_t& r : readers) {
+		if(r.pid!=-1) {
+			proc_reader_close(&r);
+		}
+	}
+	for(pid_t pid : children) {
+		CHECK_NOT_M1(kill(pid, SIGKILL));
+		CHECK_NOT_M1(waitpid(pid, NULL, 0));
+	}
+	return EXIT_SUCCESS;
+}
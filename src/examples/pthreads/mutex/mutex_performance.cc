@@ -22,9 +22,12 @@
 #include <sys/types.h>	// for ftok(3), semget(3), semctl(3), semop(3)
 #include <sys/ipc.h>	// for ftok(3), semget(3), semctl(3), semop(3)
 #include <sys/sem.h>	// for semget(3), semctl(3), semop(3)
-#include <err_utils.h>	// for CHECK_ZERO_ERRNO(), CHECK_ZERO(), CHECK_NOT_M1()
+#include <err_utils.h>	// for CHECK_ZERO_ERRNO(), CHECK_ZERO(), CHECK_NOT_M1(), CHECK_ASSERT()
 #include <sched_utils.h>// for sched_run_priority(), SCHED_FIFO_HIGH_PRIORITY:const
 #include <measure.h>	// for measure, measure_init(), measure_start(), measure_end(), measure_print()
+#include <futex_utils.h>	// for futex_mutex_t, futex_sem_t, futex_cond_t, futex_eventcount_t and their functions
+#include <stdlib.h>	// for atoi(3), EXIT_SUCCESS, EXIT_FAILURE
+#include <stdio.h>	// for fprintf(3)
 
 /*
  * This demo shows the difference between regular pthread mutex (which is a
@@ -41,10 +44,22 @@
  * 10 times more. In all other aspects all other types of locks (recursive, non
  * recursive, shared, non shared) perform about the same.
  *
+ * The futex based primitives from futex_utils.h are measured as well, both in
+ * the single thread loop and in a contended run where [threads] threads (default 4)
+ * fight over the same lock with a tiny critical section. The single thread loop
+ * never shows contention at all, which is where the implementations differ: spinning
+ * before sleeping saves the futex(2) calls when the lock is held for a short
+ * time. A condition variable ping-pong between two threads is measured too,
+ * with pthread, futex and eventcount based waiting. With a single waiter a
+ * broadcast is a signal, so a broadcast round with [threads] waiters on the
+ * same condition variable is measured as well: that is where
+ * futex_cond_broadcast() requeues the waiters onto the mutex instead of
+ * waking them all to fight over it.
+ *
  * EXTRA_LINK_FLAGS_AFTER=-lpthread
  */
 
-void do_work(pthread_mutex_t* mutex, sem_t* sem, int semid, const char* name) {
+void do_work(pthread_mutex_t* mutex, sem_t* sem, int semid, futex_mutex_t* fmutex, futex_sem_t* fsem, const char* name) {
 	const unsigned int loop=1000000;
 	measure m;
 	measure_init(&m, name, loop);
@@ -69,6 +84,14 @@ void do_work(pthread_mutex_t* mutex, sem_t* sem, int semid, const char* name) {
 			sops.sem_flg=0;
 			CHECK_NOT_M1(semop(semid, &sops, 1));
 		}
+		if(fmutex) {
+			futex_mutex_lock(fmutex);
+			futex_mutex_unlock(fmutex);
+		}
+		if(fsem) {
+			futex_sem_wait(fsem);
+			futex_sem_post(fsem);
+		}
 	}
 	measure_end(&m);
 	measure_print(&m);
@@ -80,18 +103,318 @@ static pthread_mutex_t mutex_errorcheck;
 static sem_t sem_nonshared;
 static sem_t sem_shared;
 static int semid;
+static futex_mutex_t futex_mutex_spin;
+static futex_mutex_t futex_mutex_nospin;
+static futex_sem_t futex_sem;
 
 void* work(void*) {
-	do_work(&mutex_fast, NULL, -1, "fast mutexes");
-	do_work(&mutex_recursive, NULL, -1, "recursive mutexes");
-	do_work(&mutex_errorcheck, NULL, -1, "error checking mutexes");
-	do_work(NULL, &sem_nonshared, -1, "non shared semaphores");
-	do_work(NULL, &sem_shared, -1, "shared semaphores");
-	do_work(NULL, NULL, semid, "SYSV IPC semaphores");
+	do_work(&mutex_fast, NULL, -1, NULL, NULL, "fast mutexes");
+	do_work(&mutex_recursive, NULL, -1, NULL, NULL, "recursive mutexes");
+	do_work(&mutex_errorcheck, NULL, -1, NULL, NULL, "error checking mutexes");
+	do_work(NULL, &sem_nonshared, -1, NULL, NULL, "non shared semaphores");
+	do_work(NULL, &sem_shared, -1, NULL, NULL, "shared semaphores");
+	do_work(NULL, NULL, semid, NULL, NULL, "SYSV IPC semaphores");
+	do_work(NULL, NULL, -1, &futex_mutex_spin, NULL, "futex mutexes (adaptive spin)");
+	do_work(NULL, NULL, -1, &futex_mutex_nospin, NULL, "futex mutexes (no spin)");
+	do_work(NULL, NULL, -1, NULL, &futex_sem, "futex semaphores");
+	return NULL;
+}
+
+/*
+ * The contended case: many threads on the same lock
+ */
+typedef enum _lock_type{
+	LOCK_PTHREAD_MUTEX,
+	LOCK_FUTEX_MUTEX_SPIN,
+	LOCK_FUTEX_MUTEX_NOSPIN,
+	LOCK_POSIX_SEM,
+	LOCK_FUTEX_SEM,
+} lock_type;
+
+typedef struct _contended_data{
+	lock_type type;
+	unsigned int loop;
+	unsigned long counter;
+} contended_data;
+
+static void* contended_worker(void* p) {
+	contended_data* cd=static_cast<contended_data*>(p);
+	for(unsigned int i=0; i<cd->loop; i++) {
+		switch(cd->type) {
+		case LOCK_PTHREAD_MUTEX:
+			CHECK_ZERO_ERRNO(pthread_mutex_lock(&mutex_fast));
+			cd->counter++;
+			CHECK_ZERO_ERRNO(pthread_mutex_unlock(&mutex_fast));
+			break;
+		case LOCK_FUTEX_MUTEX_SPIN:
+			futex_mutex_lock(&futex_mutex_spin);
+			cd->counter++;
+			futex_mutex_unlock(&futex_mutex_spin);
+			break;
+		case LOCK_FUTEX_MUTEX_NOSPIN:
+			futex_mutex_lock(&futex_mutex_nospin);
+			cd->counter++;
+			futex_mutex_unlock(&futex_mutex_nospin);
+			break;
+		case LOCK_POSIX_SEM:
+			CHECK_ZERO(sem_wait(&sem_nonshared));
+			cd->counter++;
+			CHECK_ZERO(sem_post(&sem_nonshared));
+			break;
+		case LOCK_FUTEX_SEM:
+			futex_sem_wait(&futex_sem);
+			cd->counter++;
+			futex_sem_post(&futex_sem);
+			break;
+		}
+	}
+	return NULL;
+}
+
+void do_contended(lock_type type, unsigned int thread_num, const char* name) {
+	const unsigned int loop=1000000;
+	contended_data cd;
+	cd.type=type;
+	cd.loop=loop/thread_num;
+	cd.counter=0;
+	pthread_t* threads=new pthread_t[thread_num];
+	measure m;
+	measure_init(&m, name, cd.loop*thread_num);
+	measure_start(&m);
+	for(unsigned int i=0; i<thread_num; i++) {
+		CHECK_ZERO_ERRNO(pthread_create(threads+i, NULL, contended_worker, &cd));
+	}
+	for(unsigned int i=0; i<thread_num; i++) {
+		CHECK_ZERO_ERRNO(pthread_join(threads[i], NULL));
+	}
+	measure_end(&m);
+	measure_print(&m);
+	// the lock must have protected the counter
+	CHECK_ASSERT(cd.counter==cd.loop*thread_num);
+	delete[] threads;
+}
+
+/*
+ * Condition variable ping-pong: two threads pass a turn back and forth
+ */
+typedef enum _wait_type{
+	WAIT_PTHREAD_COND,
+	WAIT_FUTEX_COND,
+	WAIT_FUTEX_EVENTCOUNT,
+} wait_type;
+
+typedef struct _pingpong_data{
+	wait_type type;
+	unsigned int loop;
+	int turn;
+	pthread_mutex_t pmutex;
+	pthread_cond_t pcond;
+	futex_mutex_t fmutex;
+	futex_cond_t fcond;
+	futex_eventcount_t ec;
+} pingpong_data;
+
+static void pingpong_wait_turn(pingpong_data* pd, int me) {
+	switch(pd->type) {
+	case WAIT_PTHREAD_COND:
+		CHECK_ZERO_ERRNO(pthread_mutex_lock(&pd->pmutex));
+		while(pd->turn!=me) {
+			CHECK_ZERO_ERRNO(pthread_cond_wait(&pd->pcond, &pd->pmutex));
+		}
+		CHECK_ZERO_ERRNO(pthread_mutex_unlock(&pd->pmutex));
+		break;
+	case WAIT_FUTEX_COND:
+		futex_mutex_lock(&pd->fmutex);
+		while(pd->turn!=me) {
+			futex_cond_wait(&pd->fcond, &pd->fmutex);
+		}
+		futex_mutex_unlock(&pd->fmutex);
+		break;
+	case WAIT_FUTEX_EVENTCOUNT:
+		while(__atomic_load_n(&pd->turn, __ATOMIC_ACQUIRE)!=me) {
+			int key=futex_eventcount_prepare(&pd->ec);
+			if(__atomic_load_n(&pd->turn, __ATOMIC_ACQUIRE)==me) {
+				futex_eventcount_cancel(&pd->ec);
+				break;
+			}
+			futex_eventcount_commit(&pd->ec, key);
+		}
+		break;
+	}
+}
+
+static void pingpong_give_turn(pingpong_data* pd, int other) {
+	switch(pd->type) {
+	case WAIT_PTHREAD_COND:
+		CHECK_ZERO_ERRNO(pthread_mutex_lock(&pd->pmutex));
+		pd->turn=other;
+		CHECK_ZERO_ERRNO(pthread_cond_signal(&pd->pcond));
+		CHECK_ZERO_ERRNO(pthread_mutex_unlock(&pd->pmutex));
+		break;
+	case WAIT_FUTEX_COND:
+		futex_mutex_lock(&pd->fmutex);
+		pd->turn=other;
+		futex_cond_broadcast(&pd->fcond);
+		futex_mutex_unlock(&pd->fmutex);
+		break;
+	case WAIT_FUTEX_EVENTCOUNT:
+		__atomic_store_n(&pd->turn, other, __ATOMIC_RELEASE);
+		futex_eventcount_notify(&pd->ec);
+		break;
+	}
+}
+
+static void* pingpong_worker(void* p) {
+	pingpong_data* pd=static_cast<pingpong_data*>(p);
+	for(unsigned int i=0; i<pd->loop; i++) {
+		pingpong_wait_turn(pd, 1);
+		pingpong_give_turn(pd, 0);
+	}
+	return NULL;
+}
+
+void do_pingpong(wait_type type, const char* name) {
+	const unsigned int loop=100000;
+	pingpong_data pd;
+	pd.type=type;
+	pd.loop=loop;
+	pd.turn=0;
+	CHECK_ZERO_ERRNO(pthread_mutex_init(&pd.pmutex, NULL));
+	CHECK_ZERO_ERRNO(pthread_cond_init(&pd.pcond, NULL));
+	futex_mutex_init(&pd.fmutex, FUTEX_MUTEX_DEFAULT_SPIN_MAX);
+	futex_cond_init(&pd.fcond);
+	futex_eventcount_init(&pd.ec);
+	pthread_t other;
+	measure m;
+	measure_init(&m, name, loop);
+	measure_start(&m);
+	CHECK_ZERO_ERRNO(pthread_create(&other, NULL, pingpong_worker, &pd));
+	for(unsigned int i=0; i<loop; i++) {
+		pingpong_give_turn(&pd, 1);
+		pingpong_wait_turn(&pd, 0);
+	}
+	CHECK_ZERO_ERRNO(pthread_join(other, NULL));
+	measure_end(&m);
+	measure_print(&m);
+	CHECK_ZERO_ERRNO(pthread_cond_destroy(&pd.pcond));
+	CHECK_ZERO_ERRNO(pthread_mutex_destroy(&pd.pmutex));
+}
+
+/*
+ * Condition variable broadcast: 'waiters' threads block on the same
+ * condition and are released together, round after round. The last one to
+ * arrive tells the main thread which opens the next round.
+ */
+typedef struct _broadcast_data{
+	wait_type type;
+	unsigned int loop;
+	unsigned int waiters;
+	unsigned int arrived;
+	unsigned int generation;
+	pthread_mutex_t pmutex;
+	pthread_cond_t pcond;
+	futex_mutex_t fmutex;
+	futex_cond_t fcond;
+} broadcast_data;
+
+static void broadcast_lock(broadcast_data* bd) {
+	if(bd->type==WAIT_PTHREAD_COND) {
+		CHECK_ZERO_ERRNO(pthread_mutex_lock(&bd->pmutex));
+	} else {
+		futex_mutex_lock(&bd->fmutex);
+	}
+}
+
+static void broadcast_unlock(broadcast_data* bd) {
+	if(bd->type==WAIT_PTHREAD_COND) {
+		CHECK_ZERO_ERRNO(pthread_mutex_unlock(&bd->pmutex));
+	} else {
+		futex_mutex_unlock(&bd->fmutex);
+	}
+}
+
+static void broadcast_wait(broadcast_data* bd) {
+	if(bd->type==WAIT_PTHREAD_COND) {
+		CHECK_ZERO_ERRNO(pthread_cond_wait(&bd->pcond, &bd->pmutex));
+	} else {
+		futex_cond_wait(&bd->fcond, &bd->fmutex);
+	}
+}
+
+static void broadcast_wake_all(broadcast_data* bd) {
+	if(bd->type==WAIT_PTHREAD_COND) {
+		CHECK_ZERO_ERRNO(pthread_cond_broadcast(&bd->pcond));
+	} else {
+		futex_cond_broadcast(&bd->fcond);
+	}
+}
+
+static void* broadcast_worker(void* p) {
+	broadcast_data* bd=static_cast<broadcast_data*>(p);
+	broadcast_lock(bd);
+	for(unsigned int i=0; i<bd->loop; i++) {
+		unsigned int generation=bd->generation;
+		bd->arrived++;
+		if(bd->arrived==bd->waiters) {
+			broadcast_wake_all(bd);
+		}
+		while(bd->generation==generation) {
+			broadcast_wait(bd);
+		}
+	}
+	broadcast_unlock(bd);
 	return NULL;
 }
 
-int main() {
+void do_broadcast(wait_type type, unsigned int waiters, const char* name) {
+	const unsigned int loop=20000;
+	broadcast_data bd;
+	bd.type=type;
+	bd.loop=loop;
+	bd.waiters=waiters;
+	bd.arrived=0;
+	bd.generation=0;
+	CHECK_ZERO_ERRNO(pthread_mutex_init(&bd.pmutex, NULL));
+	CHECK_ZERO_ERRNO(pthread_cond_init(&bd.pcond, NULL));
+	futex_mutex_init(&bd.fmutex, FUTEX_MUTEX_DEFAULT_SPIN_MAX);
+	futex_cond_init(&bd.fcond);
+	pthread_t* threads=new pthread_t[waiters];
+	measure m;
+	measure_init(&m, name, loop);
+	measure_start(&m);
+	for(unsigned int i=0; i<waiters; i++) {
+		CHECK_ZERO_ERRNO(pthread_create(threads+i, NULL, broadcast_worker, &bd));
+	}
+	broadcast_lock(&bd);
+	for(unsigned int i=0; i<loop; i++) {
+		while(bd.arrived<waiters) {
+			broadcast_wait(&bd);
+		}
+		bd.arrived=0;
+		bd.generation++;
+		broadcast_wake_all(&bd);
+	}
+	broadcast_unlock(&bd);
+	for(unsigned int i=0; i<waiters; i++) {
+		CHECK_ZERO_ERRNO(pthread_join(threads[i], NULL));
+	}
+	measure_end(&m);
+	measure_print(&m);
+	// every waiter saw every round
+	CHECK_ASSERT(bd.generation==loop && bd.arrived==0);
+	delete[] threads;
+	CHECK_ZERO_ERRNO(pthread_cond_destroy(&bd.pcond));
+	CHECK_ZERO_ERRNO(pthread_mutex_destroy(&bd.pmutex));
+}
+
+int main(int argc, char** argv) {
+	// signed so that a negative count is refused and does not wrap around
+	const int thread_num=argc>1 ? atoi(argv[1]) : 4;
+	// the work is divided between the threads
+	if(argc>2 || thread_num<1 || thread_num>1024) {
+		fprintf(stderr, "%s: usage: %s [threads]\n", argv[0], argv[0]);
+		return EXIT_FAILURE;
+	}
 	key_t key=CHECK_NOT_M1(ftok("/etc/passwd", 'x'));
 	semid=CHECK_NOT_M1(semget(key, 1, IPC_CREAT | 0666));
 	CHECK_NOT_M1(semctl(semid, 0, SETVAL, 1));
@@ -107,7 +430,23 @@ int main() {
 	CHECK_ZERO_ERRNO(pthread_mutex_init(&mutex_recursive, &attr));
 	CHECK_ZERO_ERRNO(pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK_NP));
 	CHECK_ZERO_ERRNO(pthread_mutex_init(&mutex_errorcheck, &attr));
+	futex_mutex_init(&futex_mutex_spin, FUTEX_MUTEX_DEFAULT_SPIN_MAX);
+	futex_mutex_init(&futex_mutex_nospin, 0);
+	futex_sem_init(&futex_sem, 1);
 	sched_run_priority(work, NULL, SCHED_FIFO_HIGH_PRIORITY, SCHED_FIFO);
+
+	// contended runs are done at normal priority since SCHED_FIFO threads
+	// spinning on the same core would starve the lock holder
+	do_contended(LOCK_PTHREAD_MUTEX, thread_num, "contended fast mutexes");
+	do_contended(LOCK_FUTEX_MUTEX_SPIN, thread_num, "contended futex mutexes (adaptive spin)");
+	do_contended(LOCK_FUTEX_MUTEX_NOSPIN, thread_num, "contended futex mutexes (no spin)");
+	do_contended(LOCK_POSIX_SEM, thread_num, "contended non shared semaphores");
+	do_contended(LOCK_FUTEX_SEM, thread_num, "contended futex semaphores");
+	do_pingpong(WAIT_PTHREAD_COND, "pthread condition variable ping-pong");
+	do_pingpong(WAIT_FUTEX_COND, "futex condition variable ping-pong");
+	do_pingpong(WAIT_FUTEX_EVENTCOUNT, "futex eventcount ping-pong");
+	do_broadcast(WAIT_PTHREAD_COND, thread_num, "pthread condition variable broadcast");
+	do_broadcast(WAIT_FUTEX_COND, thread_num, "futex condition variable broadcast");
 	CHECK_ZERO_ERRNO(pthread_mutex_destroy(&mutex_fast));
 	CHECK_ZERO_ERRNO(pthread_mutex_destroy(&mutex_recursive));
 	CHECK_ZERO_ERRNO(pthread_mutex_destroy(&mutex_errorcheck));
@@ -0,0 +1,646 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <stdio.h>	// for printf(3), fprintf(3), FILE, fopen(3), fscanf(3), fclose(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3), exit(3)
+#include <string.h>	// for strcmp(3), strtok_r(3), strdup(3)
+#include <pthread.h>	// for pthread_spin_*(3), pthread_mutex_*(3), pthread_create(3), pthread_join(3), pthread_attr_setaffinity_np(3)
+#include <sched.h>	// for cpu_set_t, CPU_ZERO(3), CPU_SET(3)
+#include <unistd.h>	// for sysconf(3)
+#include <time.h>	// for nanosleep(2), struct timespec
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <stdint.h>	// for uint64_t
+#include <vector>	// for vector
+#include <err_utils.h>	// for CHECK_ZERO_ERRNO(), CHECK_NOT_M1(), CHECK_ASSERT()
+#include <atomic_utils.h>	// for cpu_relax()
+#include <futex_utils.h>	// for futex_mutex_t, futex_mutex_init(), futex_mutex_lock(), futex_mutex_unlock()
+#include <LatencyHistogram.hh>	// for LatencyHistogram, latency_now()
+
+using namespace std;
+
+/*
+ * This is a benchmark matrix of lock implementations, an extension of
+ * spinlock_performance.cc which only measures pthread_spinlock_t.
+ *
+ * Locks:
+ * tas - test and set: spin on an atomic exchange.
+ * ttas - test and test and set with exponential backoff: spin reading the
+ *	lock (which stays in the local cache) and only try the exchange when it
+ *	looks free. Back off after a failure.
+ * ticket - a ticket lock: fair (FIFO) but all waiters spin on the same line.
+ * mcs - the Mellor-Crummey Scott queue lock: every waiter spins on its own
+ *	node so a release touches only one other cache.
+ * clh - the Craig, Landin and Hagersten queue lock: like mcs but waiters spin
+ *	on the node of their predecessor.
+ * atomics - the CAS spinlock of spinlock_implementation_using_atomics.c.
+ * pthread_spin - pthread_spinlock_t.
+ * pthread_mutex - pthread_mutex_t.
+ * futex - the adaptive futex mutex from futex_utils.h.
+ *
+ * Every combination of lock, thread count, critical section length and
+ * placement is run for a fixed time. Each thread measures the latency of every
+ * lock acquisition. The critical section increments a shared counter
+ * [cs] times and the code between critical sections does [cs] iterations of
+ * local work. One CSV line is printed per combination.
+ *
+ * Placements:
+ * same_cpu - all threads on one logical CPU (the bad case of spinlocks).
+ * smt - threads on the hyper threads of one physical core.
+ * cross_core - threads on different physical cores of the same socket.
+ * cross_socket - threads spread round robin over the sockets.
+ * A placement that the machine cannot provide for the requested number of
+ * threads is skipped with a message on stderr. The topology is read from
+ * /sys/devices/system/cpu/cpuN/topology.
+ *
+ * Example:
+ * ./spinlock_matrix.elf --locks=ticket,mcs --threads=2,4 --cs=0,100 --placements=cross_core > out.csv
+ *
+ * EXTRA_LINK_FLAGS_AFTER=-lpthread
+ */
+
+static const unsigned int cache_line=64;
+
+/*
+ * The locks
+ */
+typedef struct _tas_lock{
+	int val;
+} __attribute__((aligned(cache_line))) tas_lock;
+
+static inline void tas_lock_acquire(tas_lock* l) {
+	while(__atomic_exchange_n(&l->val, 1, __ATOMIC_ACQUIRE)) {
+		cpu_relax();
+	}
+}
+
+static inline void tas_lock_release(tas_lock* l) {
+	__atomic_store_n(&l->val, 0, __ATOMIC_RELEASE);
+}
+
+static inline void ttas_lock_acquire(tas_lock* l) {
+	unsigned int backoff=1;
+	while(true) {
+		while(__atomic_load_n(&l->val, __ATOMIC_RELAXED)) {
+			cpu_relax();
+		}
+		if(!__atomic_exchange_n(&l->val, 1, __ATOMIC_ACQUIRE)) {
+			return;
+		}
+		for(unsigned int i=0; i<backoff; i++) {
+			cpu_relax();
+		}
+		if(backoff<1024) {
+			backoff*=2;
+		}
+	}
+}
+
+typedef struct _ticket_lock{
+	unsigned int next;
+	unsigned int owner;
+} __attribute__((aligned(cache_line))) ticket_lock;
+
+static inline void ticket_lock_acquire(ticket_lock* l) {
+	unsigned int me=__atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED);
+	while(__atomic_load_n(&l->owner, __ATOMIC_ACQUIRE)!=me) {
+		cpu_relax();
+	}
+}
+
+static inline void ticket_lock_release(ticket_lock* l) {
+	__atomic_store_n(&l->owner, l->owner+1, __ATOMIC_RELEASE);
+}
+
+typedef struct _mcs_node{
+	struct _mcs_node* next;
+	int locked;
+} __attribute__((aligned(cache_line))) mcs_node;
+
+typedef struct _mcs_lock{
+	mcs_node* tail;
+} __attribute__((aligned(cache_line))) mcs_lock;
+
+static inline void mcs_lock_acquire(mcs_lock* l, mcs_node* me) {
+	me->next=NULL;
+	me->locked=1;
+	mcs_node* prev=__atomic_exchange_n(&l->tail, me, __ATOMIC_ACQ_REL);
+	if(prev) {
+		__atomic_store_n(&prev->next, me, __ATOMIC_RELEASE);
+		while(__atomic_load_n(&me->locked, __ATOMIC_ACQUIRE)) {
+			cpu_relax();
+		}
+	}
+}
+
+static inline void mcs_lock_release(mcs_lock* l, mcs_node* me) {
+	mcs_node* next=__atomic_load_n(&me->next, __ATOMIC_ACQUIRE);
+	if(!next) {
+		mcs_node* expected=me;
+		if(__atomic_compare_exchange_n(&l->tail, &expected, NULL, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			return;
+		}
+		// a successor is in the middle of linking itself
+		while(!(next=__atomic_load_n(&me->next, __ATOMIC_ACQUIRE))) {
+			cpu_relax();
+		}
+	}
+	__atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+typedef struct _clh_node{
+	int locked;
+} __attribute__((aligned(cache_line))) clh_node;
+
+typedef struct _clh_lock{
+	clh_node* tail;
+} __attribute__((aligned(cache_line))) clh_lock;
+
+// in clh a thread gives its node to its successor and takes over the node of its
+// predecessor, so the per thread state is a pointer which changes on every release
+typedef struct _clh_thread{
+	clh_node* mine;
+	clh_node* pred;
+} clh_thread;
+
+static inline void clh_lock_acquire(clh_lock* l, clh_thread* t) {
+	__atomic_store_n(&t->mine->locked, 1, __ATOMIC_RELAXED);
+	t->pred=__atomic_exchange_n(&l->tail, t->mine, __ATOMIC_ACQ_REL);
+	while(__atomic_load_n(&t->pred->locked, __ATOMIC_ACQUIRE)) {
+		cpu_relax();
+	}
+}
+
+static inline void clh_lock_release(clh_thread* t) {
+	clh_node* mine=t->mine;
+	t->mine=t->pred;
+	__atomic_store_n(&mine->locked, 0, __ATOMIC_RELEASE);
+}
+
+// the same as spinlock_implementation_using_atomics.c
+typedef struct _mypthread_spinlock_t{
+	int val;
+} __attribute__((aligned(cache_line))) mypthread_spinlock_t;
+
+static inline void mypthread_spin_lock(mypthread_spinlock_t* lock) {
+	while(!__sync_bool_compare_and_swap(&(lock->val), 0, 1)) {
+	}
+}
+
+static inline void mypthread_spin_unlock(mypthread_spinlock_t* lock) {
+	__sync_synchronize();
+	lock->val=0;
+}
+
+typedef enum _lock_type{
+	LOCK_TAS,
+	LOCK_TTAS,
+	LOCK_TICKET,
+	LOCK_MCS,
+	LOCK_CLH,
+	LOCK_ATOMICS,
+	LOCK_PTHREAD_SPIN,
+	LOCK_PTHREAD_MUTEX,
+	LOCK_FUTEX,
+	LOCK_NUM,
+} lock_type;
+
+static const char* lock_names[]={
+	"tas",
+	"ttas",
+	"ticket",
+	"mcs",
+	"clh",
+	"atomics",
+	"pthread_spin",
+	"pthread_mutex",
+	"futex",
+};
+
+typedef enum _placement_type{
+	PLACE_SAME_CPU,
+	PLACE_SMT,
+	PLACE_CROSS_CORE,
+	PLACE_CROSS_SOCKET,
+	PLACE_NUM,
+} placement_type;
+
+static const char* placement_names[]={
+	"same_cpu",
+	"smt",
+	"cross_core",
+	"cross_socket",
+};
+
+/*
+ * all the locks, one of them is used in each run
+ */
+typedef struct _locks{
+	tas_lock tas;
+	ticket_lock ticket;
+	mcs_lock mcs;
+	clh_lock clh;
+	clh_node clh_initial;
+	mypthread_spinlock_t atomics;
+	pthread_spinlock_t pthread_spin;
+	pthread_mutex_t pthread_mutex;
+	futex_mutex_t futex;
+	// the data protected by the lock, on its own cache line
+	volatile unsigned long counter __attribute__((aligned(cache_line)));
+} locks;
+
+typedef struct _run_data{
+	lock_type type;
+	unsigned int cs;
+	volatile bool stop;
+	locks l;
+} run_data;
+
+typedef struct _thread_data{
+	run_data* rd;
+	unsigned long ops;
+	LatencyHistogram hist;
+	mcs_node mcs;
+	clh_thread clh;
+} thread_data;
+
+static inline void lock_acquire(run_data* rd, thread_data* td) {
+	switch(rd->type) {
+	case LOCK_TAS:
+		tas_lock_acquire(&rd->l.tas);
+		break;
+	case LOCK_TTAS:
+		ttas_lock_acquire(&rd->l.tas);
+		break;
+	case LOCK_TICKET:
+		ticket_lock_acquire(&rd->l.ticket);
+		break;
+	case LOCK_MCS:
+		mcs_lock_acquire(&rd->l.mcs, &td->mcs);
+		break;
+	case LOCK_CLH:
+		clh_lock_acquire(&rd->l.clh, &td->clh);
+		break;
+	case LOCK_ATOMICS:
+		mypthread_spin_lock(&rd->l.atomics);
+		break;
+	case LOCK_PTHREAD_SPIN:
+		CHECK_ZERO_ERRNO(pthread_spin_lock(&rd->l.pthread_spin));
+		break;
+	case LOCK_PTHREAD_MUTEX:
+		CHECK_ZERO_ERRNO(pthread_mutex_lock(&rd->l.pthread_mutex));
+		break;
+	case LOCK_FUTEX:
+		futex_mutex_lock(&rd->l.futex);
+		break;
+	case LOCK_NUM:
+		break;
+	}
+}
+
+static inline void lock_release(run_data* rd, thread_data* td) {
+	switch(rd->type) {
+	case LOCK_TAS:
+	case LOCK_TTAS:
+		tas_lock_release(&rd->l.tas);
+		break;
+	case LOCK_TICKET:
+		ticket_lock_release(&rd->l.ticket);
+		break;
+	case LOCK_MCS:
+		mcs_lock_release(&rd->l.mcs, &td->mcs);
+		break;
+	case LOCK_CLH:
+		clh_lock_release(&td->clh);
+		break;
+	case LOCK_ATOMICS:
+		mypthread_spin_unlock(&rd->l.atomics);
+		break;
+	case LOCK_PTHREAD_SPIN:
+		CHECK_ZERO_ERRNO(pthread_spin_unlock(&rd->l.pthread_spin));
+		break;
+	case LOCK_PTHREAD_MUTEX:
+		CHECK_ZERO_ERRNO(pthread_mutex_unlock(&rd->l.pthread_mutex));
+		break;
+	case LOCK_FUTEX:
+		futex_mutex_unlock(&rd->l.futex);
+		break;
+	case LOCK_NUM:
+		break;
+	}
+}
+
+static void* worker(void* p) {
+	thread_data* td=static_cast<thread_data*>(p);
+	run_data* rd=td->rd;
+	volatile unsigned long local=0;
+	while(!rd->stop) {
+		uint64_t start=latency_now();
+		lock_acquire(rd, td);
+		uint64_t end=latency_now();
+		for(unsigned int i=0; i<rd->cs; i++) {
+			rd->l.counter=rd->l.counter+1;
+		}
+		rd->l.counter=rd->l.counter+1;
+		lock_release(rd, td);
+		td->hist.record(end-start);
+		td->ops++;
+		for(unsigned int i=0; i<rd->cs; i++) {
+			local=local+1;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Topology
+ */
+typedef struct _cpu_info{
+	int cpu;
+	int core;
+	int socket;
+} cpu_info;
+
+static int read_topology_value(int cpu, const char* name) {
+	char path[256];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+	FILE* f=fopen(path, "r");
+	if(f==NULL) {
+		return 0;
+	}
+	int val=0;
+	if(fscanf(f, "%d", &val)!=1) {
+		val=0;
+	}
+	CHECK_NOT_EOF(fclose(f));
+	return val;
+}
+
+static vector<cpu_info> read_topology() {
+	vector<cpu_info> cpus;
+	const int cpu_num=CHECK_NOT_M1(sysconf(_SC_NPROCESSORS_ONLN));
+	for(int i=0; i<cpu_num; i++) {
+		cpu_info ci;
+		ci.cpu=i;
+		ci.core=read_topology_value(i, "core_id");
+		ci.socket=read_topology_value(i, "physical_package_id");
+		cpus.push_back(ci);
+	}
+	return cpus;
+}
+
+/*
+ * choose 'n' cpus for the placement, returns false if the machine cannot do it
+ */
+static bool choose_cpus(const vector<cpu_info>& cpus, placement_type placement, unsigned int n, vector<int>& chosen) {
+	chosen.clear();
+	switch(placement) {
+	case PLACE_SAME_CPU:
+		for(unsigned int i=0; i<n; i++) {
+			chosen.push_back(cpus[0].cpu);
+		}
+		return true;
+	case PLACE_SMT:
+		for(const cpu_info& c : cpus) {
+			if(c.socket==cpus[0].socket && c.core==cpus[0].core && chosen.size()<n) {
+				chosen.push_back(c.cpu);
+			}
+		}
+		return chosen.size()==n && n>1;
+	case PLACE_CROSS_CORE: {
+		// one logical cpu per physical core of the first socket
+		vector<int> seen_cores;
+		for(const cpu_info& c : cpus) {
+			if(c.socket!=cpus[0].socket || chosen.size()==n) {
+				continue;
+			}
+			bool seen=false;
+			for(int core : seen_cores) {
+				if(core==c.core) {
+					seen=true;
+				}
+			}
+			if(!seen) {
+				seen_cores.push_back(c.core);
+				chosen.push_back(c.cpu);
+			}
+		}
+		return chosen.size()==n && n>1;
+	}
+	case PLACE_CROSS_SOCKET: {
+		vector<vector<int>> per_socket;
+		for(const cpu_info& c : cpus) {
+			if((unsigned int)c.socket>=per_socket.size()) {
+				per_socket.resize(c.socket+1);
+			}
+			per_socket[c.socket].push_back(c.cpu);
+		}
+		if(per_socket.size()<2) {
+			return false;
+		}
+		for(unsigned int i=0; chosen.size()<n; i++) {
+			unsigned int s=i%per_socket.size();
+			unsigned int idx=i/per_socket.size();
+			if(idx>=per_socket[s].size()) {
+				return false;
+			}
+			chosen.push_back(per_socket[s][idx]);
+		}
+		return true;
+	}
+	case PLACE_NUM:
+		break;
+	}
+	return false;
+}
+
+static void run(lock_type type, placement_type placement, const vector<int>& chosen, unsigned int cs, unsigned int millis) {
+	const unsigned int thread_num=chosen.size();
+	run_data* rd=new run_data;
+	rd->type=type;
+	rd->cs=cs;
+	rd->stop=false;
+	rd->l.tas.val=0;
+	rd->l.ticket.next=0;
+	rd->l.ticket.owner=0;
+	rd->l.mcs.tail=NULL;
+	rd->l.clh_initial.locked=0;
+	rd->l.clh.tail=&rd->l.clh_initial;
+	rd->l.atomics.val=0;
+	CHECK_ZERO_ERRNO(pthread_spin_init(&rd->l.pthread_spin, PTHREAD_PROCESS_PRIVATE));
+	CHECK_ZERO_ERRNO(pthread_mutex_init(&rd->l.pthread_mutex, NULL));
+	futex_mutex_init(&rd->l.futex, FUTEX_MUTEX_DEFAULT_SPIN_MAX);
+	rd->l.counter=0;
+	pthread_t* threads=new pthread_t[thread_num];
+	thread_data* tds=new thread_data[thread_num];
+	clh_node* clh_nodes=new clh_node[thread_num];
+	uint64_t start=latency_now();
+	for(unsigned int i=0; i<thread_num; i++) {
+		tds[i].rd=rd;
+		tds[i].ops=0;
+		tds[i].clh.mine=clh_nodes+i;
+		tds[i].clh.pred=NULL;
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		CPU_SET(chosen[i], &cpu_set);
+		pthread_attr_t attr;
+		CHECK_ZERO_ERRNO(pthread_attr_init(&attr));
+		CHECK_ZERO_ERRNO(pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpu_set));
+		CHECK_ZERO_ERRNO(pthread_create(threads+i, &attr, worker, tds+i));
+		CHECK_ZERO_ERRNO(pthread_attr_destroy(&attr));
+	}
+	struct timespec ts;
+	ts.tv_sec=millis/1000;
+	ts.tv_nsec=(millis%1000)*1000000L;
+	CHECK_NOT_M1(nanosleep(&ts, NULL));
+	rd->stop=true;
+	LatencyHistogram hist;
+	unsigned long ops=0;
+	for(unsigned int i=0; i<thread_num; i++) {
+		CHECK_ZERO_ERRNO(pthread_join(threads[i], NULL));
+		hist.merge(tds[i].hist);
+		ops+=tds[i].ops;
+	}
+	uint64_t end=latency_now();
+	// the lock must have protected the counter
+	CHECK_ASSERT(rd->l.counter==ops*(cs+1));
+	double secs=(end-start)/1e9;
+	printf("%s,%s,%u,%u,%lu,%.0lf,%.1lf,%lu,%lu,%lu,%lu\n",
+		lock_names[type],
+		placement_names[placement],
+		thread_num,
+		cs,
+		ops,
+		ops/secs,
+		hist.get_mean(),
+		hist.percentile(50),
+		hist.percentile(99),
+		hist.percentile(99.9),
+		hist.get_max());
+	fflush(stdout);
+	CHECK_ZERO_ERRNO(pthread_spin_destroy(&rd->l.pthread_spin));
+	CHECK_ZERO_ERRNO(pthread_mutex_destroy(&rd->l.pthread_mutex));
+	delete[] threads;
+	delete[] tds;
+	delete[] clh_nodes;
+	delete rd;
+}
+
+/*
+ * parse a comma separated list of names (or "all") into indices
+ */
+static vector<unsigned int> parse_names(const char* arg, const char** names, unsigned int num) {
+	vector<unsigned int> res;
+	if(strcmp(arg, "all")==0) {
+		for(unsigned int i=0; i<num; i++) {
+			res.push_back(i);
+		}
+		return res;
+	}
+	char* copy=strdup(arg);
+	char* saveptr;
+	for(char* tok=strtok_r(copy, ",", &saveptr); tok; tok=strtok_r(NULL, ",", &saveptr)) {
+		bool found=false;
+		for(unsigned int i=0; i<num; i++) {
+			if(strcmp(tok, names[i])==0) {
+				res.push_back(i);
+				found=true;
+			}
+		}
+		if(!found) {
+			fprintf(stderr, "unknown name [%s]\n", tok);
+			exit(EXIT_FAILURE);
+		}
+	}
+	free(copy);
+	return res;
+}
+
+static vector<unsigned int> parse_numbers(const char* arg) {
+	vector<unsigned int> res;
+	char* copy=strdup(arg);
+	char* saveptr;
+	for(char* tok=strtok_r(copy, ",", &saveptr); tok; tok=strtok_r(NULL, ",", &saveptr)) {
+		res.push_back(atoi(tok));
+	}
+	free(copy);
+	return res;
+}
+
+int main(int argc, char** argv) {
+	const char* arg_locks="all";
+	const char* arg_placements="all";
+	const char* arg_threads="1,2,4,8";
+	const char* arg_cs="0,10,100,1000";
+	unsigned int millis=200;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"locks", required_argument, 0, 0},
+			{"placements", required_argument, 0, 1},
+			{"threads", required_argument, 0, 2},
+			{"cs", required_argument, 0, 3},
+			{"millis", required_argument, 0, 4},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			arg_locks=optarg;
+			break;
+		case 1:
+			arg_placements=optarg;
+			break;
+		case 2:
+			arg_threads=optarg;
+			break;
+		case 3:
+			arg_cs=optarg;
+			break;
+		case 4:
+			millis=atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--locks=all|tas,ttas,ticket,mcs,clh,atomics,pthread_spin,pthread_mutex,futex] [--placements=all|same_cpu,smt,cross_core,cross_socket] [--threads=1,2,4,8] [--cs=0,10,100,1000] [--millis=200]\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	vector<unsigned int> lock_list=parse_names(arg_locks, lock_names, LOCK_NUM);
+	vector<unsigned int> placement_list=parse_names(arg_placements, placement_names, PLACE_NUM);
+	vector<unsigned int> thread_list=parse_numbers(arg_threads);
+	vector<unsigned int> cs_list=parse_numbers(arg_cs);
+	vector<cpu_info> cpus=read_topology();
+	printf("lock,placement,threads,cs,ops,ops_per_sec,lat_mean_ns,lat_p50_ns,lat_p99_ns,lat_p999_ns,lat_max_ns\n");
+	for(unsigned int placement : placement_list) {
+		for(unsigned int threads : thread_list) {
+			vector<int> chosen;
+			if(!choose_cpus(cpus, (placement_type)placement, threads, chosen)) {
+				fprintf(stderr, "skipping placement %s with %u threads, not enough cpus\n", placement_names[placement], threads);
+				continue;
+			}
+			for(unsigned int cs : cs_list) {
+				for(unsigned int type : lock_list) {
+					run((lock_type)type, (placement_type)placement, chosen, cs, millis);
+				}
+			}
+		}
+	}
+	return EXIT_SUCCESS;
+}
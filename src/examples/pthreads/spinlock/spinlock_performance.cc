@@ -38,6 +38,9 @@
  * threads on the same CPU) then you will see the time slice of the operating
  * system in the histograms that are produced.
  *
+ * See spinlock_matrix.cc for a comparison of many lock implementations over
+ * thread counts, critical section lengths and thread placements.
+ *
  * EXTRA_LINK_FLAGS_AFTER=-lpthread
  */
 
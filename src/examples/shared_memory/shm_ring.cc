@@ -0,0 +1,402 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for pid_t, key_t
+#include <sys/socket.h>	// for socketpair(2)
+#include <sys/ipc.h>	// for IPC_PRIVATE, IPC_RMID
+#include <sys/msg.h>	// for msgget(2), msgsnd(2), msgrcv(2), msgctl(2)
+#include <sys/wait.h>	// for waitpid(2)
+#include <signal.h>	// for raise(3), SIGKILL
+#include <stdio.h>	// for printf(3), fprintf(3), fopen(3), fscanf(3), fclose(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3)
+#include <string.h>	// for strcmp(3), memcpy(3)
+#include <unistd.h>	// for fork(2), pipe(2), read(2), write(2), close(2), _exit(2)
+#include <getopt.h>	// for getopt_long(3), struct option
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_ASSERT(), CHECK_NOT_NULL_FILEP()
+#include <shm_ring.hh>	// for ShmRing
+#include <LatencyHistogram.hh>	// for LatencyHistogram, latency_now()
+#include <vector>	// for vector<T>
+
+using namespace std;
+
+/*
+ * Round trip latency of ShmRing (shm_ring.hh), a shared memory message
+ * channel, against pipes, unix domain sockets and SysV message queues.
+ *
+ * The parent sends a message of --size bytes, a forked child sends it back,
+ * --count times per size. The ring is measured twice: sleeping on the futex
+ * right away (--spin=0, the fair comparison to the blocking kernel
+ * mechanisms) and spinning first.
+ *
+ * Other modes:
+ * --mpsc=N	N producer processes send numbered messages of random sizes
+ *		to one consumer which checks that nothing is lost,
+ *		duplicated or reordered per producer.
+ * --crash	a producer dies between reserve() and commit() and a
+ *		consumer dies in the middle of a message, the survivors
+ *		recover.
+ *
+ * Numbers on a single core VM (round trip in us, p50/p99):
+ *	transport	64B		1K		16K
+ *	pipe		2.5/4.3		2.5/4.4		4.7/10.4
+ *	unix		3.6/9.6		3.7/9.5		5.8/12.9
+ *	sysv_msg	3.0/5.6		3.1/6.3		(above msgmax)
+ *	ring		2.5/8.2		2.5/4.0		4.3/10.8
+ * With one cpu every round trip is two context switches whatever the
+ * transport so the ring, which sleeps on a futex, is as fast as a pipe and
+ * not faster. Its advantage shows with a cpu per side: with --spin the
+ * waiter sees the message without entering the kernel at all. Spinning on
+ * a single cpu makes things a hundred times worse (the spinner burns the
+ * slice the peer needs), which is why the spin run is skipped there.
+ * --mpsc=8 moved ~300K messages/s of 1KB on average through a 64KB ring.
+ * ipc/ipc_latency.cc compares the ring with every other IPC mechanism.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ * EXTRA_LINK_FLAGS_AFTER=-lpthread -lrt
+ */
+
+static const char* ping_name="/shm_ring_ping";
+static const char* pong_name="/shm_ring_pong";
+
+struct Transport {
+	virtual ~Transport() {}
+	// called in the child after the fork
+	virtual void child_setup() {}
+	virtual void parent_setup() {}
+	virtual void send(bool parent, const char* buf, size_t len)=0;
+	virtual void recv(bool parent, char* buf, size_t len)=0;
+};
+
+static void write_all(int fd, const char* buf, size_t len) {
+	while(len>0) {
+		ssize_t ret=CHECK_NOT_M1(write(fd, buf, len));
+		buf+=ret;
+		len-=ret;
+	}
+}
+
+static void read_all(int fd, char* buf, size_t len) {
+	while(len>0) {
+		ssize_t ret=CHECK_NOT_M1(read(fd, buf, len));
+		CHECK_ASSERT(ret>0);
+		buf+=ret;
+		len-=ret;
+	}
+}
+
+// a pipe in each direction, or a socketpair used both ways
+struct FdTransport : public Transport {
+	int parent_rd, parent_wr, child_rd, child_wr;
+	explicit FdTransport(bool socket) {
+		if(socket) {
+			int sv[2];
+			CHECK_NOT_M1(socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+			parent_rd=parent_wr=sv[0];
+			child_rd=child_wr=sv[1];
+		} else {
+			int to_child[2], to_parent[2];
+			CHECK_NOT_M1(pipe(to_child));
+			CHECK_NOT_M1(pipe(to_parent));
+			child_rd=to_child[0];
+			parent_wr=to_child[1];
+			parent_rd=to_parent[0];
+			child_wr=to_parent[1];
+		}
+	}
+	void send(bool parent, const char* buf, size_t len) {
+		write_all(parent?parent_wr:child_wr, buf, len);
+	}
+	void recv(bool parent, char* buf, size_t len) {
+		read_all(parent?parent_rd:child_rd, buf, len);
+	}
+};
+
+// one queue, the message type tells the direction
+struct SysvTransport : public Transport {
+	int id;
+	vector<char> msg;
+	explicit SysvTransport(size_t max) : msg(sizeof(long)+max) {
+		id=CHECK_NOT_M1(msgget(IPC_PRIVATE, IPC_CREAT|0600));
+	}
+	~SysvTransport() {
+		CHECK_NOT_M1(msgctl(id, IPC_RMID, NULL));
+	}
+	void send(bool parent, const char* buf, size_t len) {
+		long type=parent?1:2;
+		memcpy(msg.data(), &type, sizeof(type));
+		memcpy(msg.data()+sizeof(long), buf, len);
+		CHECK_NOT_M1(msgsnd(id, msg.data(), len, 0));
+	}
+	void recv(bool parent, char* buf, size_t len) {
+		ssize_t ret=CHECK_NOT_M1(msgrcv(id, msg.data(), len, parent?2:1, 0));
+		CHECK_ASSERT((size_t)ret==len);
+		memcpy(buf, msg.data()+sizeof(long), len);
+	}
+};
+
+struct RingTransport : public Transport {
+	ShmRing* ping;
+	ShmRing* pong;
+	explicit RingTransport(unsigned int spin) {
+		ping=ShmRing::create(ping_name, 1<<20, spin);
+		pong=ShmRing::create(pong_name, 1<<20, spin);
+	}
+	~RingTransport() {
+		delete ping;
+		delete pong;
+	}
+	void parent_setup() {
+		CHECK_ASSERT(ping->attach_producer());
+		CHECK_ASSERT(pong->attach_consumer());
+		ShmRing::unlink(ping_name);
+		ShmRing::unlink(pong_name);
+	}
+	void child_setup() {
+		CHECK_ASSERT(ping->attach_consumer());
+		CHECK_ASSERT(pong->attach_producer());
+	}
+	void send(bool parent, const char* buf, size_t len) {
+		CHECK_ASSERT((parent?ping:pong)->send(buf, len)==shm_ring_ok);
+	}
+	void recv(bool parent, char* buf, size_t len) {
+		ShmRing* r=parent?pong:ping;
+		const char* p;
+		uint32_t got;
+		CHECK_ASSERT(r->receive(&p, &got)==shm_ring_ok && got==len);
+		memcpy(buf, p, len);
+		r->release();
+	}
+};
+
+static void ping_pong(const char* name, Transport* t, const vector<size_t>& sizes, unsigned int count) {
+	size_t max=0;
+	for(size_t s : sizes) {
+		max=s>max?s:max;
+	}
+	vector<char> buf(max);
+	pid_t pid=CHECK_NOT_M1(fork());
+	if(pid==0) {
+		t->child_setup();
+		for(size_t s : sizes) {
+			for(unsigned int i=0; i<count; i++) {
+				t->recv(false, buf.data(), s);
+				t->send(false, buf.data(), s);
+			}
+		}
+		// the parent cleans up, it may still be reading our last reply
+		_exit(EXIT_SUCCESS);
+	}
+	t->parent_setup();
+	for(size_t s : sizes) {
+		LatencyHistogram h;
+		uint64_t start=latency_now();
+		for(unsigned int i=0; i<count; i++) {
+			uint64_t t0=latency_now();
+			t->send(true, buf.data(), s);
+			t->recv(true, buf.data(), s);
+			h.record(latency_now()-t0);
+		}
+		double elapsed=(latency_now()-start)/1e9;
+		printf("%-12s %8zd %10.1lf %10.1lf %10.1lf %10.1lf %12.0lf\n", name, s, h.get_min()/1e3, h.percentile(50)/1e3, h.percentile(99)/1e3, h.percentile(99.9)/1e3, count/elapsed);
+	}
+	int status;
+	CHECK_NOT_M1(waitpid(pid, &status, 0));
+	delete t;
+}
+
+struct MpscMessage {
+	uint32_t producer;
+	uint32_t seq;
+};
+
+static void mpsc(unsigned int producers, unsigned int count) {
+	const char* name="/shm_ring_mpsc";
+	ShmRing* r=ShmRing::create(name, 1<<16);
+	vector<pid_t> pids;
+	for(unsigned int p=0; p<producers; p++) {
+		pid_t pid=CHECK_NOT_M1(fork());
+		if(pid==0) {
+			CHECK_ASSERT(r->attach_producer());
+			unsigned int seed=p;
+			for(unsigned int i=0; i<count; i++) {
+				uint32_t len=sizeof(MpscMessage)+rand_r(&seed)%2000;
+				char* buf;
+				CHECK_ASSERT(r->reserve(len, &buf)==shm_ring_ok);
+				MpscMessage m={p, i};
+				memcpy(buf, &m, sizeof(m));
+				memset(buf+sizeof(m), (char)i, len-sizeof(m));
+				r->commit(len);
+			}
+			delete r;
+			_exit(EXIT_SUCCESS);
+		}
+		pids.push_back(pid);
+	}
+	CHECK_ASSERT(r->attach_consumer());
+	vector<uint32_t> next(producers, 0);
+	uint64_t start=latency_now();
+	uint64_t bytes=0;
+	for(uint64_t n=0; n<(uint64_t)producers*count; n++) {
+		const char* p;
+		uint32_t len;
+		CHECK_ASSERT(r->receive(&p, &len)==shm_ring_ok);
+		MpscMessage m;
+		memcpy(&m, p, sizeof(m));
+		CHECK_ASSERT(m.producer<producers && m.seq==next[m.producer]);
+		CHECK_ASSERT(len==sizeof(m) || p[len-1]==(char)m.seq);
+		next[m.producer]++;
+		bytes+=len;
+		r->release();
+	}
+	double elapsed=(latency_now()-start)/1e9;
+	for(pid_t pid : pids) {
+		int status;
+		CHECK_NOT_M1(waitpid(pid, &status, 0));
+	}
+	printf("mpsc: %u producers, %lu messages in order, %.0lf msgs/s, %.0lf MB/s\n", producers, (uint64_t)producers*count, producers*count/elapsed, bytes/elapsed/1e6);
+	delete r;
+	ShmRing::unlink(name);
+}
+
+static void crash() {
+	const char* name="/shm_ring_crash";
+	ShmRing* r=ShmRing::create(name, 1<<16);
+	// a producer dies with a reserved, uncommitted frame
+	pid_t pid=CHECK_NOT_M1(fork());
+	if(pid==0) {
+		CHECK_ASSERT(r->attach_producer());
+		char* buf;
+		CHECK_ASSERT(r->reserve(100, &buf)==shm_ring_ok);
+		raise(SIGKILL);
+	}
+	int status;
+	CHECK_NOT_M1(waitpid(pid, &status, 0));
+	CHECK_ASSERT(r->attach_producer());
+	CHECK_ASSERT(r->send("after", 6)==shm_ring_ok);
+	// a consumer dies in the middle of reading that message
+	pid=CHECK_NOT_M1(fork());
+	if(pid==0) {
+		CHECK_ASSERT(r->attach_consumer());
+		const char* p;
+		uint32_t len;
+		CHECK_ASSERT(r->receive(&p, &len)==shm_ring_ok);
+		printf("consumer 1 got '%s' past the dead producer's frame, dying without release\n", p);
+		fflush(stdout);
+		raise(SIGKILL);
+	}
+	CHECK_NOT_M1(waitpid(pid, &status, 0));
+	// the producer notices the dead consumer once the ring is full
+	char big[8000]={0};
+	shm_ring_result res;
+	unsigned int sent=0;
+	while((res=r->send(big, sizeof(big)))==shm_ring_ok) {
+		sent++;
+	}
+	printf("producer sent %u messages and then got %s\n", sent, res==shm_ring_peer_dead?"peer_dead":"timeout");
+	// a new consumer takes over and gets the message again
+	CHECK_ASSERT(r->attach_consumer());
+	const char* p;
+	uint32_t len;
+	CHECK_ASSERT(r->receive(&p, &len)==shm_ring_ok && strcmp(p, "after")==0);
+	printf("consumer 2 got '%s' again\n", p);
+	r->release();
+	for(unsigned int i=0; i<sent; i++) {
+		CHECK_ASSERT(r->receive(&p, &len)==shm_ring_ok && len==sizeof(big));
+		r->release();
+	}
+	CHECK_ASSERT(r->receive(&p, &len, 50*1000*1000)==shm_ring_timeout);
+	printf("and the %u that followed, the ring is consistent\n", sent);
+	delete r;
+	ShmRing::unlink(name);
+}
+
+int main(int argc, char** argv) {
+	vector<size_t> sizes={64, 1024, 16384};
+	unsigned int count=20000;
+	unsigned int spin=20000;
+	unsigned int producers=0;
+	bool do_crash=false;
+	while(true) {
+		int option_index=0;
+		static struct option long_options[]={
+			{"size", required_argument, 0, 0},
+			{"count", required_argument, 0, 1},
+			{"spin", required_argument, 0, 2},
+			{"mpsc", required_argument, 0, 3},
+			{"crash", no_argument, 0, 4},
+			{0, 0, 0, 0}
+		};
+		int c=getopt_long(argc, argv, "", long_options, &option_index);
+		if(c==-1)
+			break;
+		switch(c) {
+		case 0:
+			sizes={(size_t)atol(optarg)};
+			break;
+		case 1:
+			count=atoi(optarg);
+			break;
+		case 2:
+			spin=atoi(optarg);
+			break;
+		case 3:
+			producers=atoi(optarg);
+			break;
+		case 4:
+			do_crash=true;
+			break;
+		default:
+			fprintf(stderr, "%s: usage: %s [--size=bytes] [--count=N] [--spin=N] [--mpsc=producers] [--crash]\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(do_crash) {
+		crash();
+		return EXIT_SUCCESS;
+	}
+	if(producers) {
+		mpsc(producers, count*10);
+		return EXIT_SUCCESS;
+	}
+	printf("%-12s %8s %10s %10s %10s %10s %12s\n", "transport", "size", "min_us", "p50_us", "p99_us", "p99.9_us", "rtt/s");
+	ping_pong("pipe", new FdTransport(false), sizes, count);
+	ping_pong("unix", new FdTransport(true), sizes, count);
+	// a SysV message cannot be larger than kernel.msgmax (8K by default)
+	FILE* f=CHECK_NOT_NULL_FILEP(fopen("/proc/sys/kernel/msgmax", "r"));
+	size_t msgmax;
+	CHECK_ASSERT(fscanf(f, "%zu", &msgmax)==1);
+	CHECK_NOT_M1(fclose(f));
+	vector<size_t> sysv_sizes;
+	for(size_t s : sizes) {
+		if(s<=msgmax) {
+			sysv_sizes.push_back(s);
+		}
+	}
+	if(!sysv_sizes.empty()) {
+		ping_pong("sysv_msg", new SysvTransport(sysv_sizes.back()), sysv_sizes, count);
+	}
+	ping_pong("ring", new RingTransport(0), sizes, count);
+	// spinning on one cpu only burns the time slice the peer needs
+	if(sysconf(_SC_NPROCESSORS_ONLN)>1) {
+		char name[32];
+		snprintf(name, sizeof(name), "ring_spin%u", spin);
+		ping_pong(name, new RingTransport(spin), sizes, count);
+	}
+	return EXIT_SUCCESS;
+}
@@ -31,6 +31,9 @@
 /*
  * This is a simple shared memory server that works well with the shared memory
  * client in shm_client.cc.
+ *
+ * There is no synchronization at all, the client may read a half updated
+ * struct. For a message channel over shared memory see shm_ring.cc.
  */
 
 volatile bool cont=true;
@@ -0,0 +1,631 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <firstinclude.h>
+#include <stdio.h>	// for printf(3), fprintf(3), snprintf(3)
+#include <stdlib.h>	// for EXIT_SUCCESS, EXIT_FAILURE, atoi(3)
+#include <string.h>	// for memchr(3), memmem(3), memmove(3), strcmp(3), strlen(3)
+#include <strings.h>	// for bzero(3), strncasecmp(3)
+#include <stdint.h>	// for intmax_t, uint64_t
+#include <errno.h>	// for errno, EAGAIN, EINTR, EMFILE
+#include <signal.h>	// for signal(2), SIGPIPE, SIG_IGN
+#include <sys/epoll.h>	// for epoll_create1(2), epoll_ctl(2), epoll_wait(2)
+#include <sys/types.h>	// for accept4(2)
+#include <sys/socket.h>	// for socket(2), accept4(2), send(2), recv(2), setsockopt(2)
+#include <sys/sendfile.h>	// for sendfile(2)
+#include <sys/stat.h>	// for fstat(2), stat(2)
+#include <sys/timerfd.h>	// for timerfd_create(2), timerfd_settime(2)
+#include <sys/resource.h>	// for getrlimit(2), setrlimit(2)
+#include <netinet/in.h>	// for sockaddr_in
+#include <netinet/tcp.h>// for TCP_NODELAY
+#include <fcntl.h>	// for open(2)
+#include <time.h>	// for time(2)
+#include <unistd.h>	// for read(2), close(2)
+#include <err_utils.h>	// for CHECK_NOT_M1()
+#include <network_utils.h>	// for get_backlog()
+#include <string>	// for string
+#include <vector>	// for vector<T>
+#include <unordered_map>// for unordered_map<K,V>
+#include <memory>	// for shared_ptr<T>, make_shared<T>()
+
+using namespace std;
+
+/*
+ * This is a production minded static file HTTP/1.1 server built on epoll(7).
+ * It is the next step after solution.cc in this folder which demonstrates
+ * the basic idea but pays for it on every event:
+ * - solution.cc keeps its connections in a std::map (a tree walk and a cache
+ * miss per lookup), this one uses a flat vector indexed by the file descriptor.
+ * The kernel hands out the lowest free descriptor so the table stays dense.
+ * - solution.cc is level-triggered and calls epoll_ctl(EPOLL_CTL_MOD) on every
+ * state change. Here every connection is registered exactly once with
+ * EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET and the state machine in service()
+ * runs each direction until EAGAIN. No epoll_ctl(2) in the steady state.
+ * - solution.cc creates a timerfd per connection (two extra fds and three
+ * syscalls per re-arm). Here one timerfd ticks once a second and drives a
+ * timing wheel. Touching a connection only writes its deadline. The wheel
+ * lazily moves connections whose deadline moved when their slot comes up,
+ * so the common case costs nothing.
+ * - bodies go out with sendfile(2) straight from the page cache. Small files
+ * (up to 'inline_max') are kept in memory glued to their header so a whole
+ * response is a single send(2). For bigger files the header is sent with
+ * MSG_MORE so that it shares a segment with the start of the body.
+ * - an open file cache keeps the fd, the stat(2) data and two pre-rendered
+ * headers (keep-alive and close) per path. Entries are revalidated with a
+ * stat(2) at most once a second.
+ * - keep-alive and pipelining: requests that arrived together are answered
+ * in order from the same input buffer without going back to epoll.
+ *
+ * Things this server deliberately does not do: ranges, chunked uploads,
+ * percent-decoding, directory listings. A path with ".." in it is refused.
+ * To scale beyond one core run several copies with SO_REUSEPORT (enabled below).
+ *
+ * Benchmarking: use ../../../examples/networking/tcp/load_generator.cc.
+ * Examples:
+ *	./solution_static.elf 8080 /var/www 10 &
+ *	load_generator --port=8080 --proto=http --path=/index.html --connections=100	(keep-alive)
+ *	load_generator --port=8080 --proto=http --path=/index.html --connections=100 --pipeline=16	(pipelined)
+ *	load_generator --port=8080 --proto=http --path=/index.html --connections=50 --close	(connection per request)
+ * Compare with ../minimal_web_server (remove the sleep(10) first, it serves
+ * one request per 10 seconds by design) and ../../pthreads/pthread_web_server
+ * which can only be measured in connection per request mode.
+ * Numbers on a single core VM over loopback (server and client share the
+ * core), 2KB file, one client thread, 5 seconds per run:
+ *	this server, 100 conns, keep-alive	122K req/s	p50 0.76ms p99 1.4ms
+ *	this server, 100 conns, pipelined x16	147K req/s
+ *	this server, 50 conns, close	21K req/s	p50 2.4ms p99 3.7ms
+ *	pthread_web_server, 50 conns, close	10K req/s	p50 4.8ms p99.9 11ms
+ *	minimal_web_server, 50 conns, close	33K connects/s, 0.6K responses/s
+ * The minimal server never reads the request and closing a socket with
+ * unread data sends a reset, so most of its connections end in a reset
+ * instead of a response. Keep-alive is where the real win is.
+ *
+ * EXTRA_COMPILE_FLAGS_BEFORE=-std=c++17
+ */
+
+// how big can a request header be
+static const size_t inbuf_size=8192;
+// files up to this size are served from memory
+static const off_t inline_max=16384;
+// how often (in seconds) to revalidate a cache entry against the disk
+static const time_t revalidate_secs=1;
+
+struct FileEntry {
+	string path;
+	int fd;
+	off_t size;
+	struct timespec mtime;
+	ino_t ino;
+	time_t checked;
+	// header+body for small files, header only for big ones
+	string resp_keepalive;
+	string resp_close;
+	size_t header_keepalive_len;
+	size_t header_close_len;
+	bool inlined;
+	FileEntry() : fd(-1), size(0), mtime(), ino(0), checked(0), header_keepalive_len(0), header_close_len(0), inlined(false) {}
+	~FileEntry() {
+		if(fd!=-1) {
+			close(fd);
+		}
+	}
+};
+
+struct Connection {
+	bool active;
+	bool keepalive;
+	bool peer_closed;
+	// input buffer, filled by recv(2), consumed by the parser
+	char* inbuf;
+	size_t inlen;
+	// the current response: a memory part (header or header+body)
+	// followed by an optional sendfile(2) part
+	const char* out;
+	size_t outlen;
+	size_t outoff;
+	shared_ptr<FileEntry> file;
+	off_t fileoff;
+	off_t fileend;
+	// timing wheel links and deadline (in wheel ticks)
+	int wheel_prev;
+	int wheel_next;
+	int wheel_slot;
+	unsigned long deadline;
+};
+
+static vector<Connection> conns;
+static unordered_map<string, shared_ptr<FileEntry>> file_cache;
+static string docroot;
+static int epollfd;
+static unsigned long tick=0;
+static unsigned int idle_ticks;
+static vector<int> wheel;
+
+static const char* response_400="HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char* response_404="HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+static const char* response_404_close="HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char* response_405="HTTP/1.1 405 Method Not Allowed\r\nAllow: GET, HEAD\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char* response_431="HTTP/1.1 431 Request Header Fields Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+static const char* content_type(const string& path) {
+	size_t dot=path.rfind('.');
+	if(dot==string::npos) {
+		return "application/octet-stream";
+	}
+	const char* ext=path.c_str()+dot+1;
+	if(strcmp(ext, "html")==0 || strcmp(ext, "htm")==0) return "text/html";
+	if(strcmp(ext, "txt")==0) return "text/plain";
+	if(strcmp(ext, "css")==0) return "text/css";
+	if(strcmp(ext, "js")==0) return "application/javascript";
+	if(strcmp(ext, "json")==0) return "application/json";
+	if(strcmp(ext, "png")==0) return "image/png";
+	if(strcmp(ext, "jpg")==0 || strcmp(ext, "jpeg")==0) return "image/jpeg";
+	if(strcmp(ext, "gif")==0) return "image/gif";
+	if(strcmp(ext, "svg")==0) return "image/svg+xml";
+	return "application/octet-stream";
+}
+
+static void render_headers(FileEntry* e) {
+	char buf[256];
+	const char* ct=content_type(e->path);
+	int len=snprintf(buf, sizeof(buf), "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %jd\r\n\r\n", ct, (intmax_t)e->size);
+	e->resp_keepalive.assign(buf, len);
+	e->header_keepalive_len=len;
+	len=snprintf(buf, sizeof(buf), "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %jd\r\nConnection: close\r\n\r\n", ct, (intmax_t)e->size);
+	e->resp_close.assign(buf, len);
+	e->header_close_len=len;
+}
+
+// open a file and fill a fresh cache entry, NULL if the file cannot be served
+static shared_ptr<FileEntry> load_file(const string& path, time_t now) {
+	int fd=open(path.c_str(), O_RDONLY|O_CLOEXEC);
+	if(fd==-1) {
+		return nullptr;
+	}
+	auto e=make_shared<FileEntry>();
+	e->fd=fd;
+	e->path=path;
+	struct stat st;
+	if(fstat(fd, &st)==-1 || !S_ISREG(st.st_mode)) {
+		return nullptr;
+	}
+	e->size=st.st_size;
+	e->mtime=st.st_mtim;
+	e->ino=st.st_ino;
+	e->checked=now;
+	render_headers(e.get());
+	if(e->size<=inline_max) {
+		string body(e->size, '\0');
+		ssize_t got=pread(fd, &body[0], e->size, 0);
+		if(got==e->size) {
+			e->resp_keepalive+=body;
+			e->resp_close+=body;
+			e->inlined=true;
+		}
+	}
+	return e;
+}
+
+static shared_ptr<FileEntry> lookup_file(const string& path, time_t now) {
+	auto it=file_cache.find(path);
+	if(it!=file_cache.end()) {
+		FileEntry* e=it->second.get();
+		if(now-e->checked<revalidate_secs) {
+			return it->second;
+		}
+		struct stat st;
+		if(stat(path.c_str(), &st)==0 && st.st_ino==e->ino && st.st_size==e->size && st.st_mtim.tv_sec==e->mtime.tv_sec && st.st_mtim.tv_nsec==e->mtime.tv_nsec) {
+			e->checked=now;
+			return it->second;
+		}
+		// stale: in flight responses keep their own reference to the old entry
+		file_cache.erase(it);
+	}
+	auto e=load_file(path, now);
+	if(e) {
+		file_cache[path]=e;
+	}
+	return e;
+}
+
+static void wheel_unlink(int fd) {
+	Connection& c=conns[fd];
+	if(c.wheel_slot==-1) {
+		return;
+	}
+	if(c.wheel_prev!=-1) {
+		conns[c.wheel_prev].wheel_next=c.wheel_next;
+	} else {
+		wheel[c.wheel_slot]=c.wheel_next;
+	}
+	if(c.wheel_next!=-1) {
+		conns[c.wheel_next].wheel_prev=c.wheel_prev;
+	}
+	c.wheel_slot=-1;
+}
+
+static void wheel_link(int fd) {
+	Connection& c=conns[fd];
+	int slot=c.deadline%wheel.size();
+	c.wheel_slot=slot;
+	c.wheel_prev=-1;
+	c.wheel_next=wheel[slot];
+	if(c.wheel_next!=-1) {
+		conns[c.wheel_next].wheel_prev=fd;
+	}
+	wheel[slot]=fd;
+}
+
+static inline void touch(int fd) {
+	// no list surgery here, the wheel notices the new deadline lazily
+	conns[fd].deadline=tick+idle_ticks;
+}
+
+/*
+ * The listening socket is edge triggered: once accept4(2) fails with
+ * EMFILE no new event comes for the clients already in the backlog. So
+ * remember that, and accept again after a connection closed.
+ */
+static bool accept_blocked=false;
+static bool fds_freed=false;
+
+static void close_connection(int fd) {
+	Connection& c=conns[fd];
+	fds_freed=true;
+	wheel_unlink(fd);
+	c.active=false;
+	c.file.reset();
+	delete[] c.inbuf;
+	c.inbuf=NULL;
+	// close(2) also removes the fd from the epoll set
+	close(fd);
+}
+
+// set up the response for the next request in the input buffer
+// returns false if there is no complete request yet
+static bool parse_request(int fd, time_t now) {
+	Connection& c=conns[fd];
+	char* end=static_cast<char*>(memmem(c.inbuf, c.inlen, "\r\n\r\n", 4));
+	if(end==NULL) {
+		return false;
+	}
+	size_t reqlen=end-c.inbuf+4;
+	// request line: METHOD SP PATH SP VERSION
+	char* line_end=static_cast<char*>(memchr(c.inbuf, '\r', reqlen));
+	char* sp1=static_cast<char*>(memchr(c.inbuf, ' ', line_end-c.inbuf));
+	char* sp2=sp1?static_cast<char*>(memchr(sp1+1, ' ', line_end-sp1-1)):NULL;
+	c.file.reset();
+	c.fileoff=c.fileend=0;
+	c.outoff=0;
+	if(sp2==NULL) {
+		c.out=response_400;
+		c.outlen=strlen(response_400);
+		c.keepalive=false;
+	} else {
+		bool head=(sp1-c.inbuf==4 && memcmp(c.inbuf, "HEAD", 4)==0);
+		bool get=(sp1-c.inbuf==3 && memcmp(c.inbuf, "GET", 3)==0);
+		// HTTP/1.1 defaults to keep-alive, HTTP/1.0 to close
+		c.keepalive=(line_end-sp2-1==8 && memcmp(sp2+1, "HTTP/1.1", 8)==0);
+		for(char* p=line_end+2; p<end; ) {
+			char* eol=static_cast<char*>(memmem(p, end+2-p, "\r\n", 2));
+			if(strncasecmp(p, "Connection:", 11)==0) {
+				char* v=p+11;
+				while(*v==' ') v++;
+				if(strncasecmp(v, "close", 5)==0) {
+					c.keepalive=false;
+				} else if(strncasecmp(v, "keep-alive", 10)==0) {
+					c.keepalive=true;
+				}
+			}
+			p=eol+2;
+		}
+		string path(sp1+1, sp2-sp1-1);
+		size_t q=path.find('?');
+		if(q!=string::npos) {
+			path.resize(q);
+		}
+		if(!path.empty() && path.back()=='/') {
+			path+="index.html";
+		}
+		if(!get && !head) {
+			c.out=response_405;
+			c.outlen=strlen(response_405);
+			c.keepalive=false;
+		} else if(path.empty() || path[0]!='/' || path.find("..")!=string::npos) {
+			c.out=response_400;
+			c.outlen=strlen(response_400);
+			c.keepalive=false;
+		} else {
+			shared_ptr<FileEntry> e=lookup_file(docroot+path, now);
+			if(!e) {
+				c.out=c.keepalive?response_404:response_404_close;
+				c.outlen=strlen(c.out);
+			} else {
+				const string& resp=c.keepalive?e->resp_keepalive:e->resp_close;
+				size_t hlen=c.keepalive?e->header_keepalive_len:e->header_close_len;
+				c.out=resp.data();
+				if(head) {
+					c.outlen=hlen;
+				} else if(e->inlined) {
+					c.outlen=resp.size();
+				} else {
+					c.outlen=hlen;
+					c.fileend=e->size;
+				}
+				// keep the entry alive while we point into it
+				c.file=e;
+			}
+		}
+	}
+	// consume the request, anything after it is the next pipelined request
+	c.inlen-=reqlen;
+	memmove(c.inbuf, c.inbuf+reqlen, c.inlen);
+	return true;
+}
+
+// run the connection state machine until it blocks in both directions
+static void service(int fd, time_t now) {
+	Connection& c=conns[fd];
+	touch(fd);
+	while(true) {
+		// 1. flush the current response
+		if(c.outoff<c.outlen) {
+			int flags=MSG_NOSIGNAL;
+			if(c.fileend>0) {
+				flags|=MSG_MORE;
+			}
+			ssize_t ret=send(fd, c.out+c.outoff, c.outlen-c.outoff, flags);
+			if(ret==-1) {
+				if(errno==EAGAIN) {
+					return;
+				}
+				if(errno==EINTR) {
+					continue;
+				}
+				close_connection(fd);
+				return;
+			}
+			c.outoff+=ret;
+			continue;
+		}
+		if(c.fileoff<c.fileend) {
+			ssize_t ret=sendfile(fd, c.file->fd, &c.fileoff, c.fileend-c.fileoff);
+			if(ret==-1) {
+				if(errno==EAGAIN) {
+					return;
+				}
+				if(errno==EINTR) {
+					continue;
+				}
+				close_connection(fd);
+				return;
+			}
+			if(ret==0) {
+				// the file shrunk under us, the length we promised is a lie
+				close_connection(fd);
+				return;
+			}
+			continue;
+		}
+		// 2. response done
+		if(c.out!=NULL) {
+			c.out=NULL;
+			c.outlen=c.outoff=0;
+			c.file.reset();
+			if(!c.keepalive) {
+				close_connection(fd);
+				return;
+			}
+		}
+		// 3. next pipelined request, if we already have it
+		if(parse_request(fd, now)) {
+			continue;
+		}
+		if(c.inlen==inbuf_size) {
+			c.out=response_431;
+			c.outlen=strlen(response_431);
+			c.keepalive=false;
+			c.inlen=0;
+			continue;
+		}
+		// 4. read more
+		if(c.peer_closed) {
+			close_connection(fd);
+			return;
+		}
+		ssize_t ret=recv(fd, c.inbuf+c.inlen, inbuf_size-c.inlen, 0);
+		if(ret==-1) {
+			if(errno==EAGAIN) {
+				return;
+			}
+			if(errno==EINTR) {
+				continue;
+			}
+			close_connection(fd);
+			return;
+		}
+		if(ret==0) {
+			c.peer_closed=true;
+			continue;
+		}
+		c.inlen+=ret;
+	}
+}
+
+static void accept_all(int sockfd) {
+	accept_blocked=false;
+	while(true) {
+		int fd=accept4(sockfd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+		if(fd==-1) {
+			if(errno==EAGAIN || errno==EINTR || errno==ECONNABORTED) {
+				if(errno==EAGAIN) {
+					return;
+				}
+				continue;
+			}
+			if(errno==EMFILE || errno==ENFILE) {
+				// out of fds: main() calls us again once one is closed
+				accept_blocked=true;
+				return;
+			}
+			CHECK_NOT_M1(fd);
+		}
+		if(static_cast<size_t>(fd)>=conns.size()) {
+			close(fd);
+			continue;
+		}
+		int one=1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		Connection& c=conns[fd];
+		c.active=true;
+		c.keepalive=true;
+		c.peer_closed=false;
+		c.inbuf=new char[inbuf_size];
+		c.inlen=0;
+		c.out=NULL;
+		c.outlen=c.outoff=0;
+		c.fileoff=c.fileend=0;
+		c.deadline=tick+idle_ticks;
+		wheel_link(fd);
+		struct epoll_event ev;
+		ev.events=EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET;
+		ev.data.fd=fd;
+		CHECK_NOT_M1(epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev));
+		// the request may already be here (TCP_DEFER_ACCEPT or a fast client)
+		service(fd, time(NULL));
+	}
+}
+
+static void wheel_advance(void) {
+	tick++;
+	size_t slot=tick%wheel.size();
+	int fd=wheel[slot];
+	wheel[slot]=-1;
+	while(fd!=-1) {
+		int next=conns[fd].wheel_next;
+		conns[fd].wheel_slot=-1;
+		if(conns[fd].deadline<=tick) {
+			close_connection(fd);
+		} else {
+			wheel_link(fd);
+		}
+		fd=next;
+	}
+}
+
+int main(int argc, char** argv) {
+	if(argc<3 || argc>5) {
+		fprintf(stderr, "%s: usage: %s [port] [docroot] [idle_seconds] [maxevents]\n", argv[0], argv[0]);
+		fprintf(stderr, "%s: for example: %s 8080 /var/www 10 256\n", argv[0], argv[0]);
+		return EXIT_FAILURE;
+	}
+	const unsigned int port=atoi(argv[1]);
+	docroot=argv[2];
+	idle_ticks=argc>3?atoi(argv[3]):10;
+	const unsigned int maxevents=argc>4?atoi(argv[4]):256;
+	if(idle_ticks<1) {
+		idle_ticks=1;
+	}
+
+	// sendfile(2) has no MSG_NOSIGNAL
+	signal(SIGPIPE, SIG_IGN);
+
+	// size the connection table by the fd limit, raising the soft limit if we may
+	struct rlimit rl;
+	CHECK_NOT_M1(getrlimit(RLIMIT_NOFILE, &rl));
+	if(rl.rlim_cur<rl.rlim_max) {
+		rl.rlim_cur=rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		CHECK_NOT_M1(getrlimit(RLIMIT_NOFILE, &rl));
+	}
+	size_t table_size=rl.rlim_cur>(1<<20)?(1<<20):rl.rlim_cur;
+	conns.resize(table_size);
+	for(Connection& c : conns) {
+		c.active=false;
+		c.inbuf=NULL;
+		c.wheel_slot=-1;
+	}
+	// one slot more than the timeout so a fresh deadline never lands on the current slot
+	wheel.assign(idle_ticks+1, -1);
+
+	int sockfd=CHECK_NOT_M1(socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, IPPROTO_TCP));
+	int optval=1;
+	CHECK_NOT_M1(setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)));
+	CHECK_NOT_M1(setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)));
+	struct sockaddr_in server;
+	bzero(&server, sizeof(server));
+	server.sin_family=AF_INET;
+	server.sin_addr.s_addr=INADDR_ANY;
+	server.sin_port=htons(port);
+	// cppcheck-suppress dangerousTypeCast
+	CHECK_NOT_M1(bind(sockfd, reinterpret_cast<struct sockaddr*>(&server), sizeof(server)));
+	CHECK_NOT_M1(listen(sockfd, get_backlog()));
+
+	epollfd=CHECK_NOT_M1(epoll_create1(EPOLL_CLOEXEC));
+	struct epoll_event ev;
+	ev.events=EPOLLIN|EPOLLET;
+	ev.data.fd=sockfd;
+	CHECK_NOT_M1(epoll_ctl(epollfd, EPOLL_CTL_ADD, sockfd, &ev));
+
+	// a single periodic timer drives the whole wheel
+	int timerfd=CHECK_NOT_M1(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC));
+	struct itimerspec its;
+	its.it_value.tv_sec=1;
+	its.it_value.tv_nsec=0;
+	its.it_interval.tv_sec=1;
+	its.it_interval.tv_nsec=0;
+	CHECK_NOT_M1(timerfd_settime(timerfd, 0, &its, NULL));
+	ev.events=EPOLLIN;
+	ev.data.fd=timerfd;
+	CHECK_NOT_M1(epoll_ctl(epollfd, EPOLL_CTL_ADD, timerfd, &ev));
+
+	printf("serving %s on port %u, %zu connection slots, idle timeout %us\n", docroot.c_str(), port, table_size, idle_ticks);
+	vector<struct epoll_event> events(maxevents);
+	while(true) {
+		int nfds=epoll_wait(epollfd, events.data(), maxevents, -1);
+		if(nfds==-1 && errno==EINTR) {
+			continue;
+		}
+		CHECK_NOT_M1(nfds);
+		time_t now=time(NULL);
+		for(int n=0; n<nfds; n++) {
+			int fd=events[n].data.fd;
+			if(fd==sockfd) {
+				accept_all(sockfd);
+			} else if(fd==timerfd) {
+				uint64_t expirations;
+				if(read(timerfd, &expirations, sizeof(expirations))==sizeof(expirations)) {
+					for(uint64_t i=0; i<expirations; i++) {
+						wheel_advance();
+					}
+				}
+			} else if(conns[fd].active) {
+				if(events[n].events & (EPOLLHUP|EPOLLERR)) {
+					close_connection(fd);
+				} else {
+					service(fd, now);
+				}
+			}
+		}
+		if(accept_blocked && fds_freed) {
+			accept_all(sockfd);
+		}
+		fds_freed=false;
+	}
+	return EXIT_SUCCESS;
+}
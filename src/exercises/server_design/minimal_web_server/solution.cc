@@ -34,11 +34,12 @@
  * This is the most minimal web server you can write using the C language.
  */
 
+// HTTP wants CRLF at the end of every header line
 const char* my_response=
-	"HTTP/1.1 200 OK\n"
-	"Content-Type: text/html\n"
-	"Connection: Closed\n"
-	"\n"
+	"HTTP/1.1 200 OK\r\n"
+	"Content-Type: text/html\r\n"
+	"Connection: Closed\r\n"
+	"\r\n"
 	"<html>\n"
 	"<body>\n"
 	"<h1>Hello, World!</h1>\n"
@@ -0,0 +1,229 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <firstinclude.h>
+#include <stdio.h>	// for printf(3), FILE, fprintf(3)
+#include <string.h>	// for memset(3)
+#include <stdint.h>	// for uint64_t
+#include <time.h>	// for clock_gettime(2), struct timespec
+#include <math.h>	// for sqrt(3)
+
+/*
+ * A latency histogram in the spirit of HdrHistogram.
+ *
+ * Values (usually nanoseconds) are kept in log-linear buckets: every power of
+ * two range is split into 'sub_count' linear buckets. This means that the
+ * relative error of every recorded value is bounded (1/64 here) while the
+ * whole 64 bit range takes a fixed, small amount of memory and recording a
+ * value is a couple of instructions with no allocation.
+ *
+ * Histograms of different threads can be merged so that each thread records
+ * into its own histogram without sharing cache lines and the results are
+ * combined at the end.
+ */
+
+class LatencyHistogram{
+private:
+	static const unsigned int sub_bits=7;
+	static const unsigned int sub_count=1<<sub_bits;
+	static const unsigned int sub_half=sub_count/2;
+	static const unsigned int bucket_num=(64-sub_bits+1)*sub_half+sub_half;
+	uint64_t counts[bucket_num];
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	double sum;
+	double sum2;
+
+	static unsigned int index_of(uint64_t v) {
+		if(v<sub_count) {
+			return v;
+		}
+		unsigned int msb=63-__builtin_clzll(v);
+		unsigned int shift=msb-(sub_bits-1);
+		return shift*sub_half+(unsigned int)(v>>shift);
+	}
+	static uint64_t lowest_of(unsigned int i) {
+		if(i<sub_count) {
+			return i;
+		}
+		unsigned int shift=i/sub_half-1;
+		uint64_t top=i%sub_half+sub_half;
+		return top<<shift;
+	}
+	static uint64_t highest_of(unsigned int i) {
+		if(i<sub_count) {
+			return i;
+		}
+		unsigned int shift=i/sub_half-1;
+		uint64_t top=i%sub_half+sub_half;
+		return ((top+1)<<shift)-1;
+	}
+
+public:
+	LatencyHistogram() {
+		reset();
+	}
+	void reset() {
+		memset(counts, 0, sizeof(counts));
+		total=0;
+		min=UINT64_MAX;
+		max=0;
+		sum=0;
+		sum2=0;
+	}
+	inline void record(uint64_t v) {
+		counts[index_of(v)]++;
+		total++;
+		sum+=v;
+		sum2+=(double)v*v;
+		if(v<min) {
+			min=v;
+		}
+		if(v>max) {
+			max=v;
+		}
+	}
+	// Record a value measured by a closed loop client which meant to issue
+	// a request every 'expected_interval'. A stall of v means the requests
+	// that should have been sent during the stall were never measured, so
+	// add them back as v-interval, v-2*interval... (HdrHistogram's
+	// recordValueWithExpectedInterval). Open loop clients that timestamp
+	// the intended send time do not need this.
+	inline void record_corrected(uint64_t v, uint64_t expected_interval) {
+		record(v);
+		if(expected_interval==0 || v<2*expected_interval) {
+			return;
+		}
+		for(uint64_t missing=v-expected_interval; missing>=expected_interval; missing-=expected_interval) {
+			record(missing);
+		}
+	}
+	void merge(const LatencyHistogram& other) {
+		for(unsigned int i=0; i<bucket_num; i++) {
+			counts[i]+=other.counts[i];
+		}
+		total+=other.total;
+		sum+=other.sum;
+		sum2+=other.sum2;
+		if(other.min<min) {
+			min=other.min;
+		}
+		if(other.max>max) {
+			max=other.max;
+		}
+	}
+	uint64_t get_count() const {
+		return total;
+	}
+	uint64_t get_min() const {
+		return total ? min : 0;
+	}
+	uint64_t get_max() const {
+		return max;
+	}
+	double get_mean() const {
+		return total ? sum/total : 0;
+	}
+	double get_stddev() const {
+		if(total==0) {
+			return 0;
+		}
+		double mean=get_mean();
+		double var=sum2/total-mean*mean;
+		return var>0 ? sqrt(var) : 0;
+	}
+	// the value at percentile p (0..100), reported as the top of its bucket
+	uint64_t percentile(double p) const {
+		if(total==0) {
+			return 0;
+		}
+		uint64_t wanted=(uint64_t)(p/100.0*total+0.5);
+		if(wanted<1) {
+			wanted=1;
+		}
+		uint64_t seen=0;
+		for(unsigned int i=0; i<bucket_num; i++) {
+			seen+=counts[i];
+			if(seen>=wanted) {
+				uint64_t h=highest_of(i);
+				return h<max ? h : max;
+			}
+		}
+		return max;
+	}
+	// one line summary
+	void print_summary(const char* name, FILE* f=stdout) const {
+		fprintf(f, "%s: count=%lu min=%lu mean=%.1lf p50=%lu p90=%lu p99=%lu p99.9=%lu p99.99=%lu max=%lu\n",
+			name,
+			total,
+			get_min(),
+			get_mean(),
+			percentile(50),
+			percentile(90),
+			percentile(99),
+			percentile(99.9),
+			percentile(99.99),
+			max);
+	}
+	// all non empty buckets, one per line
+	void print_buckets(const char* name, FILE* f=stdout) const {
+		for(unsigned int i=0; i<bucket_num; i++) {
+			if(counts[i]) {
+				fprintf(f, "%s: [%lu,%lu] %lu\n", name, lowest_of(i), highest_of(i), counts[i]);
+			}
+		}
+	}
+	// the percentile distribution in the format of HdrHistogram's
+	// outputPercentileDistribution() so that the standard plotting
+	// tools for that format can be used
+	void print_hdr(FILE* f=stdout, double scale=1.0) const {
+		fprintf(f, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+		uint64_t seen=0;
+		for(unsigned int i=0; i<bucket_num; i++) {
+			if(counts[i]==0) {
+				continue;
+			}
+			seen+=counts[i];
+			double q=(double)seen/total;
+			uint64_t h=highest_of(i);
+			if(h>max) {
+				h=max;
+			}
+			if(seen<total) {
+				fprintf(f, "%12.3lf %14.12lf %10lu %14.2lf\n", h/scale, q, seen, 1/(1-q));
+			} else {
+				fprintf(f, "%12.3lf %14.12lf %10lu\n", h/scale, q, seen);
+			}
+		}
+		fprintf(f, "#[Mean    = %12.3lf, StdDeviation   = %12.3lf]\n", get_mean()/scale, get_stddev()/scale);
+		fprintf(f, "#[Max     = %12.3lf, Total count    = %12lu]\n", max/scale, total);
+	}
+};
+
+/*
+ * The current time in nanoseconds from CLOCK_MONOTONIC. This goes via the
+ * vDSO and so does not enter the kernel.
+ */
+static inline uint64_t latency_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
@@ -28,3 +28,17 @@
 
 // stolen shamelssly from the gnu C library...
 #define atomic_full_barrier() __asm__ volatile("" ::: "memory")
+
+/*
+ * A spin loop hint for busy waiting. On x86 this is the 'pause' instruction
+ * (encoded as 'rep;nop') which saves power, lets the other hyper thread on
+ * the same core run and avoids the memory order mis-speculation penalty when
+ * the loop exits. See also examples/power_management/rep_nop.cc
+ */
+static inline void cpu_relax(void) {
+#if __i386__ || __x86_64__
+	__asm__ __volatile__("rep;nop" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
@@ -0,0 +1,195 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <firstinclude.h>
+#include <stdio.h>	// for FILE, fopen(3), fscanf(3), fclose(3)
+#include <stdlib.h>	// for posix_memalign(3), free(3)
+#include <stdint.h>	// for uint64_t
+#include <unistd.h>	// for sysconf(3)
+#include <sched.h>	// for sched_getcpu(3)
+#include <new>	// for placement new
+#include <atomic>	// for atomic
+#include <err_utils.h>	// for CHECK_ZERO_ERRNO(), CHECK_NOT_M1(), CHECK_ASSERT()
+
+/*
+ * Helpers for avoiding false sharing.
+ *
+ * False sharing happens when two threads write to different variables which
+ * happen to live on the same cache line. The line ping-pongs between the
+ * caches of the cores although the threads share no data. See
+ * examples/multi_core/cache_line_contention.cc for the cost and
+ * examples/multi_core/false_sharing_detector.cc for a tool to find it.
+ *
+ * Compile time vs run time line size:
+ * types need a compile time size. CACHE_LINE_SIZE is 64 by default and can
+ * be set from the build machine using
+ * EXTRA_COMPILE_SHELL=echo -DCACHE_LINE_SIZE=`getconf LEVEL1_DCACHE_LINESIZE`
+ * (as done in cache_line_pad.cc). cache_line_check() verifies at run time
+ * that the machine we run on does not have bigger lines than we compiled for.
+ * Arrays whose size is only known at run time (per_thread_array) use the
+ * run time line size directly.
+ *
+ * Note that Intel CPUs prefetch cache lines in pairs (the "adjacent line
+ * prefetcher") so on these CPUs 128 bytes of padding is sometimes needed to
+ * completely avoid interference. This is why gcc defines
+ * std::hardware_destructive_interference_size as 64 but warns about it.
+ */
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif // CACHE_LINE_SIZE
+
+/*
+ * The L1 data cache line size of the machine we are running on
+ */
+static inline unsigned int cache_line_size() {
+	static unsigned int size=0;
+	if(size==0) {
+		long val=sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+		if(val<=0) {
+			// some kernels/libcs do not report it via sysconf, try sysfs
+			FILE* f=fopen("/sys/devices/system/cpu/cpu0/cache/index0/coherency_line_size", "r");
+			if(f!=NULL) {
+				if(fscanf(f, "%ld", &val)!=1) {
+					val=0;
+				}
+				CHECK_NOT_EOF(fclose(f));
+			}
+		}
+		size=val>0 ? val : CACHE_LINE_SIZE;
+	}
+	return size;
+}
+
+/*
+ * make sure that the compile time line size is good enough for this machine
+ */
+static inline void cache_line_check() {
+	CHECK_ASSERT(cache_line_size()<=CACHE_LINE_SIZE);
+}
+
+/*
+ * A T alone on its own cache line(s). sizeof(cache_padded<T>) is a multiple
+ * of CACHE_LINE_SIZE and arrays of it put every element on separate lines.
+ * Note that new[] only respects the alignment since C++17, use
+ * -std=c++17 or later (or posix_memalign(3)) when allocating these on the heap.
+ */
+template<typename T> struct alignas(CACHE_LINE_SIZE) cache_padded {
+	T value;
+
+	cache_padded() : value() {
+	}
+	explicit cache_padded(const T& ivalue) : value(ivalue) {
+	}
+	T& operator*() {
+		return value;
+	}
+	const T& operator*() const {
+		return value;
+	}
+	T* operator->() {
+		return &value;
+	}
+	const T* operator->() const {
+		return &value;
+	}
+};
+
+/*
+ * An array of 'n' elements of T where every element starts on its own cache
+ * line, using the cache line size of the machine we run on. Typical use is
+ * one element per thread, each thread writing only to its own element.
+ */
+template<typename T> class per_thread_array {
+private:
+	char* mem;
+	size_t stride;
+	unsigned int n;
+
+public:
+	explicit per_thread_array(unsigned int in) : n(in) {
+		size_t line=cache_line_size();
+		stride=(sizeof(T)+line-1)/line*line;
+		void* p;
+		CHECK_ZERO_ERRNO(posix_memalign(&p, line, stride*n));
+		mem=static_cast<char*>(p);
+		for(unsigned int i=0; i<n; i++) {
+			new(mem+i*stride) T();
+		}
+	}
+	~per_thread_array() {
+		for(unsigned int i=0; i<n; i++) {
+			reinterpret_cast<T*>(mem+i*stride)->~T();
+		}
+		free(mem);
+	}
+	per_thread_array(const per_thread_array&)=delete;
+	per_thread_array& operator=(const per_thread_array&)=delete;
+	T& operator[](unsigned int i) {
+		return *reinterpret_cast<T*>(mem+i*stride);
+	}
+	const T& operator[](unsigned int i) const {
+		return *reinterpret_cast<const T*>(mem+i*stride);
+	}
+	unsigned int size() const {
+		return n;
+	}
+	size_t get_stride() const {
+		return stride;
+	}
+};
+
+/*
+ * A counter which is cheap to increment from many threads and more expensive
+ * to read. Every cpu increments its own shard (chosen by sched_getcpu(3),
+ * which is a vDSO call) and a read sums all the shards. A thread may migrate
+ * between reading its cpu number and incrementing, which is why the shards
+ * are still atomic, but the shard is almost always local so the line stays
+ * in the local cache. Reads are not a snapshot: increments that happen during
+ * a read may or may not be counted.
+ */
+class sharded_counter {
+private:
+	per_thread_array<std::atomic<uint64_t>> shards;
+
+public:
+	sharded_counter() : shards(CHECK_NOT_M1(sysconf(_SC_NPROCESSORS_CONF))) {
+	}
+	inline void add(uint64_t v) {
+		int cpu=sched_getcpu();
+		unsigned int shard=cpu<0 ? 0 : (unsigned int)cpu%shards.size();
+		shards[shard].fetch_add(v, std::memory_order_relaxed);
+	}
+	inline void inc() {
+		add(1);
+	}
+	uint64_t read() const {
+		uint64_t sum=0;
+		for(unsigned int i=0; i<shards.size(); i++) {
+			sum+=shards[i].load(std::memory_order_relaxed);
+		}
+		return sum;
+	}
+	void reset() {
+		for(unsigned int i=0; i<shards.size(); i++) {
+			shards[i].store(0, std::memory_order_relaxed);
+		}
+	}
+};
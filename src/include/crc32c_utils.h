@@ -0,0 +1,95 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ * CRC32C (Castagnoli), the checksum of iSCSI, ext4 metadata and most
+ * storage formats, because x86 has an instruction for it since SSE4.2
+ * (crc32, 8 bytes per instruction, about 20 times faster than a table).
+ *
+ * crc32c() uses the instruction when the cpu has it and a table otherwise,
+ * decided at run time so no -msse4.2 is needed (the hardware version is
+ * compiled for sse4.2 through a function attribute).
+ *
+ * The value is chained: crc32c(b, n2, crc32c(a, n1, 0)) is the crc of a
+ * followed by b.
+ */
+
+/* THIS IS A C FILE, NO C++ here */
+
+#include <firstinclude.h>
+#include <stddef.h>	// for size_t
+#include <stdint.h>	// for uint32_t, uint64_t
+#include <string.h>	// for memcpy(3)
+#if __x86_64__
+#include <nmmintrin.h>	// for _mm_crc32_u64(), _mm_crc32_u8()
+#endif // __x86_64__
+
+// the reflected Castagnoli polynomial
+#define CRC32C_POLY 0x82F63B78
+
+static inline uint32_t crc32c_sw(const void* data, size_t len, uint32_t crc) {
+	static uint32_t table[256];
+	static int table_ready=0;
+	if(!__atomic_load_n(&table_ready, __ATOMIC_ACQUIRE)) {
+		// racing threads compute the same values
+		for(uint32_t i=0; i<256; i++) {
+			uint32_t c=i;
+			for(int j=0; j<8; j++) {
+				c=(c>>1)^((c & 1)?CRC32C_POLY:0);
+			}
+			table[i]=c;
+		}
+		__atomic_store_n(&table_ready, 1, __ATOMIC_RELEASE);
+	}
+	const unsigned char* p=(const unsigned char*)data;
+	crc=~crc;
+	while(len--) {
+		crc=table[(crc^*p++) & 0xff]^(crc>>8);
+	}
+	return ~crc;
+}
+
+#if __x86_64__
+__attribute__((target("sse4.2"))) static inline uint32_t crc32c_hw(const void* data, size_t len, uint32_t crc) {
+	const unsigned char* p=(const unsigned char*)data;
+	uint64_t c=~crc;
+	while(len>=8) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		c=_mm_crc32_u64(c, v);
+		p+=8;
+		len-=8;
+	}
+	uint32_t c32=(uint32_t)c;
+	while(len--) {
+		c32=_mm_crc32_u8(c32, *p++);
+	}
+	return ~c32;
+}
+#endif // __x86_64__
+
+static inline uint32_t crc32c(const void* data, size_t len, uint32_t crc) {
+#if __x86_64__
+	if(__builtin_cpu_supports("sse4.2")) {
+		return crc32c_hw(data, len, crc);
+	}
+#endif // __x86_64__
+	return crc32c_sw(data, len, crc);
+}
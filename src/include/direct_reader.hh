@@ -0,0 +1,275 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for ssize_t, off_t
+#include <sys/stat.h>	// for statx(2), struct statx, STATX_*, S_ISBLK()
+#include <sys/ioctl.h>	// for ioctl(2)
+#include <linux/fs.h>	// for BLKSSZGET
+#include <fcntl.h>	// for AT_EMPTY_PATH
+#include <aio.h>	// for aio_read(3), aio_suspend(3), aio_error(3), aio_return(3), struct aiocb
+#include <stdio.h>	// for snprintf(3), fopen(3), fscanf(3), fclose(3)
+#include <stdlib.h>	// for aligned_alloc(3), free(3)
+#include <string.h>	// for memset(3), strcmp(3)
+#include <errno.h>	// for errno, EINTR, EINPROGRESS
+#include <unistd.h>	// for pread(2), dup(2), close(2)
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_NOT_NULL(), CHECK_ZERO(), CHECK_ASSERT()
+#include <uring_batch.hh>	// for UringBatch
+#include <functional>	// for function<T>
+#include <vector>	// for vector<T>
+#include <utility>	// for pair<T1, T2>
+
+/*
+ * Reading with O_DIRECT.
+ *
+ * O_DIRECT reads go from the device straight into the user buffer, without
+ * the page cache: no copy and no cache pollution, but also no read ahead,
+ * so every read waits for the device unless the caller keeps several of
+ * them in flight. And the buffer address, the file offset and the length
+ * must all be aligned, or the read fails with EINVAL.
+ *
+ * - dio_align() finds the alignment for a file. Since 6.1 statx(2) reports
+ * it (STATX_DIOALIGN, 0 if the file does not support O_DIRECT at all).
+ * Before that the rule was the logical block size of the device: the
+ * BLKSSZGET ioctl(2) for a block device, sysfs for the device under a file.
+ * - AlignedBufferPool is one aligned_alloc(3) region cut into equal aligned
+ * buffers.
+ * - DirectReadEngine reads with a queue depth, the backends being pread(2)
+ * (sync, the depth is always 1), POSIX AIO (aio) and io_uring (uring).
+ * submit() queues a read, reap() waits until at least one completes and
+ * reports everything that did through on_complete with the tag given to
+ * submit() and the result (-errno on failure). Tags go from 0 to depth-1,
+ * the index of the buffer in the pool is a natural tag.
+ *
+ * glibc runs the POSIX AIO requests of one fd one after the other in a
+ * single thread, so the aio backend reads every slot through its own dup(2)
+ * of the fd to get the depth it was asked for (so an engine must not
+ * outlive the fds it was given, a new fd with the same number would read
+ * through the old dup).
+ *
+ * Used by examples/io/{direct_read,direct_read_bench}.cc
+ */
+
+struct DioAlign {
+	// alignment of the buffer address
+	unsigned int mem_align;
+	// alignment of the file offset and of the length
+	unsigned int offset_align;
+	// logical block size of the device, 0 if unknown
+	unsigned int logical_block;
+};
+
+static inline unsigned int dio_sysfs_block_size(unsigned int major, unsigned int minor) {
+	// a partition has no queue of its own, that of the disk is one up
+	const char* formats[]={
+		"/sys/dev/block/%u:%u/queue/logical_block_size",
+		"/sys/dev/block/%u:%u/../queue/logical_block_size",
+	};
+	for(const char* format : formats) {
+		char path[128];
+		snprintf(path, sizeof(path), format, major, minor);
+		FILE* f=fopen(path, "r");
+		if(f==NULL) {
+			continue;
+		}
+		unsigned int size=0;
+		int ret=fscanf(f, "%u", &size);
+		fclose(f);
+		if(ret==1) {
+			return size;
+		}
+	}
+	return 0;
+}
+
+static inline DioAlign dio_align(int fd) {
+	DioAlign a={0, 0, 0};
+	struct statx stx;
+	CHECK_NOT_M1(statx(fd, "", AT_EMPTY_PATH, STATX_TYPE|STATX_DIOALIGN, &stx));
+	if(S_ISBLK(stx.stx_mode)) {
+		int size;
+		CHECK_NOT_M1(ioctl(fd, BLKSSZGET, &size));
+		a.logical_block=size;
+	} else {
+		a.logical_block=dio_sysfs_block_size(stx.stx_dev_major, stx.stx_dev_minor);
+	}
+	if(stx.stx_mask & STATX_DIOALIGN) {
+		a.mem_align=stx.stx_dio_mem_align;
+		a.offset_align=stx.stx_dio_offset_align;
+	} else {
+		// kernels before 6.1: the old rule, or 512 if even that is unknown
+		a.offset_align=a.logical_block!=0?a.logical_block:512;
+		a.mem_align=a.offset_align;
+	}
+	return a;
+}
+
+class AlignedBufferPool{
+private:
+	char* base;
+	size_t buf_size;
+	std::vector<unsigned int> free_list;
+
+public:
+	AlignedBufferPool(unsigned int count, size_t size, size_t align) {
+		// every buffer, not only the first, must start aligned
+		buf_size=(size+align-1)/align*align;
+		base=static_cast<char*>(CHECK_NOT_NULL(aligned_alloc(align, count*buf_size)));
+		// fault the pages in now and not during the reads
+		memset(base, 0, count*buf_size);
+		for(unsigned int i=count; i>0; i--) {
+			free_list.push_back(i-1);
+		}
+	}
+	~AlignedBufferPool() {
+		free(base);
+	}
+	unsigned int get() {
+		CHECK_ASSERT(!free_list.empty());
+		unsigned int i=free_list.back();
+		free_list.pop_back();
+		return i;
+	}
+	void put(unsigned int i) {
+		free_list.push_back(i);
+	}
+	char* buffer(unsigned int i) const {
+		return base+i*buf_size;
+	}
+	size_t size() const {
+		return buf_size;
+	}
+};
+
+class DirectReadEngine{
+public:
+	std::function<void(unsigned int tag, ssize_t res)> on_complete;
+
+	virtual ~DirectReadEngine() {
+	}
+	virtual void submit(int fd, void* buf, size_t len, off_t offset, unsigned int tag)=0;
+	virtual void reap()=0;
+	// sync, aio or uring, NULL for an unknown name
+	static DirectReadEngine* create(const char* name, unsigned int depth);
+};
+
+class SyncReadEngine: public DirectReadEngine {
+private:
+	std::vector<std::pair<unsigned int, ssize_t> > done;
+
+public:
+	void submit(int fd, void* buf, size_t len, off_t offset, unsigned int tag) {
+		ssize_t res=pread(fd, buf, len, offset);
+		done.emplace_back(tag, res==-1?-errno:res);
+	}
+	void reap() {
+		for(const auto& d : done) {
+			on_complete(d.first, d.second);
+		}
+		done.clear();
+	}
+};
+
+class AioReadEngine: public DirectReadEngine {
+private:
+	std::vector<struct aiocb> cbs;
+	// the requests in flight, NULL for a free slot (aio_suspend(3) skips those)
+	std::vector<const struct aiocb*> inflight;
+	// the dup(2) of the fd each slot reads through and the fd it is a dup of
+	std::vector<int> fds;
+	std::vector<int> orig_fds;
+
+public:
+	AioReadEngine(unsigned int depth) : cbs(depth), inflight(depth, NULL), fds(depth, -1), orig_fds(depth, -1) {
+	}
+	~AioReadEngine() {
+		for(int fd : fds) {
+			if(fd!=-1) {
+				CHECK_NOT_M1(close(fd));
+			}
+		}
+	}
+	void submit(int fd, void* buf, size_t len, off_t offset, unsigned int tag) {
+		CHECK_ASSERT(tag<cbs.size() && inflight[tag]==NULL);
+		if(orig_fds[tag]!=fd) {
+			if(fds[tag]!=-1) {
+				CHECK_NOT_M1(close(fds[tag]));
+			}
+			fds[tag]=CHECK_NOT_M1(dup(fd));
+			orig_fds[tag]=fd;
+		}
+		struct aiocb* cb=&cbs[tag];
+		memset(cb, 0, sizeof(*cb));
+		cb->aio_fildes=fds[tag];
+		cb->aio_buf=buf;
+		cb->aio_nbytes=len;
+		cb->aio_offset=offset;
+		CHECK_ZERO(aio_read(cb));
+		inflight[tag]=cb;
+	}
+	void reap() {
+		while(aio_suspend(inflight.data(), inflight.size(), NULL)==-1) {
+			CHECK_ASSERT(errno==EINTR);
+		}
+		for(unsigned int tag=0; tag<inflight.size(); tag++) {
+			if(inflight[tag]==NULL) {
+				continue;
+			}
+			int err=aio_error(inflight[tag]);
+			if(err==EINPROGRESS) {
+				continue;
+			}
+			ssize_t res=aio_return(&cbs[tag]);
+			inflight[tag]=NULL;
+			on_complete(tag, res==-1?-err:res);
+		}
+	}
+};
+
+class UringReadEngine: public DirectReadEngine {
+private:
+	UringBatch ring;
+
+public:
+	UringReadEngine(unsigned int depth) : ring(depth) {
+		ring.on_complete=[this](uint64_t tag, int res) {
+			on_complete(tag, res);
+		};
+	}
+	void submit(int fd, void* buf, size_t len, off_t offset, unsigned int tag) {
+		UringBatch::prep_read(ring.get_sqe(), fd, buf, len, offset, tag);
+	}
+	void reap() {
+		ring.submit(1);
+	}
+};
+
+inline DirectReadEngine* DirectReadEngine::create(const char* name, unsigned int depth) {
+	if(strcmp(name, "sync")==0) {
+		return new SyncReadEngine();
+	}
+	if(strcmp(name, "aio")==0) {
+		return new AioReadEngine(depth);
+	}
+	if(strcmp(name, "uring")==0) {
+		return new UringReadEngine(depth);
+	}
+	return NULL;
+}
@@ -0,0 +1,119 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ * Finding a fixed string in a big buffer (grep -F) with SIMD.
+ *
+ * The candidate scan compares 16 (sse2) or 32 (avx2) positions at once:
+ * one vector of the haystack against the first byte of the needle and
+ * another, m-1 bytes further, against the last byte. Only positions where
+ * both match are candidates and are verified with memcmp(3). Checking two
+ * bytes instead of one (what memchr(3) followed by memcmp(3) does) cuts
+ * the false candidates by about the frequency of the second byte, which
+ * matters for text where the first byte of a word is common.
+ *
+ * fast_search() picks avx2 when the cpu has it, sse2 (every x86_64) or
+ * memmem(3) otherwise, at run time so no -mavx2 is needed (the avx2 code
+ * is compiled for avx2 through a function attribute). A needle of one
+ * byte is plain memchr(3), which glibc already vectorizes.
+ *
+ * The scans never read beyond hay+n.
+ *
+ * Used by examples/io/fastgrep.cc
+ */
+
+/* THIS IS A C FILE, NO C++ here */
+
+#include <firstinclude.h>
+#include <stddef.h>	// for size_t
+#include <string.h>	// for memchr(3), memcmp(3), memmem(3)
+#if __x86_64__
+#include <immintrin.h>	// for _mm256_*, _mm_*
+#endif // __x86_64__
+
+typedef const char* (*fast_search_func)(const char* hay, size_t n, const char* needle, size_t m);
+
+static inline const char* fast_search_memmem(const char* hay, size_t n, const char* needle, size_t m) {
+	return (const char*)memmem(hay, n, needle, m);
+}
+
+#if __x86_64__
+static inline const char* fast_search_sse2(const char* hay, size_t n, const char* needle, size_t m) {
+	if(m<=1 || n<m) {
+		return m==1?(const char*)memchr(hay, needle[0], n):fast_search_memmem(hay, n, needle, m);
+	}
+	const __m128i first=_mm_set1_epi8(needle[0]);
+	const __m128i last=_mm_set1_epi8(needle[m-1]);
+	size_t i=0;
+	for(; i+m-1+16<=n; i+=16) {
+		__m128i a=_mm_loadu_si128((const __m128i*)(hay+i));
+		__m128i b=_mm_loadu_si128((const __m128i*)(hay+i+m-1));
+		unsigned int mask=_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+		while(mask!=0) {
+			unsigned int bit=__builtin_ctz(mask);
+			if(memcmp(hay+i+bit+1, needle+1, m-2)==0) {
+				return hay+i+bit;
+			}
+			mask&=mask-1;
+		}
+	}
+	return fast_search_memmem(hay+i, n-i, needle, m);
+}
+
+__attribute__((target("avx2"))) static inline const char* fast_search_avx2(const char* hay, size_t n, const char* needle, size_t m) {
+	if(m<=1 || n<m) {
+		return m==1?(const char*)memchr(hay, needle[0], n):fast_search_memmem(hay, n, needle, m);
+	}
+	const __m256i first=_mm256_set1_epi8(needle[0]);
+	const __m256i last=_mm256_set1_epi8(needle[m-1]);
+	size_t i=0;
+	for(; i+m-1+32<=n; i+=32) {
+		__m256i a=_mm256_loadu_si256((const __m256i*)(hay+i));
+		__m256i b=_mm256_loadu_si256((const __m256i*)(hay+i+m-1));
+		unsigned int mask=_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+		while(mask!=0) {
+			unsigned int bit=__builtin_ctz(mask);
+			if(memcmp(hay+i+bit+1, needle+1, m-2)==0) {
+				return hay+i+bit;
+			}
+			mask&=mask-1;
+		}
+	}
+	/* the tail is shorter than a vector */
+	return fast_search_sse2(hay+i, n-i, needle, m);
+}
+#endif // __x86_64__
+
+/* the best one for this cpu */
+static inline fast_search_func fast_search_select(void) {
+#if __x86_64__
+	if(__builtin_cpu_supports("avx2")) {
+		return fast_search_avx2;
+	}
+	return fast_search_sse2;
+#else // __x86_64__
+	return fast_search_memmem;
+#endif // __x86_64__
+}
+
+/* first occurrence of needle[0..m) in hay[0..n), NULL if none */
+static inline const char* fast_search(const char* hay, size_t n, const char* needle, size_t m) {
+	return fast_search_select()(hay, n, needle, m);
+}
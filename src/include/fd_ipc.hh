@@ -0,0 +1,460 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for ssize_t
+#include <sys/socket.h>	// for socket(2), socketpair(2), sendmsg(2), recvmsg(2), SCM_RIGHTS
+#include <sys/un.h>	// for sockaddr_un
+#include <sys/mman.h>	// for memfd_create(2), mmap(2), munmap(2)
+#include <sys/stat.h>	// for fstat(2)
+#include <fcntl.h>	// for fcntl(2), F_ADD_SEALS, F_GET_SEALS, F_SEAL_*
+#include <unistd.h>	// for ftruncate(2), close(2), unlink(2)
+#include <errno.h>	// for errno, EINTR, EAGAIN
+#include <stdio.h>	// for snprintf(3)
+#include <string.h>	// for memcpy(3), memset(3)
+#include <stdint.h>	// for uint32_t, uint64_t
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_NOT_VOIDP(), CHECK_ASSERT()
+#include <vector>	// for vector<T>
+
+/*
+ * Message passing between co-located processes over a SOCK_SEQPACKET unix
+ * domain socket.
+ *
+ * Small messages travel inline: header and payload in one datagram, copied
+ * into the socket and out of it again, which is the cheapest thing for a
+ * few KB.
+ *
+ * Large messages are never copied through the socket. The payload is put in
+ * a memfd and only a header and the fd (SCM_RIGHTS) cross the socket. The
+ * receiver maps the pages the sender wrote. A sender that builds its data
+ * in place (alloc(), fill, send()) does not copy it at all. There are two
+ * flavours:
+ * - sealed (the default): a new memfd per message, sealed against writing
+ * and resizing before it is sent. The receiver checks the seals so the
+ * sender cannot change the data under its feet or shrink the file and
+ * make it take a SIGBUS. Safe against an untrusted sender but every
+ * message pays for fresh pages: allocating and zeroing them costs more
+ * than copying them (see ipc_memfd.cc).
+ * - pooled: memfds are recycled. A buffer is sent with its fd the first
+ * time only, the receiver keeps it mapped and release() sends the buffer
+ * back. Only resizing is sealed so the receiver is still safe from
+ * SIGBUS, but the sender could write into a buffer the receiver is
+ * reading, so use this between processes that trust each other.
+ *
+ * SOCK_SEQPACKET keeps message boundaries so no framing is needed and a
+ * control message cannot get split from its header.
+ *
+ * Used by examples/networking/unix_socket/ipc_memfd.cc
+ */
+
+static const uint32_t fd_ipc_inline=1;
+static const uint32_t fd_ipc_memfd=2;
+static const uint32_t fd_ipc_pooled=3;
+static const uint32_t fd_ipc_release=4;
+// every seal that matters for a reader; F_SEAL_SEAL so no one can undo them
+static const int fd_ipc_seals=F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL;
+// a pooled buffer stays writable for its owner
+static const int fd_ipc_pool_seals=F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL;
+static const uint32_t fd_ipc_no_buffer=UINT32_MAX;
+
+struct FdIpcHeader{
+	uint32_t type;
+	uint32_t tag;
+	uint64_t len;
+	uint32_t buffer;
+	uint32_t pad;
+};
+
+/*
+ * A writable memfd backed buffer. Fill 'data' (up to 'len') and hand it
+ * to FdChannel::send().
+ */
+struct FdIpcBuffer{
+	int fd;
+	char* data;
+	size_t len;
+	uint32_t buffer;
+};
+
+/*
+ * A received message. 'data' points into the channel's inline buffer
+ * (valid until the next receive) or into a read only mapping of the
+ * sender's memfd (valid until release()).
+ */
+struct FdIpcMessage{
+	uint32_t tag;
+	const char* data;
+	size_t len;
+	int fd;
+	size_t map_len;
+	uint32_t buffer;
+};
+
+class FdChannel{
+private:
+	struct PoolBuffer{
+		int fd;
+		char* data;
+		size_t capacity;
+		bool busy;
+		bool sent;
+	};
+	struct Mapping{
+		const char* data;
+		size_t capacity;
+	};
+	int fd;
+	size_t inline_max;
+	bool pooled;
+	std::vector<char> in_buf;
+	// sender side: our pooled buffers
+	std::vector<PoolBuffer> pool;
+	// receiver side: the peer's pooled buffers, by buffer id
+	std::vector<Mapping> mappings;
+
+public:
+	/*
+	 * 'inline_max' is the largest payload sent inline. It must fit the
+	 * socket send buffer (SO_SNDBUF, ~200KB by default) since a
+	 * SOCK_SEQPACKET message is never split. 'pooled' selects how this
+	 * side sends large messages, a receiver handles both kinds.
+	 */
+	FdChannel(int ifd, size_t iinline_max=64*1024, bool ipooled=false) : fd(ifd), inline_max(iinline_max), pooled(ipooled), in_buf(sizeof(FdIpcHeader)+iinline_max) {
+	}
+	~FdChannel() {
+		for(const PoolBuffer& b : pool) {
+			CHECK_NOT_M1(munmap(b.data, b.capacity));
+			CHECK_NOT_M1(close(b.fd));
+		}
+		for(const Mapping& m : mappings) {
+			if(m.data) {
+				CHECK_NOT_M1(munmap(const_cast<char*>(m.data), m.capacity));
+			}
+		}
+		CHECK_NOT_M1(close(fd));
+	}
+	FdChannel(const FdChannel&)=delete;
+	FdChannel& operator=(const FdChannel&)=delete;
+
+	// two connected ends, for a parent and its child
+	static void pair(int fds[2]) {
+		CHECK_NOT_M1(socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, fds));
+	}
+	static int listen(const char* path) {
+		int lfd=CHECK_NOT_M1(socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0));
+		struct sockaddr_un addr;
+		fill_addr(&addr, path);
+		int ret=unlink(path);
+		if(ret==-1 && errno!=ENOENT) {
+			CHECK_NOT_M1(ret);
+		}
+		CHECK_NOT_M1(bind(lfd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)));
+		CHECK_NOT_M1(::listen(lfd, 16));
+		return lfd;
+	}
+	static int connect(const char* path) {
+		int cfd=CHECK_NOT_M1(socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0));
+		struct sockaddr_un addr;
+		fill_addr(&addr, path);
+		CHECK_NOT_M1(::connect(cfd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)));
+		return cfd;
+	}
+
+	size_t get_inline_max() const {
+		return inline_max;
+	}
+
+	/*
+	 * A buffer for building a large message in place. MAP_POPULATE
+	 * allocates all the pages in one go instead of a fault per page.
+	 * Pooled buffers come in power of two sizes and are reused once the
+	 * receiver released them.
+	 */
+	FdIpcBuffer alloc(size_t len) {
+		FdIpcBuffer b;
+		b.len=len;
+		if(!pooled) {
+			b.fd=CHECK_NOT_M1(memfd_create("fd_ipc", MFD_CLOEXEC|MFD_ALLOW_SEALING));
+			CHECK_NOT_M1(ftruncate(b.fd, len));
+			b.data=static_cast<char*>(CHECK_NOT_VOIDP(mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, b.fd, 0), MAP_FAILED));
+			b.buffer=fd_ipc_no_buffer;
+			return b;
+		}
+		drain_releases();
+		size_t capacity=4096;
+		while(capacity<len) {
+			capacity*=2;
+		}
+		for(uint32_t i=0; i<pool.size(); i++) {
+			if(!pool[i].busy && pool[i].capacity==capacity) {
+				pool[i].busy=true;
+				b.fd=pool[i].fd;
+				b.data=pool[i].data;
+				b.buffer=i;
+				return b;
+			}
+		}
+		PoolBuffer p;
+		p.fd=CHECK_NOT_M1(memfd_create("fd_ipc_pool", MFD_CLOEXEC|MFD_ALLOW_SEALING));
+		CHECK_NOT_M1(ftruncate(p.fd, capacity));
+		CHECK_NOT_M1(fcntl(p.fd, F_ADD_SEALS, fd_ipc_pool_seals));
+		p.data=static_cast<char*>(CHECK_NOT_VOIDP(mmap(NULL, capacity, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, p.fd, 0), MAP_FAILED));
+		p.capacity=capacity;
+		p.busy=true;
+		p.sent=false;
+		pool.push_back(p);
+		b.fd=p.fd;
+		b.data=p.data;
+		b.buffer=pool.size()-1;
+		return b;
+	}
+
+	// send a buffer from alloc(), the buffer is not ours any more
+	void send(FdIpcBuffer& b, uint32_t tag=0) {
+		FdIpcHeader h;
+		h.tag=tag;
+		h.len=b.len;
+		h.buffer=b.buffer;
+		h.pad=0;
+		bool with_fd=true;
+		if(b.buffer==fd_ipc_no_buffer) {
+			h.type=fd_ipc_memfd;
+			// F_SEAL_WRITE fails while a writable shared mapping exists
+			CHECK_NOT_M1(munmap(b.data, b.len));
+			CHECK_NOT_M1(fcntl(b.fd, F_ADD_SEALS, fd_ipc_seals));
+		} else {
+			h.type=fd_ipc_pooled;
+			with_fd=!pool[b.buffer].sent;
+			pool[b.buffer].sent=true;
+		}
+		struct iovec iov;
+		iov.iov_base=&h;
+		iov.iov_len=sizeof(h);
+		union {
+			char buf[CMSG_SPACE(sizeof(int))];
+			struct cmsghdr align;
+		} control;
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov=&iov;
+		msg.msg_iovlen=1;
+		if(with_fd) {
+			msg.msg_control=control.buf;
+			msg.msg_controllen=sizeof(control.buf);
+			struct cmsghdr* cmsg=CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level=SOL_SOCKET;
+			cmsg->cmsg_type=SCM_RIGHTS;
+			cmsg->cmsg_len=CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &b.fd, sizeof(int));
+		}
+		send_msg(&msg);
+		if(b.buffer==fd_ipc_no_buffer) {
+			// the message in flight holds its own reference to the file
+			CHECK_NOT_M1(close(b.fd));
+		}
+		b.fd=-1;
+		b.data=NULL;
+	}
+
+	// send a payload from anywhere, inline or through a memfd by size
+	void send(const void* data, size_t len, uint32_t tag=0) {
+		if(len>inline_max) {
+			FdIpcBuffer b=alloc(len);
+			memcpy(b.data, data, len);
+			send(b, tag);
+			return;
+		}
+		FdIpcHeader h;
+		h.type=fd_ipc_inline;
+		h.tag=tag;
+		h.len=len;
+		h.buffer=fd_ipc_no_buffer;
+		h.pad=0;
+		struct iovec iov[2];
+		iov[0].iov_base=&h;
+		iov[0].iov_len=sizeof(h);
+		iov[1].iov_base=const_cast<void*>(data);
+		iov[1].iov_len=len;
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov=iov;
+		msg.msg_iovlen=2;
+		send_msg(&msg);
+	}
+
+	/*
+	 * Receive the next message. Returns false when the other side closed
+	 * the connection. Every message must be given back with release().
+	 */
+	bool receive(FdIpcMessage& m) {
+		while(true) {
+			union {
+				char buf[CMSG_SPACE(sizeof(int))];
+				struct cmsghdr align;
+			} control;
+			struct iovec iov;
+			iov.iov_base=in_buf.data();
+			iov.iov_len=in_buf.size();
+			struct msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov=&iov;
+			msg.msg_iovlen=1;
+			msg.msg_control=control.buf;
+			msg.msg_controllen=sizeof(control.buf);
+			ssize_t ret;
+			do {
+				ret=recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+			} while(ret==-1 && errno==EINTR);
+			CHECK_NOT_M1(ret);
+			if(ret==0) {
+				return false;
+			}
+			// a truncated message or lost fd is a protocol error, not something to recover from
+			CHECK_ASSERT((size_t)ret>=sizeof(FdIpcHeader) && !(msg.msg_flags&(MSG_TRUNC|MSG_CTRUNC)));
+			FdIpcHeader h;
+			memcpy(&h, in_buf.data(), sizeof(h));
+			if(h.type==fd_ipc_release) {
+				buffer_released(h.buffer);
+				continue;
+			}
+			m.tag=h.tag;
+			m.len=h.len;
+			m.fd=-1;
+			m.map_len=0;
+			m.buffer=fd_ipc_no_buffer;
+			int passed=-1;
+			struct cmsghdr* cmsg=CMSG_FIRSTHDR(&msg);
+			if(cmsg!=NULL) {
+				CHECK_ASSERT(cmsg->cmsg_type==SCM_RIGHTS);
+				memcpy(&passed, CMSG_DATA(cmsg), sizeof(int));
+			}
+			switch(h.type) {
+			case fd_ipc_inline:
+				CHECK_ASSERT((size_t)ret==sizeof(h)+h.len && passed==-1);
+				m.data=in_buf.data()+sizeof(h);
+				return true;
+			case fd_ipc_memfd:
+				CHECK_ASSERT(passed!=-1);
+				m.fd=passed;
+				m.map_len=h.len;
+				m.data=map(passed, h.len, fd_ipc_seals);
+				return true;
+			case fd_ipc_pooled:
+				if(passed!=-1) {
+					add_mapping(h.buffer, passed);
+				}
+				CHECK_ASSERT(h.buffer<mappings.size() && mappings[h.buffer].data!=NULL && h.len<=mappings[h.buffer].capacity);
+				m.buffer=h.buffer;
+				m.data=mappings[h.buffer].data;
+				return true;
+			default:
+				CHECK_ASSERT(false);
+			}
+		}
+	}
+
+	void release(FdIpcMessage& m) {
+		if(m.buffer!=fd_ipc_no_buffer) {
+			FdIpcHeader h;
+			h.type=fd_ipc_release;
+			h.tag=m.tag;
+			h.len=0;
+			h.buffer=m.buffer;
+			h.pad=0;
+			struct iovec iov;
+			iov.iov_base=&h;
+			iov.iov_len=sizeof(h);
+			struct msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov=&iov;
+			msg.msg_iovlen=1;
+			send_msg(&msg);
+			m.buffer=fd_ipc_no_buffer;
+			return;
+		}
+		if(m.fd==-1) {
+			return;
+		}
+		if(m.map_len) {
+			CHECK_NOT_M1(munmap(const_cast<char*>(m.data), m.map_len));
+		}
+		CHECK_NOT_M1(close(m.fd));
+		m.fd=-1;
+	}
+
+private:
+	void send_msg(struct msghdr* msg) {
+		ssize_t ret;
+		do {
+			ret=sendmsg(fd, msg, MSG_NOSIGNAL);
+		} while(ret==-1 && errno==EINTR);
+		CHECK_NOT_M1(ret);
+	}
+	// check the seals and the size, not the header, then map read only
+	static const char* map(int mfd, size_t len, int seals) {
+		int got=CHECK_NOT_M1(fcntl(mfd, F_GET_SEALS));
+		CHECK_ASSERT((got&seals)==seals);
+		struct stat st;
+		CHECK_NOT_M1(fstat(mfd, &st));
+		CHECK_ASSERT((uint64_t)st.st_size>=len);
+		if(len==0) {
+			return NULL;
+		}
+		return static_cast<const char*>(CHECK_NOT_VOIDP(mmap(NULL, len, PROT_READ, MAP_SHARED|MAP_POPULATE, mfd, 0), MAP_FAILED));
+	}
+	void add_mapping(uint32_t buffer, int mfd) {
+		struct stat st;
+		CHECK_NOT_M1(fstat(mfd, &st));
+		if(buffer>=mappings.size()) {
+			mappings.resize(buffer+1, Mapping{NULL, 0});
+		}
+		CHECK_ASSERT(mappings[buffer].data==NULL);
+		mappings[buffer].capacity=st.st_size;
+		mappings[buffer].data=map(mfd, st.st_size, fd_ipc_pool_seals);
+		// the mapping keeps the file alive
+		CHECK_NOT_M1(close(mfd));
+	}
+	void buffer_released(uint32_t buffer) {
+		CHECK_ASSERT(buffer<pool.size() && pool[buffer].busy);
+		pool[buffer].busy=false;
+	}
+	// take the releases that already arrived without blocking or
+	// consuming anything else
+	void drain_releases() {
+		while(true) {
+			FdIpcHeader h;
+			ssize_t ret=recv(fd, &h, sizeof(h), MSG_PEEK|MSG_DONTWAIT);
+			if(ret==-1 && (errno==EAGAIN || errno==EINTR)) {
+				return;
+			}
+			CHECK_NOT_M1(ret);
+			if((size_t)ret<sizeof(h) || h.type!=fd_ipc_release) {
+				return;
+			}
+			CHECK_NOT_M1(recv(fd, &h, sizeof(h), 0));
+			buffer_released(h.buffer);
+		}
+	}
+	static void fill_addr(struct sockaddr_un* addr, const char* path) {
+		memset(addr, 0, sizeof(*addr));
+		addr->sun_family=AF_UNIX;
+		snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", path);
+	}
+};
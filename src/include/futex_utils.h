@@ -0,0 +1,320 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ * A small library of synchronization primitives built directly on futex(2).
+ *
+ * futex_mutex_t - Ulrich Drepper's three state mutex ("Futexes Are Tricky",
+ *	mutex 3). The state is 0 (unlocked), 1 (locked, no waiters) or 2 (locked,
+ *	maybe waiters). Uncontended lock and unlock are a single atomic operation
+ *	each and never enter the kernel, unlock only calls futex(2) when the state
+ *	says somebody may be sleeping.
+ *	Before going to sleep the lock spins for a while using the 'pause'
+ *	instruction (see cpu_relax() in atomic_utils.h). The number of spins adapts
+ *	to how long the lock was actually held in the past, the same way glibc's
+ *	PTHREAD_MUTEX_ADAPTIVE_NP works.
+ * futex_cond_t - a condition variable. futex_cond_broadcast() does not wake all
+ *	waiters to have them fight for the mutex (the thundering herd). It wakes one
+ *	and moves the rest from the condition variable futex to the mutex futex
+ *	with FUTEX_CMP_REQUEUE where they are woken one by one by the unlocks.
+ * futex_sem_t - a counting semaphore which only calls the kernel when there
+ *	are sleepers (post) or when the count is zero (wait).
+ * futex_eventcount_t - an eventcount. Turns any lock free structure into a
+ *	blocking one: a consumer calls futex_eventcount_prepare(), re-checks the
+ *	structure, and then either cancels or commits to sleep. A producer calls
+ *	futex_eventcount_notify() after changing the structure which costs just a
+ *	load when nobody waits.
+ *
+ * All futexes here are process private (FUTEX_PRIVATE_FLAG). To use them in
+ * shared memory between processes remove the flag. futex_wait_shared() and
+ * futex_wake_shared() are the raw wrappers without it.
+ *
+ * References:
+ * https://www.akkadia.org/drepper/futex.pdf
+ * https://www.1024cores.net/home/lock-free-algorithms/eventcounts
+ */
+
+/* THIS IS A C FILE, NO C++ here */
+
+#include <firstinclude.h>
+#include <unistd.h>	// for syscall(2)
+#include <sys/syscall.h>// for SYS_futex
+#include <linux/futex.h>// for FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE, FUTEX_CMP_REQUEUE_PRIVATE
+#include <limits.h>	// for INT_MAX
+#include <errno.h>	// for errno, EAGAIN, EINTR, ETIMEDOUT
+#include <stddef.h>	// for NULL
+#include <stdbool.h>	// for false
+#include <time.h>	// for struct timespec
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_ERROR()
+#include <atomic_utils.h>	// for cpu_relax()
+
+/*
+ * raw futex(2) wrappers
+ */
+static inline void futex_wait(int* addr, int val) {
+	long ret=syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+	// EAGAIN means the value was not 'val' anymore, EINTR a signal, both are fine
+	if(ret==-1 && errno!=EAGAIN && errno!=EINTR) {
+		CHECK_ERROR("futex(FUTEX_WAIT)");
+	}
+}
+
+static inline int futex_wake(int* addr, int count) {
+	return CHECK_NOT_M1(syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0));
+}
+
+/*
+ * the same for a futex in memory shared between processes. The wait gives
+ * up after 'timeout' (relative, NULL for ever) and returns false if it did,
+ * so a waiter can check whether its peer is still alive.
+ */
+static inline bool futex_wait_shared(int* addr, int val, const struct timespec* timeout) {
+	long ret=syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+	if(ret==-1) {
+		if(errno==ETIMEDOUT) {
+			return false;
+		}
+		if(errno!=EAGAIN && errno!=EINTR) {
+			CHECK_ERROR("futex(FUTEX_WAIT)");
+		}
+	}
+	return true;
+}
+
+static inline int futex_wake_shared(int* addr, int count) {
+	return CHECK_NOT_M1(syscall(SYS_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0));
+}
+
+/*
+ * wake 'wake_count' waiters on 'addr' and move up to 'requeue_count' of the
+ * rest to wait on 'addr2', only if *addr is still 'val'. Returns -1 with
+ * errno==EAGAIN if *addr changed.
+ */
+static inline long futex_cmp_requeue(int* addr, int wake_count, int requeue_count, int* addr2, int val) {
+	return syscall(SYS_futex, addr, FUTEX_CMP_REQUEUE_PRIVATE, wake_count, (void*)(long)requeue_count, addr2, val);
+}
+
+/*
+ * Mutex
+ */
+typedef struct _futex_mutex_t{
+	int state;
+	int spin_estimate;
+	int spin_max;
+} futex_mutex_t;
+
+#define FUTEX_MUTEX_DEFAULT_SPIN_MAX 100
+
+/*
+ * spin_max==0 means never spin, go to sleep immediately on contention
+ */
+static inline void futex_mutex_init(futex_mutex_t* m, int spin_max) {
+	m->state=0;
+	m->spin_estimate=0;
+	m->spin_max=spin_max;
+}
+
+static inline int futex_mutex_cas(int* addr, int expected, int desired) {
+	__atomic_compare_exchange_n(addr, &expected, desired, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+	return expected;
+}
+
+static inline int futex_mutex_trylock(futex_mutex_t* m) {
+	return futex_mutex_cas(&m->state, 0, 1)==0;
+}
+
+static inline void futex_mutex_lock(futex_mutex_t* m) {
+	int c=futex_mutex_cas(&m->state, 0, 1);
+	if(c==0) {
+		return;
+	}
+	// spin for a while, the holder may be running on another core and
+	// release soon. Test before we CAS to not steal the cache line for nothing.
+	if(m->spin_max>0) {
+		int estimate=__atomic_load_n(&m->spin_estimate, __ATOMIC_RELAXED);
+		int limit=estimate*2+10;
+		if(limit>m->spin_max) {
+			limit=m->spin_max;
+		}
+		for(int cnt=0; cnt<limit; cnt++) {
+			cpu_relax();
+			if(__atomic_load_n(&m->state, __ATOMIC_RELAXED)==0 && futex_mutex_cas(&m->state, 0, 1)==0) {
+				__atomic_store_n(&m->spin_estimate, estimate+(cnt-estimate)/8, __ATOMIC_RELAXED);
+				return;
+			}
+		}
+		__atomic_store_n(&m->spin_estimate, estimate+(limit-estimate)/8, __ATOMIC_RELAXED);
+	}
+	// park: mark the lock as contended and sleep until it is released
+	c=__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+	while(c!=0) {
+		futex_wait(&m->state, 2);
+		c=__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+	}
+}
+
+/*
+ * lock the mutex assuming that there are other waiters. This is used by
+ * threads woken from futex_cond_wait() which may have been requeued to the
+ * mutex with other threads behind them.
+ */
+static inline void futex_mutex_lock_contended(futex_mutex_t* m) {
+	while(__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE)!=0) {
+		futex_wait(&m->state, 2);
+	}
+}
+
+static inline void futex_mutex_unlock(futex_mutex_t* m) {
+	if(__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE)!=1) {
+		__atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+		futex_wake(&m->state, 1);
+	}
+}
+
+/*
+ * Condition variable
+ */
+typedef struct _futex_cond_t{
+	int seq;
+	futex_mutex_t* mutex;
+} futex_cond_t;
+
+static inline void futex_cond_init(futex_cond_t* c) {
+	c->seq=0;
+	c->mutex=NULL;
+}
+
+/*
+ * as with pthread_cond_wait(3) spurious wakeups are possible, always call
+ * this in a loop that checks the predicate
+ */
+static inline void futex_cond_wait(futex_cond_t* c, futex_mutex_t* m) {
+	int seq=__atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->mutex, m, __ATOMIC_RELAXED);
+	futex_mutex_unlock(m);
+	futex_wait(&c->seq, seq);
+	futex_mutex_lock_contended(m);
+}
+
+static inline void futex_cond_signal(futex_cond_t* c) {
+	__atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+	futex_wake(&c->seq, 1);
+}
+
+static inline void futex_cond_broadcast(futex_cond_t* c) {
+	futex_mutex_t* m=__atomic_load_n(&c->mutex, __ATOMIC_RELAXED);
+	int seq=__atomic_add_fetch(&c->seq, 1, __ATOMIC_RELEASE);
+	if(m==NULL) {
+		futex_wake(&c->seq, INT_MAX);
+		return;
+	}
+	// wake one and move the rest to the mutex. The woken thread locks the
+	// mutex with futex_mutex_lock_contended() which marks it as contended so
+	// its unlock wakes the next requeued waiter and so on down the chain.
+	if(futex_cmp_requeue(&c->seq, 1, INT_MAX, &m->state, seq)==-1) {
+		if(errno!=EAGAIN) {
+			CHECK_ERROR("futex(FUTEX_CMP_REQUEUE)");
+		}
+		// seq changed under us, fall back to waking everybody
+		futex_wake(&c->seq, INT_MAX);
+	}
+}
+
+/*
+ * Counting semaphore
+ */
+typedef struct _futex_sem_t{
+	int value;
+	int waiters;
+} futex_sem_t;
+
+static inline void futex_sem_init(futex_sem_t* s, int value) {
+	s->value=value;
+	s->waiters=0;
+}
+
+static inline int futex_sem_trywait(futex_sem_t* s) {
+	int v=__atomic_load_n(&s->value, __ATOMIC_RELAXED);
+	while(v>0) {
+		if(__atomic_compare_exchange_n(&s->value, &v, v-1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static inline void futex_sem_wait(futex_sem_t* s) {
+	while(!futex_sem_trywait(s)) {
+		__atomic_fetch_add(&s->waiters, 1, __ATOMIC_SEQ_CST);
+		futex_wait(&s->value, 0);
+		__atomic_fetch_sub(&s->waiters, 1, __ATOMIC_RELAXED);
+	}
+}
+
+static inline void futex_sem_post(futex_sem_t* s) {
+	__atomic_fetch_add(&s->value, 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST)>0) {
+		futex_wake(&s->value, 1);
+	}
+}
+
+/*
+ * Eventcount
+ */
+typedef struct _futex_eventcount_t{
+	int epoch;
+	int waiters;
+} futex_eventcount_t;
+
+static inline void futex_eventcount_init(futex_eventcount_t* ec) {
+	ec->epoch=0;
+	ec->waiters=0;
+}
+
+/*
+ * announce that we are about to wait, returns a key for commit/cancel
+ */
+static inline int futex_eventcount_prepare(futex_eventcount_t* ec) {
+	__atomic_fetch_add(&ec->waiters, 1, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&ec->epoch, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * the condition became true between prepare and commit, do not sleep
+ */
+static inline void futex_eventcount_cancel(futex_eventcount_t* ec) {
+	__atomic_fetch_sub(&ec->waiters, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * sleep unless there was a notify since the matching prepare
+ */
+static inline void futex_eventcount_commit(futex_eventcount_t* ec, int key) {
+	futex_wait(&ec->epoch, key);
+	__atomic_fetch_sub(&ec->waiters, 1, __ATOMIC_RELAXED);
+}
+
+static inline void futex_eventcount_notify(futex_eventcount_t* ec) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&ec->waiters, __ATOMIC_RELAXED)>0) {
+		__atomic_fetch_add(&ec->epoch, 1, __ATOMIC_SEQ_CST);
+		futex_wake(&ec->epoch, INT_MAX);
+	}
+}
@@ -26,7 +26,7 @@
 /* THIS IS A C FILE, NO C++ here */
 
 #include <firstinclude.h>
-#include <proc_utils.h>	// for my_system()
+#include <multiproc_utils.h>	// for my_system()
 
 // kernel log handling functions
 static inline void klog_clear(void) {
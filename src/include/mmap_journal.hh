@@ -0,0 +1,476 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for off_t
+#include <sys/stat.h>	// for mkdir(2), fstat(2), struct stat
+#include <sys/mman.h>	// for mmap(2), munmap(2), msync(2)
+#include <fcntl.h>	// for open(2), fallocate(2), O_*
+#include <pthread.h>	// for pthread_mutex_*, pthread_cond_*
+#include <sched.h>	// for sched_yield(2)
+#include <stdio.h>	// for snprintf(3), fprintf(3)
+#include <stdlib.h>	// for exit(3), EXIT_FAILURE
+#include <stddef.h>	// for offsetof()
+#include <stdint.h>	// for uint32_t, uint64_t
+#include <string.h>	// for memcpy(3), memset(3), memcmp(3)
+#include <errno.h>	// for errno, EEXIST, ENOENT
+#include <unistd.h>	// for fdatasync(2), fsync(2), close(2), unlink(2), sysconf(3)
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_NOT_VOIDP(), CHECK_ZERO_ERRNO(), CHECK_ASSERT()
+#include <crc32c_utils.h>	// for crc32c()
+
+/*
+ * An append only log in memory mapped segments, for many writers.
+ *
+ * The log is a directory of segment files (00000000.seg, 00000001.seg...)
+ * of a fixed size, each fallocate(2)d in full when created and mapped
+ * MAP_SHARED, so an append is a memcpy(3) and never extends a file. The
+ * log offset of a record is its position in the concatenation of the data
+ * parts of all the segments (after their 64 byte header).
+ *
+ * Appending (append(), lock free):
+ * - space is reserved with one atomic fetch-and-add on the tail. A record
+ * that does not fit in what is left of its segment turns its reservation
+ * into padding (the rest of the segment and the start of the next one)
+ * and reserves again.
+ * - the payload is copied in, then the crc and last the length with a
+ * release store. The length is the commit marker: a record with a zero
+ * length was never finished, all the unused space is zero (fallocate).
+ * - the crc is CRC32C (crc32c_utils.h) of the log offset, the length and
+ * the payload, so a torn write (only some of the pages of a record reached
+ * the disk) or a record from another offset is detected.
+ *
+ * Committing (commit(), group commit):
+ * append() returns the log offset just after the record. commit() of that
+ * offset returns once everything up to it is on disk. One of the waiting
+ * writers leads: it walks the commit markers from the durable point to
+ * find how far the log is written without holes (records reserved but not
+ * yet written stop the walk), syncs that range with one msync(MS_SYNC)
+ * (or fdatasync(2) of the segments, --sync) and wakes the others.
+ *
+ * Recovery (the constructor):
+ * opening an existing log scans the records from the start and stops at
+ * the first one that is not complete (zero length, bad crc). That is the
+ * end of the log: the rest of that segment is zeroed and the segments after
+ * it removed, so no record written after a hole can come back to life
+ * later. Every record acknowledged by commit() is before that point.
+ * Only segments whose header checks out are ever zeroed or removed, plus a
+ * last segment that is empty or has an all zero header (a crash while
+ * create_segment() was setting it up, before it held anything). A segment
+ * that is shorter than the segment size, was written with another segment
+ * size or has a corrupt header stops the program with an error and nothing
+ * is touched: deciding what is lost there is for a human.
+ *
+ * scan() calls a function for every record, for readers.
+ *
+ * Used by examples/mmap/mmap_journal.cc
+ */
+
+enum journal_sync {
+	journal_sync_msync,
+	journal_sync_fdatasync,
+	journal_sync_none,
+};
+
+struct JournalSegmentHeader {
+	char magic[8];
+	uint64_t index;
+	uint64_t size;
+	uint32_t version;
+	uint32_t crc;
+	char pad[32];
+};
+
+struct JournalRecordHeader {
+	// the commit marker, 0 while the record is not complete
+	uint32_t length;
+	uint32_t crc;
+};
+
+class MmapJournal{
+private:
+	static const size_t header_size=sizeof(JournalSegmentHeader);
+	static const unsigned int max_segments=1<<16;
+	// the high bit of the length marks padding, the rest is its size
+	static const uint32_t pad_flag=0x80000000;
+	static constexpr const char* magic="JOURNAL1";
+
+	struct Segment {
+		int fd;
+		char* base;
+	};
+
+	char dir[256];
+	size_t segment_size;
+	size_t data_size;
+	enum journal_sync sync_mode;
+	Segment* segments[max_segments];
+	// protects the creation of segments
+	pthread_mutex_t segment_mutex;
+	// the next offset to reserve
+	uint64_t tail;
+	// group commit state
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	uint64_t durable;
+	bool syncing;
+	unsigned long syncs;
+	long pagesize;
+
+	static size_t align8(size_t n) {
+		return (n+7)&~(size_t)7;
+	}
+	static uint32_t record_crc(uint64_t offset, uint32_t length, const void* data) {
+		uint32_t crc=crc32c(&offset, sizeof(offset), 0);
+		crc=crc32c(&length, sizeof(length), crc);
+		return crc32c(data, (length & pad_flag)?0:length, crc);
+	}
+	static uint32_t segment_crc(const JournalSegmentHeader* h) {
+		return crc32c(h, offsetof(JournalSegmentHeader, crc), 0);
+	}
+	void segment_path(uint64_t index, char* path, size_t len) const {
+		snprintf(path, len, "%s/%08lx.seg", dir, (unsigned long)index);
+	}
+	[[noreturn]] void fail(uint64_t index, const char* why) const {
+		char path[300];
+		segment_path(index, path, sizeof(path));
+		fprintf(stderr, "journal: %s: %s, not touching the journal\n", path, why);
+		exit(EXIT_FAILURE);
+	}
+	/*
+	 * Map an existing segment, NULL if there is none. A file of length
+	 * 0 (a crash between creating and fallocating it) is not mapped, its
+	 * base is NULL. Touching a mapping beyond the end of the file would
+	 * be a SIGBUS so any other size but the segment size is an error.
+	 */
+	Segment* open_segment(uint64_t index) {
+		char path[300];
+		segment_path(index, path, sizeof(path));
+		int fd=open(path, O_RDWR|O_CLOEXEC);
+		if(fd==-1) {
+			CHECK_ASSERT(errno==ENOENT);
+			return NULL;
+		}
+		struct stat st;
+		CHECK_NOT_M1(fstat(fd, &st));
+		Segment* s=new Segment;
+		s->fd=fd;
+		s->base=NULL;
+		if(st.st_size==0) {
+			return s;
+		}
+		if((size_t)st.st_size!=segment_size) {
+			char why[128];
+			snprintf(why, sizeof(why), "size is %lu, the segment size is %zu", (unsigned long)st.st_size, segment_size);
+			fail(index, why);
+		}
+		s->base=static_cast<char*>(CHECK_NOT_VOIDP(mmap(NULL, segment_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0), MAP_FAILED));
+		return s;
+	}
+	void close_segment(Segment* s) {
+		if(s->base!=NULL) {
+			CHECK_NOT_M1(munmap(s->base, segment_size));
+		}
+		CHECK_NOT_M1(close(s->fd));
+		delete s;
+	}
+	Segment* create_segment(uint64_t index) {
+		char path[300];
+		segment_path(index, path, sizeof(path));
+		int fd=CHECK_NOT_M1(open(path, O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC, 0644));
+		CHECK_NOT_M1(fallocate(fd, 0, 0, segment_size));
+		Segment* s=new Segment;
+		s->fd=fd;
+		s->base=static_cast<char*>(CHECK_NOT_VOIDP(mmap(NULL, segment_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0), MAP_FAILED));
+		JournalSegmentHeader* h=reinterpret_cast<JournalSegmentHeader*>(s->base);
+		memcpy(h->magic, magic, sizeof(h->magic));
+		h->index=index;
+		h->size=segment_size;
+		h->version=1;
+		h->crc=segment_crc(h);
+		// the segment, its size and its directory entry must be on disk
+		// before any record in it is acknowledged
+		if(sync_mode!=journal_sync_none) {
+			CHECK_NOT_M1(fsync(fd));
+			int dirfd=CHECK_NOT_M1(open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC));
+			CHECK_NOT_M1(fsync(dirfd));
+			CHECK_NOT_M1(close(dirfd));
+		}
+		return s;
+	}
+	bool segment_valid(const Segment* s, uint64_t index) const {
+		if(s->base==NULL) {
+			return false;
+		}
+		const JournalSegmentHeader* h=reinterpret_cast<const JournalSegmentHeader*>(s->base);
+		return memcmp(h->magic, magic, sizeof(h->magic))==0 && h->index==index && h->size==segment_size && h->crc==segment_crc(h);
+	}
+	// never set up: no file content or a header of zeros
+	bool segment_blank(const Segment* s) const {
+		if(s->base==NULL) {
+			return true;
+		}
+		static const char zeros[header_size]={};
+		return memcmp(s->base, zeros, header_size)==0;
+	}
+	// stop unless every segment is valid, only the last may be blank
+	void check_segments() const {
+		for(uint64_t index=0; index<max_segments && segments[index]!=NULL; index++) {
+			const Segment* s=segments[index];
+			if(segment_valid(s, index)) {
+				continue;
+			}
+			bool last=index+1==max_segments || segments[index+1]==NULL;
+			if(segment_blank(s)) {
+				if(!last) {
+					fail(index, "empty segment in the middle of the journal");
+				}
+				continue;
+			}
+			const JournalSegmentHeader* h=reinterpret_cast<const JournalSegmentHeader*>(s->base);
+			if(memcmp(h->magic, magic, sizeof(h->magic))==0 && h->crc==segment_crc(h) && h->size!=segment_size) {
+				char why[128];
+				snprintf(why, sizeof(why), "written with segment size %lu, opened with %zu", (unsigned long)h->size, segment_size);
+				fail(index, why);
+			}
+			fail(index, "bad segment header");
+		}
+	}
+	Segment* get_segment(uint64_t index) {
+		CHECK_ASSERT(index<max_segments);
+		Segment* s=__atomic_load_n(&segments[index], __ATOMIC_ACQUIRE);
+		if(s!=NULL) {
+			return s;
+		}
+		CHECK_ZERO_ERRNO(pthread_mutex_lock(&segment_mutex));
+		s=segments[index];
+		if(s==NULL) {
+			s=create_segment(index);
+			__atomic_store_n(&segments[index], s, __ATOMIC_RELEASE);
+		}
+		CHECK_ZERO_ERRNO(pthread_mutex_unlock(&segment_mutex));
+		return s;
+	}
+	JournalRecordHeader* record_at(uint64_t offset) {
+		Segment* s=get_segment(offset/data_size);
+		return reinterpret_cast<JournalRecordHeader*>(s->base+header_size+offset%data_size);
+	}
+	// the size a record takes in the log
+	static size_t frame_size(uint32_t length) {
+		return align8(sizeof(JournalRecordHeader)+length);
+	}
+	// the offset after the record at offset if it is complete and valid,
+	// 0 otherwise
+	uint64_t check_record(uint64_t offset, const JournalRecordHeader* r) const {
+		uint32_t length=__atomic_load_n(&r->length, __ATOMIC_ACQUIRE);
+		if(length==0) {
+			return 0;
+		}
+		size_t size=(length & pad_flag)?length & ~pad_flag:frame_size(length);
+		if(size<sizeof(JournalRecordHeader) || size%8!=0 || offset%data_size+size>data_size) {
+			return 0;
+		}
+		uint64_t end=offset+size;
+		if(r->crc!=record_crc(offset, length, r+1)) {
+			return 0;
+		}
+		return end;
+	}
+	void pad(uint64_t offset, size_t size) {
+		JournalRecordHeader* r=record_at(offset);
+		uint32_t length=size|pad_flag;
+		r->crc=record_crc(offset, length, r+1);
+		__atomic_store_n(&r->length, length, __ATOMIC_RELEASE);
+	}
+	// how far the log is complete from offset, stops at the first hole
+	uint64_t written_from(uint64_t offset, uint64_t limit) {
+		while(offset<limit) {
+			uint64_t end=check_record(offset, record_at(offset));
+			if(end==0) {
+				break;
+			}
+			offset=end;
+		}
+		return offset;
+	}
+	void sync_range(uint64_t from, uint64_t to) {
+		if(sync_mode==journal_sync_none || from==to) {
+			return;
+		}
+		uint64_t first=from/data_size;
+		uint64_t last=(to-1)/data_size;
+		for(uint64_t index=first; index<=last; index++) {
+			Segment* s=get_segment(index);
+			if(sync_mode==journal_sync_fdatasync) {
+				CHECK_NOT_M1(fdatasync(s->fd));
+				continue;
+			}
+			uint64_t start=index==first?header_size+from%data_size:header_size;
+			uint64_t end=index==last?header_size+(to-1)%data_size+1:segment_size;
+			// msync(2) wants a page aligned address
+			start-=start%pagesize;
+			CHECK_NOT_M1(msync(s->base+start, end-start, MS_SYNC));
+		}
+		syncs++;
+	}
+	void recover() {
+		for(uint64_t index=0; index<max_segments; index++) {
+			segments[index]=open_segment(index);
+			if(segments[index]==NULL) {
+				break;
+			}
+		}
+		check_segments();
+		uint64_t offset=0;
+		while(true) {
+			uint64_t index=offset/data_size;
+			if(index>=max_segments || segments[index]==NULL || !segment_valid(segments[index], index)) {
+				break;
+			}
+			uint64_t end=check_record(offset, record_at(offset));
+			if(end==0) {
+				break;
+			}
+			offset=end;
+		}
+		tail=offset;
+		durable=offset;
+		// zero the rest of the segment of the end, remove all after it
+		// (check_segments() made sure these are ours: valid or blank)
+		uint64_t index=offset/data_size;
+		if(index<max_segments && segments[index]!=NULL) {
+			if(segment_valid(segments[index], index)) {
+				size_t start=header_size+offset%data_size;
+				memset(segments[index]->base+start, 0, segment_size-start);
+				CHECK_NOT_M1(msync(segments[index]->base, segment_size, MS_SYNC));
+				index++;
+			}
+			for(; index<max_segments && segments[index]!=NULL; index++) {
+				char path[300];
+				segment_path(index, path, sizeof(path));
+				close_segment(segments[index]);
+				CHECK_NOT_M1(unlink(path));
+				segments[index]=NULL;
+			}
+		}
+	}
+
+public:
+	MmapJournal(const char* idir, size_t isegment_size=64*1024*1024, enum journal_sync isync_mode=journal_sync_msync) : segment_size(isegment_size), data_size(isegment_size-header_size), sync_mode(isync_mode), syncing(false), syncs(0) {
+		static_assert(sizeof(JournalSegmentHeader)==64, "segment header is 64 bytes");
+		pagesize=sysconf(_SC_PAGESIZE);
+		CHECK_ASSERT(segment_size%pagesize==0 && segment_size<pad_flag);
+		snprintf(dir, sizeof(dir), "%s", idir);
+		if(mkdir(dir, 0755)==-1) {
+			CHECK_ASSERT(errno==EEXIST);
+		}
+		memset(segments, 0, sizeof(segments));
+		CHECK_ZERO_ERRNO(pthread_mutex_init(&segment_mutex, NULL));
+		CHECK_ZERO_ERRNO(pthread_mutex_init(&mutex, NULL));
+		CHECK_ZERO_ERRNO(pthread_cond_init(&cond, NULL));
+		recover();
+	}
+	~MmapJournal() {
+		for(Segment* s : segments) {
+			if(s!=NULL) {
+				close_segment(s);
+			}
+		}
+		CHECK_ZERO_ERRNO(pthread_cond_destroy(&cond));
+		CHECK_ZERO_ERRNO(pthread_mutex_destroy(&mutex));
+		CHECK_ZERO_ERRNO(pthread_mutex_destroy(&segment_mutex));
+	}
+
+	// append a record, returns the offset just after it (for commit())
+	uint64_t append(const void* data, uint32_t length) {
+		const size_t size=frame_size(length);
+		CHECK_ASSERT(length>0 && length<pad_flag && size<=data_size);
+		while(true) {
+			uint64_t offset=__atomic_fetch_add(&tail, size, __ATOMIC_RELAXED);
+			uint64_t left=data_size-offset%data_size;
+			if(size>left) {
+				// pad both parts of the reservation, everything is 8 byte
+				// aligned so there is room for a header in each
+				pad(offset, left);
+				pad(offset+left, size-left);
+				continue;
+			}
+			JournalRecordHeader* r=record_at(offset);
+			memcpy(r+1, data, length);
+			r->crc=record_crc(offset, length, data);
+			__atomic_store_n(&r->length, length, __ATOMIC_RELEASE);
+			return offset+size;
+		}
+	}
+
+	// wait until everything up to offset is on disk
+	void commit(uint64_t offset) {
+		CHECK_ZERO_ERRNO(pthread_mutex_lock(&mutex));
+		while(durable<offset) {
+			if(syncing) {
+				CHECK_ZERO_ERRNO(pthread_cond_wait(&cond, &mutex));
+				continue;
+			}
+			syncing=true;
+			uint64_t from=durable;
+			CHECK_ZERO_ERRNO(pthread_mutex_unlock(&mutex));
+			uint64_t to=written_from(from, __atomic_load_n(&tail, __ATOMIC_RELAXED));
+			sync_range(from, to);
+			CHECK_ZERO_ERRNO(pthread_mutex_lock(&mutex));
+			durable=to;
+			syncing=false;
+			CHECK_ZERO_ERRNO(pthread_cond_broadcast(&cond));
+			if(to<offset) {
+				// a record before ours is still being written
+				CHECK_ZERO_ERRNO(pthread_mutex_unlock(&mutex));
+				sched_yield();
+				CHECK_ZERO_ERRNO(pthread_mutex_lock(&mutex));
+			}
+		}
+		CHECK_ZERO_ERRNO(pthread_mutex_unlock(&mutex));
+	}
+
+	// call f(offset, data, length) for every record, returns the end
+	template<class F> uint64_t scan(F f) {
+		uint64_t offset=0;
+		uint64_t end=__atomic_load_n(&tail, __ATOMIC_RELAXED);
+		while(offset<end) {
+			const JournalRecordHeader* r=record_at(offset);
+			uint64_t next=check_record(offset, r);
+			if(next==0) {
+				break;
+			}
+			if(!(r->length & pad_flag)) {
+				f(offset, static_cast<const void*>(r+1), r->length);
+			}
+			offset=next;
+		}
+		return offset;
+	}
+
+	uint64_t get_tail() const {
+		return __atomic_load_n(&tail, __ATOMIC_RELAXED);
+	}
+	uint64_t get_durable() const {
+		return durable;
+	}
+	unsigned long get_syncs() const {
+		return syncs;
+	}
+};
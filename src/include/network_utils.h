@@ -30,10 +30,11 @@
 #include <sys/stat.h>	// for open(2)
 #include <fcntl.h>	// for open(2)
 #include <unistd.h>	// for read(2), close(2)
-#include <stdlib.h>	// for atoi(3)
-#include <stdio.h>	// for snprintf(3)
+#include <stdlib.h>	// for atoi(3), strtoull(3)
+#include <stdio.h>	// for snprintf(3), fopen(3), fgets(3), fclose(3)
+#include <string.h>	// for strncmp(3), strcmp(3), strtok_r(3), memset(3)
 #include <netdb.h>	// for getservbyname(3)
-#include <err_utils.h>	// for CHECK_NOT_M1()
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_NOT_NULL_FILEP()
 
 static inline int get_backlog(void) {
 	// read the data from the /proc/sys/net/core/somaxconn virtual file...
@@ -75,3 +76,51 @@ static inline void domain_to_str(int domain, char* buf, unsigned int bufsize) {
 		break;
 	}
 }
+
+/*
+ * The kernel wide UDP counters from /proc/net/snmp. They are not per socket
+ * so other UDP traffic on the machine shows up too, take deltas around a
+ * test. RcvbufErrors is the interesting one: datagrams dropped because the
+ * receiving socket buffer was full.
+ */
+typedef struct _udp_snmp_t {
+	unsigned long long InDatagrams;
+	unsigned long long NoPorts;
+	unsigned long long InErrors;
+	unsigned long long OutDatagrams;
+	unsigned long long RcvbufErrors;
+	unsigned long long SndbufErrors;
+} udp_snmp_t;
+
+static inline void get_udp_snmp(udp_snmp_t* s) {
+	// the file has a "Udp:" line with the names followed by one with the values
+	FILE* f=CHECK_NOT_NULL_FILEP(fopen("/proc/net/snmp", "r"));
+	char names[1024];
+	char values[1024];
+	memset(s, 0, sizeof(*s));
+	while(fgets(names, sizeof(names), f)!=NULL) {
+		if(strncmp(names, "Udp:", 4)!=0) {
+			continue;
+		}
+		if(fgets(values, sizeof(values), f)==NULL) {
+			break;
+		}
+		char* nsave;
+		char* vsave;
+		char* name=strtok_r(names, " \n", &nsave);
+		char* value=strtok_r(values, " \n", &vsave);
+		while(name!=NULL && value!=NULL) {
+			unsigned long long v=strtoull(value, NULL, 10);
+			if(strcmp(name, "InDatagrams")==0) s->InDatagrams=v;
+			if(strcmp(name, "NoPorts")==0) s->NoPorts=v;
+			if(strcmp(name, "InErrors")==0) s->InErrors=v;
+			if(strcmp(name, "OutDatagrams")==0) s->OutDatagrams=v;
+			if(strcmp(name, "RcvbufErrors")==0) s->RcvbufErrors=v;
+			if(strcmp(name, "SndbufErrors")==0) s->SndbufErrors=v;
+			name=strtok_r(NULL, " \n", &nsave);
+			value=strtok_r(NULL, " \n", &vsave);
+		}
+		break;
+	}
+	CHECK_NOT_M1(fclose(f));
+}
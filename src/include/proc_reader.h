@@ -0,0 +1,501 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ * A fast reader for the per process files in /proc for programs which
+ * sample many processes again and again (monitoring agents, top(1)).
+ *
+ * - the files of a process are opened once (proc_reader_open()) and every
+ * sample is a single pread(2) from offset 0 per file, no open(2) and
+ * close(2), no path lookup. procfs regenerates the content on every read
+ * from offset 0.
+ * - no allocation: the text is read into a buffer inside the reader and
+ * parsed with hand written integer scanners (no sscanf(3), no stdio) into
+ * flat structs.
+ * - an open fd stays bound to the process it was opened for: when the
+ * process exits reads fail with ESRCH, even if the pid is reused. The
+ * caller should then close the reader and open a new one if it wants
+ * the new process.
+ *
+ * Supported files: stat, statm, status, smaps_rollup, schedstat and io.
+ * smaps_rollup walks all the mappings of the process under its mmap lock,
+ * it is by far the most expensive of them. io needs ptrace access to the
+ * process (your own processes or root), if it cannot be opened it is left
+ * closed and reading it fails with EBADF.
+ *
+ * Used by proc_utils.h and examples/proc/proc_sample.cc
+ */
+
+/* THIS IS A C FILE, NO C++ here */
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for pid_t, ssize_t
+#include <fcntl.h>	// for open(2), O_RDONLY, O_CLOEXEC
+#include <unistd.h>	// for pread(2), close(2)
+#include <stdio.h>	// for snprintf(3)
+#include <string.h>	// for memcpy(3), memcmp(3), memchr(3), memrchr(3), memset(3)
+#include <stddef.h>	// for offsetof()
+#include <stdbool.h>	// for bool, true, false
+#include <errno.h>	// for errno, EBADF, EINVAL, ENOENT, ESRCH, EACCES, EPERM
+#include <err_utils.h>	// for CHECK_NOT_M1()
+
+enum proc_file {
+	proc_file_stat,
+	proc_file_statm,
+	proc_file_status,
+	proc_file_smaps_rollup,
+	proc_file_schedstat,
+	proc_file_io,
+	proc_file_count,
+};
+
+#define PROC_FILE(f) (1U<<(f))
+#define PROC_FILES_ALL ((1U<<proc_file_count)-1)
+
+static const char* const proc_file_names[proc_file_count]={
+	"stat",
+	"statm",
+	"status",
+	"smaps_rollup",
+	"schedstat",
+	"io",
+};
+
+// /proc/<pid>/stat, see proc(5) for the meaning of the fields
+typedef struct _proc_stat {
+	char comm[64];
+	char state;
+	int ppid;
+	int pgrp;
+	int session;
+	int tty_nr;
+	unsigned int flags;
+	unsigned long minflt;
+	unsigned long cminflt;
+	unsigned long majflt;
+	unsigned long cmajflt;
+	unsigned long utime;	// clock ticks
+	unsigned long stime;	// clock ticks
+	long cutime;
+	long cstime;
+	long priority;
+	long nice;
+	long num_threads;
+	unsigned long long starttime;	// clock ticks after boot
+	unsigned long vsize;	// bytes
+	long rss;	// pages
+	int processor;
+	unsigned int rt_priority;
+	unsigned int policy;
+	unsigned long long delayacct_blkio_ticks;
+} proc_stat_t;
+
+// /proc/<pid>/statm, all in pages
+typedef struct _proc_statm {
+	unsigned long size;
+	unsigned long resident;
+	unsigned long shared;
+	unsigned long text;
+	unsigned long lib;
+	unsigned long data;
+	unsigned long dt;
+} proc_statm_t;
+
+// the numeric lines of /proc/<pid>/status, sizes in kB
+typedef struct _proc_status {
+	unsigned long long uid;	// real uid
+	unsigned long long gid;	// real gid
+	unsigned long long vm_peak;
+	unsigned long long vm_size;
+	unsigned long long vm_lck;
+	unsigned long long vm_hwm;
+	unsigned long long vm_rss;
+	unsigned long long rss_anon;
+	unsigned long long rss_file;
+	unsigned long long rss_shmem;
+	unsigned long long vm_data;
+	unsigned long long vm_stk;
+	unsigned long long vm_exe;
+	unsigned long long vm_lib;
+	unsigned long long vm_pte;
+	unsigned long long vm_swap;
+	unsigned long long threads;
+	unsigned long long voluntary_ctxt_switches;
+	unsigned long long nonvoluntary_ctxt_switches;
+} proc_status_t;
+
+// /proc/<pid>/smaps_rollup, in kB
+typedef struct _proc_smaps_rollup {
+	unsigned long long rss;
+	unsigned long long pss;
+	unsigned long long pss_anon;
+	unsigned long long pss_file;
+	unsigned long long pss_shmem;
+	unsigned long long shared_clean;
+	unsigned long long shared_dirty;
+	unsigned long long private_clean;
+	unsigned long long private_dirty;
+	unsigned long long referenced;
+	unsigned long long anonymous;
+	unsigned long long swap;
+	unsigned long long swap_pss;
+	unsigned long long locked;
+} proc_smaps_rollup_t;
+
+// /proc/<pid>/schedstat
+typedef struct _proc_schedstat {
+	unsigned long long run_ns;	// time spent on the cpu
+	unsigned long long wait_ns;	// time spent waiting on a run queue
+	unsigned long long timeslices;
+} proc_schedstat_t;
+
+// /proc/<pid>/io, in bytes and system calls
+typedef struct _proc_io {
+	unsigned long long rchar;
+	unsigned long long wchar;
+	unsigned long long syscr;
+	unsigned long long syscw;
+	unsigned long long read_bytes;
+	unsigned long long write_bytes;
+	unsigned long long cancelled_write_bytes;
+} proc_io_t;
+
+#define PROC_READER_BUFSIZE 8192
+
+typedef struct _proc_reader {
+	pid_t pid;
+	int fds[proc_file_count];
+	char buf[PROC_READER_BUFSIZE];
+} proc_reader_t;
+
+/*
+ * Open the files (a mask of PROC_FILE() bits) of process pid (0 for the
+ * calling process). Returns false (errno set) if the process does not
+ * exist, files which cannot be opened for lack of permission (EACCES,
+ * EPERM) stay closed, any other failure (EMFILE, ENFILE) is fatal.
+ */
+static inline bool proc_reader_open(proc_reader_t* r, pid_t pid, unsigned int files) {
+	char path[64];
+	int i;
+	r->pid=pid;
+	for(i=0; i<proc_file_count; i++) {
+		r->fds[i]=-1;
+	}
+	for(i=0; i<proc_file_count; i++) {
+		if(!(files & PROC_FILE(i))) {
+			continue;
+		}
+		if(pid==0) {
+			snprintf(path, sizeof(path), "/proc/self/%s", proc_file_names[i]);
+		} else {
+			snprintf(path, sizeof(path), "/proc/%d/%s", pid, proc_file_names[i]);
+		}
+		r->fds[i]=open(path, O_RDONLY|O_CLOEXEC);
+		if(r->fds[i]!=-1) {
+			continue;
+		}
+		// no ptrace access (io), the file stays closed
+		if(errno==EACCES || errno==EPERM) {
+			continue;
+		}
+		// out of fds (EMFILE, ENFILE) or anything else is a bug of the
+		// caller, not something to sample around
+		if(errno!=ENOENT && errno!=ESRCH) {
+			CHECK_NOT_M1(r->fds[i]);
+		}
+		// the process is gone
+		int err=errno;
+		for(i=0; i<proc_file_count; i++) {
+			if(r->fds[i]!=-1) {
+				CHECK_NOT_M1(close(r->fds[i]));
+				r->fds[i]=-1;
+			}
+		}
+		errno=err;
+		return false;
+	}
+	return true;
+}
+
+static inline void proc_reader_close(proc_reader_t* r) {
+	int i;
+	for(i=0; i<proc_file_count; i++) {
+		if(r->fds[i]!=-1) {
+			CHECK_NOT_M1(close(r->fds[i]));
+			r->fds[i]=-1;
+		}
+	}
+}
+
+/*
+ * Read a whole file into the buffer of the reader. Returns the length or -1
+ * with errno set (ESRCH: the process is gone, EBADF: the file is not open).
+ */
+static inline ssize_t proc_reader_pread(proc_reader_t* r, enum proc_file f) {
+	if(r->fds[f]==-1) {
+		errno=EBADF;
+		return -1;
+	}
+	ssize_t len=pread(r->fds[f], r->buf, sizeof(r->buf)-1, 0);
+	if(len==-1) {
+		return -1;
+	}
+	r->buf[len]='\0';
+	return len;
+}
+
+/*
+ * Integer scanners: skip blanks, parse a (signed) decimal number, return
+ * the position after it.
+ */
+static inline const char* proc_scan_ull(const char* p, const char* end, unsigned long long* v) {
+	unsigned long long r=0;
+	while(p<end && (*p==' ' || *p=='\t')) {
+		p++;
+	}
+	while(p<end && (unsigned char)(*p-'0')<10) {
+		r=r*10+(*p-'0');
+		p++;
+	}
+	*v=r;
+	return p;
+}
+
+static inline const char* proc_scan_ll(const char* p, const char* end, long long* v) {
+	unsigned long long r;
+	bool neg=false;
+	while(p<end && (*p==' ' || *p=='\t')) {
+		p++;
+	}
+	if(p<end && *p=='-') {
+		neg=true;
+		p++;
+	}
+	p=proc_scan_ull(p, end, &r);
+	*v=neg?-(long long)r:(long long)r;
+	return p;
+}
+
+/*
+ * "Name:   value [kB]" files: every line whose name is in the table has the
+ * first number after the colon stored in the unsigned long long at the
+ * given offset of out. Lines not in the table are skipped.
+ */
+typedef struct _proc_field {
+	const char* name;
+	unsigned int len;
+	size_t offset;
+} proc_field_t;
+
+#define PROC_FIELD(type, name, member) { name, sizeof(name)-1, offsetof(type, member) }
+
+static inline void proc_parse_fields(const char* p, const char* end, const proc_field_t* fields, unsigned int nfields, void* out) {
+	unsigned int hint=0;
+	while(p<end) {
+		const char* eol=(const char*)memchr(p, '\n', end-p);
+		if(eol==NULL) {
+			eol=end;
+		}
+		const char* colon=(const char*)memchr(p, ':', eol-p);
+		if(colon!=NULL) {
+			unsigned int len=colon-p;
+			// the lines come in the order of the table, start at the last hit
+			unsigned int i;
+			for(i=0; i<nfields; i++) {
+				const proc_field_t* f=&fields[(hint+i)%nfields];
+				if(f->len==len && memcmp(f->name, p, len)==0) {
+					unsigned long long* v=(unsigned long long*)((char*)out+f->offset);
+					proc_scan_ull(colon+1, eol, v);
+					hint=(hint+i+1)%nfields;
+					break;
+				}
+			}
+		}
+		p=eol+1;
+	}
+}
+
+static inline bool proc_read_stat(proc_reader_t* r, proc_stat_t* s) {
+	ssize_t len=proc_reader_pread(r, proc_file_stat);
+	if(len==-1) {
+		return false;
+	}
+	const char* end=r->buf+len;
+	// the command name may contain anything, spaces and ')' included
+	const char* open=(const char*)memchr(r->buf, '(', len);
+	const char* close=(const char*)memrchr(r->buf, ')', len);
+	if(open==NULL || close==NULL || close+3>end) {
+		errno=EINVAL;
+		return false;
+	}
+	size_t comm_len=close-open-1;
+	if(comm_len>=sizeof(s->comm)) {
+		comm_len=sizeof(s->comm)-1;
+	}
+	memcpy(s->comm, open+1, comm_len);
+	s->comm[comm_len]='\0';
+	s->state=close[2];
+	// fields 4 (ppid) to 42 (delayacct_blkio_ticks) of proc(5)
+	long long v[43];
+	const char* p=close+3;
+	int i;
+	for(i=4; i<=42; i++) {
+		p=proc_scan_ll(p, end, &v[i]);
+	}
+	s->ppid=v[4];
+	s->pgrp=v[5];
+	s->session=v[6];
+	s->tty_nr=v[7];
+	s->flags=v[9];
+	s->minflt=v[10];
+	s->cminflt=v[11];
+	s->majflt=v[12];
+	s->cmajflt=v[13];
+	s->utime=v[14];
+	s->stime=v[15];
+	s->cutime=v[16];
+	s->cstime=v[17];
+	s->priority=v[18];
+	s->nice=v[19];
+	s->num_threads=v[20];
+	s->starttime=v[22];
+	s->vsize=v[23];
+	s->rss=v[24];
+	s->processor=v[39];
+	s->rt_priority=v[40];
+	s->policy=v[41];
+	s->delayacct_blkio_ticks=v[42];
+	return true;
+}
+
+static inline bool proc_read_statm(proc_reader_t* r, proc_statm_t* s) {
+	ssize_t len=proc_reader_pread(r, proc_file_statm);
+	if(len==-1) {
+		return false;
+	}
+	const char* end=r->buf+len;
+	unsigned long long v[7];
+	const char* p=r->buf;
+	int i;
+	for(i=0; i<7; i++) {
+		p=proc_scan_ull(p, end, &v[i]);
+	}
+	s->size=v[0];
+	s->resident=v[1];
+	s->shared=v[2];
+	s->text=v[3];
+	s->lib=v[4];
+	s->data=v[5];
+	s->dt=v[6];
+	return true;
+}
+
+static const proc_field_t proc_status_fields[]={
+	PROC_FIELD(proc_status_t, "Uid", uid),
+	PROC_FIELD(proc_status_t, "Gid", gid),
+	PROC_FIELD(proc_status_t, "VmPeak", vm_peak),
+	PROC_FIELD(proc_status_t, "VmSize", vm_size),
+	PROC_FIELD(proc_status_t, "VmLck", vm_lck),
+	PROC_FIELD(proc_status_t, "VmHWM", vm_hwm),
+	PROC_FIELD(proc_status_t, "VmRSS", vm_rss),
+	PROC_FIELD(proc_status_t, "RssAnon", rss_anon),
+	PROC_FIELD(proc_status_t, "RssFile", rss_file),
+	PROC_FIELD(proc_status_t, "RssShmem", rss_shmem),
+	PROC_FIELD(proc_status_t, "VmData", vm_data),
+	PROC_FIELD(proc_status_t, "VmStk", vm_stk),
+	PROC_FIELD(proc_status_t, "VmExe", vm_exe),
+	PROC_FIELD(proc_status_t, "VmLib", vm_lib),
+	PROC_FIELD(proc_status_t, "VmPTE", vm_pte),
+	PROC_FIELD(proc_status_t, "VmSwap", vm_swap),
+	PROC_FIELD(proc_status_t, "Threads", threads),
+	PROC_FIELD(proc_status_t, "voluntary_ctxt_switches", voluntary_ctxt_switches),
+	PROC_FIELD(proc_status_t, "nonvoluntary_ctxt_switches", nonvoluntary_ctxt_switches),
+};
+
+// kernel threads have no Vm* lines, those fields are left 0
+static inline bool proc_read_status(proc_reader_t* r, proc_status_t* s) {
+	ssize_t len=proc_reader_pread(r, proc_file_status);
+	if(len==-1) {
+		return false;
+	}
+	memset(s, 0, sizeof(*s));
+	proc_parse_fields(r->buf, r->buf+len, proc_status_fields, sizeof(proc_status_fields)/sizeof(proc_status_fields[0]), s);
+	return true;
+}
+
+static const proc_field_t proc_smaps_rollup_fields[]={
+	PROC_FIELD(proc_smaps_rollup_t, "Rss", rss),
+	PROC_FIELD(proc_smaps_rollup_t, "Pss", pss),
+	PROC_FIELD(proc_smaps_rollup_t, "Pss_Anon", pss_anon),
+	PROC_FIELD(proc_smaps_rollup_t, "Pss_File", pss_file),
+	PROC_FIELD(proc_smaps_rollup_t, "Pss_Shmem", pss_shmem),
+	PROC_FIELD(proc_smaps_rollup_t, "Shared_Clean", shared_clean),
+	PROC_FIELD(proc_smaps_rollup_t, "Shared_Dirty", shared_dirty),
+	PROC_FIELD(proc_smaps_rollup_t, "Private_Clean", private_clean),
+	PROC_FIELD(proc_smaps_rollup_t, "Private_Dirty", private_dirty),
+	PROC_FIELD(proc_smaps_rollup_t, "Referenced", referenced),
+	PROC_FIELD(proc_smaps_rollup_t, "Anonymous", anonymous),
+	PROC_FIELD(proc_smaps_rollup_t, "Swap", swap),
+	PROC_FIELD(proc_smaps_rollup_t, "SwapPss", swap_pss),
+	PROC_FIELD(proc_smaps_rollup_t, "Locked", locked),
+};
+
+// kernel threads have no mappings, all fields are left 0
+static inline bool proc_read_smaps_rollup(proc_reader_t* r, proc_smaps_rollup_t* s) {
+	ssize_t len=proc_reader_pread(r, proc_file_smaps_rollup);
+	if(len==-1) {
+		return false;
+	}
+	memset(s, 0, sizeof(*s));
+	proc_parse_fields(r->buf, r->buf+len, proc_smaps_rollup_fields, sizeof(proc_smaps_rollup_fields)/sizeof(proc_smaps_rollup_fields[0]), s);
+	return true;
+}
+
+static inline bool proc_read_schedstat(proc_reader_t* r, proc_schedstat_t* s) {
+	ssize_t len=proc_reader_pread(r, proc_file_schedstat);
+	if(len==-1) {
+		return false;
+	}
+	const char* end=r->buf+len;
+	const char* p=proc_scan_ull(r->buf, end, &s->run_ns);
+	p=proc_scan_ull(p, end, &s->wait_ns);
+	proc_scan_ull(p, end, &s->timeslices);
+	return true;
+}
+
+static const proc_field_t proc_io_fields[]={
+	PROC_FIELD(proc_io_t, "rchar", rchar),
+	PROC_FIELD(proc_io_t, "wchar", wchar),
+	PROC_FIELD(proc_io_t, "syscr", syscr),
+	PROC_FIELD(proc_io_t, "syscw", syscw),
+	PROC_FIELD(proc_io_t, "read_bytes", read_bytes),
+	PROC_FIELD(proc_io_t, "write_bytes", write_bytes),
+	PROC_FIELD(proc_io_t, "cancelled_write_bytes", cancelled_write_bytes),
+};
+
+static inline bool proc_read_io(proc_reader_t* r, proc_io_t* s) {
+	ssize_t len=proc_reader_pread(r, proc_file_io);
+	if(len==-1) {
+		return false;
+	}
+	memset(s, 0, sizeof(*s));
+	proc_parse_fields(r->buf, r->buf+len, proc_io_fields, sizeof(proc_io_fields)/sizeof(proc_io_fields[0]), s);
+	return true;
+}
@@ -27,12 +27,13 @@
 
 #include <firstinclude.h>
 #include <sys/types.h>	// for getpid(2), pid_t:type
-#include <unistd.h>	// for getpid(2), pid_t:type
+#include <unistd.h>	// for getpid(2), pid_t:type, read(2), close(2)
 #include <stdio.h>	// for snprintf(3), printf(3), fopen(3), fgets(3), fclose(3), feof(3), FILE:type, getline(3), sscanf(3), fread(3) , fwrite(3)
 #include <sys/time.h>	// for getrusage(2), rusage:struct
 #include <sys/resource.h>	// for getrusage(2), rusage:struct
 #include <string.h>	// for strstr(3)
-#include <multiproc_utils.h>	// for my_system()
+#include <fcntl.h>	// for open(2), O_RDONLY
+#include <proc_reader.h>	// for proc_reader_t, proc_reader_open(), proc_read_stat(), proc_read_status()
 #include <err_utils.h>	// for CHECK_NOT_NULL_FILEP(), CHECK_NOT_NULL(), CHECK_NOT_M1(), CHECK_ZERO_ERRNO(), CHECK_ASSERT(), CHECK_NOT_NEGATIVE()
 
 /*
@@ -47,15 +48,17 @@ static inline void getrusage_show_vmem(void) {
 }
 
 /*
- * Function to print the current processes /proc maps file
+ * Print a file to stdout, like cat(1) does but without running it.
+ * Goes through stdio so it comes out in order with our other output.
  */
-static inline void proc_print_mmap(const char *filter) {
-	pid_t pid=getpid();
-	if (filter==NULL) {
-		my_system("cat /proc/%d/maps", pid);
-	} else {
-		my_system("cat /proc/%d/maps | grep %s", pid, filter);
+static inline void proc_cat(const char* path) {
+	char buf[4096];
+	ssize_t len;
+	int fd=CHECK_NOT_M1(open(path, O_RDONLY));
+	while((len=CHECK_NOT_M1(read(fd, buf, sizeof(buf))))>0) {
+		CHECK_ASSERT(fwrite(buf, 1, len, stdout)==(size_t)len);
 	}
+	CHECK_NOT_M1(close(fd));
 }
 
 /*
@@ -110,7 +113,7 @@ static inline void proc_print_mmap_self_filter(const char* filter) {
 	ssize_t read_size;
 
 	FILE* fp=CHECK_NOT_NULL_FILEP(fopen("/proc/self/maps", "r"));
-	while (CHECK_NOT_M1(read_size=getline(&line, &len, fp))) {
+	while ((read_size=getline(&line, &len, fp)) != -1) {
 		if(strstr(line, filter)) {
 			printf("%s", line);
 		}
@@ -122,6 +125,18 @@ static inline void proc_print_mmap_self_filter(const char* filter) {
 	CHECK_ZERO_ERRNO(fclose(fp));
 }
 
+/*
+ * Function to print the current processes /proc maps file, only the lines
+ * containing filter if it is not NULL
+ */
+static inline void proc_print_mmap(const char *filter) {
+	if (filter==NULL) {
+		proc_print_mmap_self();
+	} else {
+		proc_print_mmap_self_filter(filter);
+	}
+}
+
 /*
  * Function to print the current processes /proc maps only for the exe itself
  */
@@ -131,43 +146,49 @@ static inline void proc_print_mmap_self_only(void) {
 }
 
 /*
- * Print memory stats for the current process
+ * Print memory stats for a process (0 for the current process)
  */
-static inline void proc_print_mem_stats(pid_t pid __attribute__((unused))) {
-	/*
-	 * TODO
-	 * proc_t myproc;
-	 * get_proc_stats(pid, &myproc);
-	 * printf("size is %ld, min_flt is %ld, state is %c\n", myproc.rss, myproc.min_flt, myproc.state);
-	 */
+static inline void proc_print_mem_stats(pid_t pid) {
+	proc_reader_t r;
+	proc_stat_t st;
+	proc_status_t status;
+	CHECK_ASSERT(proc_reader_open(&r, pid, PROC_FILE(proc_file_stat)|PROC_FILE(proc_file_status)));
+	CHECK_ASSERT(proc_read_stat(&r, &st));
+	CHECK_ASSERT(proc_read_status(&r, &status));
+	proc_reader_close(&r);
+	printf("rss is %llu kB, vsize is %llu kB, min_flt is %lu, maj_flt is %lu, state is %c\n", status.vm_rss, status.vm_size, st.minflt, st.majflt, st.state);
 }
 
 /*
  * Print memory stats for the current process
  */
 static inline void proc_print_mem_stats_self(void) {
-	printf("this should be implemented\n");
+	proc_print_mem_stats(0);
 }
 
 /*
  * Print the name of any process according to pid
  */
 static inline void my_print_process_name_proc(pid_t pid) {
-	my_system("cat /proc/%d/comm", pid);
+	char filename[256];
+	snprintf(filename, 256, "/proc/%d/comm", pid);
+	proc_cat(filename);
 }
 
 /*
  * Print the name of our process via /proc
  */
 static inline void my_print_process_name_proc_self(void) {
-	my_system("cat /proc/self/comm");
+	proc_cat("/proc/self/comm");
 }
 
 /*
  * Print the current threads name from /proc
  */
 static inline void print_thread_name_proc(void) {
-	my_system("cat /proc/%d/comm", gettid());
+	char filename[256];
+	snprintf(filename, 256, "/proc/%d/comm", gettid());
+	proc_cat(filename);
 }
 
 /*
@@ -0,0 +1,499 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <firstinclude.h>
+#include <sys/mman.h>	// for shm_open(3), shm_unlink(3), mmap(2), munmap(2)
+#include <sys/stat.h>	// for fstat(2)
+#include <fcntl.h>	// for O_CREAT, O_RDWR
+#include <unistd.h>	// for ftruncate(2), close(2)
+#include <pthread.h>	// for pthread_mutex_*(3), pthread_mutexattr_*(3)
+#include <errno.h>	// for EOWNERDEAD, EBUSY
+#include <string.h>	// for memcpy(3), memset(3)
+#include <stdint.h>	// for uint32_t, uint64_t
+#include <time.h>	// for struct timespec
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_NOT_VOIDP(), CHECK_ZERO_ERRNO(), CHECK_ASSERT()
+#include <futex_utils.h>	// for futex_wait_shared(), futex_wake_shared()
+#include <atomic_utils.h>	// for cpu_relax()
+#include <LatencyHistogram.hh>	// for latency_now()
+
+/*
+ * A message channel between processes in POSIX shared memory.
+ *
+ * The ring carries variable length messages, each framed by an 8 byte
+ * header (length and flags) and padded to 8 bytes. Any number of producers
+ * (up to shm_ring_max_producers) and one consumer:
+ * - a producer reserves space by moving 'tail' with a compare and swap,
+ * writes the payload in place and then commits the frame by storing its
+ * flags with release semantics. Producers never wait for each other, a
+ * slow producer only holds back the consumer at its own frame. With a
+ * single producer the CAS never fails.
+ * - a message that does not fit before the end of the ring is preceded
+ * by a padding frame so a message is always contiguous.
+ * - the consumer reads frames at 'head' in place, zeroes what it consumed
+ * (so that stale payload can never look like a committed header) and
+ * advances 'head'.
+ *
+ * Waiting: both sides spin for a configurable number of rounds and then
+ * sleep on a shared futex. The other side only makes a system call when
+ * the 'waiting' word says somebody sleeps, so a busy channel never enters
+ * the kernel.
+ *
+ * A peer dying must not hang the survivors. Every participant holds a
+ * robust, process shared mutex for as long as it is attached (see
+ * examples/pthreads/mutex/mutex_robust.cc). The kernel releases it when
+ * the holder dies and the next trylock returns EOWNERDEAD. Sleeps have a
+ * timeout so waiters notice:
+ * - a producer waiting for space sees a dead consumer and gets
+ * shm_ring_peer_dead instead of blocking forever. A new consumer can
+ * attach and continues where the dead one stopped, a message that was
+ * being read is delivered again.
+ * - a producer dying between reserving and committing leaves a hole the
+ * consumer would wait on for ever. Producers publish the range they are
+ * about to reserve ('claim') in their slot before the CAS so the
+ * consumer can find the dead producer's frame and skip it.
+ * Two producers dying at the same moment while racing for the same
+ * position cannot be told apart and is not handled.
+ * A robust mutex belongs to the thread that locked it, not the process:
+ * attach, use and detach a ShmRing from one thread. If that thread exits
+ * while the rest of the process goes on, its peers see it as dead; if
+ * another thread of the process crashes, nothing is noticed until the
+ * whole process is gone. Only detach_*() from the attaching thread
+ * unlocks it (unlocking from another thread fails with EPERM).
+ *
+ * Used by examples/shared_memory/shm_ring.cc
+ */
+
+static const uint64_t shm_ring_magic=0x53484d52494e4731ULL;
+static const unsigned int shm_ring_max_producers=16;
+static const uint32_t shm_ring_committed=1;
+static const uint32_t shm_ring_pad=2;
+
+enum shm_ring_result {
+	shm_ring_ok,
+	shm_ring_timeout,
+	shm_ring_peer_dead,
+};
+
+enum shm_ring_slot_state {
+	shm_ring_free,
+	shm_ring_active,
+	shm_ring_dead,
+};
+
+struct ShmRingFrame{
+	uint32_t len;
+	uint32_t flags;
+};
+
+struct alignas(64) ShmRingSlot{
+	pthread_mutex_t alive;
+	int state;
+	uint64_t claim_pos;
+	// 0 when there is no claim
+	uint64_t claim_end;
+};
+
+struct ShmRingHeader{
+	uint64_t magic;
+	uint64_t capacity;
+	// producers
+	alignas(64) uint64_t tail;
+	int space_seq;
+	int producers_waiting;
+	// consumer
+	alignas(64) uint64_t head;
+	// where a release in progress ends, so a new consumer can finish it
+	uint64_t release_end;
+	int data_seq;
+	int consumer_waiting;
+	ShmRingSlot consumer;
+	ShmRingSlot producers[shm_ring_max_producers];
+};
+
+class ShmRing{
+private:
+	ShmRingHeader* h;
+	char* data;
+	size_t map_size;
+	uint64_t mask;
+	// spins before sleeping
+	unsigned int spin;
+	// how often a sleeper wakes up to check on its peers
+	struct timespec check;
+	// producer state
+	ShmRingSlot* slot;
+	uint64_t frame_pos;
+	// consumer state
+	bool consumer;
+
+	static inline uint64_t align8(uint64_t v) {
+		return (v+7)&~7ULL;
+	}
+	ShmRingFrame* frame_at(uint64_t pos) {
+		return reinterpret_cast<ShmRingFrame*>(data+(pos&mask));
+	}
+	static void init_mutex(pthread_mutex_t* m) {
+		pthread_mutexattr_t attr;
+		CHECK_ZERO_ERRNO(pthread_mutexattr_init(&attr));
+		CHECK_ZERO_ERRNO(pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED));
+		CHECK_ZERO_ERRNO(pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST));
+		CHECK_ZERO_ERRNO(pthread_mutex_init(m, &attr));
+		CHECK_ZERO_ERRNO(pthread_mutexattr_destroy(&attr));
+	}
+	/*
+	 * Lock a slot's mutex for this process. Returns the state the slot
+	 * was in, a dead owner shows up as shm_ring_dead.
+	 */
+	static int lock_slot(ShmRingSlot* s, bool* locked) {
+		int ret=pthread_mutex_trylock(&s->alive);
+		if(ret==EBUSY) {
+			*locked=false;
+			return shm_ring_active;
+		}
+		*locked=true;
+		if(ret==EOWNERDEAD) {
+			CHECK_ZERO_ERRNO(pthread_mutex_consistent(&s->alive));
+			if(s->state==shm_ring_active) {
+				__atomic_store_n(&s->state, shm_ring_dead, __ATOMIC_SEQ_CST);
+			}
+		} else {
+			CHECK_ZERO_ERRNO(ret);
+		}
+		return __atomic_load_n(&s->state, __ATOMIC_SEQ_CST);
+	}
+	// is the owner of an active slot dead? marks it dead if so
+	static bool check_dead(ShmRingSlot* s) {
+		if(__atomic_load_n(&s->state, __ATOMIC_SEQ_CST)!=shm_ring_active) {
+			return s->state==shm_ring_dead;
+		}
+		int ret=pthread_mutex_trylock(&s->alive);
+		if(ret==EBUSY) {
+			return false;
+		}
+		if(ret==EOWNERDEAD) {
+			CHECK_ZERO_ERRNO(pthread_mutex_consistent(&s->alive));
+			__atomic_store_n(&s->state, shm_ring_dead, __ATOMIC_SEQ_CST);
+			CHECK_ZERO_ERRNO(pthread_mutex_unlock(&s->alive));
+			return true;
+		}
+		CHECK_ZERO_ERRNO(ret);
+		// the owner detached cleanly in the meantime
+		CHECK_ZERO_ERRNO(pthread_mutex_unlock(&s->alive));
+		return s->state==shm_ring_dead;
+	}
+	// zero [from, to) in ring coordinates
+	void zero(uint64_t from, uint64_t to) {
+		while(from<to) {
+			uint64_t off=from&mask;
+			uint64_t n=to-from;
+			if(off+n>h->capacity) {
+				n=h->capacity-off;
+			}
+			memset(data+off, 0, n);
+			from+=n;
+		}
+	}
+	void advance_head(uint64_t end) {
+		uint64_t head=h->head;
+		__atomic_store_n(&h->release_end, end, __ATOMIC_RELAXED);
+		zero(head, end);
+		__atomic_store_n(&h->head, end, __ATOMIC_RELEASE);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if(__atomic_load_n(&h->producers_waiting, __ATOMIC_RELAXED)>0) {
+			__atomic_fetch_add(&h->space_seq, 1, __ATOMIC_SEQ_CST);
+			futex_wake_shared(&h->space_seq, INT_MAX);
+		}
+	}
+	/*
+	 * The frame at head is not committed. If it belongs to a producer
+	 * that died skip it. Also frees the slots of dead producers once the
+	 * consumer is past anything they could have reserved.
+	 */
+	void recover_producers() {
+		uint64_t head=h->head;
+		bool live_claim=false;
+		ShmRingSlot* dead_claim=nullptr;
+		for(unsigned int i=0; i<shm_ring_max_producers; i++) {
+			ShmRingSlot* s=&h->producers[i];
+			if(s->state==shm_ring_free) {
+				continue;
+			}
+			bool dead=check_dead(s);
+			uint64_t pos=__atomic_load_n(&s->claim_pos, __ATOMIC_SEQ_CST);
+			uint64_t end=__atomic_load_n(&s->claim_end, __ATOMIC_SEQ_CST);
+			bool covers=end!=0 && pos<=head && head<end;
+			if(!dead) {
+				live_claim|=covers;
+				continue;
+			}
+			if(covers) {
+				dead_claim=s;
+			} else if(end==0 || end<=head) {
+				// nothing of it is left in the ring
+				__atomic_store_n(&s->claim_end, 0, __ATOMIC_SEQ_CST);
+				__atomic_store_n(&s->state, shm_ring_free, __ATOMIC_SEQ_CST);
+			}
+		}
+		if(dead_claim==nullptr || live_claim) {
+			return;
+		}
+		if(__atomic_load_n(&frame_at(head)->flags, __ATOMIC_ACQUIRE)&shm_ring_committed) {
+			return;
+		}
+		uint64_t end=dead_claim->claim_end;
+		if(__atomic_load_n(&h->tail, __ATOMIC_ACQUIRE)<end) {
+			// its reservation never happened
+			return;
+		}
+		advance_head(end);
+		__atomic_store_n(&dead_claim->claim_end, 0, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&dead_claim->state, shm_ring_free, __ATOMIC_SEQ_CST);
+	}
+
+	ShmRing(ShmRingHeader* ih, size_t imap_size, unsigned int ispin) : h(ih), data(reinterpret_cast<char*>(ih)+header_size()), map_size(imap_size), mask(ih->capacity-1), spin(ispin), slot(nullptr), frame_pos(0), consumer(false) {
+		check.tv_sec=0;
+		check.tv_nsec=10*1000*1000;
+	}
+
+public:
+	static size_t header_size() {
+		return (sizeof(ShmRingHeader)+4095)&~4095UL;
+	}
+	/*
+	 * Create (or recreate) the shared memory object 'name' holding a ring
+	 * of 'capacity' bytes (a power of 2). A message can be at most half
+	 * of that.
+	 */
+	static ShmRing* create(const char* name, size_t capacity, unsigned int spin=0) {
+		CHECK_ASSERT(capacity>=4096 && (capacity&(capacity-1))==0);
+		int fd=CHECK_NOT_M1(shm_open(name, O_CREAT|O_RDWR|O_TRUNC, 0600));
+		size_t size=header_size()+capacity;
+		CHECK_NOT_M1(ftruncate(fd, size));
+		void* p=CHECK_NOT_VOIDP(mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, 0), MAP_FAILED);
+		CHECK_NOT_M1(close(fd));
+		ShmRingHeader* hdr=static_cast<ShmRingHeader*>(p);
+		hdr->capacity=capacity;
+		init_mutex(&hdr->consumer.alive);
+		for(unsigned int i=0; i<shm_ring_max_producers; i++) {
+			init_mutex(&hdr->producers[i].alive);
+		}
+		__atomic_store_n(&hdr->magic, shm_ring_magic, __ATOMIC_RELEASE);
+		return new ShmRing(hdr, size, spin);
+	}
+	static ShmRing* open(const char* name, unsigned int spin=0) {
+		int fd=CHECK_NOT_M1(shm_open(name, O_RDWR, 0));
+		struct stat st;
+		CHECK_NOT_M1(fstat(fd, &st));
+		void* p=CHECK_NOT_VOIDP(mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, 0), MAP_FAILED);
+		CHECK_NOT_M1(close(fd));
+		ShmRingHeader* hdr=static_cast<ShmRingHeader*>(p);
+		CHECK_ASSERT(__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE)==shm_ring_magic && header_size()+hdr->capacity==(size_t)st.st_size);
+		return new ShmRing(hdr, st.st_size, spin);
+	}
+	static void unlink(const char* name) {
+		CHECK_NOT_M1(shm_unlink(name));
+	}
+	~ShmRing() {
+		if(slot) {
+			detach_producer();
+		}
+		if(consumer) {
+			detach_consumer();
+		}
+		CHECK_NOT_M1(munmap(h, map_size));
+	}
+	ShmRing(const ShmRing&)=delete;
+	ShmRing& operator=(const ShmRing&)=delete;
+
+	size_t max_message() const {
+		return h->capacity/2-sizeof(ShmRingFrame);
+	}
+
+	// returns false if all producer slots are taken
+	bool attach_producer() {
+		for(unsigned int i=0; i<shm_ring_max_producers; i++) {
+			ShmRingSlot* s=&h->producers[i];
+			bool locked;
+			int state=lock_slot(s, &locked);
+			if(state==shm_ring_free) {
+				s->claim_end=0;
+				__atomic_store_n(&s->state, shm_ring_active, __ATOMIC_SEQ_CST);
+				slot=s;
+				return true;
+			}
+			// the slot of a dead producer is cleaned by the consumer
+			if(locked) {
+				CHECK_ZERO_ERRNO(pthread_mutex_unlock(&s->alive));
+			}
+		}
+		return false;
+	}
+	void detach_producer() {
+		__atomic_store_n(&slot->state, shm_ring_free, __ATOMIC_SEQ_CST);
+		CHECK_ZERO_ERRNO(pthread_mutex_unlock(&slot->alive));
+		slot=nullptr;
+	}
+	// returns false if there already is a live consumer
+	bool attach_consumer() {
+		bool locked;
+		// a dead consumer is fine, we take over from it
+		lock_slot(&h->consumer, &locked);
+		if(!locked) {
+			return false;
+		}
+		// finish a release the previous consumer died in the middle of
+		uint64_t end=__atomic_load_n(&h->release_end, __ATOMIC_RELAXED);
+		if(end>h->head) {
+			advance_head(end);
+		}
+		__atomic_store_n(&h->consumer.state, shm_ring_active, __ATOMIC_SEQ_CST);
+		consumer=true;
+		return true;
+	}
+	void detach_consumer() {
+		__atomic_store_n(&h->consumer.state, shm_ring_free, __ATOMIC_SEQ_CST);
+		CHECK_ZERO_ERRNO(pthread_mutex_unlock(&h->consumer.alive));
+		consumer=false;
+	}
+
+	/*
+	 * Reserve room for a message of 'len' bytes, write it at the returned
+	 * pointer and commit(). Waits up to 'timeout_ns' for room.
+	 */
+	shm_ring_result reserve(uint32_t len, char** p, uint64_t timeout_ns=UINT64_MAX) {
+		CHECK_ASSERT(slot!=nullptr && len<=max_message());
+		uint64_t need=align8(sizeof(ShmRingFrame)+len);
+		uint64_t deadline=0;
+		unsigned int spins=0;
+		while(true) {
+			uint64_t pos=__atomic_load_n(&h->tail, __ATOMIC_RELAXED);
+			uint64_t off=pos&mask;
+			uint64_t pad=off+need>h->capacity?h->capacity-off:0;
+			uint64_t end=pos+pad+need;
+			if(end-__atomic_load_n(&h->head, __ATOMIC_ACQUIRE)>h->capacity) {
+				// full
+				if(spins<spin) {
+					spins++;
+					cpu_relax();
+					continue;
+				}
+				if(deadline==0) {
+					deadline=timeout_ns==UINT64_MAX?UINT64_MAX:latency_now()+timeout_ns;
+				}
+				__atomic_fetch_add(&h->producers_waiting, 1, __ATOMIC_SEQ_CST);
+				int seq=__atomic_load_n(&h->space_seq, __ATOMIC_SEQ_CST);
+				if(end-__atomic_load_n(&h->head, __ATOMIC_SEQ_CST)>h->capacity) {
+					if(!futex_wait_shared(&h->space_seq, seq, &check)) {
+						if(check_dead(&h->consumer)) {
+							__atomic_fetch_sub(&h->producers_waiting, 1, __ATOMIC_SEQ_CST);
+							return shm_ring_peer_dead;
+						}
+					}
+				}
+				__atomic_fetch_sub(&h->producers_waiting, 1, __ATOMIC_SEQ_CST);
+				if(deadline!=UINT64_MAX && latency_now()>=deadline) {
+					return shm_ring_timeout;
+				}
+				continue;
+			}
+			// publish what we are about to take before we take it
+			__atomic_store_n(&slot->claim_pos, pos, __ATOMIC_SEQ_CST);
+			__atomic_store_n(&slot->claim_end, end, __ATOMIC_SEQ_CST);
+			if(__atomic_compare_exchange_n(&h->tail, &pos, end, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+				if(pad) {
+					ShmRingFrame* f=frame_at(pos);
+					f->len=pad-sizeof(ShmRingFrame);
+					__atomic_store_n(&f->flags, shm_ring_committed|shm_ring_pad, __ATOMIC_RELEASE);
+				}
+				frame_pos=pos+pad;
+				*p=data+(frame_pos&mask)+sizeof(ShmRingFrame);
+				return shm_ring_ok;
+			}
+			__atomic_store_n(&slot->claim_end, 0, __ATOMIC_SEQ_CST);
+		}
+	}
+	void commit(uint32_t len) {
+		ShmRingFrame* f=frame_at(frame_pos);
+		f->len=len;
+		__atomic_store_n(&f->flags, shm_ring_committed, __ATOMIC_RELEASE);
+		__atomic_store_n(&slot->claim_end, 0, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if(__atomic_load_n(&h->consumer_waiting, __ATOMIC_RELAXED)) {
+			__atomic_fetch_add(&h->data_seq, 1, __ATOMIC_SEQ_CST);
+			futex_wake_shared(&h->data_seq, 1);
+		}
+	}
+	shm_ring_result send(const void* buf, uint32_t len, uint64_t timeout_ns=UINT64_MAX) {
+		char* p;
+		shm_ring_result r=reserve(len, &p, timeout_ns);
+		if(r==shm_ring_ok) {
+			memcpy(p, buf, len);
+			commit(len);
+		}
+		return r;
+	}
+
+	/*
+	 * Get the next message in place, give it back with release(). Waits
+	 * up to 'timeout_ns'.
+	 */
+	shm_ring_result receive(const char** p, uint32_t* len, uint64_t timeout_ns=UINT64_MAX) {
+		CHECK_ASSERT(consumer);
+		uint64_t deadline=0;
+		unsigned int spins=0;
+		while(true) {
+			ShmRingFrame* f=frame_at(h->head);
+			uint32_t flags=__atomic_load_n(&f->flags, __ATOMIC_ACQUIRE);
+			if(flags&shm_ring_committed) {
+				if(flags&shm_ring_pad) {
+					advance_head(h->head+sizeof(ShmRingFrame)+f->len);
+					continue;
+				}
+				*p=reinterpret_cast<const char*>(f)+sizeof(ShmRingFrame);
+				*len=f->len;
+				return shm_ring_ok;
+			}
+			if(spins<spin) {
+				spins++;
+				cpu_relax();
+				continue;
+			}
+			if(deadline==0) {
+				deadline=timeout_ns==UINT64_MAX?UINT64_MAX:latency_now()+timeout_ns;
+			}
+			__atomic_store_n(&h->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+			int seq=__atomic_load_n(&h->data_seq, __ATOMIC_SEQ_CST);
+			if(!(__atomic_load_n(&f->flags, __ATOMIC_SEQ_CST)&shm_ring_committed)) {
+				if(!futex_wait_shared(&h->data_seq, seq, &check) && __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE)!=h->head) {
+					// somebody reserved and did not commit for a while
+					recover_producers();
+				}
+			}
+			__atomic_store_n(&h->consumer_waiting, 0, __ATOMIC_RELAXED);
+			if(deadline!=UINT64_MAX && latency_now()>=deadline) {
+				return shm_ring_timeout;
+			}
+		}
+	}
+	void release() {
+		ShmRingFrame* f=frame_at(h->head);
+		advance_head(h->head+align8(sizeof(ShmRingFrame)+f->len));
+	}
+};
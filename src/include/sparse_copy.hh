@@ -0,0 +1,219 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for off_t, ssize_t
+#include <sys/stat.h>	// for fstat(2), struct stat
+#include <sys/ioctl.h>	// for ioctl(2)
+#include <linux/fs.h>	// for FS_IOC_FIEMAP
+#include <linux/fiemap.h>	// for struct fiemap, struct fiemap_extent, FIEMAP_*
+#include <fcntl.h>	// for fallocate(2), FALLOC_FL_*
+#include <errno.h>	// for errno, ENXIO, EXDEV, EINVAL, EOPNOTSUPP, ENOSYS, ENOTTY
+#include <stdlib.h>	// for malloc(3), free(3)
+#include <string.h>	// for memset(3)
+#include <unistd.h>	// for lseek(2), copy_file_range(2), pread(2), pwrite(2), ftruncate(2)
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_NOT_NULL(), CHECK_ASSERT()
+#include <functional>	// for function<T>
+#include <vector>	// for vector<T>
+
+/*
+ * Copying sparse files (VM images, core files, databases) by their data
+ * extents only.
+ *
+ * A plain copy reads the holes as zeros and writes those zeros out: the
+ * copy takes as long as the apparent size and the destination is fully
+ * allocated. Here the data extents of the source are found with:
+ * - lseek(2) SEEK_DATA/SEEK_HOLE (sparse_walk_seek): portable (every
+ * file system that knows holes, tmpfs and NFS 4.2 included), one pair of
+ * system calls per extent.
+ * - the FS_IOC_FIEMAP ioctl(2) (sparse_walk_fiemap): up to
+ * sparse_fiemap_batch extents per call, the physical layout too. Not every
+ * file system has it: tmpfs (so a default /tmp on many systems), proc and
+ * most network file systems fail with EOPNOTSUPP (ENOTTY on some). There
+ * the SEEK_DATA/SEEK_HOLE walk is used instead, SparseCopyStats::walk says
+ * which walk really ran.
+ * Unwritten (preallocated) extents read as zeros so they count as holes.
+ * FIEMAP_FLAG_SYNC flushes delayed allocation first, or fresh data would
+ * look like holes.
+ * and only the data ranges are copied, with copy_file_range(2) (no copy to
+ * user space, a reflink on file systems that can share blocks) falling
+ * back to pread(2)/pwrite(2) where the kernel does not support it between
+ * the two files.
+ *
+ * The holes of the destination:
+ * - sparse_holes_preserve: the destination is truncated to the size of the
+ * source and only the data is written, the rest stays holes. For a new or
+ * emptied destination.
+ * - sparse_holes_punch: the holes of the source are punched in the
+ * destination (fallocate(2) FALLOC_FL_PUNCH_HOLE). For updating an
+ * existing copy in place: stale data where the source now has holes goes
+ * away and the blocks are freed.
+ *
+ * Used by examples/io/zero_copy/{copy_file_sparse,copy_file_bench}.cc
+ */
+
+enum sparse_walk {
+	sparse_walk_seek,
+	sparse_walk_fiemap,
+};
+
+enum sparse_holes {
+	sparse_holes_preserve,
+	sparse_holes_punch,
+};
+
+struct SparseCopyStats {
+	unsigned long extents;
+	off_t data_bytes;
+	off_t hole_bytes;
+	// system calls spent on finding the extents
+	unsigned long walk_calls;
+	// the walk that was used (fiemap falls back to seek)
+	enum sparse_walk walk;
+};
+
+static const unsigned int sparse_fiemap_batch=256;
+
+// call f(offset, length) for every data extent of fd in order
+static inline void sparse_walk_data(int fd, enum sparse_walk walk, std::function<void(off_t, off_t)> f, SparseCopyStats* stats) {
+	struct stat st;
+	CHECK_NOT_M1(fstat(fd, &st));
+	const off_t size=st.st_size;
+	stats->walk=walk;
+	if(walk==sparse_walk_seek) {
+		off_t pos=0;
+		while(pos<size) {
+			off_t data=lseek(fd, pos, SEEK_DATA);
+			stats->walk_calls++;
+			if(data==-1) {
+				// no data after pos, the rest is a hole
+				CHECK_ASSERT(errno==ENXIO);
+				break;
+			}
+			off_t hole=CHECK_NOT_M1(lseek(fd, data, SEEK_HOLE));
+			stats->walk_calls++;
+			f(data, hole-data);
+			pos=hole;
+		}
+		return;
+	}
+	const size_t len=sizeof(struct fiemap)+sparse_fiemap_batch*sizeof(struct fiemap_extent);
+	struct fiemap* fm=static_cast<struct fiemap*>(CHECK_NOT_NULL(malloc(len)));
+	off_t pos=0;
+	// adjacent extents are merged into one copy
+	off_t run_start=0, run_len=0;
+	bool last=false;
+	while(!last && pos<size) {
+		memset(fm, 0, len);
+		fm->fm_start=pos;
+		fm->fm_length=size-pos;
+		fm->fm_flags=FIEMAP_FLAG_SYNC;
+		fm->fm_extent_count=sparse_fiemap_batch;
+		int ret=ioctl(fd, FS_IOC_FIEMAP, fm);
+		stats->walk_calls++;
+		if(ret==-1 && (errno==EOPNOTSUPP || errno==ENOTTY)) {
+			// no FIEMAP on this file system, it fails on the first call
+			CHECK_ASSERT(pos==0);
+			free(fm);
+			sparse_walk_data(fd, sparse_walk_seek, f, stats);
+			return;
+		}
+		CHECK_NOT_M1(ret);
+		if(fm->fm_mapped_extents==0) {
+			break;
+		}
+		for(unsigned int i=0; i<fm->fm_mapped_extents; i++) {
+			const struct fiemap_extent* e=&fm->fm_extents[i];
+			off_t start=e->fe_logical;
+			off_t end=start+e->fe_length;
+			if(end>size) {
+				end=size;
+			}
+			pos=end;
+			if(e->fe_flags & FIEMAP_EXTENT_LAST) {
+				last=true;
+			}
+			if(e->fe_flags & FIEMAP_EXTENT_UNWRITTEN || start>=end) {
+				continue;
+			}
+			if(run_len>0 && run_start+run_len==start) {
+				run_len+=end-start;
+				continue;
+			}
+			if(run_len>0) {
+				f(run_start, run_len);
+			}
+			run_start=start;
+			run_len=end-start;
+		}
+	}
+	if(run_len>0) {
+		f(run_start, run_len);
+	}
+	free(fm);
+}
+
+// copy len bytes at offset from fdin to the same offset in fdout
+static inline void sparse_copy_range(int fdin, int fdout, off_t offset, off_t len) {
+	off_t in=offset, out=offset;
+	while(len>0) {
+		ssize_t ret=copy_file_range(fdin, &in, fdout, &out, len, 0);
+		if(ret==-1 && (errno==EXDEV || errno==EINVAL || errno==EOPNOTSUPP || errno==ENOSYS)) {
+			break;
+		}
+		CHECK_NOT_M1(ret);
+		CHECK_ASSERT(ret>0);
+		len-=ret;
+	}
+	// copy_file_range(2) is not supported between these files
+	std::vector<char> buf(len>0?1024*1024:0);
+	while(len>0) {
+		size_t chunk=len<(off_t)buf.size()?len:buf.size();
+		ssize_t ret=CHECK_NOT_M1(pread(fdin, buf.data(), chunk, in));
+		CHECK_ASSERT(ret>0);
+		CHECK_ASSERT(pwrite(fdout, buf.data(), ret, in)==ret);
+		in+=ret;
+		len-=ret;
+	}
+}
+
+static inline SparseCopyStats sparse_copy(int fdin, int fdout, enum sparse_walk walk, enum sparse_holes holes) {
+	SparseCopyStats stats;
+	memset(&stats, 0, sizeof(stats));
+	struct stat st;
+	CHECK_NOT_M1(fstat(fdin, &st));
+	const off_t size=st.st_size;
+	CHECK_NOT_M1(ftruncate(fdout, size));
+	off_t pos=0;
+	sparse_walk_data(fdin, walk, [&](off_t offset, off_t len) {
+		if(holes==sparse_holes_punch && offset>pos) {
+			CHECK_NOT_M1(fallocate(fdout, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, pos, offset-pos));
+		}
+		sparse_copy_range(fdin, fdout, offset, len);
+		stats.extents++;
+		stats.data_bytes+=len;
+		pos=offset+len;
+	}, &stats);
+	if(holes==sparse_holes_punch && size>pos) {
+		CHECK_NOT_M1(fallocate(fdout, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, pos, size-pos));
+	}
+	stats.hole_bytes=size-stats.data_bytes;
+	return stats;
+}
@@ -0,0 +1,411 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for ino64_t, mode_t, off_t
+#include <sys/stat.h>	// for fstatat(2), statx(2), struct stat, struct statx, STATX_*
+#include <sys/sysmacros.h>	// for makedev(3)
+#include <fcntl.h>	// for openat(2), O_*, AT_*
+#include <dirent.h>	// for getdents64(2), struct dirent64, DT_*, IFTODT()
+#include <errno.h>	// for errno
+#include <stdio.h>	// for fprintf(3), stderr
+#include <string.h>	// for strerror(3)
+#include <limits.h>	// for UINT_MAX
+#include <unistd.h>	// for close(2)
+#include <sched.h>	// for sched_yield(2)
+#include <time.h>	// for nanosleep(2), struct timespec
+#include <pthread.h>	// for pthread_create(3), pthread_join(3)
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_ZERO_ERRNO(), CHECK_ASSERT()
+#include <cache_line_utils.hh>	// for CACHE_LINE_SIZE
+#include <vector>	// for vector<T>
+#include <deque>	// for deque<T>
+#include <string>	// for string
+#include <mutex>	// for mutex, lock_guard<T>
+#include <atomic>	// for atomic<T>
+#include <functional>	// for function<T>
+
+/*
+ * A parallel directory tree walker.
+ *
+ * - getdents64(2) with a large buffer (256KB by default) instead of
+ * readdir(3)'s 32KB, so a directory of thousands of entries is read in a
+ * few system calls.
+ * - the type of an entry comes from d_type, a stat is only done when the
+ * visitor asks for one or the file system does not fill d_type
+ * (DT_UNKNOWN).
+ * - everything is relative to the fd of the parent directory (openat(2),
+ * fstatat(2), statx(2)) so the kernel never resolves a full path again.
+ * - statx(2) can be told which fields are needed (STATX_TYPE|STATX_SIZE and
+ * so on) which lets network and fuse file systems skip the rest.
+ * - every worker has a deque of directories still to be read. A worker
+ * pushes the subdirectories it finds to the back of its own deque and
+ * takes from the back (depth first, so few parent fds are open at any
+ * time), an idle worker steals from the front of another worker's deque
+ * (the oldest entry, usually the biggest subtree).
+ *
+ * A directory fd stays open while subdirectories found in it are waiting
+ * to be opened (reference counted in TreeWalkDir). Errors (permission
+ * denied, entries that vanished) are reported to stderr and counted, the
+ * walk goes on like find(1) does. Symbolic links are never followed, the
+ * root included.
+ *
+ * The visitor is called concurrently from all workers with the worker
+ * number, so it can keep per worker state without locking.
+ *
+ * Used by examples/filesystem/tree_walk.cc
+ */
+
+enum tree_walk_stat {
+	// no stat at all, only d_type (entries with DT_UNKNOWN are still stat'ed)
+	tree_walk_stat_none,
+	// fstatat(2) every entry
+	tree_walk_stat_fstatat,
+	// statx(2) every entry with the mask given to the walker
+	tree_walk_stat_statx,
+};
+
+struct TreeWalkEntry {
+	// the path of the directory the entry is in ("" for the root)
+	const std::string* dir;
+	const char* name;
+	// fd of that directory, for *at() system calls (AT_FDCWD for the root)
+	int dirfd;
+	// DT_*, never DT_UNKNOWN
+	unsigned char type;
+	ino64_t ino;
+	// 0 for the root, 1 for the entries of the root and so on
+	unsigned int depth;
+	// the fields below are only valid if the entry was stat'ed and only
+	// the ones in the statx mask
+	bool have_stat;
+	mode_t mode;
+	nlink_t nlink;
+	dev_t dev;
+	off_t size;
+	blkcnt_t blocks;	// in 512 byte units
+
+	void path(std::string& p) const {
+		p.assign(*dir);
+		if(!p.empty() && p.back()!='/') {
+			p.push_back('/');
+		}
+		p.append(name);
+	}
+};
+
+struct TreeWalkStats {
+	unsigned long dirs;
+	unsigned long entries;
+	unsigned long getdents;
+	unsigned long stats;
+	unsigned long steals;
+	unsigned long errors;
+
+	void add(const TreeWalkStats& o) {
+		dirs+=o.dirs;
+		entries+=o.entries;
+		getdents+=o.getdents;
+		stats+=o.stats;
+		steals+=o.steals;
+		errors+=o.errors;
+	}
+};
+
+class TreeWalker{
+public:
+	typedef std::function<void(unsigned int worker, const TreeWalkEntry& e)> Visitor;
+
+private:
+	// a directory whose subdirectories have not all been opened yet
+	struct TreeWalkDir {
+		int fd;
+		std::string path;
+		std::atomic<unsigned int> refs;
+	};
+	// a directory to be read: a name in a parent directory
+	struct TreeWalkItem {
+		TreeWalkDir* parent;
+		std::string name;
+		unsigned int depth;
+	};
+	struct alignas(CACHE_LINE_SIZE) TreeWalkQueue {
+		std::mutex lock;
+		std::deque<TreeWalkItem> items;
+	};
+	struct TreeWalkWorker {
+		TreeWalker* walker;
+		unsigned int id;
+		std::vector<char> buf;
+		std::vector<TreeWalkItem> found;
+		TreeWalkStats stats;
+	};
+
+	unsigned int workers;
+	Visitor visitor;
+	tree_walk_stat stat_mode;
+	unsigned int statx_mask;
+	size_t bufsize;
+	unsigned int max_depth;
+	std::vector<TreeWalkQueue> queues;
+	// directories pushed and not yet done, the walk is over at zero
+	std::atomic<unsigned long> pending;
+	TreeWalkStats total;
+
+	static void release(TreeWalkDir* d) {
+		if(d!=NULL && d->refs.fetch_sub(1)==1) {
+			CHECK_NOT_M1(close(d->fd));
+			delete d;
+		}
+	}
+
+	static void error(TreeWalkWorker& w, const std::string& dir, const char* name, const char* what) {
+		int err=errno;
+		fprintf(stderr, "tree_walk: %s %s%s%s: %s\n", what, dir.c_str(), dir.empty()?"":"/", name, strerror(err));
+		w.stats.errors++;
+	}
+
+	// stat an entry, false if it could not be done (gone, no permission)
+	bool stat_entry(TreeWalkWorker& w, int dirfd, const char* name, TreeWalkEntry& e) {
+		w.stats.stats++;
+		if(stat_mode==tree_walk_stat_fstatat) {
+			struct stat st;
+			if(fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW)==-1) {
+				return false;
+			}
+			e.mode=st.st_mode;
+			e.nlink=st.st_nlink;
+			e.dev=st.st_dev;
+			e.size=st.st_size;
+			e.blocks=st.st_blocks;
+			e.ino=st.st_ino;
+		} else {
+			// with tree_walk_stat_none we only get here for DT_UNKNOWN
+			// and the root
+			unsigned int mask=stat_mode==tree_walk_stat_statx?statx_mask:STATX_TYPE;
+			struct statx stx;
+			if(statx(dirfd, name, AT_SYMLINK_NOFOLLOW|AT_NO_AUTOMOUNT, mask, &stx)==-1) {
+				return false;
+			}
+			e.mode=stx.stx_mode;
+			e.nlink=stx.stx_nlink;
+			e.dev=makedev(stx.stx_dev_major, stx.stx_dev_minor);
+			e.size=stx.stx_size;
+			e.blocks=stx.stx_blocks;
+			if(stx.stx_mask & STATX_INO) {
+				e.ino=stx.stx_ino;
+			}
+		}
+		e.have_stat=true;
+		return true;
+	}
+
+	void push(TreeWalkWorker& w) {
+		if(w.found.empty()) {
+			return;
+		}
+		pending.fetch_add(w.found.size());
+		TreeWalkQueue& q=queues[w.id];
+		std::lock_guard<std::mutex> guard(q.lock);
+		for(TreeWalkItem& item : w.found) {
+			q.items.push_back(std::move(item));
+		}
+		w.found.clear();
+	}
+
+	bool pop(TreeWalkWorker& w, TreeWalkItem& item) {
+		TreeWalkQueue& q=queues[w.id];
+		std::lock_guard<std::mutex> guard(q.lock);
+		if(q.items.empty()) {
+			return false;
+		}
+		item=std::move(q.items.back());
+		q.items.pop_back();
+		return true;
+	}
+
+	bool steal(TreeWalkWorker& w, TreeWalkItem& item) {
+		for(unsigned int i=1; i<workers; i++) {
+			TreeWalkQueue& q=queues[(w.id+i)%workers];
+			std::lock_guard<std::mutex> guard(q.lock);
+			if(!q.items.empty()) {
+				item=std::move(q.items.front());
+				q.items.pop_front();
+				w.stats.steals++;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void read_dir(TreeWalkWorker& w, TreeWalkItem& item) {
+		int parent_fd=item.parent==NULL?AT_FDCWD:item.parent->fd;
+		int fd=openat(parent_fd, item.name.c_str(), O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+		if(fd==-1) {
+			error(w, item.parent==NULL?std::string():item.parent->path, item.name.c_str(), "cannot open");
+			release(item.parent);
+			return;
+		}
+		TreeWalkDir* d=new TreeWalkDir;
+		d->fd=fd;
+		if(item.parent==NULL) {
+			d->path=item.name;
+		} else {
+			d->path=item.parent->path;
+			if(d->path.back()!='/') {
+				d->path.push_back('/');
+			}
+			d->path.append(item.name);
+		}
+		d->refs=1;
+		release(item.parent);
+		w.stats.dirs++;
+		TreeWalkEntry e;
+		e.dir=&d->path;
+		e.dirfd=fd;
+		e.depth=item.depth+1;
+		while(true) {
+			ssize_t nread=getdents64(fd, w.buf.data(), w.buf.size());
+			w.stats.getdents++;
+			if(nread==-1) {
+				error(w, std::string(), d->path.c_str(), "cannot read");
+				break;
+			}
+			if(nread==0) {
+				break;
+			}
+			for(ssize_t pos=0; pos<nread;) {
+				const struct dirent64* de=reinterpret_cast<const struct dirent64*>(w.buf.data()+pos);
+				pos+=de->d_reclen;
+				const char* name=de->d_name;
+				if(name[0]=='.' && (name[1]=='\0' || (name[1]=='.' && name[2]=='\0'))) {
+					continue;
+				}
+				w.stats.entries++;
+				e.name=name;
+				e.type=de->d_type;
+				e.ino=de->d_ino;
+				e.have_stat=false;
+				if(stat_mode!=tree_walk_stat_none || e.type==DT_UNKNOWN) {
+					if(!stat_entry(w, fd, name, e)) {
+						error(w, d->path, name, "cannot stat");
+						continue;
+					}
+					if(e.type==DT_UNKNOWN) {
+						e.type=IFTODT(e.mode);
+					}
+				}
+				visitor(w.id, e);
+				if(e.type==DT_DIR && e.depth<max_depth) {
+					d->refs++;
+					w.found.push_back(TreeWalkItem{d, name, e.depth});
+				}
+			}
+			// let other workers have the subdirectories as soon as possible
+			push(w);
+		}
+		release(d);
+	}
+
+	static void* worker_main(void* arg) {
+		TreeWalkWorker* w=static_cast<TreeWalkWorker*>(arg);
+		TreeWalker* walker=w->walker;
+		unsigned int idle=0;
+		while(true) {
+			TreeWalkItem item;
+			if(walker->pop(*w, item) || walker->steal(*w, item)) {
+				idle=0;
+				walker->read_dir(*w, item);
+				walker->pending.fetch_sub(1);
+				continue;
+			}
+			if(walker->pending.load()==0) {
+				break;
+			}
+			// somebody is reading a directory which may have subdirectories
+			idle++;
+			if(idle>100) {
+				struct timespec ts={0, 50000};
+				nanosleep(&ts, NULL);
+			} else {
+				sched_yield();
+			}
+		}
+		return NULL;
+	}
+
+public:
+	TreeWalker(unsigned int iworkers, Visitor ivisitor, tree_walk_stat istat_mode, unsigned int istatx_mask=STATX_TYPE|STATX_MODE|STATX_NLINK|STATX_INO|STATX_SIZE|STATX_BLOCKS, size_t ibufsize=256*1024, unsigned int imax_depth=UINT_MAX) :
+		workers(iworkers),
+		visitor(ivisitor),
+		stat_mode(istat_mode),
+		statx_mask(istatx_mask|STATX_TYPE),
+		bufsize(ibufsize),
+		max_depth(imax_depth),
+		queues(iworkers),
+		pending(0),
+		total() {
+		CHECK_ASSERT(workers>0);
+	}
+
+	// walk the tree at root, returns when all of it was visited
+	void walk(const char* root) {
+		TreeWalkWorker w0;
+		w0.id=0;
+		w0.stats=TreeWalkStats();
+		std::string empty;
+		TreeWalkEntry e;
+		e.dir=&empty;
+		e.name=root;
+		e.dirfd=AT_FDCWD;
+		e.depth=0;
+		e.ino=0;
+		e.have_stat=false;
+		if(!stat_entry(w0, AT_FDCWD, root, e)) {
+			error(w0, empty, root, "cannot stat");
+			total.add(w0.stats);
+			return;
+		}
+		e.type=IFTODT(e.mode);
+		visitor(0, e);
+		total.add(w0.stats);
+		if(e.type!=DT_DIR || max_depth==0) {
+			return;
+		}
+		pending=1;
+		queues[0].items.push_back(TreeWalkItem{NULL, root, 0});
+		std::vector<TreeWalkWorker> ws(workers);
+		std::vector<pthread_t> tids(workers);
+		for(unsigned int i=0; i<workers; i++) {
+			ws[i].walker=this;
+			ws[i].id=i;
+			ws[i].buf.resize(bufsize);
+			ws[i].stats=TreeWalkStats();
+			CHECK_ZERO_ERRNO(pthread_create(&tids[i], NULL, worker_main, &ws[i]));
+		}
+		for(unsigned int i=0; i<workers; i++) {
+			CHECK_ZERO_ERRNO(pthread_join(tids[i], NULL));
+			total.add(ws[i].stats);
+		}
+	}
+
+	const TreeWalkStats& get_stats() const {
+		return total;
+	}
+};
@@ -0,0 +1,544 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <firstinclude.h>
+#include <sys/inotify.h>	// for inotify_init1(2), inotify_add_watch(2), inotify_rm_watch(2), struct inotify_event, IN_*
+#include <sys/fanotify.h>	// for fanotify_init(2), fanotify_mark(2), struct fanotify_event_metadata, FAN_*
+#include <sys/stat.h>	// for stat(2), struct stat
+#include <fcntl.h>	// for open(2), open_by_handle_at(2), struct file_handle, O_*
+#include <errno.h>	// for errno, EAGAIN, ENOSPC
+#include <stdio.h>	// for fprintf(3), snprintf(3), stderr
+#include <stdint.h>	// for uint32_t, uint64_t
+#include <stdlib.h>	// for realpath(3)
+#include <limits.h>	// for PATH_MAX
+#include <string.h>	// for strcmp(3), memcpy(3)
+#include <unistd.h>	// for read(2), close(2), readlink(2)
+#include <dirent.h>	// for DT_DIR
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_NOT_NULL()
+#include <tree_walk.hh>	// for TreeWalker, TreeWalkEntry
+#include <vector>	// for vector<T>
+#include <deque>	// for deque<T>
+#include <string>	// for string
+#include <unordered_map>	// for unordered_map<K, V>
+#include <functional>	// for function<T>
+#include <utility>	// for pair<T1, T2>
+
+/*
+ * Watching whole directory trees (hundreds of thousands of directories)
+ * for changes, with bounded cost under event storms.
+ *
+ * Two backends behind TreeWatcher:
+ * - inotify (InotifyTreeWatcher): inotify(7) watches one directory, so a
+ * tree needs a watch per directory. They are added by the parallel
+ * TreeWalker (tree_walk.hh), inotify_add_watch(2) from all workers at
+ * once. Every watch costs about 1KB of kernel memory and counts against
+ * /proc/sys/fs/inotify/max_user_watches (raise it with sysctl
+ * fs.inotify.max_user_watches=... for big trees). Directories created or
+ * moved into the tree get watches as their events arrive, moves inside the
+ * tree rename the watched paths. Files created in a new directory before
+ * its watch is in place are not reported (the inotify race every watcher
+ * has).
+ * - fanotify (FanotifyTreeWatcher): one FAN_MARK_FILESYSTEM mark with
+ * FAN_REPORT_DFID_NAME reports changes anywhere on the file system of the
+ * root as (directory handle, name). No per directory setup at all, but it
+ * needs CAP_SYS_ADMIN, sees the whole file system (events outside the
+ * root are dropped after coalescing) and the directory is found from its
+ * handle with open_by_handle_at(2) (CAP_DAC_READ_SEARCH), which is done at
+ * emit time and cached.
+ * The masks are IN_* bits for both (the FAN_* values of the same events are
+ * the same bits), IN_ISDIR marks directories.
+ *
+ * Reading: the fd is non blocking, read(2) goes into one flat buffer
+ * (256KB by default, about 8000 events per system call) and the variable
+ * length records are parsed in place, at most max_reads reads per call of
+ * read_events() so a storm cannot starve the rest of an event loop.
+ *
+ * Coalescing (TreeWatchCoalescer): the events of a path within a window are
+ * merged into one, with the masks or'ed and a count. An event is emitted
+ * window nanoseconds after the first event of its path, so a file written
+ * ten thousand times in a burst is one event. Memory is bounded: past
+ * max_pending distinct paths the oldest are emitted early. Overflows of the
+ * kernel queue (IN_Q_OVERFLOW, FAN_Q_OVERFLOW: events were lost, rescan)
+ * are reported as an event with an empty path.
+ *
+ * Both fds go into epoll(7) like any other (get_fd()); next_deadline() is
+ * when flush() has something to emit, for a timerfd or an epoll_wait
+ * timeout.
+ *
+ * Used by examples/notifications/tree_watch.cc
+ */
+
+struct TreeWatchEvent {
+	// the full path, empty for a queue overflow
+	const char* path;
+	// IN_* bits of all the events merged
+	uint32_t mask;
+	// number of raw events merged into this one
+	unsigned int count;
+};
+
+struct TreeWatchStats {
+	unsigned long reads;
+	unsigned long bytes;
+	unsigned long raw_events;
+	unsigned long emitted;
+	unsigned long overflows;
+	// early emits because of max_pending
+	unsigned long forced;
+	// fanotify events outside the root
+	unsigned long filtered;
+	unsigned long watches;
+	unsigned long watch_errors;
+};
+
+class TreeWatchCoalescer{
+private:
+	struct Pending {
+		uint32_t mask;
+		unsigned int count;
+	};
+	typedef std::unordered_map<std::string, Pending> map_t;
+	map_t pending;
+	// the order the keys came in, with the time of their first event
+	std::deque<std::pair<uint64_t, map_t::value_type*> > order;
+	std::string scratch;
+
+public:
+	// true if this is the first event of the key in its window
+	bool add(const char* key, size_t len, uint32_t mask, uint64_t now) {
+		scratch.assign(key, len);
+		auto res=pending.emplace(scratch, Pending{mask, 1});
+		if(!res.second) {
+			res.first->second.mask|=mask;
+			res.first->second.count++;
+			return false;
+		}
+		order.emplace_back(now, &*res.first);
+		return true;
+	}
+	// call f(key, mask, count) for keys older than window and the oldest
+	// keys past max_pending, returns the number of the latter
+	template<class F> unsigned long flush(uint64_t now, uint64_t window, size_t max_pending, F f) {
+		unsigned long forced=0;
+		while(!order.empty()) {
+			bool due=order.front().first+window<=now;
+			if(!due && pending.size()<=max_pending) {
+				break;
+			}
+			if(!due) {
+				forced++;
+			}
+			map_t::value_type* e=order.front().second;
+			f(e->first, e->second.mask, e->second.count);
+			order.pop_front();
+			pending.erase(pending.find(e->first));
+		}
+		return forced;
+	}
+	// the first event of the oldest key, 0 if none
+	uint64_t oldest() const {
+		return order.empty()?0:order.front().first;
+	}
+	size_t size() const {
+		return pending.size();
+	}
+};
+
+class TreeWatcher{
+public:
+	typedef std::function<void(const TreeWatchEvent& e)> Callback;
+
+protected:
+	int fd;
+	uint32_t mask;
+	uint64_t window;
+	size_t max_pending;
+	unsigned int max_reads;
+	std::vector<char> buf;
+	TreeWatchCoalescer coalescer;
+	TreeWatchStats stats;
+	std::string path;
+
+	TreeWatcher(uint32_t imask, uint64_t iwindow, size_t ibufsize) :
+		fd(-1),
+		mask(imask),
+		window(iwindow),
+		max_pending(64*1024),
+		max_reads(16),
+		buf(ibufsize),
+		stats() {
+	}
+	// parse the records in buf[0..len)
+	virtual void parse(size_t len, uint64_t now)=0;
+	// turn a coalescer key into a path, false to drop the event
+	virtual bool resolve(const std::string& key, std::string& p)=0;
+
+	void overflow(uint64_t now) {
+		stats.overflows++;
+		coalescer.add("", 0, IN_Q_OVERFLOW, now);
+	}
+
+public:
+	virtual ~TreeWatcher() {
+		if(fd!=-1) {
+			CHECK_NOT_M1(close(fd));
+		}
+	}
+	// start watching the tree at root (may be called more than once)
+	virtual void add_tree(const char* root)=0;
+
+	int get_fd() const {
+		return fd;
+	}
+	// read and coalesce what the kernel has queued, false if it was empty
+	bool read_events(uint64_t now) {
+		for(unsigned int i=0; i<max_reads; i++) {
+			ssize_t len=read(fd, buf.data(), buf.size());
+			if(len==-1 && errno==EAGAIN) {
+				return i>0;
+			}
+			CHECK_NOT_M1(len);
+			stats.reads++;
+			stats.bytes+=len;
+			parse(len, now);
+		}
+		return true;
+	}
+	// emit the events whose window is over, all of them with force
+	void flush(uint64_t now, Callback cb, bool force=false) {
+		uint64_t w=force?0:window;
+		stats.forced+=coalescer.flush(now, w, max_pending, [&](const std::string& key, uint32_t m, unsigned int count) {
+			if(key.empty()) {
+				path.clear();
+			} else if(!resolve(key, path)) {
+				stats.filtered++;
+				return;
+			}
+			stats.emitted++;
+			cb(TreeWatchEvent{path.c_str(), m, count});
+		});
+	}
+	// when flush() will have something to emit, 0 if nothing is pending
+	uint64_t next_deadline() const {
+		uint64_t oldest=coalescer.oldest();
+		return oldest==0?0:oldest+window;
+	}
+	size_t pending() const {
+		return coalescer.size();
+	}
+	void set_limits(size_t imax_pending, unsigned int imax_reads) {
+		max_pending=imax_pending;
+		max_reads=imax_reads;
+	}
+	const TreeWatchStats& get_stats() const {
+		return stats;
+	}
+	// inotify or fanotify, NULL for an unknown name
+	static TreeWatcher* create(const char* name, uint32_t mask, uint64_t window, unsigned int workers, size_t bufsize=256*1024);
+};
+
+class InotifyTreeWatcher: public TreeWatcher {
+private:
+	unsigned int workers;
+	// the path of every watch
+	std::unordered_map<int, std::string> paths;
+	// directories moved out of a watched directory in this read, by cookie
+	std::unordered_map<uint32_t, std::string> moved;
+	bool warned;
+
+	uint32_t watch_mask() const {
+		// the structure of the tree is always needed
+		return mask|IN_CREATE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR|IN_EXCL_UNLINK;
+	}
+
+	void watch_error(const char* p) {
+		stats.watch_errors++;
+		if(errno==ENOSPC && !warned) {
+			fprintf(stderr, "tree_watch: out of inotify watches at %s, raise fs.inotify.max_user_watches\n", p);
+			warned=true;
+		}
+	}
+
+	// all directories of the tree, in parallel
+	void add_watches(const std::string& root, unsigned int nworkers) {
+		std::vector<std::vector<std::pair<int, std::string> > > found(nworkers);
+		std::vector<std::pair<unsigned long, int> > errors(nworkers);
+		const uint32_t m=watch_mask();
+		TreeWalker walker(nworkers, [&](unsigned int worker, const TreeWalkEntry& e) {
+			if(e.type!=DT_DIR) {
+				return;
+			}
+			std::string p;
+			if(e.depth==0) {
+				p=e.name;
+			} else {
+				e.path(p);
+			}
+			int wd=inotify_add_watch(fd, p.c_str(), m);
+			if(wd==-1) {
+				errors[worker].first++;
+				errors[worker].second=errno;
+				return;
+			}
+			found[worker].emplace_back(wd, std::move(p));
+		}, tree_walk_stat_none);
+		walker.walk(root.c_str());
+		for(unsigned int i=0; i<nworkers; i++) {
+			for(auto& f : found[i]) {
+				paths[f.first]=std::move(f.second);
+			}
+			if(errors[i].first>0) {
+				errno=errors[i].second;
+				watch_error(root.c_str());
+				stats.watch_errors+=errors[i].first-1;
+			}
+		}
+		stats.watches=paths.size();
+	}
+
+	// a directory showed up in the tree
+	void add_dir(const std::string& p) {
+		int wd=inotify_add_watch(fd, p.c_str(), watch_mask());
+		if(wd==-1) {
+			watch_error(p.c_str());
+			return;
+		}
+		paths[wd]=p;
+		stats.watches=paths.size();
+		// an empty directory has a link count of 2 (. and ..), if it has
+		// subdirectories already walk it (which adds its watch again,
+		// harmless)
+		struct stat st;
+		if(stat(p.c_str(), &st)==0 && st.st_nlink!=2) {
+			add_watches(p, 1);
+		}
+	}
+
+	void rename_dirs(const std::string& from, const std::string& to) {
+		for(auto& e : paths) {
+			std::string& p=e.second;
+			if(p.compare(0, from.size(), from)==0 && (p.size()==from.size() || p[from.size()]=='/')) {
+				p.replace(0, from.size(), to);
+			}
+		}
+	}
+
+	void remove_dirs(const std::string& from) {
+		for(auto& e : paths) {
+			const std::string& p=e.second;
+			if(p.compare(0, from.size(), from)==0 && (p.size()==from.size() || p[from.size()]=='/')) {
+				// IN_IGNORED will follow and erase the entry
+				inotify_rm_watch(fd, e.first);
+			}
+		}
+	}
+
+	void parse(size_t len, uint64_t now) {
+		for(size_t pos=0; pos<len;) {
+			const struct inotify_event* ie=reinterpret_cast<const struct inotify_event*>(buf.data()+pos);
+			pos+=sizeof(struct inotify_event)+ie->len;
+			stats.raw_events++;
+			if(ie->mask & IN_Q_OVERFLOW) {
+				overflow(now);
+				continue;
+			}
+			auto it=paths.find(ie->wd);
+			if(it==paths.end()) {
+				continue;
+			}
+			if(ie->mask & IN_IGNORED) {
+				paths.erase(it);
+				stats.watches=paths.size();
+				continue;
+			}
+			path.assign(it->second);
+			if(ie->len>0 && ie->name[0]!='\0') {
+				path.push_back('/');
+				path.append(ie->name);
+			}
+			if(ie->mask & IN_ISDIR) {
+				if(ie->mask & IN_CREATE) {
+					add_dir(path);
+				} else if(ie->mask & IN_MOVED_FROM) {
+					moved[ie->cookie]=path;
+				} else if(ie->mask & IN_MOVED_TO) {
+					auto m=moved.find(ie->cookie);
+					if(m!=moved.end()) {
+						rename_dirs(m->second, path);
+						moved.erase(m);
+					} else {
+						add_dir(path);
+					}
+				}
+			}
+			if(ie->mask & mask) {
+				coalescer.add(path.data(), path.size(), ie->mask & (mask|IN_ISDIR), now);
+			}
+		}
+		// the pair of a move comes in the same read, what is left moved
+		// out of the tree
+		for(auto& m : moved) {
+			remove_dirs(m.second);
+		}
+		moved.clear();
+	}
+
+	bool resolve(const std::string& key, std::string& p) {
+		p.assign(key);
+		return true;
+	}
+
+public:
+	InotifyTreeWatcher(uint32_t imask, uint64_t iwindow, unsigned int iworkers, size_t ibufsize) :
+		TreeWatcher(imask, iwindow, ibufsize),
+		workers(iworkers),
+		warned(false) {
+		fd=CHECK_NOT_M1(inotify_init1(IN_NONBLOCK|IN_CLOEXEC));
+	}
+	void add_tree(const char* root) {
+		std::string r(root);
+		while(r.size()>1 && r.back()=='/') {
+			r.pop_back();
+		}
+		add_watches(r, workers);
+	}
+};
+
+class FanotifyTreeWatcher: public TreeWatcher {
+private:
+	struct Root {
+		std::string path;
+		// for open_by_handle_at(2)
+		int mount_fd;
+	};
+	std::vector<Root> roots;
+	// directory handle (the key without the name) to path
+	std::unordered_map<std::string, std::string> dirs;
+	std::string key;
+
+	void parse(size_t len, uint64_t now) {
+		const struct fanotify_event_metadata* md=reinterpret_cast<const struct fanotify_event_metadata*>(buf.data());
+		ssize_t left=len;
+		while(FAN_EVENT_OK(md, left)) {
+			stats.raw_events++;
+			if(md->mask & FAN_Q_OVERFLOW) {
+				overflow(now);
+			} else {
+				const struct fanotify_event_info_fid* fid=reinterpret_cast<const struct fanotify_event_info_fid*>(md+1);
+				if(fid->hdr.info_type==FAN_EVENT_INFO_TYPE_DFID_NAME) {
+					const struct file_handle* fh=reinterpret_cast<const struct file_handle*>(fid->handle);
+					const char* name=reinterpret_cast<const char*>(fh->f_handle+fh->handle_bytes);
+					// key: fsid, the handle and the name, the handle is
+					// resolved only when the event is emitted
+					size_t hlen=sizeof(fid->fsid)+sizeof(struct file_handle)+fh->handle_bytes;
+					key.assign(reinterpret_cast<const char*>(&fid->fsid), hlen);
+					key.append(name);
+					// a directory moved, cached paths may be stale
+					if((md->mask & FAN_ONDIR) && (md->mask & (FAN_MOVED_FROM|FAN_MOVED_TO))) {
+						dirs.clear();
+					}
+					coalescer.add(key.data(), key.size(), md->mask & (mask|IN_ISDIR), now);
+				}
+			}
+			md=FAN_EVENT_NEXT(md, left);
+		}
+	}
+
+	bool in_roots(const std::string& p) const {
+		for(const Root& r : roots) {
+			if(p.compare(0, r.path.size(), r.path)==0 && (p.size()==r.path.size() || p[r.path.size()]=='/' || r.path=="/")) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool resolve(const std::string& k, std::string& p) {
+		size_t hlen=sizeof(__kernel_fsid_t)+sizeof(struct file_handle);
+		struct file_handle fh;
+		memcpy(&fh, k.data()+sizeof(__kernel_fsid_t), sizeof(fh));
+		hlen+=fh.handle_bytes;
+		std::string dir_key(k, 0, hlen);
+		auto it=dirs.find(dir_key);
+		if(it==dirs.end()) {
+			std::vector<char> h(k.begin()+sizeof(__kernel_fsid_t), k.begin()+hlen);
+			std::string dir;
+			for(const Root& r : roots) {
+				int dfd=open_by_handle_at(r.mount_fd, reinterpret_cast<struct file_handle*>(h.data()), O_PATH);
+				if(dfd==-1) {
+					continue;
+				}
+				char link[64];
+				char target[PATH_MAX];
+				snprintf(link, sizeof(link), "/proc/self/fd/%d", dfd);
+				ssize_t n=readlink(link, target, sizeof(target));
+				CHECK_NOT_M1(close(dfd));
+				if(n>0) {
+					dir.assign(target, n);
+					break;
+				}
+			}
+			if(dir.empty()) {
+				// gone before we got to it
+				dir="?";
+			}
+			if(dirs.size()>=max_pending) {
+				dirs.clear();
+			}
+			it=dirs.emplace(dir_key, dir).first;
+		}
+		p.assign(it->second);
+		if(p.size()>1 || p[0]!='/') {
+			p.push_back('/');
+		}
+		p.append(k, hlen, std::string::npos);
+		return p[0]=='?' || in_roots(p);
+	}
+
+public:
+	FanotifyTreeWatcher(uint32_t imask, uint64_t iwindow, size_t ibufsize) :
+		TreeWatcher(imask, iwindow, ibufsize) {
+		fd=CHECK_NOT_M1(fanotify_init(FAN_CLASS_NOTIF|FAN_REPORT_DFID_NAME|FAN_NONBLOCK|FAN_CLOEXEC, O_RDONLY));
+	}
+	~FanotifyTreeWatcher() {
+		for(const Root& r : roots) {
+			CHECK_NOT_M1(close(r.mount_fd));
+		}
+	}
+	void add_tree(const char* root) {
+		char real[PATH_MAX];
+		CHECK_NOT_NULL(realpath(root, real));
+		// events on directories and files alike
+		const uint64_t fmask=(mask & (IN_CREATE|IN_DELETE|IN_MODIFY|IN_ATTRIB|IN_MOVED_FROM|IN_MOVED_TO|IN_CLOSE_WRITE))|FAN_ONDIR;
+		CHECK_NOT_M1(fanotify_mark(fd, FAN_MARK_ADD|FAN_MARK_FILESYSTEM, fmask, AT_FDCWD, real));
+		roots.push_back(Root{real, CHECK_NOT_M1(open(real, O_RDONLY|O_DIRECTORY|O_CLOEXEC))});
+		stats.watches++;
+	}
+};
+
+inline TreeWatcher* TreeWatcher::create(const char* name, uint32_t mask, uint64_t window, unsigned int workers, size_t bufsize) {
+	if(strcmp(name, "inotify")==0) {
+		return new InotifyTreeWatcher(mask, window, workers, bufsize);
+	}
+	if(strcmp(name, "fanotify")==0) {
+		return new FanotifyTreeWatcher(mask, window, bufsize);
+	}
+	return NULL;
+}
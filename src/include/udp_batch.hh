@@ -0,0 +1,378 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for ssize_t
+#include <sys/socket.h>	// for socket(2), recvmmsg(2), sendmmsg(2), setsockopt(2), getsockopt(2)
+#include <netinet/in.h>	// for sockaddr_in, IPPROTO_UDP
+#include <netinet/udp.h>// for SOL_UDP
+#include <errno.h>	// for errno, EAGAIN, EINTR
+#include <string.h>	// for memcpy(3), memset(3)
+#include <stdint.h>	// for uint64_t
+#include <unistd.h>	// for write(2), usleep(3)
+#include <err_utils.h>	// for CHECK_NOT_M1()
+#include <vector>	// for vector<T>
+
+/*
+ * Batched UDP sending and receiving.
+ *
+ * The plain way to move datagrams costs a system call per datagram. There
+ * are two ways to amortize that:
+ * - recvmmsg(2)/sendmmsg(2): many datagrams per system call, each still a
+ * separate skb going through the stack.
+ * - segmentation offload: with UDP_SEGMENT (GSO) the sender hands the kernel
+ * one big buffer and a segment size and the stack carries it as one unit as
+ * far as it can (to the NIC if it supports it). With UDP_GRO the receiver
+ * gets many datagrams of the same flow glued together in one buffer and a
+ * control message with the segment size. Over loopback a GSO packet reaches
+ * a GRO socket without ever being split.
+ *
+ * Every datagram starts with a 64 bit sequence number so the receiver can
+ * count the ones that got lost (UdpStats). Datagrams too short to carry one
+ * are not data, they are counted as runts and dropped. An empty datagram
+ * marks the end; since udp may lose it too it is sent a few times.
+ *
+ * Used by examples/networking/udp/{send_batch,recv_batch,udp_pps}.cc
+ */
+
+// older headers do not have these
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// the largest UDP payload that fits in an IPv4 datagram
+static const size_t udp_max_payload=65507;
+// the kernel limit on the number of segments in one GSO send
+static const unsigned int udp_max_segments=64;
+
+/*
+ * Collect small writes in a big buffer and write(2) them in one go.
+ * A write(2) per datagram would cost as much as the receive it follows.
+ */
+class BufferedWriter{
+private:
+	int fd;
+	std::vector<char> buf;
+	size_t len;
+
+public:
+	BufferedWriter(int ifd, size_t size) : fd(ifd), buf(size), len(0) {
+	}
+	~BufferedWriter() {
+		flush();
+	}
+	inline void write(const char* p, size_t n) {
+		if(len+n>buf.size()) {
+			flush();
+			if(n>buf.size()) {
+				write_all(p, n);
+				return;
+			}
+		}
+		memcpy(buf.data()+len, p, n);
+		len+=n;
+	}
+	void flush() {
+		write_all(buf.data(), len);
+		len=0;
+	}
+
+private:
+	void write_all(const char* p, size_t n) {
+		while(n>0) {
+			ssize_t ret=CHECK_NOT_M1(::write(fd, p, n));
+			p+=ret;
+			n-=ret;
+		}
+	}
+};
+
+struct UdpStats{
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t syscalls;
+	uint64_t lost;
+	uint64_t reordered;
+	uint64_t next_seq;
+	uint64_t runts;
+
+	UdpStats() : packets(0), bytes(0), syscalls(0), lost(0), reordered(0), next_seq(0), runts(0) {
+	}
+	inline void account(uint64_t seq, size_t len) {
+		packets++;
+		bytes+=len;
+		if(seq==next_seq) {
+			next_seq++;
+		} else if(seq>next_seq) {
+			lost+=seq-next_seq;
+			next_seq=seq+1;
+		} else {
+			// counted as lost when we jumped over it
+			reordered++;
+			if(lost>0) {
+				lost--;
+			}
+		}
+	}
+};
+
+/*
+ * Ask for a big receive buffer. SO_RCVBUFFORCE can go above
+ * net.core.rmem_max but needs CAP_NET_ADMIN, SO_RCVBUF is capped.
+ * Returns what we actually got (the kernel doubles the request for its
+ * own bookkeeping and reports the doubled value).
+ */
+static inline int udp_set_rcvbuf(int fd, int size) {
+	if(setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size))==-1) {
+		CHECK_NOT_M1(setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)));
+	}
+	int got;
+	socklen_t len=sizeof(got);
+	CHECK_NOT_M1(getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &got, &len));
+	return got;
+}
+
+static inline int udp_set_sndbuf(int fd, int size) {
+	if(setsockopt(fd, SOL_SOCKET, SO_SNDBUFFORCE, &size, sizeof(size))==-1) {
+		CHECK_NOT_M1(setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)));
+	}
+	int got;
+	socklen_t len=sizeof(got);
+	CHECK_NOT_M1(getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &got, &len));
+	return got;
+}
+
+class UdpReceiver{
+private:
+	int fd;
+	unsigned int batch;
+	size_t slot_size;
+	bool gro;
+	std::vector<char> data;
+	std::vector<struct mmsghdr> msgs;
+	std::vector<struct iovec> iovs;
+	std::vector<char> control;
+	size_t control_size;
+
+public:
+	// batch==1 without gro means a plain recv(2) per datagram
+	UdpReceiver(int ifd, unsigned int ibatch, size_t max_datagram, bool igro) : fd(ifd), batch(ibatch), slot_size(igro?udp_max_payload+1:max_datagram), gro(igro), data(ibatch*slot_size), msgs(ibatch), iovs(ibatch), control_size(CMSG_SPACE(sizeof(int))) {
+		control.resize(batch*control_size);
+		if(gro) {
+			int one=1;
+			CHECK_NOT_M1(setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one)));
+		}
+		for(unsigned int i=0; i<batch; i++) {
+			iovs[i].iov_base=data.data()+i*slot_size;
+			iovs[i].iov_len=slot_size;
+		}
+	}
+	/*
+	 * Receive what is there (blocking for at least one datagram).
+	 * Returns the number of datagrams received, 0 if the end marker (an
+	 * empty datagram) arrived and -1 on a receive timeout (SO_RCVTIMEO).
+	 */
+	int receive(UdpStats& stats, BufferedWriter* writer) {
+		if(batch==1 && !gro) {
+			ssize_t len=recv(fd, data.data(), slot_size, 0);
+			if(len==-1) {
+				if(errno==EAGAIN || errno==EINTR) {
+					return -1;
+				}
+				CHECK_NOT_M1(len);
+			}
+			stats.syscalls++;
+			if(len==0) {
+				return 0;
+			}
+			deliver(data.data(), len, stats, writer);
+			return 1;
+		}
+		for(unsigned int i=0; i<batch; i++) {
+			struct msghdr& h=msgs[i].msg_hdr;
+			memset(&h, 0, sizeof(h));
+			h.msg_iov=&iovs[i];
+			h.msg_iovlen=1;
+			if(gro) {
+				h.msg_control=control.data()+i*control_size;
+				h.msg_controllen=control_size;
+			}
+		}
+		// MSG_WAITFORONE: block for the first datagram, then take what is queued
+		int n=recvmmsg(fd, msgs.data(), batch, MSG_WAITFORONE, NULL);
+		if(n==-1) {
+			if(errno==EAGAIN || errno==EINTR) {
+				return -1;
+			}
+			CHECK_NOT_M1(n);
+		}
+		stats.syscalls++;
+		int count=0;
+		for(int i=0; i<n; i++) {
+			size_t len=msgs[i].msg_len;
+			if(len==0) {
+				return 0;
+			}
+			char* p=static_cast<char*>(iovs[i].iov_base);
+			size_t seg=len;
+			if(gro) {
+				struct msghdr& h=msgs[i].msg_hdr;
+				for(struct cmsghdr* c=CMSG_FIRSTHDR(&h); c!=NULL; c=CMSG_NXTHDR(&h, c)) {
+					if(c->cmsg_level==SOL_UDP && c->cmsg_type==UDP_GRO) {
+						int gso_size;
+						memcpy(&gso_size, CMSG_DATA(c), sizeof(gso_size));
+						seg=gso_size;
+					}
+				}
+			}
+			// a coalesced buffer holds datagrams of 'seg' bytes, the last may be shorter
+			for(size_t off=0; off<len; off+=seg) {
+				size_t l=len-off<seg?len-off:seg;
+				deliver(p+off, l, stats, writer);
+				count++;
+			}
+		}
+		return count;
+	}
+
+private:
+	inline void deliver(const char* p, size_t len, UdpStats& stats, BufferedWriter* writer) {
+		uint64_t seq;
+		// no room for a sequence number, not one of ours
+		if(len<sizeof(seq)) {
+			stats.runts++;
+			return;
+		}
+		memcpy(&seq, p, sizeof(seq));
+		stats.account(seq, len);
+		if(writer) {
+			writer->write(p, len);
+		}
+	}
+};
+
+class UdpSender{
+private:
+	int fd;
+	size_t size;
+	unsigned int batch;
+	// datagrams per message: 1 or, with GSO, as many as fit
+	unsigned int segs;
+	std::vector<char> data;
+	std::vector<struct mmsghdr> msgs;
+	std::vector<struct iovec> iovs;
+
+public:
+	/*
+	 * 'fd' must be connect(2)ed to the destination.
+	 * batch==1 without gso means a plain send(2) per datagram.
+	 */
+	UdpSender(int ifd, size_t isize, unsigned int ibatch, bool gso) : fd(ifd), size(isize), batch(ibatch), segs(1), msgs(ibatch), iovs(ibatch) {
+		if(gso) {
+			segs=udp_max_payload/size;
+			if(segs>udp_max_segments) {
+				segs=udp_max_segments;
+			}
+			int seg_size=size;
+			CHECK_NOT_M1(setsockopt(fd, SOL_UDP, UDP_SEGMENT, &seg_size, sizeof(seg_size)));
+		}
+		data.resize(batch*segs*size, 'x');
+		for(unsigned int i=0; i<batch; i++) {
+			iovs[i].iov_base=data.data()+i*segs*size;
+			iovs[i].iov_len=segs*size;
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov=&iovs[i];
+			msgs[i].msg_hdr.msg_iovlen=1;
+		}
+	}
+	// the most datagrams a single call to send() will try to move
+	unsigned int per_call() const {
+		return batch*segs;
+	}
+	/*
+	 * Send up to 'n' datagrams numbered from 'seq' on. Returns how many
+	 * went out (fewer if the kernel pushed back).
+	 */
+	unsigned int send(uint64_t seq, unsigned int n, UdpStats& stats) {
+		if(n>per_call()) {
+			n=per_call();
+		}
+		for(unsigned int i=0; i<n; i++) {
+			uint64_t s=seq+i;
+			memcpy(data.data()+i*size, &s, sizeof(s));
+		}
+		unsigned int messages=(n+segs-1)/segs;
+		int sent;
+		if(messages==1 && segs==1) {
+			ssize_t ret=::send(fd, data.data(), size, 0);
+			if(ret==-1) {
+				return handle_error(stats);
+			}
+			sent=1;
+		} else {
+			for(unsigned int i=0; i<messages; i++) {
+				unsigned int in_msg=(i==messages-1)?n-i*segs:segs;
+				iovs[i].iov_len=in_msg*size;
+			}
+			sent=sendmmsg(fd, msgs.data(), messages, 0);
+			if(sent==-1) {
+				return handle_error(stats);
+			}
+		}
+		stats.syscalls++;
+		unsigned int datagrams=0;
+		for(int i=0; i<sent; i++) {
+			datagrams+=iovs[i].iov_len/size;
+		}
+		stats.packets+=datagrams;
+		stats.bytes+=datagrams*size;
+		return datagrams;
+	}
+	/*
+	 * An empty datagram tells the receiver we are done. It can be dropped
+	 * like any other (a full receive buffer right after a burst) so it is
+	 * sent 'times' times, a millisecond apart. A receiver which is already
+	 * gone (ECONNREFUSED) or a full queue is not an error here.
+	 */
+	void send_end(unsigned int times=10) {
+		int zero=0;
+		CHECK_NOT_M1(setsockopt(fd, SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero)));
+		for(unsigned int i=0; i<times; i++) {
+			if(::send(fd, NULL, 0, 0)==-1 && errno!=ECONNREFUSED && errno!=ENOBUFS && errno!=EAGAIN && errno!=EINTR) {
+				CHECK_NOT_M1(-1);
+			}
+			usleep(1000);
+		}
+	}
+
+private:
+	unsigned int handle_error(UdpStats& stats) {
+		// a full socket buffer or device queue, the caller retries
+		if(errno==ENOBUFS || errno==EAGAIN || errno==EINTR || errno==ECONNREFUSED) {
+			stats.syscalls++;
+			return 0;
+		}
+		CHECK_NOT_M1(-1);
+		return 0;
+	}
+};
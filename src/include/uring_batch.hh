@@ -0,0 +1,249 @@
+/*
+ * This file is part of the demos-os-linux package.
+ * Copyright (C) 2011-2026 Mark Veltzer <mark.veltzer@gmail.com>
+ *
+ * demos-os-linux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * demos-os-linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with demos-os-linux. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <firstinclude.h>
+#include <sys/types.h>	// for mode_t, off_t
+#include <sys/stat.h>	// for struct statx
+#include <sys/mman.h>	// for mmap(2), munmap(2)
+#include <sys/syscall.h>	// for __NR_io_uring_setup, __NR_io_uring_enter
+#include <linux/io_uring.h>	// for io_uring_params, io_uring_sqe, io_uring_cqe, IORING_*
+#include <stdint.h>	// for uint64_t
+#include <errno.h>	// for errno, EINTR
+#include <string.h>	// for memset(3)
+#include <unistd.h>	// for syscall(2), close(2)
+#include <err_utils.h>	// for CHECK_NOT_M1(), CHECK_NOT_VOIDP(), CHECK_ASSERT()
+#include <functional>	// for function<T>
+
+/*
+ * Batching metadata system calls through io_uring, without liburing.
+ *
+ * ls -l does a lstat(2) per entry and a /proc scanner an open(2), read(2)
+ * and close(2) per file per process: thousands of tiny system calls, each
+ * paying the user/kernel transition (and, with the spectre mitigations,
+ * much more than the work itself). Here the operations for a whole
+ * directory are put in the submission ring (IORING_OP_STATX,
+ * IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE) and handed to the
+ * kernel with one io_uring_enter(2) which also waits for all of them.
+ *
+ * Operations that may block (statx, and reads of /proc files which do not
+ * support non blocking reads) are executed by the kernel's io-wq worker
+ * threads, so on a machine with several cpus a batch also runs in
+ * parallel. There is no readlink operation in io_uring, readlinkat(2)
+ * stays a system call.
+ *
+ * Usage: set on_complete, get_sqe() and one of the prep_*() calls per
+ * operation, finish() to submit whatever is queued and wait for all
+ * of it. When the submission ring is full get_sqe() does the same by
+ * itself, so any number of operations may be queued. on_complete gets the
+ * user_data of the operation and its result (-errno on failure), in
+ * completion order. submit() waits for only some of the operations, for
+ * callers which keep a queue depth and queue more as others complete.
+ *
+ * Used by examples/io/io_uring/{ls_uring,proc_scan_uring}.cc,
+ * examples/io/write_durability.cc and direct_reader.hh
+ */
+
+class UringBatch{
+private:
+	int ring_fd;
+	unsigned int sq_entries;
+	unsigned int cq_entries;
+	void* sq_ptr;
+	size_t sq_len;
+	void* cq_ptr;
+	struct io_uring_sqe* sqes;
+	size_t sqes_len;
+	unsigned int* sq_tail;
+	unsigned int sq_mask;
+	unsigned int* cq_head;
+	unsigned int* cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe* cqes;
+	// queued in the submission ring and not yet submitted
+	unsigned int queued;
+	// submitted and not yet completed
+	unsigned int inflight;
+	unsigned long enters;
+	unsigned long ops;
+
+	static void* ring_field(void* base, unsigned int offset) {
+		return static_cast<char*>(base)+offset;
+	}
+
+	void reap() {
+		unsigned int head=*cq_head;
+		unsigned int tail=__atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+		while(head!=tail) {
+			const struct io_uring_cqe* cqe=&cqes[head & cq_mask];
+			on_complete(cqe->user_data, cqe->res);
+			head++;
+			inflight--;
+		}
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+	}
+
+public:
+	std::function<void(uint64_t user_data, int res)> on_complete;
+
+	UringBatch(unsigned int entries=256) : queued(0), inflight(0), enters(0), ops(0) {
+		struct io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		ring_fd=CHECK_NOT_M1(syscall(__NR_io_uring_setup, entries, &p));
+		CHECK_ASSERT(p.features & IORING_FEAT_SINGLE_MMAP);
+		sq_entries=p.sq_entries;
+		cq_entries=p.cq_entries;
+		// one mapping for both rings (IORING_FEAT_SINGLE_MMAP, since 5.4)
+		sq_len=p.sq_off.array+p.sq_entries*sizeof(unsigned int);
+		size_t cq_len=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+		if(cq_len>sq_len) {
+			sq_len=cq_len;
+		}
+		sq_ptr=CHECK_NOT_VOIDP(mmap(NULL, sq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING), MAP_FAILED);
+		cq_ptr=sq_ptr;
+		sqes_len=p.sq_entries*sizeof(struct io_uring_sqe);
+		sqes=static_cast<struct io_uring_sqe*>(CHECK_NOT_VOIDP(mmap(NULL, sqes_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd, IORING_OFF_SQES), MAP_FAILED));
+		sq_tail=static_cast<unsigned int*>(ring_field(sq_ptr, p.sq_off.tail));
+		sq_mask=*static_cast<unsigned int*>(ring_field(sq_ptr, p.sq_off.ring_mask));
+		cq_head=static_cast<unsigned int*>(ring_field(cq_ptr, p.cq_off.head));
+		cq_tail=static_cast<unsigned int*>(ring_field(cq_ptr, p.cq_off.tail));
+		cq_mask=*static_cast<unsigned int*>(ring_field(cq_ptr, p.cq_off.ring_mask));
+		cqes=static_cast<struct io_uring_cqe*>(ring_field(cq_ptr, p.cq_off.cqes));
+		// the indirection array never changes: slot i is sqe i
+		unsigned int* array=static_cast<unsigned int*>(ring_field(sq_ptr, p.sq_off.array));
+		for(unsigned int i=0; i<sq_entries; i++) {
+			array[i]=i;
+		}
+	}
+	~UringBatch() {
+		CHECK_ASSERT(queued==0 && inflight==0);
+		CHECK_NOT_M1(munmap(sqes, sqes_len));
+		CHECK_NOT_M1(munmap(sq_ptr, sq_len));
+		CHECK_NOT_M1(close(ring_fd));
+	}
+
+	// a zeroed submission entry, submits and waits for everything first
+	// if the ring is full
+	struct io_uring_sqe* get_sqe() {
+		if(queued+inflight==sq_entries) {
+			finish();
+		}
+		unsigned int tail=*sq_tail;
+		struct io_uring_sqe* sqe=&sqes[tail & sq_mask];
+		memset(sqe, 0, sizeof(*sqe));
+		// without SQPOLL the kernel only reads entries in io_uring_enter(2)
+		// so the tail may move before the caller fills the entry in
+		__atomic_store_n(sq_tail, tail+1, __ATOMIC_RELEASE);
+		queued++;
+		ops++;
+		return sqe;
+	}
+
+	// submit what is queued and wait for all operations to complete
+	void finish() {
+		while(queued+inflight>0) {
+			unsigned int wait=queued+inflight;
+			if(wait>cq_entries) {
+				wait=cq_entries;
+			}
+			int ret=syscall(__NR_io_uring_enter, ring_fd, queued, wait, IORING_ENTER_GETEVENTS, NULL, 0);
+			enters++;
+			if(ret==-1) {
+				CHECK_ASSERT(errno==EINTR);
+				continue;
+			}
+			queued-=ret;
+			inflight+=ret;
+			reap();
+		}
+	}
+
+	// submit what is queued and wait for at least wait operations to
+	// complete, for keeping a number of operations in flight (a queue
+	// depth) instead of draining the ring
+	void submit(unsigned int wait) {
+		while(true) {
+			int ret=syscall(__NR_io_uring_enter, ring_fd, queued, wait, IORING_ENTER_GETEVENTS, NULL, 0);
+			enters++;
+			if(ret==-1) {
+				CHECK_ASSERT(errno==EINTR);
+				continue;
+			}
+			queued-=ret;
+			inflight+=ret;
+			break;
+		}
+		reap();
+	}
+
+	static void prep_statx(struct io_uring_sqe* sqe, int dirfd, const char* path, int flags, unsigned int mask, struct statx* buf, uint64_t user_data) {
+		sqe->opcode=IORING_OP_STATX;
+		sqe->fd=dirfd;
+		sqe->addr=(uint64_t)path;
+		sqe->len=mask;
+		sqe->off=(uint64_t)buf;
+		sqe->statx_flags=flags;
+		sqe->user_data=user_data;
+	}
+	static void prep_openat(struct io_uring_sqe* sqe, int dirfd, const char* path, int flags, mode_t mode, uint64_t user_data) {
+		sqe->opcode=IORING_OP_OPENAT;
+		sqe->fd=dirfd;
+		sqe->addr=(uint64_t)path;
+		sqe->len=mode;
+		sqe->open_flags=flags;
+		sqe->user_data=user_data;
+	}
+	static void prep_read(struct io_uring_sqe* sqe, int fd, void* buf, unsigned int len, off_t offset, uint64_t user_data) {
+		sqe->opcode=IORING_OP_READ;
+		sqe->fd=fd;
+		sqe->addr=(uint64_t)buf;
+		sqe->len=len;
+		sqe->off=offset;
+		sqe->user_data=user_data;
+	}
+	static void prep_write(struct io_uring_sqe* sqe, int fd, const void* buf, unsigned int len, off_t offset, uint64_t user_data) {
+		sqe->opcode=IORING_OP_WRITE;
+		sqe->fd=fd;
+		sqe->addr=(uint64_t)buf;
+		sqe->len=len;
+		sqe->off=offset;
+		sqe->user_data=user_data;
+	}
+	// flags is 0 for fsync(2) or IORING_FSYNC_DATASYNC for fdatasync(2)
+	static void prep_fsync(struct io_uring_sqe* sqe, int fd, unsigned int flags, uint64_t user_data) {
+		sqe->opcode=IORING_OP_FSYNC;
+		sqe->fd=fd;
+		sqe->fsync_flags=flags;
+		sqe->user_data=user_data;
+	}
+	static void prep_close(struct io_uring_sqe* sqe, int fd, uint64_t user_data) {
+		sqe->opcode=IORING_OP_CLOSE;
+		sqe->fd=fd;
+		sqe->user_data=user_data;
+	}
+
+	// io_uring_enter(2) calls made so far
+	unsigned long get_enters() const {
+		return enters;
+	}
+	// operations queued so far
+	unsigned long get_ops() const {
+		return ops;
+	}
+};